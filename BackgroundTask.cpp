@@ -17,6 +17,7 @@
 */
 
 #include "BackgroundTask.h"
+#include <QMutexLocker>
 
 char const*
 BackgroundTask::CancelledException::what() const throw()
@@ -24,6 +25,19 @@ BackgroundTask::CancelledException::what() const throw()
 	return "BackgroundTask cancelled";
 }
 
+void
+BackgroundTask::cancel()
+{
+	{
+		QMutexLocker const locker(&m_cancelTimeMutex);
+		if (m_cancelTime.isNull()) {
+			m_cancelTime.start();
+		}
+	}
+
+	m_cancelFlag.fetchAndStoreRelaxed(1);
+}
+
 void
 BackgroundTask::throwIfCancelled() const
 {
@@ -32,3 +46,22 @@ BackgroundTask::throwIfCancelled() const
 	}
 }
 
+void
+BackgroundTask::recordCancellationLatency()
+{
+	int const latency = msecSinceCancelled();
+	if (latency >= 0) {
+		m_measuredCancellationLatency = latency;
+	}
+}
+
+int
+BackgroundTask::msecSinceCancelled() const
+{
+	QMutexLocker const locker(&m_cancelTimeMutex);
+	if (m_cancelTime.isNull()) {
+		return -1;
+	}
+	return m_cancelTime.elapsed();
+}
+
@@ -23,13 +23,23 @@
 #include "IntrusivePtr.h"
 #include "FilterResult.h"
 #include "TaskStatus.h"
+#include "MemoryBudget.h"
+#include <boost/function.hpp>
 #include <QAtomicInt>
+#include <QMutex>
+#include <QTime>
+#include <QtGlobal>
 #include <exception>
 
 class BackgroundTask : public AbstractCommand0<FilterResultPtr>, public TaskStatus
 {
 public:
-	enum Type { INTERACTIVE, BATCH };
+	/**
+	 * SPECULATIVE tasks do interactive processing of pages the user
+	 * is likely to switch to.  Like BATCH tasks, they run with
+	 * the batch processing priority.
+	 */
+	enum Type { INTERACTIVE, BATCH, SPECULATIVE };
 
 	class CancelledException : public std::exception
 	{
@@ -37,11 +47,150 @@ public:
 		virtual char const* what() const throw();
 	};
 	
-	BackgroundTask(Type type) : m_type(type) {}
+	typedef boost::function<void (FilterResultPtr const&)> PreviewHandler;
+	
+	/**
+	 * \brief The remaining part of a task, to be finished on another thread.
+	 * \see continueElsewhere()
+	 */
+	typedef boost::function<FilterResultPtr (TaskStatus const&)> Continuation;
+	
+	BackgroundTask(Type type)
+	: m_estimatedPeakMemory(0), m_measuredPeakMemory(0),
+	m_estimatedCost(0.0), m_measuredTime(0), m_measuredCancellationLatency(-1),
+	m_continuationAllowed(false), m_type(type) {}
 
 	Type type() const { return m_type; }
 
-	virtual void cancel() { m_cancelFlag.fetchAndStoreRelaxed(1); }
+	/**
+	 * \brief Estimated peak memory usage of this task, in bytes.
+	 *
+	 * Used for admission control.  Zero means unknown.
+	 * \see MemoryBudget
+	 */
+	qint64 estimatedPeakMemory() const { return m_estimatedPeakMemory; }
+
+	void setEstimatedPeakMemory(qint64 bytes) { m_estimatedPeakMemory = bytes; }
+
+	/**
+	 * \brief Attaches the memory reserved for running this task.
+	 *
+	 * The reservation is held until releaseMemoryReservation() is called
+	 * by the thread that ran the task, or until the task is destroyed.
+	 * Cancelling the task doesn't release it, as a cancelled task may
+	 * still be running.
+	 */
+	void setMemoryReservation(IntrusivePtr<MemoryReservation> const& reservation) {
+		m_ptrMemoryReservation = reservation;
+	}
+
+	void releaseMemoryReservation() {
+		if (m_ptrMemoryReservation.get()) {
+			m_ptrMemoryReservation->release();
+		}
+	}
+
+	/**
+	 * \brief Peak memory usage observed while running this task, in bytes.
+	 *
+	 * Set by the thread that ran the task.  Zero means not measured.
+	 */
+	qint64 measuredPeakMemory() const { return m_measuredPeakMemory; }
+
+	void setMeasuredPeakMemory(qint64 bytes) { m_measuredPeakMemory = bytes; }
+
+	/**
+	 * \brief Estimated processing time of this task, in arbitrary units.
+	 *
+	 * Used to start expensive tasks first.  Zero means unknown.
+	 * \see ProcessingCostModel
+	 */
+	double estimatedCost() const { return m_estimatedCost; }
+
+	void setEstimatedCost(double cost) { m_estimatedCost = cost; }
+
+	/**
+	 * \brief Time spent running this task, in milliseconds.
+	 *
+	 * Accumulated by the threads that ran the task and its continuation.
+	 * Zero means not measured.
+	 */
+	qint64 measuredTime() const { return m_measuredTime; }
+
+	void addMeasuredTime(qint64 msec) { m_measuredTime += msec; }
+
+	/**
+	 * \brief Time from cancel() to the task giving up its thread,
+	 *        in milliseconds.
+	 *
+	 * Recorded for any cancelled task that reached a thread, including
+	 * one cancelled while still waiting in the thread's queue, in which
+	 * case the waiting time is included.  -1 means the task wasn't
+	 * cancelled.  Logged in debug mode, along with the other timings.
+	 */
+	qint64 measuredCancellationLatency() const { return m_measuredCancellationLatency; }
+
+	/**
+	 * \brief Called by a thread that ran the task, right after it returned.
+	 */
+	void recordCancellationLatency();
+
+	/**
+	 * \brief Sets what to do with the results passed to reportPreview().
+	 *
+	 * Set by the thread that runs the task, and only if someone is
+	 * going to look at the previews.
+	 */
+	void setPreviewHandler(PreviewHandler const& handler) { m_previewHandler = handler; }
+
+	/**
+	 * \brief Returns true if reportPreview() is not going to be a no-op.
+	 */
+	bool wantsPreview() const { return !m_previewHandler.empty(); }
+
+	/**
+	 * \brief Delivers a preliminary result while the task is still running.
+	 *
+	 * Meant for quick low quality previews, to be replaced by the final result.
+	 */
+	void reportPreview(FilterResultPtr const& result) const {
+		if (m_previewHandler) {
+			m_previewHandler(result);
+		}
+	}
+
+	/**
+	 * \brief Allows or disallows continueElsewhere().
+	 *
+	 * Set by the thread that runs the task, if it has another thread
+	 * to run continuations on.
+	 */
+	void setContinuationAllowed(bool allowed) { m_continuationAllowed = allowed; }
+
+	bool continuationAllowed() const { return m_continuationAllowed; }
+
+	/**
+	 * \brief Hands the rest of the work to another thread.
+	 *
+	 * Only to be called from within the task, if continuationAllowed().
+	 * The task then returns a null result, and the thread that ran it goes
+	 * on to the next task, while the result of \p continuation becomes
+	 * the result of this task.
+	 */
+	void continueElsewhere(Continuation const& continuation) const {
+		m_continuation = continuation;
+	}
+
+	/**
+	 * \brief Returns and forgets whatever was passed to continueElsewhere().
+	 */
+	Continuation takeContinuation() {
+		Continuation continuation;
+		continuation.swap(m_continuation);
+		return continuation;
+	}
+
+	virtual void cancel();
 	
 	virtual bool isCancelled() const {
 		return m_cancelFlag.fetchAndAddRelaxed(0) != 0;
@@ -51,8 +200,25 @@ public:
 	 * \brief If cancelled, throws CancelledException.
 	 */
 	virtual void throwIfCancelled() const;
+
+	/**
+	 * \brief Returns the number of milliseconds since the task was
+	 *        first cancelled, or -1 if it wasn't.
+	 */
+	int msecSinceCancelled() const;
 private:
 	mutable QAtomicInt m_cancelFlag;
+	mutable QMutex m_cancelTimeMutex;
+	QTime m_cancelTime;
+	qint64 m_estimatedPeakMemory;
+	qint64 m_measuredPeakMemory;
+	IntrusivePtr<MemoryReservation> m_ptrMemoryReservation;
+	double m_estimatedCost;
+	qint64 m_measuredTime;
+	qint64 m_measuredCancellationLatency;
+	PreviewHandler m_previewHandler;
+	mutable Continuation m_continuation;
+	bool m_continuationAllowed;
 	Type const m_type;
 };
 
@@ -0,0 +1,577 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "BatchWorkQueue.h"
+#include "AtomicFileOverwriter.h"
+#include "ImageId.h"
+#include "Utils.h"
+#include <QCoreApplication>
+#include <QSettings>
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QStringList>
+#include <QTextStream>
+#include <QAtomicInt>
+#include <QtXml>
+#include <boost/foreach.hpp>
+
+#ifdef Q_WS_WIN
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+namespace
+{
+
+char const JOB_FILE[] = "job.xml";
+char const LEASES_DIR[] = "leases";
+char const RESULTS_DIR[] = "results";
+
+int const DEFAULT_LEASE_TIMEOUT_SEC = 120;
+
+void removeQueueDir(QString const& path)
+{
+	QDir dir(path);
+	if (!dir.exists()) {
+		return;
+	}
+	
+	// The job file goes first, so that other nodes stop looking.
+	dir.remove(JOB_FILE);
+	
+	QStringList subdirs;
+	subdirs << LEASES_DIR << RESULTS_DIR;
+	BOOST_FOREACH(QString const& subdir_name, subdirs) {
+		QDir subdir(dir.filePath(subdir_name));
+		BOOST_FOREACH(QString const& name, subdir.entryList(QDir::Files|QDir::Hidden)) {
+			subdir.remove(name);
+		}
+		dir.rmdir(subdir_name);
+	}
+	
+	QStringList const leftovers(dir.entryList(QDir::Files|QDir::Hidden));
+	BOOST_FOREACH(QString const& name, leftovers) {
+		dir.remove(name);
+	}
+	QDir().rmdir(dir.absolutePath());
+}
+
+/**
+ * \brief Parses names like "12" + suffix.
+ *
+ * \return The page index, or -1 if the name doesn't match.
+ */
+int pageIdxFromFileName(QString const& name, QString const& suffix)
+{
+	if (!name.endsWith(suffix)) {
+		return -1;
+	}
+	bool ok = false;
+	int const idx = name.left(name.size() - suffix.size()).toInt(&ok);
+	return ok && idx >= 0 ? idx : -1;
+}
+
+QByteArray readFile(QString const& path)
+{
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly)) {
+		return QByteArray();
+	}
+	return file.readAll();
+}
+
+bool writeFile(QString const& path, QByteArray const& contents)
+{
+	QFile file(path);
+	if (!file.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+		return false;
+	}
+	return file.write(contents) == contents.size();
+}
+
+} // anonymous namespace
+
+QString
+BatchWorkQueue::queueDirFor(QString const& project_file)
+{
+	return QFileInfo(project_file).absoluteFilePath() + QString::fromAscii(".queue");
+}
+
+bool
+BatchWorkQueue::create(
+	QString const& project_file, int const filter_idx,
+	std::vector<PageId> const& pages)
+{
+	QString const dir_path(queueDirFor(project_file));
+	removeQueueDir(dir_path);
+	
+	QDir dir(dir_path);
+	if (!dir.mkpath(LEASES_DIR) || !dir.mkpath(RESULTS_DIR)) {
+		return false;
+	}
+	
+	QDomDocument doc;
+	QDomElement job_el(doc.createElement("batch-job"));
+	doc.appendChild(job_el);
+	job_el.setAttribute("filter", filter_idx);
+	BOOST_FOREACH(PageId const& page_id, pages) {
+		QDomElement page_el(doc.createElement("page"));
+		page_el.setAttribute("file", page_id.imageId().filePath());
+		page_el.setAttribute("fileImage", page_id.imageId().page());
+		page_el.setAttribute("subPage", page_id.subPageAsString());
+		job_el.appendChild(page_el);
+	}
+	
+	// Nodes must never see a partially written job.
+	AtomicFileOverwriter overwriter;
+	QIODevice* const file = overwriter.startWriting(dir.filePath(JOB_FILE));
+	if (!file) {
+		return false;
+	}
+	QTextStream strm(file);
+	doc.save(strm, 2);
+	strm.flush();
+	
+	return overwriter.commit();
+}
+
+BatchWorkQueue::BatchWorkQueue(QString const& project_file)
+:	m_dir(queueDirFor(project_file)),
+	m_filterIdx(-1),
+	m_leaseTimeoutSec(DEFAULT_LEASE_TIMEOUT_SEC),
+	m_nextCandidate(0),
+	m_heartbeatCounter(0)
+{
+	QSettings settings;
+	bool ok = false;
+	int const timeout = settings.value("settings/batch_lease_timeout_sec").toInt(&ok);
+	if (ok && timeout > 0) {
+		m_leaseTimeoutSec = timeout;
+	}
+	
+	QString host(QString::fromLocal8Bit(qgetenv("HOSTNAME")));
+	if (host.isEmpty()) {
+		host = QString::fromLocal8Bit(qgetenv("COMPUTERNAME"));
+	}
+	// The node id is also used in file names.  The instance counter
+	// keeps apart queues opened by the same process.
+	static QAtomicInt instance_counter;
+	m_nodeId = QString::fromAscii("%1-%2-%3-%4").arg(host)
+		.arg(QCoreApplication::applicationPid())
+		.arg(QDateTime::currentDateTime().toTime_t())
+		.arg(instance_counter.fetchAndAddRelaxed(1));
+	
+	QFile file(m_dir.filePath(JOB_FILE));
+	if (!file.open(QIODevice::ReadOnly)) {
+		return;
+	}
+	
+	QDomDocument doc;
+	if (!doc.setContent(&file)) {
+		return;
+	}
+	
+	QDomElement const job_el(doc.documentElement());
+	int const filter_idx = job_el.attribute("filter").toInt(&ok);
+	if (!ok || filter_idx < 0) {
+		return;
+	}
+	
+	QString const page_tag_name("page");
+	QDomNode node(job_el.firstChild());
+	for (; !node.isNull(); node = node.nextSibling()) {
+		if (!node.isElement() || node.nodeName() != page_tag_name) {
+			continue;
+		}
+		QDomElement const el(node.toElement());
+		PageId::SubPage const sub_page = PageId::subPageFromString(
+			el.attribute("subPage"), &ok
+		);
+		if (!ok) {
+			return;
+		}
+		ImageId const image_id(el.attribute("file"), el.attribute("fileImage").toInt());
+		m_pages.push_back(PageId(image_id, sub_page));
+	}
+	
+	m_filterIdx = filter_idx;
+}
+
+BatchWorkQueue::~BatchWorkQueue()
+{
+	releaseAll();
+}
+
+bool
+BatchWorkQueue::exists() const
+{
+	return m_dir.exists(JOB_FILE);
+}
+
+int
+BatchWorkQueue::lease()
+{
+	// A directory listing each, rather than looking up every page.
+	refreshDone();
+	std::set<int> const leased(leasedPages());
+	
+	int const num_pages = m_pages.size();
+	
+	// The first pass takes pages in order.
+	for (; (int)m_nextCandidate < num_pages; ++m_nextCandidate) {
+		int const idx = m_nextCandidate;
+		if (!leased.count(idx) && tryLease(idx)) {
+			++m_nextCandidate;
+			return idx;
+		}
+	}
+	
+	// Then we pick up pages that were given up or left by dead nodes.
+	for (int idx = 0; idx < num_pages; ++idx) {
+		if (leased.count(idx) ? tryTakeOver(idx) : tryLease(idx)) {
+			return idx;
+		}
+	}
+	
+	return -1;
+}
+
+void
+BatchWorkQueue::heartbeat()
+{
+	++m_heartbeatCounter;
+	
+	std::vector<int> lost;
+	BOOST_FOREACH(int const idx, m_leases) {
+		if (!writeLease(idx)) {
+			lost.push_back(idx);
+		}
+	}
+	
+	// Another node judged us dead and took these pages over.
+	// We still finish them, as a result is a result.
+	BOOST_FOREACH(int const idx, lost) {
+		m_leases.erase(idx);
+	}
+}
+
+bool
+BatchWorkQueue::complete(int const page_idx, QByteArray const& result)
+{
+	AtomicFileOverwriter overwriter;
+	QIODevice* const file = overwriter.startWriting(resultPath(page_idx));
+	bool ok = false;
+	if (file) {
+		ok = file->write(result) == result.size() && overwriter.commit();
+	}
+	
+	if (ok) {
+		m_done.insert(page_idx);
+	}
+	release(page_idx);
+	
+	return ok;
+}
+
+void
+BatchWorkQueue::release(int const page_idx)
+{
+	if (m_leases.erase(page_idx)) {
+		QString const lease_path(leasePath(page_idx));
+		if (isOwnLease(readFile(lease_path))) {
+			QFile::remove(lease_path);
+		}
+	}
+}
+
+void
+BatchWorkQueue::releaseAll()
+{
+	while (!m_leases.empty()) {
+		release(*m_leases.begin());
+	}
+}
+
+bool
+BatchWorkQueue::isFinished() const
+{
+	if (m_done.size() < m_pages.size()) {
+		refreshDone();
+	}
+	return m_done.size() == m_pages.size();
+}
+
+QByteArray
+BatchWorkQueue::result(int const page_idx) const
+{
+	QFile file(resultPath(page_idx));
+	if (!file.open(QIODevice::ReadOnly)) {
+		return QByteArray();
+	}
+	return file.readAll();
+}
+
+void
+BatchWorkQueue::remove()
+{
+	m_leases.clear();
+	removeQueueDir(m_dir.absolutePath());
+}
+
+bool
+BatchWorkQueue::tryLease(int const page_idx)
+{
+	if (m_leases.count(page_idx) || m_done.count(page_idx)) {
+		return false;
+	}
+	
+	if (!claim(page_idx)) {
+		return false;
+	}
+	
+	m_leases.insert(page_idx);
+	m_observations.erase(page_idx);
+	
+	// The page may have been completed just before we took the lease.
+	if (QFile::exists(resultPath(page_idx))) {
+		release(page_idx);
+		m_done.insert(page_idx);
+		return false;
+	}
+	
+	return true;
+}
+
+bool
+BatchWorkQueue::tryTakeOver(int const page_idx)
+{
+	if (m_leases.count(page_idx) || m_done.count(page_idx)) {
+		return false;
+	}
+	
+	// No need to look at the lease again before it may have become stale.
+	std::map<int, Observation>::const_iterator const obs(m_observations.find(page_idx));
+	if (obs != m_observations.end()
+			&& obs->second.since.secsTo(QDateTime::currentDateTime()) <= m_leaseTimeoutSec) {
+		return false;
+	}
+	
+	QString const lease_path(leasePath(page_idx));
+	QByteArray const contents(readFile(lease_path));
+	if (contents.isNull()) {
+		// Released in the meantime.
+		return tryLease(page_idx);
+	}
+	
+	if (!isStale(page_idx, contents)) {
+		return false;
+	}
+	
+	// Several nodes may be taking over the same lease.  Whoever moves it
+	// aside checks it moved the stale lease and not a fresh one put there
+	// by another node that got here first.
+	QString const aside_path(lease_path + QString::fromAscii(".stale.") + m_nodeId);
+	if (!Utils::overwritingRename(lease_path, aside_path)) {
+		return false;
+	}
+	if (readFile(aside_path) != contents) {
+		// Put it back, unless yet another node has claimed the page.
+		renameIfAbsent(aside_path, lease_path);
+		QFile::remove(aside_path);
+		return false;
+	}
+	QFile::remove(aside_path);
+	m_observations.erase(page_idx);
+	
+	return tryLease(page_idx);
+}
+
+bool
+BatchWorkQueue::claim(int const page_idx)
+{
+	QByteArray const contents(leaseContents());
+	QString const lease_path(leasePath(page_idx));
+	
+	// The lease file appears with its contents already in place,
+	// so other nodes never see it empty.
+	QString const temp_path(lease_path + QString::fromAscii(".new.") + m_nodeId);
+	bool const claimed = writeFile(temp_path, contents)
+		&& renameIfAbsent(temp_path, lease_path);
+	QFile::remove(temp_path);
+	if (!claimed) {
+		return false;
+	}
+	
+	// A node putting back a lease it moved aside by mistake
+	// may have raced with us.
+	return readFile(lease_path) == contents;
+}
+
+bool
+BatchWorkQueue::isStale(int const page_idx, QByteArray const& contents)
+{
+	QDateTime const now(QDateTime::currentDateTime());
+	
+	Observation& obs = m_observations[page_idx];
+	if (obs.since.isNull() || obs.contents != contents) {
+		// The owner is alive, or we haven't been watching for long enough.
+		obs.contents = contents;
+		obs.since = now;
+		return false;
+	}
+	
+	return obs.since.secsTo(now) > m_leaseTimeoutSec;
+}
+
+bool
+BatchWorkQueue::writeLease(int const page_idx)
+{
+	QString const lease_path(leasePath(page_idx));
+	if (!isOwnLease(readFile(lease_path))) {
+		return false;
+	}
+	
+	// Readers must never see the lease truncated.
+	QString const temp_path(lease_path + QString::fromAscii(".new.") + m_nodeId);
+	if (!writeFile(temp_path, leaseContents())
+			|| !Utils::overwritingRename(temp_path, lease_path)) {
+		// The lease is still ours, just not refreshed.
+		QFile::remove(temp_path);
+	}
+	
+	return true;
+}
+
+bool
+BatchWorkQueue::isOwnLease(QByteArray const& contents) const
+{
+	return contents.startsWith((m_nodeId + QChar(' ')).toUtf8());
+}
+
+void
+BatchWorkQueue::refreshDone() const
+{
+	QString const suffix(QString::fromAscii(".xml"));
+	QDir const results_dir(m_dir.filePath(RESULTS_DIR));
+	BOOST_FOREACH(QString const& name, results_dir.entryList(QDir::Files)) {
+		int const idx = pageIdxFromFileName(name, suffix);
+		if (idx >= 0 && idx < (int)m_pages.size()) {
+			m_done.insert(idx);
+		}
+	}
+}
+
+std::set<int>
+BatchWorkQueue::leasedPages() const
+{
+	std::set<int> leased;
+	
+	QDir const leases_dir(m_dir.filePath(LEASES_DIR));
+	BOOST_FOREACH(QString const& name, leases_dir.entryList(QDir::Files)) {
+		int const idx = pageIdxFromFileName(name, QString());
+		if (idx >= 0) {
+			leased.insert(idx);
+		}
+	}
+	
+	return leased;
+}
+
+QByteArray
+BatchWorkQueue::leaseContents() const
+{
+	return (m_nodeId + QChar(' ') + QString::number(m_heartbeatCounter)).toUtf8();
+}
+
+QString
+BatchWorkQueue::leasePath(int const page_idx) const
+{
+	return m_dir.filePath(
+		QString::fromAscii("%1/%2").arg(LEASES_DIR).arg(page_idx)
+	);
+}
+
+QString
+BatchWorkQueue::resultPath(int const page_idx) const
+{
+	return m_dir.filePath(
+		QString::fromAscii("%1/%2.xml").arg(RESULTS_DIR).arg(page_idx)
+	);
+}
+
+bool
+BatchWorkQueue::createExclusively(QString const& path, QByteArray const& contents)
+{
+#ifdef Q_WS_WIN
+	HANDLE const handle = CreateFileW(
+		(WCHAR*)path.utf16(), GENERIC_WRITE, 0, 0, CREATE_NEW,
+		FILE_ATTRIBUTE_NORMAL, 0
+	);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	DWORD written = 0;
+	WriteFile(handle, contents.constData(), contents.size(), &written, 0);
+	CloseHandle(handle);
+#else
+	int const fd = open(
+		QFile::encodeName(path).constData(), O_WRONLY|O_CREAT|O_EXCL, 0644
+	);
+	if (fd == -1) {
+		return false;
+	}
+	ssize_t const written = write(fd, contents.constData(), contents.size());
+	(void)written;
+	close(fd);
+#endif
+	return true;
+}
+
+bool
+BatchWorkQueue::renameIfAbsent(QString const& from, QString const& to)
+{
+#ifdef Q_WS_WIN
+	// Without MOVEFILE_REPLACE_EXISTING, this fails if the target exists.
+	return MoveFileExW((WCHAR*)from.utf16(), (WCHAR*)to.utf16(), 0) != 0;
+#else
+	QByteArray const from_name(QFile::encodeName(from));
+	QByteArray const to_name(QFile::encodeName(to));
+	if (::link(from_name.constData(), to_name.constData()) == 0) {
+		::unlink(from_name.constData());
+		return true;
+	}
+	if (errno == EEXIST) {
+		return false;
+	}
+	
+	// Some file systems don't support hard links.  Exclusive creation
+	// is the next best thing, though the file may be seen empty briefly.
+	if (!createExclusively(to, readFile(from))) {
+		return false;
+	}
+	::unlink(from_name.constData());
+	return true;
+#endif
+}
@@ -0,0 +1,208 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BATCH_WORK_QUEUE_H_
+#define BATCH_WORK_QUEUE_H_
+
+#include "NonCopyable.h"
+#include "PageId.h"
+#include <QString>
+#include <QByteArray>
+#include <QDateTime>
+#include <QDir>
+#include <vector>
+#include <map>
+#include <set>
+
+/**
+ * \brief A queue of pages, shared by several processes through the file system.
+ *
+ * The queue lives in a directory next to the project file.  It holds
+ * a job description, a lease file for every page being worked on
+ * and a result file for every page that's done.  A process (a node)
+ * takes a page by writing a lease to a file of its own and linking it
+ * into place, which fails if the page is taken.  It keeps the lease
+ * alive with heartbeat() and gives it up with complete() or release().
+ * A lease that stayed unchanged for too long belongs to a dead node
+ * and may be taken over by another one.
+ *
+ * No clock is shared between nodes.  Staleness is judged by each node
+ * on its own clock, by watching the lease contents change.
+ *
+ * In rare races a page may be processed by two nodes.  That's harmless,
+ * as both produce the same result.
+ */
+class BatchWorkQueue
+{
+	DECLARE_NON_COPYABLE(BatchWorkQueue)
+public:
+	/**
+	 * \brief Creates a queue for a project, replacing an existing one.
+	 *
+	 * \param project_file The project file the queue belongs to.
+	 * \param filter_idx The filter to process the pages up to.
+	 * \param pages The pages to process, in the order they are to be taken.
+	 * \return true on success.
+	 */
+	static bool create(QString const& project_file,
+		int filter_idx, std::vector<PageId> const& pages);
+	
+	/**
+	 * \brief Opens the queue of a project.
+	 *
+	 * Check isValid() to find out whether there was a queue to open.
+	 */
+	explicit BatchWorkQueue(QString const& project_file);
+	
+	/**
+	 * \brief Releases the leases still held by this node.
+	 */
+	~BatchWorkQueue();
+	
+	bool isValid() const { return m_filterIdx >= 0; }
+	
+	/**
+	 * \brief Returns false if the queue was removed by another node.
+	 */
+	bool exists() const;
+	
+	int filterIdx() const { return m_filterIdx; }
+	
+	std::vector<PageId> const& pages() const { return m_pages; }
+	
+	/**
+	 * \brief Takes the next page nobody else is working on.
+	 *
+	 * \return An index into pages(), or -1 if there is nothing to take
+	 *         at the moment.
+	 */
+	int lease();
+	
+	/**
+	 * \brief Keeps the leases of this node alive.
+	 *
+	 * Must be called at least every heartbeatInterval() milliseconds.
+	 */
+	void heartbeat();
+	
+	int heartbeatInterval() const { return m_leaseTimeoutSec * 1000 / 4; }
+	
+	/**
+	 * \brief Overrides the "settings/batch_lease_timeout_sec" setting.
+	 *
+	 * A lease of another node is taken over once it stayed unchanged
+	 * for longer than that.
+	 */
+	void setLeaseTimeout(int sec) { m_leaseTimeoutSec = sec; }
+	
+	/**
+	 * \brief Stores the result for a leased page and gives up the lease.
+	 */
+	bool complete(int page_idx, QByteArray const& result);
+	
+	/**
+	 * \brief Gives up a lease without completing the page.
+	 */
+	void release(int page_idx);
+	
+	void releaseAll();
+	
+	/**
+	 * \brief Returns true if every page has a result.
+	 */
+	bool isFinished() const;
+	
+	/**
+	 * \brief Returns the result stored by complete(), or a null array.
+	 */
+	QByteArray result(int page_idx) const;
+	
+	/**
+	 * \brief Deletes the queue directory, letting other nodes know
+	 *        there is nothing left to do.
+	 */
+	void remove();
+	
+	static QString queueDirFor(QString const& project_file);
+private:
+	/**
+	 * \brief What this node saw in a lease file of another node.
+	 */
+	struct Observation
+	{
+		QByteArray contents;
+		QDateTime since;
+	};
+	
+	bool tryLease(int page_idx);
+	
+	bool tryTakeOver(int page_idx);
+	
+	/**
+	 * \brief Creates the lease file, if there isn't one already.
+	 */
+	bool claim(int page_idx);
+	
+	bool isStale(int page_idx, QByteArray const& contents);
+	
+	/**
+	 * \brief Refreshes a lease of this node.
+	 *
+	 * \return false if the lease was taken over by another node.
+	 */
+	bool writeLease(int page_idx);
+	
+	bool isOwnLease(QByteArray const& contents) const;
+	
+	/**
+	 * \brief Adds the pages that have results to m_done.
+	 */
+	void refreshDone() const;
+	
+	/**
+	 * \brief Returns the pages that have lease files, ours or not.
+	 */
+	std::set<int> leasedPages() const;
+	
+	QByteArray leaseContents() const;
+	
+	QString leasePath(int page_idx) const;
+	
+	QString resultPath(int page_idx) const;
+	
+	static bool createExclusively(QString const& path, QByteArray const& contents);
+	
+	/**
+	 * \brief Atomically renames a file, unless the target exists.
+	 */
+	static bool renameIfAbsent(QString const& from, QString const& to);
+	
+	QDir m_dir;
+	QString m_nodeId;
+	int m_filterIdx;
+	int m_leaseTimeoutSec;
+	std::vector<PageId> m_pages;
+	std::set<int> m_leases;
+	mutable std::set<int> m_done;
+	std::map<int, Observation> m_observations;
+	size_t m_nextCandidate;
+	unsigned m_heartbeatCounter;
+};
+
+#endif
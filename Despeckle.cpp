@@ -350,7 +350,7 @@ bool canBeAttachedTo(
 	return false;
 }
 
-void voronoi(ConnectivityMap& cmap, std::vector<Distance>& dist)
+void voronoi(ConnectivityMap& cmap, std::vector<Distance>& dist, TaskStatus const& status)
 {
 	int const width = cmap.size().width() + 2;
 	int const height = cmap.size().height() + 2;
@@ -372,8 +372,12 @@ void voronoi(ConnectivityMap& cmap, std::vector<Distance>& dist)
 				- (int(dist_line[x - 1].vec.x) << 1) + 1;
 	}
 	
+	TaskStatusPoller poller(&status);
+
 	// Top to bottom scan.
 	for (int y = 1; y < height - 1; ++y) {
+		poller.poll();
+
 		dist_line += width;
 		cmap_line += width;
 		dist_line[0].reset(0);
@@ -438,6 +442,8 @@ void voronoi(ConnectivityMap& cmap, std::vector<Distance>& dist)
 	
 	// Bottom to top scan.
 	for (int y = height - 2; y >= 1; --y) {
+		poller.poll();
+
 		dist_line -= width;
 		cmap_line -= width;
 		dist_line[0].reset(0);
@@ -491,7 +497,9 @@ void voronoi(ConnectivityMap& cmap, std::vector<Distance>& dist)
 	}
 }
 
-void voronoiSpecial(ConnectivityMap& cmap, std::vector<Distance>& dist, Distance const special_distance)
+void voronoiSpecial(
+	ConnectivityMap& cmap, std::vector<Distance>& dist,
+	Distance const special_distance, TaskStatus const& status)
 {
 	int const width = cmap.size().width() + 2;
 	int const height = cmap.size().height() + 2;
@@ -503,8 +511,12 @@ void voronoiSpecial(ConnectivityMap& cmap, std::vector<Distance>& dist, Distance
 	Distance* dist_line = &dist[0];
 	uint32_t* cmap_line = cmap.paddedData();
 	
+	TaskStatusPoller poller(&status);
+
 	// Top to bottom scan.
 	for (int y = 1; y < height - 1; ++y) {
+		poller.poll();
+
 		dist_line += width;
 		cmap_line += width;
 		dist_line[0].reset(0);
@@ -571,6 +583,8 @@ void voronoiSpecial(ConnectivityMap& cmap, std::vector<Distance>& dist, Distance
 	
 	// Bottom to top scan.
 	for (int y = height - 2; y >= 1; --y) {
+		poller.poll();
+
 		dist_line -= width;
 		cmap_line -= width;
 		dist_line[0].reset(0);
@@ -776,7 +790,7 @@ Despeckle::despeckleInPlace(
 	
 	// Build a Voronoi diagram.
 	std::vector<Distance> distance_matrix;
-	voronoi(cmap, distance_matrix);
+	voronoi(cmap, distance_matrix, status);
 	if (dbg) {
 		dbg->add(cmap.visualized(), "voronoi");
 	}
@@ -852,7 +866,7 @@ Despeckle::despeckleInPlace(
 		// treat pixels with a special distance in such a way
 		// to prevent them from spreading but also preventing
 		// them from being overwritten.
-		voronoiSpecial(cmap, distance_matrix, special_distance);
+		voronoiSpecial(cmap, distance_matrix, special_distance, status);
 		if (dbg) {
 			dbg->add(cmap.visualized(), "voronoi_special");
 		}
@@ -37,6 +37,14 @@ ImageLoader::load(QString const& file_path, int const page_num)
 	if (!file.open(QIODevice::ReadOnly)) {
 		return QImage();
 	}
+	
+	if (TiffReader::canRead(file)) {
+		// This version reuses open multi-page files
+		// and doesn't walk their directories again.
+		file.close();
+		return TiffReader::readImage(file_path, page_num);
+	}
+	
 	return load(file, page_num);
 }
 
@@ -0,0 +1,279 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ImagePrefetcher.h"
+#include "MemoryBudget.h"
+#include "ImageLoader.h"
+#include "ImageId.h"
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QImage>
+#include <QSize>
+#include <QtGlobal>
+#include <boost/foreach.hpp>
+#include <algorithm>
+#include <list>
+
+namespace
+{
+
+/**
+ * How long to wait before trying again to reserve memory
+ * for an image that didn't fit into the budget.
+ */
+unsigned long const RESERVE_RETRY_MSEC = 200;
+
+} // anonymous namespace
+
+
+class ImagePrefetcher::Impl : public QThread
+{
+public:
+	Impl(std::vector<PageInfo> const& pages, int max_ahead,
+		IntrusivePtr<MemoryBudget> const& memory_budget);
+
+	virtual ~Impl();
+
+	QImage take(ImageId const& image_id);
+
+	void cancel();
+protected:
+	virtual void run();
+private:
+	enum State { PENDING, LOADING, LOADED };
+
+	struct Slot
+	{
+		ImageId imageId;
+		qint64 estimatedSize;
+		int remainingTakes;
+		State state;
+		QImage image;
+
+		Slot(ImageId const& image_id, qint64 estimated_size);
+	};
+
+	typedef std::list<Slot> SlotList;
+
+	/**
+	 * \brief Releases the memory reserved for a slot and removes it.
+	 *
+	 * Must be called with m_mutex locked, and not for a slot in
+	 * LOADING state.
+	 */
+	SlotList::iterator discard(SlotList::iterator it);
+
+	QMutex m_mutex;
+	QWaitCondition m_cond;
+
+	/**
+	 * Slots are ordered as: zero or more LOADED ones, at most one LOADING,
+	 * zero or more PENDING ones.
+	 */
+	SlotList m_slots;
+	IntrusivePtr<MemoryBudget> m_ptrMemoryBudget;
+	int const m_maxAhead;
+	bool m_exiting;
+};
+
+
+int const ImagePrefetcher::DEFAULT_MAX_AHEAD = 2;
+
+ImagePrefetcher::ImagePrefetcher(
+	std::vector<PageInfo> const& pages, int const max_ahead,
+	IntrusivePtr<MemoryBudget> const& memory_budget)
+:	m_ptrImpl(new Impl(pages, max_ahead, memory_budget))
+{
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+}
+
+QImage
+ImagePrefetcher::take(ImageId const& image_id)
+{
+	return m_ptrImpl->take(image_id);
+}
+
+void
+ImagePrefetcher::cancel()
+{
+	m_ptrImpl->cancel();
+}
+
+
+/*========================== ImagePrefetcher::Impl ==========================*/
+
+ImagePrefetcher::Impl::Impl(
+	std::vector<PageInfo> const& pages, int const max_ahead,
+	IntrusivePtr<MemoryBudget> const& memory_budget)
+:	m_ptrMemoryBudget(memory_budget),
+	m_maxAhead(std::max(1, max_ahead)),
+	m_exiting(false)
+{
+	BOOST_FOREACH(PageInfo const& page, pages) {
+		if (!m_slots.empty() && m_slots.back().imageId == page.imageId()) {
+			// Both halves of a split page come from the same image.
+			++m_slots.back().remainingTakes;
+			continue;
+		}
+
+		// The image may be expanded to 32 bits per pixel when loaded.
+		QSize const size(page.metadata().size());
+		qint64 const estimated_size = qint64(size.width()) * size.height() * 4;
+		m_slots.push_back(Slot(page.imageId(), estimated_size));
+	}
+
+	start();
+}
+
+ImagePrefetcher::Impl::~Impl()
+{
+	cancel();
+	wait();
+}
+
+QImage
+ImagePrefetcher::Impl::take(ImageId const& image_id)
+{
+	QMutexLocker locker(&m_mutex);
+
+	for (;;) {
+		SlotList::iterator it(m_slots.begin());
+		for (; it != m_slots.end(); ++it) {
+			if (it->remainingTakes > 0 && it->imageId == image_id) {
+				break;
+			}
+		}
+		if (it == m_slots.end()) {
+			return QImage();
+		}
+
+		// Images scheduled before this one are left alone.  Several
+		// pages may be processed at the same time, and the tasks
+		// processing the earlier ones may not have asked for them yet.
+
+		if (it->state == LOADING) {
+			m_cond.wait(&m_mutex);
+			continue;
+		}
+
+		QImage const image(it->image);
+		if (--it->remainingTakes == 0) {
+			discard(it);
+		}
+		m_cond.wakeAll();
+
+		// A null image for a slot that wasn't loaded yet
+		// tells the caller to load it itself.
+		return image;
+	}
+}
+
+void
+ImagePrefetcher::Impl::cancel()
+{
+	QMutexLocker const locker(&m_mutex);
+
+	m_exiting = true;
+
+	SlotList::iterator it(m_slots.begin());
+	while (it != m_slots.end()) {
+		if (it->state == LOADING) {
+			it->remainingTakes = 0;
+			++it;
+		} else {
+			it = discard(it);
+		}
+	}
+
+	m_cond.wakeAll();
+}
+
+void
+ImagePrefetcher::Impl::run()
+{
+	QMutexLocker locker(&m_mutex);
+
+	while (!m_exiting) {
+		int num_ahead = 0;
+		SlotList::iterator it(m_slots.begin());
+		for (; it != m_slots.end() && it->state != PENDING; ++it) {
+			++num_ahead;
+		}
+
+		if (it == m_slots.end()) {
+			// Everything has been loaded.
+			break;
+		}
+
+		if (num_ahead >= m_maxAhead) {
+			m_cond.wait(&m_mutex);
+			continue;
+		}
+
+		if (!m_ptrMemoryBudget->tryReserve(it->estimatedSize)) {
+			m_cond.wait(&m_mutex, RESERVE_RETRY_MSEC);
+			continue;
+		}
+
+		it->state = LOADING;
+		ImageId const image_id(it->imageId);
+
+		locker.unlock();
+		QImage image;
+		{
+			// Not measured, but it spoils the measurements of tasks
+			// running at the same time.
+			MemoryBudget::PeakMeter const peak_meter;
+			image = ImageLoader::load(image_id);
+		}
+		locker.relock();
+
+		it->image = image;
+		it->state = LOADED;
+		if (it->remainingTakes == 0) {
+			discard(it);
+		}
+		m_cond.wakeAll();
+	}
+}
+
+ImagePrefetcher::Impl::SlotList::iterator
+ImagePrefetcher::Impl::discard(SlotList::iterator const it)
+{
+	if (it->state == LOADED) {
+		m_ptrMemoryBudget->release(it->estimatedSize);
+	}
+	return m_slots.erase(it);
+}
+
+
+/*====================== ImagePrefetcher::Impl::Slot ======================*/
+
+ImagePrefetcher::Impl::Slot::Slot(ImageId const& image_id, qint64 const estimated_size)
+:	imageId(image_id),
+	estimatedSize(estimated_size),
+	remainingTakes(1),
+	state(PENDING)
+{
+}
@@ -0,0 +1,86 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGE_PREFETCHER_H_
+#define IMAGE_PREFETCHER_H_
+
+#include "NonCopyable.h"
+#include "RefCountable.h"
+#include "IntrusivePtr.h"
+#include "PageInfo.h"
+#include <memory>
+#include <vector>
+
+class MemoryBudget;
+class ImageId;
+class QImage;
+
+/**
+ * \brief Loads and decodes images ahead of batch processing.
+ *
+ * Images are loaded on a dedicated thread, in the order the pages
+ * are going to be processed, so that the disk doesn't sit idle while
+ * the worker thread processes a page.  At most max_ahead decoded
+ * images are kept, and each of them reserves its size from the memory
+ * budget.  If an image doesn't fit, it's not prefetched, and the task
+ * that needs it loads it itself.
+ *
+ * This class is thread-safe.
+ */
+class ImagePrefetcher : public RefCountable
+{
+	DECLARE_NON_COPYABLE(ImagePrefetcher)
+public:
+	static int const DEFAULT_MAX_AHEAD;
+
+	/**
+	 * \param pages The pages in the order they are going to be processed.
+	 *        Consecutive pages of the same image share a single load.
+	 * \param max_ahead The maximum number of images loaded and not yet taken.
+	 * \param memory_budget The budget to reserve memory for loaded images from.
+	 */
+	ImagePrefetcher(std::vector<PageInfo> const& pages, int max_ahead,
+		IntrusivePtr<MemoryBudget> const& memory_budget);
+
+	/**
+	 * \brief Stops the loading thread and releases the reserved memory.
+	 */
+	virtual ~ImagePrefetcher();
+
+	/**
+	 * \brief Returns a prefetched image.
+	 *
+	 * If the image is currently being loaded, waits for it.  Images
+	 * scheduled before this one are kept until they are taken as well.
+	 * A null image is returned if the image wasn't prefetched, in which
+	 * case the caller is supposed to load it itself.
+	 */
+	QImage take(ImageId const& image_id);
+
+	/**
+	 * \brief Stops prefetching and discards the images not yet taken.
+	 */
+	void cancel();
+private:
+	class Impl;
+
+	std::auto_ptr<Impl> m_ptrImpl;
+};
+
+#endif
@@ -31,6 +31,7 @@
 #include "Dpm.h"
 #include "FilterData.h"
 #include "ImageLoader.h"
+#include "ImagePrefetcher.h"
 #include "imageproc/BinaryThreshold.h"
 #include <QCoreApplication>
 #include <QImage>
@@ -58,13 +59,15 @@ LoadFileTask::LoadFileTask(
 	Type type, PageInfo const& page,
 	IntrusivePtr<ThumbnailPixmapCache> const& thumbnail_cache,
 	IntrusivePtr<ProjectPages> const& pages,
-	IntrusivePtr<fix_orientation::Task> const& next_task)
+	IntrusivePtr<fix_orientation::Task> const& next_task,
+	IntrusivePtr<ImagePrefetcher> const& prefetcher)
 :	BackgroundTask(type),
 	m_ptrThumbnailCache(thumbnail_cache),
 	m_imageId(page.imageId()),
 	m_imageMetadata(page.metadata()),
 	m_ptrPages(pages),
-	m_ptrNextTask(next_task)
+	m_ptrNextTask(next_task),
+	m_ptrPrefetcher(prefetcher)
 {
 	assert(m_ptrNextTask);
 }
@@ -76,7 +79,13 @@ LoadFileTask::~LoadFileTask()
 FilterResultPtr
 LoadFileTask::operator()()
 {
-	QImage image(ImageLoader::load(m_imageId));
+	QImage image;
+	if (m_ptrPrefetcher) {
+		image = m_ptrPrefetcher->take(m_imageId);
+	}
+	if (image.isNull()) {
+		image = ImageLoader::load(m_imageId);
+	}
 	
 	try {
 		throwIfCancelled();
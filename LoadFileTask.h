@@ -27,6 +27,7 @@
 #include "ImageMetadata.h"
 
 class ThumbnailPixmapCache;
+class ImagePrefetcher;
 class PageInfo;
 class ProjectPages;
 class QImage;
@@ -40,10 +41,15 @@ class LoadFileTask : public BackgroundTask
 {
 	DECLARE_NON_COPYABLE(LoadFileTask)
 public:
+	/**
+	 * \param prefetcher If provided, the image is taken from it,
+	 *        unless it wasn't prefetched.
+	 */
 	LoadFileTask(Type type, PageInfo const& page,
 		IntrusivePtr<ThumbnailPixmapCache> const& thumbnail_cache,
 		IntrusivePtr<ProjectPages> const& pages,
-		IntrusivePtr<fix_orientation::Task> const& next_task);
+		IntrusivePtr<fix_orientation::Task> const& next_task,
+		IntrusivePtr<ImagePrefetcher> const& prefetcher = IntrusivePtr<ImagePrefetcher>());
 	
 	virtual ~LoadFileTask();
 	
@@ -60,6 +66,7 @@ private:
 	ImageMetadata m_imageMetadata;
 	IntrusivePtr<ProjectPages> const m_ptrPages;
 	IntrusivePtr<fix_orientation::Task> const m_ptrNextTask;
+	IntrusivePtr<ImagePrefetcher> const m_ptrPrefetcher;
 };
 
 #endif
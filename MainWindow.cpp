@@ -29,6 +29,12 @@
 #include "PageOrderOption.h"
 #include "PageOrderProvider.h"
 #include "ProcessingTaskQueue.h"
+#include "MemoryBudget.h"
+#include "ProcessingCostModel.h"
+#include "ImagePrefetcher.h"
+#include "WriteBehindQueue.h"
+#include "SpeculativeResultCache.h"
+#include "BatchWorkQueue.h"
 #include "FileNameDisambiguator.h"
 #include "OutputFileNameGenerator.h"
 #include "ImageInfo.h"
@@ -44,6 +50,7 @@
 #include "BasicImageView.h"
 #include "ProjectWriter.h"
 #include "ProjectReader.h"
+#include "ProjectMerger.h"
 #include "ThumbnailPixmapCache.h"
 #include "ThumbnailFactory.h"
 #include "ContentBoxPropagator.h"
@@ -84,6 +91,7 @@
 #include "config.h"
 #include "version.h"
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
 #include <boost/lambda/lambda.hpp>
 #include <boost/lambda/bind.hpp>
 #include <QApplication>
@@ -117,6 +125,7 @@
 #include <Qt>
 #include <QDebug>
 #include <algorithm>
+#include <utility>
 #include <vector>
 #include <stddef.h>
 #include <math.h>
@@ -125,13 +134,28 @@
 MainWindow::MainWindow()
 :	m_ptrPages(new ProjectPages),
 	m_ptrStages(new StageSequence(m_ptrPages, PageSelectionAccessor(this))),
+	m_ptrMemoryBudget(
+		new MemoryBudget(MemoryBudget::loadLimit("settings/memory_budget_mb"))
+	),
+	m_ptrCostModel(new ProcessingCostModel),
 	m_ptrWorkerThread(new WorkerThread),
-	m_ptrInteractiveQueue(new ProcessingTaskQueue(ProcessingTaskQueue::RANDOM_ORDER)),
+	m_ptrInteractiveQueue(
+		new ProcessingTaskQueue(ProcessingTaskQueue::RANDOM_ORDER, m_ptrMemoryBudget)
+	),
+	m_ptrSpeculativeResults(new SpeculativeResultCache),
+	m_speculativeFilter(-1),
+	m_speculationEnabled(
+		QSettings().value("settings/speculative_processing", true).toBool()
+	),
 	m_curFilter(0),
 	m_ignoreSelectionChanges(0),
 	m_ignorePageOrderingChanges(0),
 	m_debug(false),
-	m_closing(false)
+	m_distributedTimerId(0),
+	m_distributedCoordinator(false),
+	m_joinBatchAfterOpening(false),
+	m_closing(false),
+	m_reviewingDuringBatch(false)
 {
 	m_maxLogicalThumbSize = QSize(250, 160);
 	m_ptrThumbSequence.reset(new ThumbnailSequence(m_maxLogicalThumbSize));
@@ -173,6 +197,11 @@ MainWindow::MainWindow()
 	connect(actionPrevPageQ, SIGNAL(triggered(bool)), this, SLOT(goPrevPage()));
 	connect(actionNextPageW, SIGNAL(triggered(bool)), this, SLOT(goNextPage()));
 	connect(actionAbout, SIGNAL(triggered(bool)), this, SLOT(showAboutDialog()));
+	connect(actionBatchProgress, SIGNAL(triggered(bool)), this, SLOT(showBatchProgress()));
+	connect(
+		actionDistributedBatch, SIGNAL(triggered(bool)),
+		this, SLOT(startDistributedBatchProcessing())
+	);
 	
 	connect(
 		filterList->selectionModel(),
@@ -189,6 +218,11 @@ MainWindow::MainWindow()
 		SIGNAL(taskResult(BackgroundTaskPtr const&, FilterResultPtr const&)),
 		this, SLOT(filterResult(BackgroundTaskPtr const&, FilterResultPtr const&))
 	);
+	connect(
+		m_ptrWorkerThread.get(),
+		SIGNAL(taskPreview(BackgroundTaskPtr const&, FilterResultPtr const&)),
+		this, SLOT(filterPreview(BackgroundTaskPtr const&, FilterResultPtr const&))
+	);
 	
 	connect(
 		m_ptrThumbSequence.get(),
@@ -277,6 +311,7 @@ MainWindow::MainWindow()
 MainWindow::~MainWindow()
 {
 	m_ptrInteractiveQueue->cancelAndClear();
+	discardSpeculation();
 	if (m_ptrBatchQueue.get()) {
 		m_ptrBatchQueue->cancelAndClear();
 	}
@@ -313,9 +348,11 @@ MainWindow::switchToNewProject(
 {
 	stopBatchProcessing(CLEAR_MAIN_AREA);
 	m_ptrInteractiveQueue->cancelAndClear();
+	discardSpeculation();
 	
 	m_ptrPages = pages;
 	m_projectFile = project_file_path;
+	m_ptrCostModel->clear();
 
 	if (project_reader) {
 		m_selectedPage = project_reader->selectedPage();
@@ -509,7 +546,13 @@ MainWindow::closeEvent(QCloseEvent* const event)
 void
 MainWindow::timerEvent(QTimerEvent* const event)
 {
-	// We only use the timer event for delayed closing of the window.
+	if (event->timerId() == m_distributedTimerId) {
+		pollDistributedBatch();
+		return;
+	}
+	
+	// Other than that, we only use the timer event for delayed
+	// closing of the window.
 	killTimer(event->timerId());
 	
 	if (closeProjectInteractive()) {
@@ -657,7 +700,7 @@ MainWindow::resetThumbSequence(
 void
 MainWindow::setOptionsWidget(FilterOptionsWidget* widget, Ownership const ownership)
 {
-	if (isBatchProcessingInProgress()) {
+	if (isBatchProcessingInForeground()) {
 		if (ownership == TRANSFER_OWNERSHIP) {
 			delete widget;
 		}
@@ -736,7 +779,7 @@ MainWindow::setImageWidget(
 	QWidget* widget, Ownership const ownership,
 	DebugImages* debug_images)
 {
-	if (isBatchProcessingInProgress() && widget != m_ptrBatchProcessingWidget.get()) {
+	if (isBatchProcessingInForeground() && widget != m_ptrBatchProcessingWidget.get()) {
 		if (ownership == TRANSFER_OWNERSHIP) {
 			delete widget;
 		}
@@ -778,25 +821,28 @@ MainWindow::removeImageWidget()
 void
 MainWindow::invalidateThumbnail(PageId const& page_id)
 {
+	forgetSpeculation(page_id);
 	m_ptrThumbSequence->invalidateThumbnail(page_id);
 }
 
 void
 MainWindow::invalidateThumbnail(PageInfo const& page_info)
 {
+	forgetSpeculation(page_info.id());
 	m_ptrThumbSequence->invalidateThumbnail(page_info);
 }
 
 void
 MainWindow::invalidateAllThumbnails()
 {
+	discardSpeculation();
 	m_ptrThumbSequence->invalidateAllThumbnails();
 }
 
 void
 MainWindow::goFirstPage()
 {
-	if (isBatchProcessingInProgress() || !isProjectLoaded()) {
+	if (isBatchProcessingInForeground() || !isProjectLoaded()) {
 		return;
 	}
 	
@@ -809,7 +855,7 @@ MainWindow::goFirstPage()
 void
 MainWindow::goLastPage()
 {
-	if (isBatchProcessingInProgress() || !isProjectLoaded()) {
+	if (isBatchProcessingInForeground() || !isProjectLoaded()) {
 		return;
 	}
 	
@@ -822,7 +868,7 @@ MainWindow::goLastPage()
 void
 MainWindow::goNextPage()
 {
-	if (isBatchProcessingInProgress() || !isProjectLoaded()) {
+	if (isBatchProcessingInForeground() || !isProjectLoaded()) {
 		return;
 	}
 	
@@ -837,7 +883,7 @@ MainWindow::goNextPage()
 void
 MainWindow::goPrevPage()
 {
-	if (isBatchProcessingInProgress() || !isProjectLoaded()) {
+	if (isBatchProcessingInForeground() || !isProjectLoaded()) {
 		return;
 	}
 	
@@ -875,8 +921,11 @@ MainWindow::currentPageChanged(
 	}
 	
 	if (flags & ThumbnailSequence::SELECTED_BY_USER) {
-		if (isBatchProcessingInProgress()) {
-			stopBatchProcessing();
+		if (isBatchProcessingInForeground()) {
+			// Let the user review pages while batch processing goes on.
+			m_reviewingDuringBatch = true;
+			actionBatchProgress->setEnabled(true);
+			updateMainArea();
 		} else if (!(flags & ThumbnailSequence::REDUNDANT_SELECTION)) {
 			// Start loading / processing the newly selected page.
 			updateMainArea();
@@ -997,6 +1046,7 @@ MainWindow::filterSelectionChanged(QItemSelection const& selected)
 		// Should not happen, but just in case.
 		m_ptrBatchQueue->cancelAndClear();
 	}
+	discardSpeculation();
 	
 	bool const was_below_fix_orientation = isBelowFixOrientation(m_curFilter);
 	bool const was_below_select_content = isBelowSelectContent(m_curFilter);
@@ -1053,6 +1103,9 @@ MainWindow::pageOrderingChanged(int idx)
 void
 MainWindow::reloadRequested()
 {
+	// Settings have changed, and they may be shared with other pages.
+	discardSpeculation();
+	
 	// Start loading / processing the current page.
 	updateMainArea();
 }
@@ -1063,20 +1116,75 @@ MainWindow::startBatchProcessing()
 	if (isBatchProcessingInProgress() || !isProjectLoaded()) {
 		return;
 	}
+	
+	std::vector<PageInfo> pages;
+	PageInfo page(m_ptrThumbSequence->selectionLeader());
+	for (; !page.isNull(); page = m_ptrThumbSequence->nextPage(page.id())) {
+		pages.push_back(page);
+	}
+	
+	beginBatchProcessing(pages, true);
+}
 
+/**
+ * \brief Sets up batch processing and starts the first tasks.
+ *
+ * \param pages The pages to process.  In distributed batch processing,
+ *        pages are added later, as they are leased.
+ * \param prefetch Whether to read the images of \p pages ahead.
+ * \return false if there turned out to be nothing to process.
+ */
+bool
+MainWindow::beginBatchProcessing(std::vector<PageInfo> const& pages, bool const prefetch)
+{
 	m_ptrInteractiveQueue->cancelAndClear();
+	discardSpeculation();
+	
+	ProcessingTaskQueue::Order order = currentPageOrderProvider().get()
+		? ProcessingTaskQueue::RANDOM_ORDER
+		: ProcessingTaskQueue::SEQUENTIAL_ORDER;
+	if (order == ProcessingTaskQueue::SEQUENTIAL_ORDER
+			&& m_ptrWorkerThread->batchPipelineDepth() > 1
+			&& QSettings().value("settings/largest_first_batch_order", true).toBool()) {
+		// With several pages in flight, an expensive page left
+		// for the end would keep everything else waiting.
+		order = ProcessingTaskQueue::LARGEST_FIRST_ORDER;
+	}
 	
 	m_ptrBatchQueue.reset(
 		new ProcessingTaskQueue(
-			currentPageOrderProvider().get()
-			? ProcessingTaskQueue::RANDOM_ORDER
-			: ProcessingTaskQueue::SEQUENTIAL_ORDER
+			order, m_ptrMemoryBudget, m_ptrCostModel, m_curFilter
 		)
 	);
-	PageInfo page(m_ptrThumbSequence->selectionLeader());
-	for (; !page.isNull(); page = m_ptrThumbSequence->nextPage(page.id())) {
+	
+	// Images are read ahead and output files are written behind,
+	// so that the worker thread doesn't wait for the disk.
+	// They are read in the order the pages are going to be taken.
+	std::vector<PageInfo> prefetch_pages;
+	if (prefetch) {
+		if (order == ProcessingTaskQueue::LARGEST_FIRST_ORDER) {
+			prefetch_pages = orderByCost(pages);
+		} else {
+			prefetch_pages = pages;
+		}
+	}
+	m_ptrBatchPrefetcher.reset(
+		new ImagePrefetcher(
+			prefetch_pages, ImagePrefetcher::DEFAULT_MAX_AHEAD, m_ptrMemoryBudget
+		)
+	);
+	if (m_curFilter >= m_ptrStages->outputFilterIdx()) {
+		m_ptrBatchWriteBehind.reset(
+			new WriteBehindQueue(
+				m_ptrMemoryBudget,
+				boost::bind(&MainWindow::postBatchWriteDone, this)
+			)
+		);
+	}
+	
+	BOOST_FOREACH(PageInfo const& p, pages) {
 		m_ptrBatchQueue->addProcessingTask(
-			page, createCompositeTask(page, m_curFilter, /*batch=*/true, m_debug)
+			p, createCompositeTask(p, m_curFilter, BackgroundTask::BATCH, m_debug)
 		);
 	}
 
@@ -1086,20 +1194,20 @@ MainWindow::startBatchProcessing()
 	filterList->setBatchProcessingInProgress(true);
 	filterList->setEnabled(false);
 
-	BackgroundTaskPtr const task(m_ptrBatchQueue->takeForProcessing());
-	if (task) {
-		m_ptrWorkerThread->performTask(task);
-	} else {
+	resumeBatchProcessing();
+	if (m_ptrBatchQueue->numBeingProcessed() == 0 && !m_ptrDistributedBatch.get()) {
 		stopBatchProcessing();
+		return false;
 	}
 
-	page = m_ptrBatchQueue->selectedPage();
+	PageInfo const page(m_ptrBatchQueue->selectedPage());
 	if (!page.isNull()) {
 		m_ptrThumbSequence->setSelection(page.id());
 	}
 
 	// Display the batch processing screen.
 	updateMainArea();
+	return true;
 }
 
 void
@@ -1110,13 +1218,27 @@ MainWindow::stopBatchProcessing(MainAreaAction main_area)
 	}
 	
 	PageInfo const page(m_ptrBatchQueue->selectedPage());
-	if (!page.isNull()) {
+	if (!page.isNull() && !m_reviewingDuringBatch) {
 		m_ptrThumbSequence->setSelection(page.id());
 	}
 
 	m_ptrBatchQueue->cancelAndClear();
 	m_ptrBatchQueue.reset();
 	
+	m_ptrBatchPrefetcher->cancel();
+	m_ptrBatchPrefetcher.reset();
+	if (m_ptrBatchWriteBehind) {
+		// Output files must be on disk before they are looked at
+		// in interactive mode.
+		m_ptrBatchWriteBehind->flush();
+		m_ptrBatchWriteBehind.reset();
+	}
+	
+	leaveDistributedBatch();
+	
+	m_reviewingDuringBatch = false;
+	actionBatchProgress->setEnabled(false);
+	
 	filterList->setBatchProcessingInProgress(false);
 	filterList->setEnabled(true);
 
@@ -1127,16 +1249,111 @@ MainWindow::stopBatchProcessing(MainAreaAction main_area)
 		case CLEAR_MAIN_AREA:
 			removeImageWidget();
 			break;
+		case KEEP_MAIN_AREA:
+			// The page being reviewed stays as it is.
+			filterList->setBatchProcessingPossible(true);
+			break;
+	}
+}
+
+void
+MainWindow::showBatchProgress()
+{
+	if (!isBatchProcessingInProgress() || !m_reviewingDuringBatch) {
+		return;
+	}
+	
+	m_reviewingDuringBatch = false;
+	actionBatchProgress->setEnabled(false);
+	
+	m_ptrInteractiveQueue->cancelAndClear();
+	removeFilterOptionsWidget();
+	
+	PageInfo const page(m_ptrBatchQueue->selectedPage());
+	if (!page.isNull()) {
+		m_ptrThumbSequence->setSelection(page.id());
+	}
+	
+	updateMainArea();
+	resumeBatchProcessing();
+}
+
+/**
+ * \brief Starts batch processing that other processes can take part in.
+ *
+ * The pages go into a BatchWorkQueue next to the project file.  Other
+ * instances join with the --batch-node command line option, while this
+ * one processes pages too and merges everyone's results at the end.
+ */
+void
+MainWindow::startDistributedBatchProcessing()
+{
+	if (isBatchProcessingInProgress() || !isProjectLoaded()) {
+		return;
+	}
+	
+	if (m_projectFile.isEmpty()) {
+		QMessageBox::warning(
+			this, tr("Error"),
+			tr("The project has to be saved before it can be processed by several computers.")
+		);
+		return;
+	}
+	
+	// Other nodes start from the project file, so it has to be up to date.
+	if (!saveProjectWithFeedback(m_projectFile)) {
+		return;
+	}
+	
+	std::vector<PageInfo> page_infos;
+	PageInfo page(m_ptrThumbSequence->selectionLeader());
+	for (; !page.isNull(); page = m_ptrThumbSequence->nextPage(page.id())) {
+		page_infos.push_back(page);
+	}
+	
+	// Pages are leased in this order, and with several nodes,
+	// the expensive ones had better not be left for the end.
+	std::vector<PageInfo> const sorted_infos(orderByCost(page_infos));
+	std::vector<PageId> pages;
+	BOOST_FOREACH(PageInfo const& p, sorted_infos) {
+		pages.push_back(p.id());
+	}
+	
+	if (!BatchWorkQueue::create(m_projectFile, m_curFilter, pages)) {
+		QMessageBox::warning(
+			this, tr("Error"),
+			tr("Unable to create the work queue next to the project file.")
+		);
+		return;
+	}
+	
+	m_distributedCoordinator = true;
+	joinDistributedBatch();
+	if (!m_ptrDistributedBatch.get()) {
+		m_distributedCoordinator = false;
 	}
 }
 
 void
 MainWindow::filterResult(BackgroundTaskPtr const& task, FilterResultPtr const& result)
 {
+	if (task->type() == BackgroundTask::SPECULATIVE) {
+		speculativeResult(task, result);
+		return;
+	}
+
 	// Cancelled or not, we must mark it as finished.
 	m_ptrInteractiveQueue->processingFinished(task);
+	PageId batch_page;
 	if (m_ptrBatchQueue.get()) {
-		m_ptrBatchQueue->processingFinished(task);
+		batch_page = m_ptrBatchQueue->processingFinished(task);
+	}
+	
+	if (m_debug && task->measuredCancellationLatency() >= 0) {
+		qDebug() << "Task cancellation latency:"
+			<< task->measuredCancellationLatency() << "ms, measured time:"
+			<< task->measuredTime() << "ms, peak memory:"
+			<< task->measuredPeakMemory() << "bytes";
 	}
 
 	if (task->isCancelled()) {
@@ -1161,16 +1378,37 @@ MainWindow::filterResult(BackgroundTaskPtr const& task, FilterResultPtr const& r
 	// for instance because thumbnail invalidation is done from here.
 	result->updateUI(this);
 	
-	if (isBatchProcessingInProgress()) {
+	if (!isBatchProcessingInProgress()) {
+		// The worker thread is idle now.
+		speculateNeighbours();
+	} else if (m_ptrDistributedBatch.get()) {
+		if (!batch_page.isNull()) {
+			distributedPageProcessed(batch_page);
+		}
+		
+		resumeBatchProcessing();
+		if (m_ptrBatchQueue->allProcessed()) {
+			// Other nodes may still be busy, or may die and leave
+			// their pages to us.
+			pollDistributedBatch();
+			return;
+		}
+		
+		PageInfo const page(m_ptrBatchQueue->selectedPage());
+		if (!page.isNull() && !m_reviewingDuringBatch) {
+			m_ptrThumbSequence->setSelection(page.id());
+		}
+	} else {
 		if (m_ptrBatchQueue->allProcessed()) {
-			stopBatchProcessing();
+			bool const reviewing = m_reviewingDuringBatch;
+			stopBatchProcessing(reviewing ? KEEP_MAIN_AREA : UPDATE_MAIN_AREA);
 			
 			QApplication::alert(this); // Flash the taskbar entry.
 			if (m_checkBeepWhenFinished()) {
 				QApplication::beep();
 			}
 
-			if (m_selectedPage.get(getCurrentView()) == m_ptrThumbSequence->lastPage().id()) {
+			if (!reviewing && m_selectedPage.get(getCurrentView()) == m_ptrThumbSequence->lastPage().id()) {
 				// If batch processing finished at the last page, jump to the first one.	
 				goFirstPage();
 			}
@@ -1178,22 +1416,38 @@ MainWindow::filterResult(BackgroundTaskPtr const& task, FilterResultPtr const& r
 			return;
 		}
 
-		BackgroundTaskPtr const task(m_ptrBatchQueue->takeForProcessing());
-		if (task) {
-			m_ptrWorkerThread->performTask(task);
-		}
+		resumeBatchProcessing();
 
 		PageInfo const page(m_ptrBatchQueue->selectedPage());
-		if (!page.isNull()) {
+		if (!page.isNull() && !m_reviewingDuringBatch) {
 			m_ptrThumbSequence->setSelection(page.id());
 		}
 	}
 }
 
+void
+MainWindow::filterPreview(BackgroundTaskPtr const& task, FilterResultPtr const& result)
+{
+	// A cancelled task may belong to a page the user has already left.
+	if (task->isCancelled() || isBatchProcessingInForeground()) {
+		return;
+	}
+	
+	if (result->filter() != m_ptrStages->filterAt(m_curFilter)) {
+		return;
+	}
+	
+	// The final result from the same task will replace it.
+	result->updateUI(this);
+}
+
 void
 MainWindow::debugToggled(bool const enabled)
 {
 	m_debug = enabled;
+	
+	// Speculative results carry debug images, or lack them.
+	discardSpeculation();
 }
 
 void
@@ -1330,6 +1584,13 @@ MainWindow::openProject(QString const& project_file)
 	context->proceed();
 }
 
+void
+MainWindow::openProjectAsBatchNode(QString const& project_file)
+{
+	m_joinBatchAfterOpening = true;
+	openProject(project_file);
+}
+
 void
 MainWindow::projectOpened(ProjectOpeningContext* context)
 {
@@ -1349,6 +1610,11 @@ MainWindow::projectOpened(ProjectOpeningContext* context)
 		context->projectReader()->outputDirectory(),
 		context->projectFile(), context->projectReader()
 	);
+	
+	if (m_joinBatchAfterOpening) {
+		m_joinBatchAfterOpening = false;
+		joinDistributedBatch();
+	}
 }
 
 void
@@ -1406,6 +1672,7 @@ MainWindow::updateProjectActions()
 	bool const loaded = isProjectLoaded();
 	actionSaveProject->setEnabled(loaded);
 	actionSaveProjectAs->setEnabled(loaded);
+	actionDistributedBatch->setEnabled(loaded);
 }
 
 bool
@@ -1414,6 +1681,326 @@ MainWindow::isBatchProcessingInProgress() const
 	return m_ptrBatchQueue.get() != 0;
 }
 
+/**
+ * \brief Returns true if batch processing takes place and the user
+ *        is watching its progress, rather than reviewing pages.
+ */
+bool
+MainWindow::isBatchProcessingInForeground() const
+{
+	return isBatchProcessingInProgress() && !m_reviewingDuringBatch;
+}
+
+/**
+ * \brief Gets the batch task out of the way of an interactive one.
+ *
+ * The batch task is cancelled and its page goes back into the batch
+ * queue, to be processed again by resumeBatchProcessing().
+ */
+void
+MainWindow::preemptBatchProcessing()
+{
+	m_ptrBatchQueue->preemptProcessing(
+		boost::bind(
+			&MainWindow::createCompositeTask, this,
+			_1, m_curFilter, BackgroundTask::BATCH, false
+		)
+	);
+}
+
+/**
+ * \brief Keeps the worker thread's batch pipeline filled.
+ *
+ * Interactive tasks take precedence, so nothing is started while
+ * one of them is pending.
+ */
+void
+MainWindow::resumeBatchProcessing()
+{
+	if (!isBatchProcessingInProgress() || !m_ptrInteractiveQueue->allProcessed()) {
+		return;
+	}
+	
+	int const depth = m_ptrWorkerThread->batchPipelineDepth();
+	if (m_ptrDistributedBatch.get()) {
+		leaseDistributedWork(depth);
+	}
+	
+	while (m_ptrBatchQueue->numBeingProcessed() < depth) {
+		BackgroundTaskPtr const task(m_ptrBatchQueue->takeForProcessing());
+		if (!task) {
+			// Either nothing left, or it doesn't fit into the memory budget.
+			break;
+		}
+		m_ptrWorkerThread->performTask(task);
+	}
+}
+
+void
+MainWindow::joinDistributedBatch()
+{
+	if (isBatchProcessingInProgress() || m_projectFile.isEmpty()) {
+		return;
+	}
+	
+	std::auto_ptr<BatchWorkQueue> queue(new BatchWorkQueue(m_projectFile));
+	if (!queue->isValid() || queue->filterIdx() >= m_ptrStages->count()) {
+		QMessageBox::warning(
+			this, tr("Error"),
+			tr("There is no distributed batch processing to join.")
+		);
+		return;
+	}
+	
+	if (queue->filterIdx() != m_curFilter) {
+		// This propagates settings down the stages, just like it was
+		// done by the node that started the batch processing.
+		filterList->selectRow(queue->filterIdx());
+	}
+	
+	std::map<PageId, int> indexes;
+	int const num_pages = queue->pages().size();
+	for (int i = 0; i < num_pages; ++i) {
+		indexes[queue->pages()[i]] = i;
+	}
+	
+	m_distributedPageInfos.assign(num_pages, PageInfo());
+	PageSequence const sequence(m_ptrPages->toPageSequence(getCurrentView()));
+	size_t const sequence_size = sequence.numPages();
+	for (size_t i = 0; i < sequence_size; ++i) {
+		PageInfo const& page = sequence.pageAt(i);
+		std::map<PageId, int>::const_iterator const it(indexes.find(page.id()));
+		if (it != indexes.end()) {
+			m_distributedPageInfos[it->second] = page;
+		}
+	}
+	
+	m_ptrDistributedBatch = queue;
+	m_distributedTimerId = startTimer(m_ptrDistributedBatch->heartbeatInterval());
+	
+	// We don't know in advance which pages we are going to get,
+	// so there is nothing to prefetch.
+	beginBatchProcessing(std::vector<PageInfo>(), false);
+}
+
+/**
+ * \brief Leases pages from the distributed queue, up to \p depth of them.
+ */
+void
+MainWindow::leaseDistributedWork(int const depth)
+{
+	while ((int)m_distributedLeases.size() < depth) {
+		int const idx = m_ptrDistributedBatch->lease();
+		if (idx < 0) {
+			break;
+		}
+		
+		PageInfo const& page = m_distributedPageInfos[idx];
+		if (page.isNull()) {
+			// Not in our copy of the project, so nobody can process it.
+			m_ptrDistributedBatch->complete(idx, QByteArray());
+			continue;
+		}
+		
+		m_distributedLeases[page.id()] = idx;
+		m_ptrBatchQueue->addProcessingTask(
+			page, createCompositeTask(page, m_curFilter, BackgroundTask::BATCH, m_debug)
+		);
+	}
+}
+
+/**
+ * \brief Stores the settings of a processed page as its result.
+ */
+void
+MainWindow::distributedPageProcessed(PageId const& page_id)
+{
+	std::map<PageId, int>::iterator const it(m_distributedLeases.find(page_id));
+	if (it == m_distributedLeases.end()) {
+		return;
+	}
+	
+	int const idx = it->second;
+	m_distributedLeases.erase(it);
+	
+	// Once the page is complete, other nodes may finish the batch and
+	// the output files are expected to be there.  Rather than waiting
+	// for them here, we complete the page from batchWriteDone().
+	if (m_ptrBatchWriteBehind && m_ptrBatchWriteBehind->isPending(page_id)) {
+		m_distributedUnwritten[page_id] = idx;
+		return;
+	}
+	
+	completeDistributedPage(page_id, idx);
+}
+
+void
+MainWindow::completeDistributedPage(PageId const& page_id, int const idx)
+{
+	std::set<PageId> pages;
+	pages.insert(page_id);
+	ProjectWriter const writer(m_ptrPages, pages, m_outFileNameGen);
+	m_ptrDistributedBatch->complete(
+		idx, writer.toDocument(m_ptrStages->filters()).toByteArray(2)
+	);
+}
+
+/**
+ * \brief Called on the writing thread after a batch write job is done.
+ */
+void
+MainWindow::postBatchWriteDone()
+{
+	QMetaObject::invokeMethod(this, "batchWriteDone", Qt::QueuedConnection);
+}
+
+/**
+ * \brief Completes the processed pages whose output files are written.
+ */
+void
+MainWindow::batchWriteDone()
+{
+	if (m_distributedUnwritten.empty()) {
+		return;
+	}
+	
+	std::map<PageId, int>::iterator it(m_distributedUnwritten.begin());
+	while (it != m_distributedUnwritten.end()) {
+		if (m_ptrBatchWriteBehind && m_ptrBatchWriteBehind->isPending(it->first)) {
+			++it;
+		} else {
+			completeDistributedPage(it->first, it->second);
+			m_distributedUnwritten.erase(it++);
+		}
+	}
+	
+	if (m_ptrBatchQueue->allProcessed()) {
+		// That may have been the last page.
+		pollDistributedBatch();
+	}
+}
+
+/**
+ * \brief Called periodically and whenever we run out of leased pages.
+ *
+ * Keeps our leases alive, takes over pages left by dead nodes and
+ * finishes the batch processing once every page has its result.
+ */
+void
+MainWindow::pollDistributedBatch()
+{
+	if (!m_ptrDistributedBatch.get()) {
+		return;
+	}
+	
+	bool done = !m_ptrDistributedBatch->exists();
+	if (!done) {
+		m_ptrDistributedBatch->heartbeat();
+		resumeBatchProcessing();
+		done = m_ptrBatchQueue->allProcessed() && m_ptrDistributedBatch->isFinished();
+	}
+	if (!done) {
+		return;
+	}
+	
+	bool const coordinator = m_distributedCoordinator;
+	bool const reviewing = m_reviewingDuringBatch;
+	stopBatchProcessing(reviewing ? KEEP_MAIN_AREA : UPDATE_MAIN_AREA);
+	
+	if (!coordinator) {
+		// Our results are with the coordinator by now.
+		closeProjectWithoutSaving();
+		m_closing = true;
+		close();
+		return;
+	}
+	
+	QApplication::alert(this); // Flash the taskbar entry.
+	if (m_checkBeepWhenFinished()) {
+		QApplication::beep();
+	}
+}
+
+/**
+ * \brief Gives up the leases and, on the coordinator, merges the results.
+ *
+ * Called from stopBatchProcessing(), so results obtained so far are kept
+ * even if batch processing was stopped before it finished.
+ */
+void
+MainWindow::leaveDistributedBatch()
+{
+	if (!m_ptrDistributedBatch.get()) {
+		return;
+	}
+	
+	killTimer(m_distributedTimerId);
+	m_distributedTimerId = 0;
+	
+	// stopBatchProcessing() has flushed the write-behind queue.
+	typedef std::map<PageId, int>::value_type Unwritten;
+	BOOST_FOREACH(Unwritten const& ent, m_distributedUnwritten) {
+		completeDistributedPage(ent.first, ent.second);
+	}
+	m_distributedUnwritten.clear();
+	
+	std::auto_ptr<BatchWorkQueue> const queue(m_ptrDistributedBatch);
+	queue->releaseAll();
+	m_distributedLeases.clear();
+	m_distributedPageInfos.clear();
+	
+	if (m_distributedCoordinator) {
+		m_distributedCoordinator = false;
+		if (queue->exists()) {
+			mergeDistributedResults(*queue);
+			queue->remove();
+		}
+	}
+}
+
+bool
+MainWindow::mergeDistributedResults(BatchWorkQueue const& queue)
+{
+	ProjectWriter const writer(m_ptrPages, m_selectedPage, m_outFileNameGen);
+	ProjectMerger merger(writer.toDocument(m_ptrStages->filters()));
+	
+	bool merged = false;
+	int const num_pages = queue.pages().size();
+	for (int i = 0; i < num_pages; ++i) {
+		QDomDocument doc;
+		if (doc.setContent(queue.result(i)) && merger.merge(doc)) {
+			merged = true;
+		}
+	}
+	if (!merged) {
+		return false;
+	}
+	
+	ProjectReader const reader(merger.document());
+	if (!reader.success()) {
+		return false;
+	}
+	
+	reader.readFilterSettings(m_ptrStages->filters());
+	
+	std::map<ImageId, int> const& sub_pages = merger.changedSubPageCounts();
+	if (sub_pages.empty()) {
+		invalidateAllThumbnails();
+		return true;
+	}
+	
+	// Some nodes have split pages.
+	typedef std::map<ImageId, int>::value_type KV;
+	BOOST_FOREACH(KV const& kv, sub_pages) {
+		m_ptrPages->setLayoutTypeFor(
+			kv.first, kv.second > 1 ? ProjectPages::TWO_PAGE_LAYOUT
+			: ProjectPages::ONE_PAGE_LAYOUT
+		);
+	}
+	resetThumbSequence(currentPageOrderProvider());
+	return true;
+}
+
 bool
 MainWindow::isProjectLoaded() const
 {
@@ -1462,7 +2049,7 @@ MainWindow::updateMainArea()
 	if (m_ptrPages->numImages() == 0) {
 		filterList->setBatchProcessingPossible(false);
 		showNewOpenProjectPanel();
-	} else if (isBatchProcessingInProgress()) {
+	} else if (isBatchProcessingInForeground()) {
 		filterList->setBatchProcessingPossible(false);
 		setImageWidget(m_ptrBatchProcessingWidget.get(), KEEP_OWNERSHIP);
 	} else {
@@ -1473,7 +2060,7 @@ MainWindow::updateMainArea()
 			removeFilterOptionsWidget();
 		} else {
 			// Note that loadPageInteractive may reset it to false.
-			filterList->setBatchProcessingPossible(true);
+			filterList->setBatchProcessingPossible(!isBatchProcessingInProgress());
 			loadPageInteractive(page);
 		}
 	}
@@ -1490,7 +2077,7 @@ MainWindow::checkReadyForOutput(PageId const* ignore) const
 void
 MainWindow::loadPageInteractive(PageInfo const& page)
 {
-	assert(!isBatchProcessingInProgress());
+	assert(!isBatchProcessingInForeground());
 	
 	m_ptrInteractiveQueue->cancelAndClear();
 	
@@ -1513,7 +2100,7 @@ MainWindow::loadPageInteractive(PageInfo const& page)
 		return;
 	}
 	
-	if (!isBatchProcessingInProgress()) {
+	if (!isBatchProcessingInForeground()) {
 		if (m_pImageFrameLayout->indexOf(m_ptrProcessingIndicationWidget.get()) != -1) {
 			m_ptrProcessingIndicationWidget->processingRestartedEffect();
 		}
@@ -1523,13 +2110,150 @@ MainWindow::loadPageInteractive(PageInfo const& page)
 	
 	assert(m_ptrThumbnailCache.get());
 
+	FilterResultPtr const ready(
+		m_ptrSpeculativeResults->take(page.id(), m_curFilter)
+	);
+	if (ready) {
+		// The page was processed while the user was looking at another one.
+		ready->updateUI(this);
+		speculateNeighbours();
+		return;
+	}
+	
+	if (m_ptrSpeculativeTask) {
+		if (m_speculativePage == page.id() && m_speculativeFilter == m_curFilter) {
+			// It's being processed already.  filterResult() will display it.
+			return;
+		}
+		
+		// Get it out of the way of the interactive task.
+		m_ptrSpeculativeTask->cancel();
+		m_ptrSpeculativeTask.reset();
+	}
+
+	if (isBatchProcessingInProgress()) {
+		// The user is reviewing pages while batch processing goes on.
+		// resumeBatchProcessing() is called once this task is done.
+		preemptBatchProcessing();
+	}
+
 	m_ptrInteractiveQueue->cancelAndClear();
 	m_ptrInteractiveQueue->addProcessingTask(
-		page, createCompositeTask(page, m_curFilter, /*batch=*/false, m_debug)
+		page, createCompositeTask(page, m_curFilter, BackgroundTask::INTERACTIVE, m_debug)
 	);
 	m_ptrWorkerThread->performTask(m_ptrInteractiveQueue->takeForProcessing());
 }
 
+/**
+ * \brief Processes the pages next to the current one, if the worker thread is idle.
+ *
+ * The results are kept until the user switches to one of those pages,
+ * which then appears without waiting for it to be processed.
+ */
+void
+MainWindow::speculateNeighbours()
+{
+	if (!m_speculationEnabled || isBatchProcessingInProgress() || !isProjectLoaded()) {
+		return;
+	}
+	
+	if (m_ptrSpeculativeTask || !m_ptrInteractiveQueue->allProcessed()) {
+		return;
+	}
+	
+	PageId const leader(m_ptrThumbSequence->selectionLeader().id());
+	if (leader.isNull()) {
+		return;
+	}
+	
+	// The page the user is more likely to go to goes first.
+	PageInfo const candidates[] = {
+		m_ptrThumbSequence->nextPage(leader),
+		m_ptrThumbSequence->prevPage(leader)
+	};
+	
+	std::set<PageId> neighbours;
+	BOOST_FOREACH(PageInfo const& page, candidates) {
+		if (!page.isNull()) {
+			neighbours.insert(page.id());
+		}
+	}
+	m_ptrSpeculativeResults->retainOnly(neighbours);
+	
+	BOOST_FOREACH(PageInfo const& page, candidates) {
+		if (page.isNull()) {
+			continue;
+		}
+		if (m_ptrSpeculativeResults->contains(page.id(), m_curFilter)) {
+			continue;
+		}
+		if (isOutputFilter() && !checkReadyForOutput(&page.id())) {
+			continue;
+		}
+		
+		m_speculativePage = page.id();
+		m_speculativeFilter = m_curFilter;
+		m_ptrSpeculativeTask = createCompositeTask(
+			page, m_curFilter, BackgroundTask::SPECULATIVE, m_debug
+		);
+		m_ptrWorkerThread->performTask(m_ptrSpeculativeTask);
+		return;
+	}
+}
+
+void
+MainWindow::speculativeResult(BackgroundTaskPtr const& task, FilterResultPtr const& result)
+{
+	if (task != m_ptrSpeculativeTask) {
+		// Cancelled and forgotten.
+		return;
+	}
+	
+	m_ptrSpeculativeTask.reset();
+	
+	if (task->isCancelled() || !result->filter() ||
+			m_speculativeFilter != m_curFilter ||
+			result->filter() != m_ptrStages->filterAt(m_curFilter)) {
+		// Errors are left for the interactive processing to report.
+		speculateNeighbours();
+		return;
+	}
+	
+	if (!isBatchProcessingInProgress() &&
+			m_ptrThumbSequence->selectionLeader().id() == m_speculativePage) {
+		// The user switched to this page while it was being processed.
+		result->updateUI(this);
+	} else {
+		m_ptrSpeculativeResults->put(m_speculativePage, m_speculativeFilter, result);
+		
+		// Processing may have updated this page's settings.  Not going
+		// through invalidateThumbnail(), as that would drop the result.
+		m_ptrThumbSequence->invalidateThumbnail(m_speculativePage);
+	}
+	
+	speculateNeighbours();
+}
+
+void
+MainWindow::discardSpeculation()
+{
+	if (m_ptrSpeculativeTask) {
+		m_ptrSpeculativeTask->cancel();
+		m_ptrSpeculativeTask.reset();
+	}
+	m_ptrSpeculativeResults->clear();
+}
+
+void
+MainWindow::forgetSpeculation(PageId const& page_id)
+{
+	if (m_ptrSpeculativeTask && m_speculativePage == page_id) {
+		m_ptrSpeculativeTask->cancel();
+		m_ptrSpeculativeTask.reset();
+	}
+	m_ptrSpeculativeResults->remove(page_id);
+}
+
 void
 MainWindow::updateWindowTitle()
 {
@@ -1555,6 +2279,12 @@ MainWindow::closeProjectInteractive()
 		return true;
 	}
 	
+	if (m_ptrDistributedBatch.get()) {
+		// Results from other nodes have to be merged before
+		// we find out whether the project has changed.
+		stopBatchProcessing(CLEAR_MAIN_AREA);
+	}
+	
 	if (m_projectFile.isEmpty()) {
 		switch (promptProjectSave()) {
 			case SAVE:
@@ -1797,6 +2527,7 @@ MainWindow::removeFromProject(std::set<PageId> const& pages)
 	if (m_ptrBatchQueue.get()) {
 		m_ptrBatchQueue->cancelAndRemove(pages);
 	}
+	discardSpeculation();
 
 	m_ptrPages->removePages(pages);
 	m_ptrThumbSequence->removePages(pages);
@@ -1840,8 +2571,12 @@ MainWindow::eraseOutputFiles(std::set<PageId> const& pages)
 
 BackgroundTaskPtr
 MainWindow::createCompositeTask(
-	PageInfo const& page, int const last_filter_idx, bool const batch, bool debug)
+	PageInfo const& page, int const last_filter_idx,
+	BackgroundTask::Type const type, bool debug)
 {
+	// Speculative tasks produce interactive results.
+	bool const batch = (type == BackgroundTask::BATCH);
+
 	IntrusivePtr<fix_orientation::Task> fix_orientation_task;
 	IntrusivePtr<page_split::Task> page_split_task;
 	IntrusivePtr<deskew::Task> deskew_task;
@@ -1855,7 +2590,8 @@ MainWindow::createCompositeTask(
 
 	if (last_filter_idx >= m_ptrStages->outputFilterIdx()) {
 		output_task = m_ptrStages->outputFilter()->createTask(
-			page.id(), m_ptrThumbnailCache, m_outFileNameGen, batch, debug
+			page.id(), m_ptrThumbnailCache, m_ptrBatchWriteBehind,
+			m_outFileNameGen, batch, debug
 		);
 		debug = false;
 	}
@@ -1891,12 +2627,82 @@ MainWindow::createCompositeTask(
 	}
 	assert(fix_orientation_task);
 	
-	return BackgroundTaskPtr(
+	BackgroundTaskPtr const task(
 		new LoadFileTask(
-			batch ? BackgroundTask::BATCH : BackgroundTask::INTERACTIVE,
-			page, m_ptrThumbnailCache, m_ptrPages, fix_orientation_task
+			type,
+			page, m_ptrThumbnailCache, m_ptrPages, fix_orientation_task,
+			batch ? m_ptrBatchPrefetcher : IntrusivePtr<ImagePrefetcher>()
 		)
 	);
+
+	// The original image, possibly as 32 bits per pixel, plus rotated
+	// and downscaled copies made by the geometric stages.
+	QSize const orig_size(page.metadata().size());
+	qint64 estimated_memory = qint64(orig_size.width()) * orig_size.height() * 4 * 2;
+	if (output_task) {
+		estimated_memory += output_task->estimatePeakMemory(page.metadata());
+	}
+	task->setEstimatedPeakMemory(estimated_memory);
+	task->setEstimatedCost(estimateProcessingCost(page, last_filter_idx));
+
+	return task;
+}
+
+/**
+ * \brief Estimates the cost of processing a page up to a given filter.
+ *
+ * The result is in the units of output::Task::estimateCost().
+ * \see ProcessingCostModel
+ */
+double
+MainWindow::estimateProcessingCost(PageInfo const& page, int const last_filter_idx)
+{
+	// Loading the image and the geometric stages are roughly
+	// proportional to the size of the original image.
+	QSize const orig_size(page.metadata().size());
+	double cost = double(orig_size.width()) * orig_size.height();
+
+	if (last_filter_idx >= m_ptrStages->outputFilterIdx()) {
+		IntrusivePtr<output::Task> const output_task(
+			m_ptrStages->outputFilter()->createTask(
+				page.id(), m_ptrThumbnailCache, IntrusivePtr<WriteBehindQueue>(),
+				m_outFileNameGen, /*batch=*/false, /*debug=*/false
+			)
+		);
+		cost += output_task->estimateCost(page.metadata());
+	}
+
+	return cost;
+}
+
+/**
+ * \brief Sorts pages by decreasing expected cost of processing them
+ *        up to the current filter.
+ *
+ * That's the order ProcessingTaskQueue::LARGEST_FIRST_ORDER takes them in.
+ */
+std::vector<PageInfo>
+MainWindow::orderByCost(std::vector<PageInfo> const& pages)
+{
+	// Negated costs put the most expensive pages first, while
+	// indexes keep equally expensive pages in page order.
+	std::vector<std::pair<double, size_t> > keys;
+	keys.reserve(pages.size());
+	for (size_t i = 0; i < pages.size(); ++i) {
+		double const cost = m_ptrCostModel->costFor(
+			pages[i].id(), m_curFilter,
+			estimateProcessingCost(pages[i], m_curFilter)
+		);
+		keys.push_back(std::make_pair(-cost, i));
+	}
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<PageInfo> sorted;
+	sorted.reserve(pages.size());
+	for (size_t i = 0; i < keys.size(); ++i) {
+		sorted.push_back(pages[keys[i].second]);
+	}
+	return sorted;
 }
 
 IntrusivePtr<CompositeCacheDrivenTask>
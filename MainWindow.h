@@ -28,6 +28,7 @@
 #include "ThumbnailSequence.h"
 #include "OutputFileNameGenerator.h"
 #include "PageId.h"
+#include "PageInfo.h"
 #include "PageView.h"
 #include "PageRange.h"
 #include "SelectedPage.h"
@@ -41,6 +42,7 @@
 #include <memory>
 #include <vector>
 #include <set>
+#include <map>
 
 class AbstractFilter;
 class ThumbnailPixmapCache;
@@ -51,7 +53,6 @@ class PageOrderProvider;
 class FilterOptionsWidget;
 class ProcessingIndicationWidget;
 class ImageInfo;
-class PageInfo;
 class QStackedLayout;
 class WorkerThread;
 class ProjectReader;
@@ -63,6 +64,12 @@ class ProjectOpeningContext;
 class CompositeCacheDrivenTask;
 class TabbedDebugImages;
 class ProcessingTaskQueue;
+class MemoryBudget;
+class ProcessingCostModel;
+class ImagePrefetcher;
+class WriteBehindQueue;
+class SpeculativeResultCache;
+class BatchWorkQueue;
 class QLineF;
 class QRectF;
 class QLayout;
@@ -90,8 +97,17 @@ protected:
 	virtual void timerEvent(QTimerEvent* event);
 public slots:
 	void openProject(QString const& project_file);
+	
+	/**
+	 * \brief Opens a project and joins its distributed batch processing.
+	 *
+	 * Once there is nothing left to process, the window closes without
+	 * saving the project, as the results go to the node that started
+	 * the distributed batch processing.
+	 */
+	void openProjectAsBatchNode(QString const& project_file);
 private:
-	enum MainAreaAction { UPDATE_MAIN_AREA, CLEAR_MAIN_AREA };
+	enum MainAreaAction { UPDATE_MAIN_AREA, CLEAR_MAIN_AREA, KEEP_MAIN_AREA };
 private slots:
 	void goFirstPage();
 
@@ -126,6 +142,10 @@ private slots:
 	
 	void stopBatchProcessing(MainAreaAction main_area = UPDATE_MAIN_AREA);
 	
+	void showBatchProgress();
+	
+	void startDistributedBatchProcessing();
+	
 	void invalidateThumbnail(PageId const& page_id);
 
 	void invalidateThumbnail(PageInfo const& page_info);
@@ -136,6 +156,12 @@ private slots:
 		BackgroundTaskPtr const& task,
 		FilterResultPtr const& result);
 	
+	void filterPreview(
+		BackgroundTaskPtr const& task,
+		FilterResultPtr const& result);
+	
+	void batchWriteDone();
+	
 	void debugToggled(bool enabled);
 	
 	void saveProjectTriggered();
@@ -199,6 +225,30 @@ private:
 	void updateProjectActions();
 	
 	bool isBatchProcessingInProgress() const;
+	
+	bool isBatchProcessingInForeground() const;
+	
+	void preemptBatchProcessing();
+	
+	void resumeBatchProcessing();
+	
+	bool beginBatchProcessing(std::vector<PageInfo> const& pages, bool prefetch);
+	
+	void joinDistributedBatch();
+	
+	void leaseDistributedWork(int depth);
+	
+	void distributedPageProcessed(PageId const& page_id);
+	
+	void completeDistributedPage(PageId const& page_id, int idx);
+	
+	void postBatchWriteDone();
+	
+	void pollDistributedBatch();
+	
+	void leaveDistributedBatch();
+	
+	bool mergeDistributedResults(BatchWorkQueue const& queue);
 
 	bool isProjectLoaded() const;
 	
@@ -220,6 +270,14 @@ private:
 	
 	void loadPageInteractive(PageInfo const& page);
 	
+	void speculateNeighbours();
+	
+	void speculativeResult(BackgroundTaskPtr const& task, FilterResultPtr const& result);
+	
+	void discardSpeculation();
+	
+	void forgetSpeculation(PageId const& page_id);
+	
 	void updateWindowTitle();
 	
 	bool closeProjectInteractive();
@@ -241,7 +299,12 @@ private:
 	void eraseOutputFiles(std::set<PageId> const& pages);
 	
 	BackgroundTaskPtr createCompositeTask(
-		PageInfo const& page, int last_filter_idx, bool batch, bool debug);
+		PageInfo const& page, int last_filter_idx,
+		BackgroundTask::Type type, bool debug);
+
+	double estimateProcessingCost(PageInfo const& page, int last_filter_idx);
+
+	std::vector<PageInfo> orderByCost(std::vector<PageInfo> const& pages);
 	
 	IntrusivePtr<CompositeCacheDrivenTask>
 	createCompositeCacheDrivenTask(int last_filter_idx);
@@ -257,9 +320,25 @@ private:
 	OutputFileNameGenerator m_outFileNameGen;
 	IntrusivePtr<ThumbnailPixmapCache> m_ptrThumbnailCache;
 	std::auto_ptr<ThumbnailSequence> m_ptrThumbSequence;
+	IntrusivePtr<MemoryBudget> m_ptrMemoryBudget;
+	IntrusivePtr<ProcessingCostModel> m_ptrCostModel;
+	IntrusivePtr<ImagePrefetcher> m_ptrBatchPrefetcher;
+	IntrusivePtr<WriteBehindQueue> m_ptrBatchWriteBehind;
 	std::auto_ptr<WorkerThread> m_ptrWorkerThread;
 	std::auto_ptr<ProcessingTaskQueue> m_ptrBatchQueue;
 	std::auto_ptr<ProcessingTaskQueue> m_ptrInteractiveQueue;
+	std::auto_ptr<SpeculativeResultCache> m_ptrSpeculativeResults;
+	BackgroundTaskPtr m_ptrSpeculativeTask;
+	PageId m_speculativePage;
+	int m_speculativeFilter;
+	bool m_speculationEnabled;
+	std::auto_ptr<BatchWorkQueue> m_ptrDistributedBatch;
+	std::vector<PageInfo> m_distributedPageInfos;
+	std::map<PageId, int> m_distributedLeases;
+	std::map<PageId, int> m_distributedUnwritten;
+	int m_distributedTimerId;
+	bool m_distributedCoordinator;
+	bool m_joinBatchAfterOpening;
 	QStackedLayout* m_pImageFrameLayout;
 	QStackedLayout* m_pOptionsFrameLayout;
 	QPointer<FilterOptionsWidget> m_ptrOptionsWidget;
@@ -277,6 +356,7 @@ private:
 	int m_ignorePageOrderingChanges;
 	bool m_debug;
 	bool m_closing;
+	bool m_reviewingDuringBatch;
 	bool m_beepOnBatchProcessingCompletion;
 };
 
@@ -0,0 +1,242 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MemoryBudget.h"
+#include <QMutexLocker>
+#include <QSettings>
+#include <QString>
+#include <QFile>
+#include <boost/foreach.hpp>
+#include <algorithm>
+
+#if defined(Q_OS_LINUX)
+#include <QByteArray>
+#include <QList>
+#elif defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+qint64 const MemoryBudget::DEFAULT_LIMIT = qint64(1536) << 20;
+
+MemoryBudget::MemoryBudget(qint64 const limit)
+:	m_limit(limit),
+	m_reserved(0)
+{
+}
+
+qint64
+MemoryBudget::loadLimit(QString const& key, qint64 const dflt)
+{
+	QSettings settings;
+	bool ok = false;
+	qint64 const megabytes = settings.value(key).toLongLong(&ok);
+	if (!ok || megabytes <= 0) {
+		return dflt;
+	}
+	return megabytes << 20;
+}
+
+qint64
+MemoryBudget::reserved() const
+{
+	QMutexLocker const locker(&m_mutex);
+	return m_reserved;
+}
+
+bool
+MemoryBudget::tryReserve(qint64 const bytes, bool const force)
+{
+	QMutexLocker const locker(&m_mutex);
+
+	if (!force && m_reserved + bytes > m_limit) {
+		return false;
+	}
+
+	m_reserved += bytes;
+	return true;
+}
+
+void
+MemoryBudget::release(qint64 const bytes)
+{
+	QMutexLocker const locker(&m_mutex);
+
+	m_reserved -= bytes;
+	if (m_reserved < 0) {
+		m_reserved = 0;
+	}
+}
+
+qint64
+MemoryBudget::requirementFor(PageId const& page_id, qint64 const estimate) const
+{
+	QMutexLocker const locker(&m_mutex);
+
+	std::map<PageId, qint64>::const_iterator const it(m_recordedPeaks.find(page_id));
+	if (it == m_recordedPeaks.end()) {
+		return estimate;
+	}
+	return it->second;
+}
+
+void
+MemoryBudget::recordPeak(PageId const& page_id, qint64 const estimate, qint64 const actual)
+{
+	if (actual <= 0) {
+		// Not measured.
+		return;
+	}
+
+	QMutexLocker const locker(&m_mutex);
+	m_recordedPeaks[page_id] = actual;
+}
+
+qint64
+MemoryBudget::residentMemory()
+{
+#if defined(Q_OS_LINUX)
+	QFile file("/proc/self/status");
+	if (!file.open(QIODevice::ReadOnly)) {
+		return 0;
+	}
+	QList<QByteArray> const lines(file.readAll().split('\n'));
+	BOOST_FOREACH(QByteArray const& line, lines) {
+		if (line.startsWith("VmRSS:")) {
+			return line.mid(6).trimmed().split(' ').front().toLongLong() << 10;
+		}
+	}
+	return 0;
+#elif defined(Q_OS_WIN)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+	return counters.WorkingSetSize;
+#else
+	return 0;
+#endif
+}
+
+qint64
+MemoryBudget::peakResidentMemory()
+{
+#if defined(Q_OS_LINUX)
+	QFile file("/proc/self/status");
+	if (!file.open(QIODevice::ReadOnly)) {
+		return 0;
+	}
+	QList<QByteArray> const lines(file.readAll().split('\n'));
+	BOOST_FOREACH(QByteArray const& line, lines) {
+		if (line.startsWith("VmHWM:")) {
+			return line.mid(6).trimmed().split(' ').front().toLongLong() << 10;
+		}
+	}
+	return 0;
+#elif defined(Q_OS_WIN)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+	return counters.PeakWorkingSetSize;
+#else
+	return 0;
+#endif
+}
+
+void
+MemoryBudget::resetPeakResidentMemory()
+{
+#if defined(Q_OS_LINUX)
+	// Supported since Linux 4.0.  Older kernels will just
+	// make us report the peak since the process started.
+	QFile file("/proc/self/clear_refs");
+	if (file.open(QIODevice::WriteOnly)) {
+		file.write("5");
+	}
+#endif
+}
+
+
+/*========================= MemoryBudget::PeakMeter ========================*/
+
+QAtomicInt MemoryBudget::PeakMeter::m_sNumActive(0);
+QAtomicInt MemoryBudget::PeakMeter::m_sNumStarted(0);
+
+MemoryBudget::PeakMeter::PeakMeter()
+:	m_memoryBefore(0),
+	m_startSerial(m_sNumStarted.fetchAndAddOrdered(1) + 1),
+	m_alone(m_sNumActive.fetchAndAddOrdered(1) == 0),
+	m_finished(false)
+{
+	if (m_alone) {
+		// Resetting the peak would spoil the measurements of others.
+		resetPeakResidentMemory();
+		m_memoryBefore = residentMemory();
+	}
+}
+
+MemoryBudget::PeakMeter::~PeakMeter()
+{
+	finish();
+}
+
+qint64
+MemoryBudget::PeakMeter::finish()
+{
+	if (m_finished) {
+		return 0;
+	}
+	m_finished = true;
+
+	// Nobody else may have started since we did.
+	bool const alone = m_alone && m_sNumStarted.fetchAndAddOrdered(0) == m_startSerial;
+	qint64 peak = 0;
+	if (alone && m_memoryBefore > 0) {
+		peak = std::max<qint64>(peakResidentMemory() - m_memoryBefore, 0);
+	}
+
+	m_sNumActive.fetchAndAddOrdered(-1);
+	return peak;
+}
+
+
+/*============================ MemoryReservation ===========================*/
+
+MemoryReservation::MemoryReservation(
+	IntrusivePtr<MemoryBudget> const& budget, qint64 const bytes)
+:	m_ptrBudget(budget),
+	m_bytes(bytes)
+{
+}
+
+MemoryReservation::~MemoryReservation()
+{
+	release();
+}
+
+void
+MemoryReservation::release()
+{
+	QMutexLocker const locker(&m_mutex);
+
+	if (m_bytes != 0) {
+		m_ptrBudget->release(m_bytes);
+		m_bytes = 0;
+	}
+}
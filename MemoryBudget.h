@@ -0,0 +1,171 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEMORY_BUDGET_H_
+#define MEMORY_BUDGET_H_
+
+#include "NonCopyable.h"
+#include "RefCountable.h"
+#include "IntrusivePtr.h"
+#include "PageId.h"
+#include <QMutex>
+#include <QAtomicInt>
+#include <QtGlobal>
+#include <map>
+
+class QString;
+
+/**
+ * \brief Keeps track of memory reserved by tasks that are being processed.
+ *
+ * Before a task is started, its estimated peak memory usage is reserved
+ * from the budget.  A task that doesn't fit into what's left of the
+ * budget has to wait until other tasks release their reservations.
+ * The peak memory usage actually observed for a page is recorded and
+ * preferred over estimates when the same page is processed again.
+ *
+ * This class is thread-safe.
+ */
+class MemoryBudget : public RefCountable
+{
+	DECLARE_NON_COPYABLE(MemoryBudget)
+public:
+	static qint64 const DEFAULT_LIMIT;
+
+	explicit MemoryBudget(qint64 limit = DEFAULT_LIMIT);
+
+	/**
+	 * \brief Loads the budget limit (in megabytes) from QSettings.
+	 */
+	static qint64 loadLimit(QString const& key, qint64 dflt = DEFAULT_LIMIT);
+
+	qint64 limit() const { return m_limit; }
+
+	qint64 reserved() const;
+
+	/**
+	 * \brief Reserves the specified amount of memory, if it fits.
+	 *
+	 * \param bytes The amount of memory to reserve.
+	 * \param force If set, the reservation will be made even if it
+	 *        doesn't fit.  That's necessary for tasks estimated to need
+	 *        more than the whole budget, when nothing else is running.
+	 * \return true if the reservation was made.
+	 */
+	bool tryReserve(qint64 bytes, bool force = false);
+
+	void release(qint64 bytes);
+
+	/**
+	 * \brief Returns the amount of memory to reserve for a page.
+	 *
+	 * That's the recorded peak for the page, if we have one,
+	 * or the provided estimate otherwise.
+	 */
+	qint64 requirementFor(PageId const& page_id, qint64 estimate) const;
+
+	void recordPeak(PageId const& page_id, qint64 estimate, qint64 actual);
+
+	/**
+	 * \brief Returns the current resident memory size of the process,
+	 *        or 0 if not supported on this platform.
+	 */
+	static qint64 residentMemory();
+
+	/**
+	 * \brief Returns the peak resident memory size of the process,
+	 *        or 0 if not supported on this platform.
+	 */
+	static qint64 peakResidentMemory();
+
+	/**
+	 * \brief Resets the value returned by peakResidentMemory() to the
+	 *        current resident memory size, where supported.
+	 */
+	static void resetPeakResidentMemory();
+
+	class PeakMeter;
+private:
+	mutable QMutex m_mutex;
+	std::map<PageId, qint64> m_recordedPeaks;
+	qint64 const m_limit;
+	qint64 m_reserved;
+};
+
+
+/**
+ * \brief Measures the peak memory usage of a piece of work.
+ *
+ * The peak memory usage is only known for the whole process, so it can
+ * only be attributed to a task if nothing else was measured at the same
+ * time.  Meters that overlapped other meters report zero.  Work that
+ * isn't measured but does allocate should create a meter anyway, to mark
+ * concurrent measurements as unreliable.
+ *
+ * This class is thread-safe.
+ */
+class MemoryBudget::PeakMeter
+{
+	DECLARE_NON_COPYABLE(PeakMeter)
+public:
+	PeakMeter();
+
+	~PeakMeter();
+
+	/**
+	 * \brief Returns the peak memory usage above the starting point,
+	 *        or 0 if not measured.
+	 *
+	 * To be called once, at the end of the work being measured.
+	 */
+	qint64 finish();
+private:
+	static QAtomicInt m_sNumActive;
+	static QAtomicInt m_sNumStarted;
+
+	qint64 m_memoryBefore;
+	int m_startSerial;
+	bool m_alone;
+	bool m_finished;
+};
+
+
+/**
+ * \brief Memory reserved from a MemoryBudget.
+ *
+ * The reservation is given back by release() or by the destructor,
+ * whichever comes first.
+ *
+ * This class is thread-safe.
+ */
+class MemoryReservation : public RefCountable
+{
+	DECLARE_NON_COPYABLE(MemoryReservation)
+public:
+	MemoryReservation(IntrusivePtr<MemoryBudget> const& budget, qint64 bytes);
+
+	virtual ~MemoryReservation();
+
+	void release();
+private:
+	QMutex m_mutex;
+	IntrusivePtr<MemoryBudget> m_ptrBudget;
+	qint64 m_bytes;
+};
+
+#endif
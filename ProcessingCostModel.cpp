@@ -0,0 +1,71 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ProcessingCostModel.h"
+
+ProcessingCostModel::ProcessingCostModel()
+{
+}
+
+double
+ProcessingCostModel::costFor(
+	PageId const& page_id, int const last_filter_idx, double const estimate) const
+{
+	Records::const_iterator const it(
+		m_records.find(RecordKey(page_id, last_filter_idx))
+	);
+	if (it != m_records.end()) {
+		return it->second.time;
+	}
+
+	Calibrations::const_iterator const cal(m_calibrations.find(last_filter_idx));
+	if (cal != m_calibrations.end() && cal->second.estimateSum > 0.0) {
+		// Milliseconds per unit of estimate, averaged over recorded pages.
+		return estimate * (cal->second.timeSum / cal->second.estimateSum);
+	}
+
+	return estimate;
+}
+
+void
+ProcessingCostModel::recordTime(
+	PageId const& page_id, int const last_filter_idx,
+	double const estimate, qint64 const msec)
+{
+	if (msec <= 0 || estimate <= 0.0) {
+		// Not measured, or nothing to calibrate against.
+		return;
+	}
+
+	Record& record = m_records[RecordKey(page_id, last_filter_idx)];
+	Calibration& cal = m_calibrations[last_filter_idx];
+
+	// A page processed again replaces its previous record.
+	cal.estimateSum += estimate - record.estimate;
+	cal.timeSum += msec - record.time;
+	record.estimate = estimate;
+	record.time = msec;
+}
+
+void
+ProcessingCostModel::clear()
+{
+	m_records.clear();
+	m_calibrations.clear();
+}
@@ -0,0 +1,93 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PROCESSING_COST_MODEL_H_
+#define PROCESSING_COST_MODEL_H_
+
+#include "NonCopyable.h"
+#include "RefCountable.h"
+#include "PageId.h"
+#include <QtGlobal>
+#include <map>
+#include <utility>
+
+/**
+ * \brief Predicts how long pages take to process.
+ *
+ * Tasks come with cost estimates in arbitrary units, derived from image
+ * sizes and processing options.  Once a page has been processed, the time
+ * it took is recorded and preferred over the estimate when the same page
+ * is processed again.  The recorded times also calibrate the estimates
+ * of other pages, so that both end up in milliseconds and can be compared.
+ *
+ * Processing a page up to one filter costs nothing like processing it
+ * up to another, so records and calibration are kept per last filter.
+ *
+ * The recorded times are kept for as long as the project stays open.
+ * This class is not thread-safe.
+ */
+class ProcessingCostModel : public RefCountable
+{
+	DECLARE_NON_COPYABLE(ProcessingCostModel)
+public:
+	ProcessingCostModel();
+
+	/**
+	 * \brief Returns the expected processing cost of a page.
+	 *
+	 * That's the recorded time for the page, if we have one,
+	 * or the calibrated estimate otherwise.
+	 */
+	double costFor(PageId const& page_id, int last_filter_idx, double estimate) const;
+
+	void recordTime(PageId const& page_id, int last_filter_idx,
+		double estimate, qint64 msec);
+
+	void clear();
+private:
+	struct Record
+	{
+		double estimate;
+		double time;
+
+		Record() : estimate(0.0), time(0.0) {}
+	};
+
+	struct Calibration
+	{
+		double estimateSum;
+		double timeSum;
+
+		Calibration() : estimateSum(0.0), timeSum(0.0) {}
+	};
+
+	/**
+	 * A page and the last filter it was processed up to.
+	 */
+	typedef std::pair<PageId, int> RecordKey;
+
+	typedef std::map<RecordKey, Record> Records;
+
+	typedef std::map<int, Calibration> Calibrations;
+
+	Records m_records;
+	Calibrations m_calibrations;
+};
+
+#endif
@@ -18,17 +18,38 @@
 
 #include "ProcessingTaskQueue.h"
 #include <boost/foreach.hpp>
+#include <algorithm>
+#include <vector>
+
+class ProcessingTaskQueue::CostGreater
+{
+public:
+	bool operator()(Entry const* lhs, Entry const* rhs) const {
+		return lhs->cost > rhs->cost;
+	}
+};
 
 ProcessingTaskQueue::Entry::Entry(
-	PageInfo const& page_info, BackgroundTaskPtr const& tsk)
+	PageInfo const& page_info, BackgroundTaskPtr const& tsk,
+	double const cst, int const ord)
 :	pageInfo(page_info),
 	task(tsk),
+	cost(cst),
+	ordinal(ord),
 	takenForProcessing(false)
 {
 }
 
-ProcessingTaskQueue::ProcessingTaskQueue(Order order)
-:   m_order(order)
+ProcessingTaskQueue::ProcessingTaskQueue(
+	Order order, IntrusivePtr<MemoryBudget> const& memory_budget,
+	IntrusivePtr<ProcessingCostModel> const& cost_model,
+	int const last_filter_idx)
+:	m_ptrMemoryBudget(memory_budget),
+	m_ptrCostModel(cost_model),
+	m_lastFilterIdx(last_filter_idx),
+	m_nextOrdinal(0),
+	m_numTaken(0),
+	m_order(order)
 {
 }
 
@@ -36,31 +57,76 @@ void
 ProcessingTaskQueue::addProcessingTask(
 	PageInfo const& page_info, BackgroundTaskPtr const& task)
 {
-	m_queue.push_back(Entry(page_info, task));
+	// The cost is fixed here, so that tasks recreated by
+	// preemptProcessing() keep their places.
+	double cost = task->estimatedCost();
+	if (m_ptrCostModel.get()) {
+		cost = m_ptrCostModel->costFor(page_info.id(), m_lastFilterIdx, cost);
+	}
+
+	m_queue.push_back(Entry(page_info, task, cost, m_nextOrdinal++));
 }
 
 BackgroundTaskPtr
 ProcessingTaskQueue::takeForProcessing()
 {
+	if (m_order == LARGEST_FIRST_ORDER) {
+		return takeLargest();
+	}
+
 	BOOST_FOREACH(Entry& ent, m_queue) {
 		if (!ent.takenForProcessing) {
-			ent.takenForProcessing = true;
-			
-			if (m_order == RANDOM_ORDER) {
-				// In this mode we select the most recently submitted for processing page.
-				// This means question marks on selected pages, but at least this avoids
-				// jumps caused by dynamic ordering.
-				m_selectedPage = ent.pageInfo;
+			if (!reserveMemory(ent, /*force=*/m_numTaken == 0)) {
+				// Doesn't fit at the moment.  Maybe a smaller one will.
+				continue;
 			}
 
-			return ent.task;
+			return take(ent);
 		}
 	}
 
 	return BackgroundTaskPtr();
 }
 
-void
+BackgroundTaskPtr
+ProcessingTaskQueue::take(Entry& ent)
+{
+	ent.takenForProcessing = true;
+	++m_numTaken;
+	
+	if (m_order == RANDOM_ORDER) {
+		// In this mode we select the most recently submitted for processing page.
+		// This means question marks on selected pages, but at least this avoids
+		// jumps caused by dynamic ordering.
+		m_selectedPage = ent.pageInfo;
+	}
+
+	return ent.task;
+}
+
+BackgroundTaskPtr
+ProcessingTaskQueue::takeLargest()
+{
+	std::vector<Entry*> candidates;
+	BOOST_FOREACH(Entry& ent, m_queue) {
+		if (!ent.takenForProcessing) {
+			candidates.push_back(&ent);
+		}
+	}
+
+	// Equally expensive tasks are taken in page order.
+	std::stable_sort(candidates.begin(), candidates.end(), CostGreater());
+
+	BOOST_FOREACH(Entry* ent, candidates) {
+		if (reserveMemory(*ent, /*force=*/m_numTaken == 0)) {
+			return take(*ent);
+		}
+	}
+
+	return BackgroundTaskPtr();
+}
+
+PageId
 ProcessingTaskQueue::processingFinished(BackgroundTaskPtr const& task)
 {
 	std::list<Entry>::iterator it(m_queue.begin());
@@ -69,15 +135,13 @@ ProcessingTaskQueue::processingFinished(BackgroundTaskPtr const& task)
 	for (;; ++it) {
 		if (it == end) {
 			// Task not found.
-			return;
-		}
-
-		if (!it->takenForProcessing) {
-			// There is no point in looking further.
-			return;
+			return PageId();
 		}
 
 		if (it->task == task) {
+			if (!it->takenForProcessing) {
+				return PageId();
+			}
 			break;
 		}
 	}
@@ -85,14 +149,34 @@ ProcessingTaskQueue::processingFinished(BackgroundTaskPtr const& task)
 	// If we reached this point, it means we've found our entry and
 	// have <it> pointing to it. 
 
+	if (m_ptrMemoryBudget.get()) {
+		m_ptrMemoryBudget->recordPeak(
+			it->pageInfo.id(), it->task->estimatedPeakMemory(),
+			it->task->measuredPeakMemory()
+		);
+	}
+	untake(*it, true);
+
+	if (m_ptrCostModel.get() && !it->task->isCancelled()) {
+		m_ptrCostModel->recordTime(
+			it->pageInfo.id(), m_lastFilterIdx, it->task->estimatedCost(),
+			it->task->measuredTime()
+		);
+	}
+
 	if (m_order == SEQUENTIAL_ORDER) {
 		// In this mode we select the page that was just processed,
 		// rather than the one currently being processed.  This way
 		// we can avoid question marks on selected pages.
 		m_selectedPage = it->pageInfo;
+	} else if (m_order == LARGEST_FIRST_ORDER) {
+		m_finishedAhead[it->ordinal] = it->pageInfo;
 	}
 
+	PageId const page_id(it->pageInfo.id());
 	m_queue.erase(it);
+	advanceFrontier();
+	return page_id;
 }
 
 PageInfo
@@ -107,6 +191,19 @@ ProcessingTaskQueue::allProcessed() const
 	return m_queue.empty();
 }
 
+void
+ProcessingTaskQueue::preemptProcessing(
+	boost::function<BackgroundTaskPtr (PageInfo const&)> const& recreate)
+{
+	BOOST_FOREACH(Entry& ent, m_queue) {
+		if (ent.takenForProcessing) {
+			ent.task->cancel();
+			untake(ent, false);
+			ent.task = recreate(ent.pageInfo);
+		}
+	}
+}
+
 void
 ProcessingTaskQueue::cancelAndRemove(std::set<PageId> const& pages)
 {
@@ -116,6 +213,7 @@ ProcessingTaskQueue::cancelAndRemove(std::set<PageId> const& pages)
 		if (pages.find(it->pageInfo.id()) != pages.end()) {
 			if (it->takenForProcessing) {
 				it->task->cancel();
+				untake(*it, false);
 			}
 			if (m_selectedPage.id() == it->pageInfo.id()) {
 				m_selectedPage = PageInfo();
@@ -125,6 +223,8 @@ ProcessingTaskQueue::cancelAndRemove(std::set<PageId> const& pages)
 			++it;
 		}
 	}
+
+	advanceFrontier();
 }
 
 void
@@ -134,8 +234,68 @@ ProcessingTaskQueue::cancelAndClear()
 		Entry& ent = m_queue.front();
 		if (ent.takenForProcessing) {
 			ent.task->cancel();
+			untake(ent, false);
 		}
 		m_queue.pop_front();
 	}
+	m_finishedAhead.clear();
 	m_selectedPage = PageInfo();
 }
+
+/**
+ * In LARGEST_FIRST_ORDER, selects the last page of the uninterrupted
+ * run of finished pages, so that the selection moves in page order,
+ * as it does in SEQUENTIAL_ORDER.
+ */
+void
+ProcessingTaskQueue::advanceFrontier()
+{
+	if (m_finishedAhead.empty()) {
+		return;
+	}
+
+	// Entries stay in the order they were added, so the first one
+	// is the earliest page that isn't finished yet.
+	std::map<int, PageInfo>::iterator const end(
+		m_queue.empty() ? m_finishedAhead.end()
+		: m_finishedAhead.lower_bound(m_queue.front().ordinal)
+	);
+	if (end == m_finishedAhead.begin()) {
+		return;
+	}
+
+	std::map<int, PageInfo>::iterator last(end);
+	--last;
+	m_selectedPage = last->second;
+	m_finishedAhead.erase(m_finishedAhead.begin(), end);
+}
+
+bool
+ProcessingTaskQueue::reserveMemory(Entry& entry, bool const force)
+{
+	if (!m_ptrMemoryBudget.get()) {
+		return true;
+	}
+
+	qint64 const required = m_ptrMemoryBudget->requirementFor(
+		entry.pageInfo.id(), entry.task->estimatedPeakMemory()
+	);
+	if (!m_ptrMemoryBudget->tryReserve(required, force)) {
+		return false;
+	}
+
+	entry.reservation.reset(new MemoryReservation(m_ptrMemoryBudget, required));
+	entry.task->setMemoryReservation(entry.reservation);
+	return true;
+}
+
+void
+ProcessingTaskQueue::untake(Entry& entry, bool const release_memory)
+{
+	--m_numTaken;
+	if (release_memory && entry.reservation.get()) {
+		entry.reservation->release();
+	}
+	entry.reservation.reset();
+	entry.takenForProcessing = false;
+}
@@ -20,10 +20,15 @@
 #define PROCESSING_TASK_QUEUE_H_
 
 #include "NonCopyable.h"
+#include "IntrusivePtr.h"
 #include "BackgroundTask.h"
+#include "MemoryBudget.h"
+#include "ProcessingCostModel.h"
 #include "PageInfo.h"
 #include "PageId.h"
+#include <boost/function.hpp>
 #include <list>
+#include <map>
 #include <set>
 
 class ProcessingTaskQueue
@@ -31,24 +36,47 @@ class ProcessingTaskQueue
 	DECLARE_NON_COPYABLE(ProcessingTaskQueue)
 public:
 	/**
-	 * Order only affects the result of selectedPage().
-	 * For single-task queues and for custom-sorted sequences,
-	 * use RANDOM_ORDER, otherwise use SEQUENTIAL_ORDER.
+	 * SEQUENTIAL_ORDER and RANDOM_ORDER only affect the result of
+	 * selectedPage().  For single-task queues and for custom-sorted
+	 * sequences, use RANDOM_ORDER, otherwise use SEQUENTIAL_ORDER.
+	 * LARGEST_FIRST_ORDER takes the most expensive tasks first, so that
+	 * several workers don't end up waiting for a single expensive page
+	 * at the end.  Its selectedPage() still advances in page order,
+	 * following the pages processed without gaps.
 	 */
-	enum Order { SEQUENTIAL_ORDER, RANDOM_ORDER };
+	enum Order { SEQUENTIAL_ORDER, RANDOM_ORDER, LARGEST_FIRST_ORDER };
 
-	ProcessingTaskQueue(Order order);
+	/**
+	 * \param order See Order.
+	 * \param memory_budget If provided, tasks are only taken for processing
+	 *        if their estimated peak memory usage fits into the budget.
+	 * \param cost_model If provided, processing times are recorded there,
+	 *        and in LARGEST_FIRST_ORDER it converts task cost estimates.
+	 * \param last_filter_idx The filter tasks process pages up to.
+	 *        Processing times are recorded separately for each filter.
+	 */
+	ProcessingTaskQueue(Order order,
+		IntrusivePtr<MemoryBudget> const& memory_budget = IntrusivePtr<MemoryBudget>(),
+		IntrusivePtr<ProcessingCostModel> const& cost_model = IntrusivePtr<ProcessingCostModel>(),
+		int last_filter_idx = -1);
 
 	void addProcessingTask(PageInfo const& page_info, BackgroundTaskPtr const& task);
 
 	/**
 	 * The first task among those that haven't been already taken for processing
-	 * is marked as taken and returned.  A null task will be returned if there
-	 * are no such tasks.
+	 * and that fit into the memory budget is marked as taken and returned.
+	 * In LARGEST_FIRST_ORDER, "first" means the most expensive one.
+	 * If nothing is being processed, the first task is taken regardless of
+	 * the memory budget.  A null task will be returned if there are no such
+	 * tasks.
 	 */
 	BackgroundTaskPtr takeForProcessing();
 
-	void processingFinished(BackgroundTaskPtr const& task);
+	/**
+	 * \return The page the task was processing, or a null PageId
+	 *         if the task wasn't taken from this queue.
+	 */
+	PageId processingFinished(BackgroundTaskPtr const& task);
 
 	/**
 	 * \brief Returns the page to be visually selected.
@@ -61,6 +89,21 @@ public:
 
 	bool allProcessed() const;
 
+	/**
+	 * \brief Returns the number of tasks taken for processing and not yet finished.
+	 */
+	int numBeingProcessed() const { return m_numTaken; }
+
+	/**
+	 * \brief Cancels the tasks being processed and puts their pages back.
+	 *
+	 * A cancelled task can't be restarted, so \p recreate is called to
+	 * make a fresh task for each of those pages.  As the pages keep their
+	 * positions, they are going to be taken for processing first.
+	 */
+	void preemptProcessing(
+		boost::function<BackgroundTaskPtr (PageInfo const&)> const& recreate);
+
 	void cancelAndRemove(std::set<PageId> const& pages);
 
 	void cancelAndClear();
@@ -69,12 +112,44 @@ private:
 	{
 		PageInfo pageInfo;
 		BackgroundTaskPtr task;
+		IntrusivePtr<MemoryReservation> reservation;
+		double cost;
+		int ordinal;
 		bool takenForProcessing;
 
-		Entry(PageInfo const& page_info, BackgroundTaskPtr const& task);
+		Entry(PageInfo const& page_info, BackgroundTaskPtr const& task,
+			double cost, int ordinal);
 	};
 
+	class CostGreater;
+
+	BackgroundTaskPtr take(Entry& entry);
+
+	BackgroundTaskPtr takeLargest();
+
+	void advanceFrontier();
+
+	bool reserveMemory(Entry& entry, bool force);
+
+	/**
+	 * Marks a taken entry as no longer being processed by this queue.
+	 * The memory reserved for it is released only if \p release_memory
+	 * is set.  Otherwise the task holds it until it stops running.
+	 */
+	void untake(Entry& entry, bool release_memory);
+
 	std::list<Entry> m_queue;
+	IntrusivePtr<MemoryBudget> m_ptrMemoryBudget;
+	IntrusivePtr<ProcessingCostModel> m_ptrCostModel;
+	int m_lastFilterIdx;
+
+	/**
+	 * In LARGEST_FIRST_ORDER, pages finished ahead of an earlier page
+	 * that is still in the queue, indexed by Entry::ordinal.
+	 */
+	std::map<int, PageInfo> m_finishedAhead;
+	int m_nextOrdinal;
+	int m_numTaken;
 	PageInfo m_selectedPage;
 	Order m_order;
 };
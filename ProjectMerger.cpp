@@ -0,0 +1,201 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ProjectMerger.h"
+#include "ProjectReader.h"
+#include <QDomNode>
+#include <algorithm>
+
+ProjectMerger::ProjectMerger(QDomDocument const& base)
+:	m_doc(base.cloneNode(true).toDocument()),
+	m_nextPageId(1)
+{
+	ProjectReader const reader(m_doc);
+	QDomElement const project_el(m_doc.documentElement());
+	
+	QDomElement const images_el(project_el.namedItem("images").toElement());
+	QDomNode node(images_el.firstChild());
+	for (; !node.isNull(); node = node.nextSibling()) {
+		int const id = node.toElement().attribute("id").toInt();
+		ImageId const image_id(reader.imageId(id));
+		if (!image_id.isNull()) {
+			m_imageIds[image_id] = id;
+			m_imageEls[image_id] = node.toElement();
+		}
+	}
+	
+	m_pagesEl = project_el.namedItem("pages").toElement();
+	node = m_pagesEl.firstChild();
+	for (; !node.isNull(); node = node.nextSibling()) {
+		int const id = node.toElement().attribute("id").toInt();
+		PageId const page_id(reader.pageId(id));
+		if (!page_id.isNull()) {
+			m_pageIds[page_id] = id;
+		}
+		m_nextPageId = std::max(m_nextPageId, id + 1);
+	}
+	
+	m_filtersEl = project_el.namedItem("filters").toElement();
+	QDomNode filter_node(m_filtersEl.firstChild());
+	for (; !filter_node.isNull(); filter_node = filter_node.nextSibling()) {
+		QString const filter_name(filter_node.nodeName());
+		QDomNode item_node(filter_node.firstChild());
+		for (; !item_node.isNull(); item_node = item_node.nextSibling()) {
+			QDomElement const item_el(item_node.toElement());
+			if (item_el.isNull() || !item_el.hasAttribute("id")) {
+				continue;
+			}
+			QString const name(
+				itemName(item_el.tagName(), item_el.attribute("id").toInt())
+			);
+			m_items[ItemKey(filter_name, name)] = item_el;
+		}
+	}
+}
+
+bool
+ProjectMerger::merge(QDomDocument const& partial)
+{
+	ProjectReader const reader(partial);
+	if (!reader.success()) {
+		return false;
+	}
+	
+	mergePageStructure(partial, reader);
+	
+	QString const page_tag_name("page");
+	QString const image_tag_name("image");
+	
+	QDomElement const filters_el(
+		partial.documentElement().namedItem("filters").toElement()
+	);
+	QDomNode filter_node(filters_el.firstChild());
+	for (; !filter_node.isNull(); filter_node = filter_node.nextSibling()) {
+		QString const filter_name(filter_node.nodeName());
+		QDomElement filter_el(m_filtersEl.namedItem(filter_name).toElement());
+		if (filter_el.isNull()) {
+			continue;
+		}
+		
+		QDomNode item_node(filter_node.firstChild());
+		for (; !item_node.isNull(); item_node = item_node.nextSibling()) {
+			QDomElement const item_el(item_node.toElement());
+			if (item_el.isNull()) {
+				continue;
+			}
+			
+			int const partial_id = item_el.attribute("id").toInt();
+			int base_id = -1;
+			if (item_el.tagName() == page_tag_name) {
+				std::map<PageId, int>::const_iterator const it(
+					m_pageIds.find(reader.pageId(partial_id))
+				);
+				if (it != m_pageIds.end()) {
+					base_id = it->second;
+				}
+			} else if (item_el.tagName() == image_tag_name) {
+				std::map<ImageId, int>::const_iterator const it(
+					m_imageIds.find(reader.imageId(partial_id))
+				);
+				if (it != m_imageIds.end()) {
+					base_id = it->second;
+				}
+			}
+			if (base_id == -1) {
+				// Not a per-page element, or a page that's no longer there.
+				continue;
+			}
+			
+			QDomElement imported(m_doc.importNode(item_el, true).toElement());
+			imported.setAttribute("id", base_id);
+			
+			ItemKey const key(filter_name, itemName(item_el.tagName(), base_id));
+			std::map<ItemKey, QDomElement>::iterator const it(m_items.find(key));
+			if (it != m_items.end()) {
+				filter_el.replaceChild(imported, it->second);
+				it->second = imported;
+			} else {
+				filter_el.appendChild(imported);
+				m_items[key] = imported;
+			}
+		}
+	}
+	
+	return true;
+}
+
+void
+ProjectMerger::mergePageStructure(
+	QDomDocument const& partial, ProjectReader const& reader)
+{
+	QDomElement const project_el(partial.documentElement());
+	
+	QDomElement const images_el(project_el.namedItem("images").toElement());
+	QDomNode node(images_el.firstChild());
+	for (; !node.isNull(); node = node.nextSibling()) {
+		QDomElement const el(node.toElement());
+		ImageId const image_id(reader.imageId(el.attribute("id").toInt()));
+		std::map<ImageId, QDomElement>::iterator const it(m_imageEls.find(image_id));
+		if (it == m_imageEls.end()) {
+			continue;
+		}
+		
+		QDomElement& base_el = it->second;
+		int const sub_pages = el.attribute("subPages").toInt();
+		if (base_el.attribute("subPages").toInt() != sub_pages) {
+			base_el.setAttribute("subPages", sub_pages);
+			m_changedSubPageCounts[image_id] = sub_pages;
+		}
+		if (el.hasAttribute("removed")) {
+			base_el.setAttribute("removed", el.attribute("removed"));
+		} else {
+			base_el.removeAttribute("removed");
+		}
+	}
+	
+	QDomElement const pages_el(project_el.namedItem("pages").toElement());
+	node = pages_el.firstChild();
+	for (; !node.isNull(); node = node.nextSibling()) {
+		PageId const page_id(reader.pageId(node.toElement().attribute("id").toInt()));
+		if (page_id.isNull() || m_pageIds.count(page_id)) {
+			continue;
+		}
+		std::map<ImageId, int>::const_iterator const image_it(
+			m_imageIds.find(page_id.imageId())
+		);
+		if (image_it == m_imageIds.end()) {
+			continue;
+		}
+		
+		// A page of an image that was split by the node.
+		QDomElement page_el(m_doc.createElement("page"));
+		page_el.setAttribute("id", m_nextPageId);
+		page_el.setAttribute("imageId", image_it->second);
+		page_el.setAttribute("subPage", page_id.subPageAsString());
+		m_pagesEl.appendChild(page_el);
+		m_pageIds[page_id] = m_nextPageId;
+		++m_nextPageId;
+	}
+}
+
+QString
+ProjectMerger::itemName(QString const& tag_name, int const numeric_id)
+{
+	return tag_name + QChar(':') + QString::number(numeric_id);
+}
@@ -0,0 +1,87 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PROJECT_MERGER_H_
+#define PROJECT_MERGER_H_
+
+#include "NonCopyable.h"
+#include "ImageId.h"
+#include "PageId.h"
+#include <QDomDocument>
+#include <QDomElement>
+#include <QString>
+#include <map>
+#include <utility>
+
+class ProjectReader;
+
+/**
+ * \brief Brings per-page filter settings from partial projects into a full one.
+ *
+ * Partial projects are written by a ProjectWriter restricted to a few pages.
+ * Numeric ids differ from one project document to another, so page and
+ * image elements are matched by the PageId / ImageId they stand for.
+ * Settings of a partial project replace those of the full one.
+ *
+ * The page structure is merged too: images take the number of sub-pages
+ * they have in partial projects, and pages that appeared by splitting
+ * an image are added.  Images themselves are never added or removed.
+ */
+class ProjectMerger
+{
+	DECLARE_NON_COPYABLE(ProjectMerger)
+public:
+	explicit ProjectMerger(QDomDocument const& base);
+	
+	/**
+	 * \return false if \p partial is not a readable project.
+	 */
+	bool merge(QDomDocument const& partial);
+	
+	QDomDocument const& document() const { return m_doc; }
+	
+	/**
+	 * \brief The images whose number of sub-pages changed, with the new numbers.
+	 *
+	 * These have to be applied to ProjectPages, as the project document
+	 * is only used to read filter settings from.
+	 */
+	std::map<ImageId, int> const& changedSubPageCounts() const {
+		return m_changedSubPageCounts;
+	}
+private:
+	/** (filter element name, "page:<id>" or "image:<id>") */
+	typedef std::pair<QString, QString> ItemKey;
+	
+	static QString itemName(QString const& tag_name, int numeric_id);
+	
+	void mergePageStructure(QDomDocument const& partial, ProjectReader const& reader);
+	
+	QDomDocument m_doc;
+	QDomElement m_pagesEl;
+	QDomElement m_filtersEl;
+	std::map<PageId, int> m_pageIds;
+	std::map<ImageId, int> m_imageIds;
+	std::map<ImageId, QDomElement> m_imageEls;
+	std::map<ItemKey, QDomElement> m_items;
+	std::map<ImageId, int> m_changedSubPageCounts;
+	int m_nextPageId;
+};
+
+#endif
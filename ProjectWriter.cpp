@@ -43,6 +43,40 @@ ProjectWriter::ProjectWriter(
 	m_selectedPage(selected_page),
 	m_layoutDirection(page_sequence->layoutDirection())
 {
+	registerPages(0);
+}
+
+ProjectWriter::ProjectWriter(
+	IntrusivePtr<ProjectPages> const& page_sequence,
+	std::set<PageId> const& pages,
+	OutputFileNameGenerator const& out_file_name_gen)
+:	m_pageSequence(page_sequence->toPageSequence(PAGE_VIEW)),
+	m_outFileNameGen(out_file_name_gen),
+	m_layoutDirection(page_sequence->layoutDirection())
+{
+	registerPages(&pages);
+}
+
+ProjectWriter::~ProjectWriter()
+{
+}
+
+void
+ProjectWriter::registerPages(std::set<PageId> const* const restrict_to)
+{
+	PageSequence filtered;
+	if (restrict_to) {
+		size_t const num_pages = m_pageSequence.numPages();
+		for (size_t i = 0; i < num_pages; ++i) {
+			PageInfo const& page = m_pageSequence.pageAt(i);
+			if (restrict_to->count(page.id()) ||
+					restrict_to->count(PageId(page.imageId(), PageId::SINGLE_PAGE))) {
+				filtered.append(page);
+			}
+		}
+		m_pageSequence = filtered;
+	}
+	
 	int next_id = 1;
 	size_t const num_pages = m_pageSequence.numPages();
 	for (size_t i = 0; i < num_pages; ++i) {
@@ -73,12 +107,23 @@ ProjectWriter::ProjectWriter(
 	}
 }
 
-ProjectWriter::~ProjectWriter()
+bool
+ProjectWriter::write(QString const& file_path, std::vector<FilterPtr> const& filters) const
 {
+	QDomDocument const doc(toDocument(filters));
+	
+	QFile file(file_path);
+	if (file.open(QIODevice::WriteOnly)) {
+		QTextStream strm(&file);
+		doc.save(strm, 2);
+		return true;
+	}
+	
+	return false;
 }
 
-bool
-ProjectWriter::write(QString const& file_path, std::vector<FilterPtr> const& filters) const
+QDomDocument
+ProjectWriter::toDocument(std::vector<FilterPtr> const& filters) const
 {
 	QDomDocument doc;
 	QDomElement root_el(doc.createElement("project"));
@@ -108,14 +153,7 @@ ProjectWriter::write(QString const& file_path, std::vector<FilterPtr> const& fil
 		filters_el.appendChild((*it)->saveSettings(*this, doc));
 	}
 	
-	QFile file(file_path);
-	if (file.open(QIODevice::WriteOnly)) {
-		QTextStream strm(&file);
-		doc.save(strm, 2);
-		return true;
-	}
-	
-	return false;
+	return doc;
 }
 
 QDomElement
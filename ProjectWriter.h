@@ -34,6 +34,7 @@
 #include <Qt>
 #include <vector>
 #include <map>
+#include <set>
 
 class AbstractFilter;
 class ProjectPages;
@@ -52,10 +53,23 @@ public:
 		SelectedPage const& selected_page,
 		OutputFileNameGenerator const& out_file_name_gen);
 	
+	/**
+	 * \brief Restricts the output to the given pages and their images.
+	 *
+	 * PageId(image_id, PageId::SINGLE_PAGE) stands for every page
+	 * of that image, as that's how images are identified in IMAGE_VIEW.
+	 */
+	ProjectWriter(
+		IntrusivePtr<ProjectPages> const& page_sequence,
+		std::set<PageId> const& pages,
+		OutputFileNameGenerator const& out_file_name_gen);
+	
 	~ProjectWriter();
 	
 	bool write(QString const& file_path, std::vector<FilterPtr> const& filters) const;
 	
+	QDomDocument toDocument(std::vector<FilterPtr> const& filters) const;
+	
 	/**
 	 * \p out will be called like this: out(ImageId, numeric_image_id)
 	 */
@@ -108,6 +122,8 @@ private:
 	
 	class Sequenced;
 	
+	void registerPages(std::set<PageId> const* restrict_to);
+	
 	typedef std::map<ImageId, ImageMetadata> MetadataByImage;
 	
 	typedef boost::multi_index::multi_index_container<
@@ -0,0 +1,85 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "SpeculativeResultCache.h"
+
+SpeculativeResultCache::SpeculativeResultCache()
+{
+}
+
+void
+SpeculativeResultCache::put(
+	PageId const& page_id, int const filter_idx, FilterResultPtr const& result)
+{
+	Map::iterator const it(m_entries.find(page_id));
+	if (it == m_entries.end()) {
+		m_entries.insert(Map::value_type(page_id, Entry(result, filter_idx)));
+	} else {
+		it->second = Entry(result, filter_idx);
+	}
+}
+
+FilterResultPtr
+SpeculativeResultCache::take(PageId const& page_id, int const filter_idx)
+{
+	Map::iterator const it(m_entries.find(page_id));
+	if (it == m_entries.end()) {
+		return FilterResultPtr();
+	}
+	
+	FilterResultPtr result;
+	if (it->second.filterIdx == filter_idx) {
+		result = it->second.result;
+	}
+	m_entries.erase(it);
+	
+	return result;
+}
+
+bool
+SpeculativeResultCache::contains(PageId const& page_id, int const filter_idx) const
+{
+	Map::const_iterator const it(m_entries.find(page_id));
+	return it != m_entries.end() && it->second.filterIdx == filter_idx;
+}
+
+void
+SpeculativeResultCache::remove(PageId const& page_id)
+{
+	m_entries.erase(page_id);
+}
+
+void
+SpeculativeResultCache::retainOnly(std::set<PageId> const& page_ids)
+{
+	Map::iterator it(m_entries.begin());
+	while (it != m_entries.end()) {
+		if (page_ids.find(it->first) == page_ids.end()) {
+			m_entries.erase(it++);
+		} else {
+			++it;
+		}
+	}
+}
+
+void
+SpeculativeResultCache::clear()
+{
+	m_entries.clear();
+}
@@ -0,0 +1,79 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SPECULATIVE_RESULT_CACHE_H_
+#define SPECULATIVE_RESULT_CACHE_H_
+
+#include "NonCopyable.h"
+#include "FilterResult.h"
+#include "PageId.h"
+#include <map>
+#include <set>
+
+/**
+ * \brief Results of interactive processing done ahead of time.
+ *
+ * While the user looks at a page, its neighbours are processed in the
+ * background, and the results are kept here until the user switches
+ * to one of them.  A result is only good for the filter it was produced
+ * by and for the settings at the time, so entries have to be removed
+ * when anything that affects them changes.
+ */
+class SpeculativeResultCache
+{
+	DECLARE_NON_COPYABLE(SpeculativeResultCache)
+public:
+	SpeculativeResultCache();
+	
+	void put(PageId const& page_id, int filter_idx, FilterResultPtr const& result);
+	
+	/**
+	 * \brief Removes and returns the result for a page.
+	 *
+	 * A null result is returned if there is none for this page,
+	 * or if it was produced by a different filter.
+	 */
+	FilterResultPtr take(PageId const& page_id, int filter_idx);
+	
+	bool contains(PageId const& page_id, int filter_idx) const;
+	
+	void remove(PageId const& page_id);
+	
+	/**
+	 * \brief Removes results for pages other than the given ones.
+	 */
+	void retainOnly(std::set<PageId> const& page_ids);
+	
+	void clear();
+private:
+	struct Entry
+	{
+		FilterResultPtr result;
+		int filterIdx;
+		
+		Entry(FilterResultPtr const& res, int filter_idx)
+		: result(res), filterIdx(filter_idx) {}
+	};
+	
+	typedef std::map<PageId, Entry> Map;
+	
+	Map m_entries;
+};
+
+#endif
@@ -42,6 +42,7 @@
 #include <QGraphicsSimpleTextItem>
 #include <QGraphicsPixmapItem>
 #include <QGraphicsView>
+#include <QScrollBar>
 #include <QStyle>
 #include <QStyleOptionGraphicsItem>
 #include <QGraphicsSceneMouseEvent>
@@ -67,6 +68,7 @@
 #include <Qt>
 #include <QDebug>
 #include <algorithm>
+#include <vector>
 #include <stddef.h>
 #include <assert.h>
 
@@ -74,10 +76,17 @@ using namespace ::boost::multi_index;
 using namespace ::boost::lambda;
 
 
+/**
+ * \brief The layout record of a page.
+ *
+ * Every page has one, but only pages within or near the visible area
+ * have a CompositeItem on the scene.  The geometry of the rest is either
+ * measured without building graphics items, or estimated.
+ */
 class ThumbnailSequence::Item
 {
 public:
-	Item(PageInfo const& page_info, CompositeItem* comp_item);
+	Item(PageInfo const& page_info);
 	
 	PageId const& pageId() const { return pageInfo.id(); }
 	
@@ -89,9 +98,40 @@ public:
 	
 	void setSelectionLeader(bool selection_leader) const;
 	
+	/**
+	 * \brief The bounding rectangle of the item in scene coordinates.
+	 */
+	QRectF sceneRect() const { return localRect.translated(0.0, offset); }
+	
 	PageInfo pageInfo;
+	
+	/**
+	 * Null, unless the item is within or near the visible area.
+	 */
 	mutable CompositeItem* composite;
+	
 	mutable bool incompleteThumbnail;
+	
+	/**
+	 * The size of the thumbnail, possibly estimated.
+	 */
+	mutable QSizeF thumbSize;
+	
+	/**
+	 * The bounding rectangle of the composite item in its own coordinates,
+	 * possibly estimated.
+	 */
+	mutable QRectF localRect;
+	
+	/**
+	 * The vertical position of the composite item on the scene.
+	 */
+	mutable double offset;
+	
+	/**
+	 * The index of this item in Impl::m_layout.
+	 */
+	mutable size_t layoutIdx;
 private:
 	mutable bool m_isSelected;
 	mutable bool m_isSelectionLeader;
@@ -169,6 +209,12 @@ public:
 		PageInfo const& page_info, QPoint const& screen_pos, bool selected);
 		
 	void itemSelectedByUser(CompositeItem* item, Qt::KeyboardModifiers modifiers);
+	
+	/**
+	 * \brief Builds composite items for pages within or near the visible
+	 *        area, and destroys those of pages that went out of it.
+	 */
+	void updateVisibleItems();
 private:
 	class ItemsByIdTag;
 	class ItemsInOrderTag;
@@ -236,9 +282,62 @@ private:
 	std::auto_ptr<CompositeItem> getCompositeItem(
 		Item const* item, PageInfo const& info);
 	
+	/**
+	 * Creates the item's composite and puts it on the scene,
+	 * replacing the existing one, if any.
+	 */
+	void materialize(Item const& item);
+	
+	void dematerialize(Item const& item);
+	
+	void dematerializeAll();
+	
+	/**
+	 * Takes the thumbnail's size and completeness from the thumbnail
+	 * factory, without building a composite item.
+	 */
+	void measure(Item const& item);
+	
+	/**
+	 * Resets the item's geometry to the one of the largest possible thumbnail.
+	 */
+	void estimate(Item const& item);
+	
+	/**
+	 * Moves the item to where m_ptrOrderProvider wants it to be, given
+	 * its current incompleteThumbnail.  Doesn't touch m_layout.
+	 * Returns how many positions forward (positive) or backward (negative)
+	 * the item was moved.
+	 */
+	int reposition(Item const& item);
+	
+	/**
+	 * Rebuilds m_layout to follow m_itemsInOrder.
+	 */
+	void rebuildLayoutIndex();
+	
+	/**
+	 * Recalculates the positions of items starting from m_layout[from],
+	 * moving their composite items, if any, then updates the scene rect.
+	 */
+	void relayout(size_t from);
+	
 	void commitSceneRect();
 	
+	/**
+	 * Emits newSelectionLeader() and remembers the rect announced.
+	 */
+	void announceSelectionLeader(
+		PageInfo const& page_info, QRectF const& thumb_rect, SelectionFlags flags);
+	
 	static int const SPACING = 10;
+	
+	/**
+	 * Composite items are built for this many screens above
+	 * and below the visible area.
+	 */
+	static int const PREFETCH_SCREENS = 1;
+	
 	ThumbnailSequence& m_rOwner;
 	QSizeF m_maxLogicalThumbSize;
 	Container m_items;
@@ -252,10 +351,33 @@ private:
 	SelectedThenUnselected& m_selectedThenUnselected;
 	
 	Item const* m_pSelectionLeader;
+	
+	/**
+	 * The scene rect of the selection leader, as last announced.
+	 */
+	QRectF m_announcedLeaderRect;
+	
 	IntrusivePtr<ThumbnailFactory> m_ptrFactory;
 	IntrusivePtr<PageOrderProvider const> m_ptrOrderProvider;
 	GraphicsScene m_graphicsScene;
 	QRectF m_sceneRect;
+	QGraphicsView* m_pView;
+	
+	/**
+	 * Items in the order of m_itemsInOrder, for positional access.
+	 */
+	std::vector<Item const*> m_layout;
+	
+	/**
+	 * Items that currently have a composite item.
+	 */
+	std::vector<Item const*> m_materialized;
+	
+	/**
+	 * The size of the most recently built label, used for estimating
+	 * the geometry of items that were never materialized.
+	 */
+	QSizeF m_typicalLabelSize;
 };
 
 
@@ -305,7 +427,16 @@ public:
 
 	bool incompleteThumbnail() const;
 	
-	void updateSceneRect(QRectF& scene_rect);
+	QSizeF thumbSize() const;
+	
+	QSizeF labelSize() const;
+	
+	/**
+	 * \brief Predicts boundingRect() of a composite item with the given
+	 *        thumbnail and label sizes.
+	 */
+	static QRectF estimateBoundingRect(
+		QSizeF const& thumb_size, QSizeF const& label_size);
 	
 	void updateAppearence(bool selected, bool selection_leader);
 	
@@ -325,6 +456,8 @@ private:
 	
 	void setSelected(bool selected);
 	
+	static int const THUMB_LABEL_SPACING = 1;
+	
 	ThumbnailSequence::Impl& m_rOwner;
 	ThumbnailSequence::Item const* m_pItem;
 	QGraphicsItem* m_pThumb;
@@ -458,15 +591,18 @@ ThumbnailSequence::selectedRanges() const
 
 void
 ThumbnailSequence::emitNewSelectionLeader(
-	PageInfo const& page_info, CompositeItem const* composite,
+	PageInfo const& page_info, QRectF const& thumb_rect,
 	SelectionFlags const flags)
 {
-	QRectF const thumb_rect(
-		composite->mapToScene(composite->boundingRect()).boundingRect()
-	);
 	emit newSelectionLeader(page_info, thumb_rect, flags);
 }
 
+void
+ThumbnailSequence::viewportChanged()
+{
+	m_ptrImpl->updateVisibleItems();
+}
+
 
 /*======================== ThumbnailSequence::Impl ==========================*/
 
@@ -478,7 +614,8 @@ ThumbnailSequence::Impl::Impl(
 	m_itemsById(m_items.get<ItemsByIdTag>()),
 	m_itemsInOrder(m_items.get<ItemsInOrderTag>()),
 	m_selectedThenUnselected(m_items.get<SelectedThenUnselectedTag>()),
-	m_pSelectionLeader(0)
+	m_pSelectionLeader(0),
+	m_pView(0)
 {
 	m_graphicsScene.setContextMenuEventCallback(
 		bind(&Impl::sceneContextMenuEvent, this, _1)
@@ -499,7 +636,23 @@ ThumbnailSequence::Impl::setThumbnailFactory(
 void
 ThumbnailSequence::Impl::attachView(QGraphicsView* const view)
 {
+	m_pView = view;
 	view->setScene(&m_graphicsScene);
+	
+	// The scroll range changes when the viewport gets resized.
+	// Queued connections make sure we don't destroy a composite item
+	// from within its own event handler, which may trigger scrolling.
+	QScrollBar* const scroll_bar = view->verticalScrollBar();
+	QObject::connect(
+		scroll_bar, SIGNAL(valueChanged(int)),
+		&m_rOwner, SLOT(viewportChanged()), Qt::QueuedConnection
+	);
+	QObject::connect(
+		scroll_bar, SIGNAL(rangeChanged(int, int)),
+		&m_rOwner, SLOT(viewportChanged()), Qt::QueuedConnection
+	);
+	
+	updateVisibleItems();
 }
 
 void
@@ -527,15 +680,17 @@ ThumbnailSequence::Impl::reset(
 		return;
 	}
 
+	if (m_typicalLabelSize.isEmpty()) {
+		m_typicalLabelSize = getLabelGroup(pages.pageAt(0))->boundingRect().size();
+	}
+
 	Item const* some_selected_item = 0;
 
 	for (size_t i = 0; i < num_pages; ++i) {
 		PageInfo const& page_info(pages.pageAt(i));
 		
-		std::auto_ptr<CompositeItem> composite(getCompositeItem(0, page_info));
-		m_itemsInOrder.push_back(Item(page_info, composite.release()));
+		m_itemsInOrder.push_back(Item(page_info));
 		Item const* item = &m_itemsInOrder.back();
-		item->composite->setItem(item);
 
 		if (selected.find(page_info.id()) != selected.end()) {
 			item->setSelected(true);
@@ -557,8 +712,8 @@ ThumbnailSequence::Impl::reset(
 	
 	if (m_pSelectionLeader) {
 		m_pSelectionLeader->setSelectionLeader(true);
-		m_rOwner.emitNewSelectionLeader(
-			selection_leader, m_pSelectionLeader->composite, DEFAULT_SELECTION_FLAGS
+		announceSelectionLeader(
+			selection_leader, m_pSelectionLeader->sceneRect(), DEFAULT_SELECTION_FLAGS
 		);
 	}
 }
@@ -597,96 +752,30 @@ ThumbnailSequence::Impl::invalidateThumbnail(PageInfo const& page_info)
 void
 ThumbnailSequence::Impl::invalidateThumbnailImpl(ItemsById::iterator const id_it)
 {
-	std::auto_ptr<CompositeItem> composite(
-		getCompositeItem(&*id_it, id_it->pageInfo)
-	);
-	CompositeItem* const new_composite = composite.get();
-	CompositeItem* const old_composite = id_it->composite;
-	QSizeF const old_size(old_composite->boundingRect().size());
-	QSizeF const new_size(new_composite->boundingRect().size());
-	QPointF const old_pos(new_composite->pos());
+	Item const& item = *id_it;
+	QRectF const old_rect(item.sceneRect());
+	int const old_idx = item.layoutIdx;
 	
-	new_composite->updateAppearence(id_it->isSelected(), id_it->isSelectionLeader());
-	
-	m_graphicsScene.addItem(composite.release());
-	id_it->composite = new_composite;
-	id_it->incompleteThumbnail = new_composite->incompleteThumbnail();
-	delete old_composite;
-	
-	ItemsInOrder::iterator after_old(m_items.project<ItemsInOrderTag>(id_it));
-	// Notice after_old++ below.
-
-	// Move our item to the beginning of m_itemsInOrder, to make it out of range
-	// we are going to pass to itemInsertPosition().
-	m_itemsInOrder.relocate(m_itemsInOrder.begin(), after_old++);
-
-	int dist = 0;
-	ItemsInOrder::iterator const after_new(
-		itemInsertPosition(
-			++m_itemsInOrder.begin(), m_itemsInOrder.end(),
-			id_it->pageInfo.id(), id_it->incompleteThumbnail,
-			after_old, &dist
-		)
-	);
-
-	// Move our item to its intended position.
-	m_itemsInOrder.relocate(after_new, m_itemsInOrder.begin());
-
-
-	// Now let's reposition the items on the scene.
-	
-	ItemsInOrder::iterator ord_it, ord_end;
-
-	// The range of [ord_it, ord_end) is supposed to contain all items
-	// between the old and new positions of our item, with the new
-	// position in range.
-
-	if (dist <= 0) { // New position is before or equals to the old one.
-		ord_it = after_new;
-		--ord_it; // Include new item position in the range.
-		ord_end = after_old;
-	} else { // New position is after the old one.
-		ord_it = after_old;
-		ord_end = after_new;
+	if (item.composite) {
+		materialize(item);
+	} else {
+		measure(item);
 	}
 	
-	double offset = 0;
-
-	if (ord_it != m_itemsInOrder.begin()) {
-		ItemsInOrder::iterator prev(ord_it);
-		--prev;
-		offset = prev->composite->pos().y() + prev->composite->boundingRect().height() + SPACING;
-	}
-
-	// Reposition items between the old and the new position of our item,
-	// including the item itself.
-	for (; ord_it != ord_end; ++ord_it) {
-		ord_it->composite->setPos(0.0, offset);
-		offset += ord_it->composite->boundingRect().height() + SPACING;
-	}
-
-	// Reposition the items following both the new and the old position
-	// of the item, if the item size has changed.
-	if (old_size != new_size) {
-		for (; ord_it != m_itemsInOrder.end(); ++ord_it) {
-			ord_it->composite->setPos(0.0, offset);
-			offset += ord_it->composite->boundingRect().height() + SPACING;
-		}
+	int const dist = reposition(item);
+	if (dist != 0) {
+		rebuildLayoutIndex();
 	}
 	
-	// Update scene rect.
-	m_sceneRect.setTop(m_sceneRect.bottom());
-	m_itemsInOrder.front().composite->updateSceneRect(m_sceneRect);
-	m_sceneRect.setBottom(m_sceneRect.top());
-	m_itemsInOrder.back().composite->updateSceneRect(m_sceneRect);
-	id_it->composite->updateSceneRect(m_sceneRect);
-	commitSceneRect();
+	// Items preceding both the old and the new position stay where they are.
+	relayout(std::min(old_idx, old_idx + dist));
+	updateVisibleItems();
 
 	// Possibly emit the newSelectionLeader() signal.
-	if (m_pSelectionLeader == &*id_it) {
-		if (old_size != new_size || old_pos != id_it->composite->pos()) {
-			m_rOwner.emitNewSelectionLeader(
-				id_it->pageInfo, id_it->composite, REDUNDANT_SELECTION
+	if (m_pSelectionLeader == &item) {
+		if (old_rect != item.sceneRect()) {
+			announceSelectionLeader(
+				item.pageInfo, item.sceneRect(), REDUNDANT_SELECTION
 			);
 		}
 	}
@@ -695,15 +784,15 @@ ThumbnailSequence::Impl::invalidateThumbnailImpl(ItemsById::iterator const id_it
 void
 ThumbnailSequence::Impl::invalidateAllThumbnails()
 {
-	// Recreate thumbnails now, whether a thumbnail is incomplete
-	// is taken into account when sorting.
-	ItemsInOrder::iterator ord_it(m_itemsInOrder.begin());
-	ItemsInOrder::iterator const ord_end(m_itemsInOrder.end());
-	for (; ord_it != ord_end; ++ord_it) {
-		CompositeItem* const old_composite = ord_it->composite;
-		ord_it->composite = getCompositeItem(&*ord_it, ord_it->pageInfo).release();
-		ord_it->incompleteThumbnail = ord_it->composite->incompleteThumbnail();
-		delete old_composite;
+	// Composite items are recreated as they come into view.  Ordering
+	// takes into account whether a thumbnail is incomplete, which we
+	// only find out when building one.  Until then, the last known state
+	// is used, and updateVisibleItems() moves the items that turn out
+	// to be different.
+	dematerializeAll();
+	
+	BOOST_FOREACH(Item const& item, m_itemsInOrder) {
+		estimate(item);
 	}
 
 	// Sort pages in m_itemsInOrder using m_ptrOrderProvider.
@@ -717,20 +806,9 @@ ThumbnailSequence::Impl::invalidateAllThumbnails()
 		);
 	}
 	
-	m_sceneRect = QRectF(0.0, 0.0, 0.0, 0.0);
-	double offset = 0;
-
-	for (ord_it = m_itemsInOrder.begin(); ord_it != ord_end; ++ord_it) {
-		CompositeItem* composite = ord_it->composite;
-		composite->setPos(0.0, offset);
-		composite->updateSceneRect(m_sceneRect);
-		composite->updateAppearence(ord_it->isSelected(), ord_it->isSelectionLeader());
-
-		offset += composite->boundingRect().height() + SPACING;
-		m_graphicsScene.addItem(composite);
-	}
-	
-	commitSceneRect();
+	rebuildLayoutIndex();
+	relayout(0);
+	updateVisibleItems();
 }
 
 bool
@@ -774,7 +852,7 @@ ThumbnailSequence::Impl::setSelection(PageId const& page_id)
 		flags |= REDUNDANT_SELECTION;
 	}
 	
-	m_rOwner.emitNewSelectionLeader(id_it->pageInfo, id_it->composite, flags);
+	announceSelectionLeader(id_it->pageInfo, id_it->sceneRect(), flags);
 
 	return true;
 }
@@ -892,71 +970,47 @@ ThumbnailSequence::Impl::insert(
 		/*page_incomplete=*/true, ord_it
 	);
 	
-	double offset = 0.0;
-	if (!m_items.empty()) {
-		if (ord_it != m_itemsInOrder.end()) {
-			offset = ord_it->composite->pos().y();
-		} else {
-			ItemsInOrder::iterator it(ord_it);
-			--it;
-			offset = it->composite->y()
-				+ it->composite->boundingRect().height() + SPACING;
-		}
+	if (m_typicalLabelSize.isEmpty()) {
+		m_typicalLabelSize = getLabelGroup(page_info)->boundingRect().size();
 	}
-	std::auto_ptr<CompositeItem> composite(
-		getCompositeItem(0, page_info)
-	);
-	composite->setPos(0.0, offset);
-	composite->updateSceneRect(m_sceneRect);
 	
-	QPointF const pos_delta(0.0, composite->boundingRect().height() + SPACING);
-	
-	Item const item(page_info, composite.get());
+	Item const item(page_info);
+	measure(item);
 	std::pair<ItemsInOrder::iterator, bool> const ins(
 		m_itemsInOrder.insert(ord_it, item)
 	);
-	composite->setItem(&*ins.first);
-	m_graphicsScene.addItem(composite.release());
-	
-	ItemsInOrder::iterator const ord_end(m_itemsInOrder.end());
-	for (; ord_it != ord_end; ++ord_it) {
-		ord_it->composite->setPos(ord_it->composite->pos() + pos_delta);
-		ord_it->composite->updateSceneRect(m_sceneRect);
-	}
 	
-	commitSceneRect();
+	rebuildLayoutIndex();
+	relayout(ins.first->layoutIdx);
+	updateVisibleItems();
 }
 
 void
 ThumbnailSequence::Impl::removePages(std::set<PageId> const& to_remove)
 {
-	m_sceneRect = QRectF(0, 0, 0, 0);
-
 	std::set<PageId>::const_iterator const to_remove_end(to_remove.end());
-	QPointF pos_delta(0, 0);
+	size_t first_removed = m_layout.size();
 
 	ItemsInOrder::iterator ord_it(m_itemsInOrder.begin());
 	ItemsInOrder::iterator const ord_end(m_itemsInOrder.end());
 	while (ord_it != ord_end) {
 		if (to_remove.find(ord_it->pageInfo.id()) == to_remove_end) {
 			// Keeping this page.
-			if (pos_delta != QPointF(0, 0)) {
-				ord_it->composite->setPos(ord_it->composite->pos() + pos_delta);
-			}
-			ord_it->composite->updateSceneRect(m_sceneRect);
 			++ord_it;
 		} else {
 			// Removing this page.
 			if (m_pSelectionLeader == &*ord_it) {
 				m_pSelectionLeader = 0;
 			}
-			pos_delta.ry() -= ord_it->composite->boundingRect().height() + SPACING;
-			delete ord_it->composite;
+			first_removed = std::min(first_removed, ord_it->layoutIdx);
+			dematerialize(*ord_it);
 			m_itemsInOrder.erase(ord_it++);
 		}
 	}
 
-	commitSceneRect();
+	rebuildLayoutIndex();
+	relayout(first_removed);
+	updateVisibleItems();
 }
 
 bool
@@ -997,9 +1051,7 @@ ThumbnailSequence::Impl::selectionLeaderSceneRect() const
 		return QRectF();
 	}
 	
-	return m_pSelectionLeader->composite->mapToScene(
-		m_pSelectionLeader->composite->boundingRect()
-	).boundingRect();
+	return m_pSelectionLeader->sceneRect();
 }
 
 std::set<PageId>
@@ -1051,10 +1103,7 @@ void
 ThumbnailSequence::Impl::sceneContextMenuEvent(QGraphicsSceneContextMenuEvent* evt)
 {
 	if (!m_itemsInOrder.empty()) {
-		CompositeItem* composite = m_itemsInOrder.back().composite;
-		QRectF const last_thumb_rect(
-			composite->mapToScene(composite->boundingRect()).boundingRect()
-		);
+		QRectF const last_thumb_rect(m_itemsInOrder.back().sceneRect());
 		if (evt->scenePos().y() <= last_thumb_rect.bottom()) {
 			return;
 		}
@@ -1091,9 +1140,9 @@ ThumbnailSequence::Impl::selectItemWithControl(ItemsById::iterator const& id_it)
 		m_pSelectionLeader->setSelectionLeader(true);
 		moveToSelected(m_pSelectionLeader);
 		
-		m_rOwner.emitNewSelectionLeader(
+		announceSelectionLeader(
 			m_pSelectionLeader->pageInfo,
-			m_pSelectionLeader->composite, flags
+			m_pSelectionLeader->sceneRect(), flags
 		);
 		return;
 	}
@@ -1101,9 +1150,9 @@ ThumbnailSequence::Impl::selectItemWithControl(ItemsById::iterator const& id_it)
 	if (!multipleItemsSelected()) {
 		// Clicked on the only selected item.
 		flags |= REDUNDANT_SELECTION;
-		m_rOwner.emitNewSelectionLeader(
+		announceSelectionLeader(
 			m_pSelectionLeader->pageInfo,
-			m_pSelectionLeader->composite, flags
+			m_pSelectionLeader->sceneRect(), flags
 		);
 		return;
 	}
@@ -1145,8 +1194,8 @@ ThumbnailSequence::Impl::selectItemWithControl(ItemsById::iterator const& id_it)
 	m_pSelectionLeader->setSelectionLeader(true);
 	// No need to moveToSelected() as it was and remains selected.
 	
-	m_rOwner.emitNewSelectionLeader(
-		m_pSelectionLeader->pageInfo, m_pSelectionLeader->composite, flags
+	announceSelectionLeader(
+		m_pSelectionLeader->pageInfo, m_pSelectionLeader->sceneRect(), flags
 	);
 }
 
@@ -1209,7 +1258,7 @@ ThumbnailSequence::Impl::selectItemWithShift(ItemsById::iterator const& id_it)
 	m_pSelectionLeader = &*id_it;
 	m_pSelectionLeader->setSelectionLeader(true);
 	
-	m_rOwner.emitNewSelectionLeader(id_it->pageInfo, id_it->composite, flags);
+	announceSelectionLeader(id_it->pageInfo, id_it->sceneRect(), flags);
 }
 
 void
@@ -1226,7 +1275,7 @@ ThumbnailSequence::Impl::selectItemNoModifiers(ItemsById::iterator const& id_it)
 	m_pSelectionLeader->setSelectionLeader(true);
 	moveToSelected(m_pSelectionLeader);
 	
-	m_rOwner.emitNewSelectionLeader(id_it->pageInfo, id_it->composite, flags);
+	announceSelectionLeader(id_it->pageInfo, id_it->sceneRect(), flags);
 }
 
 void
@@ -1234,12 +1283,9 @@ ThumbnailSequence::Impl::clear()
 {
 	m_pSelectionLeader = 0;
 	
-	ItemsInOrder::iterator it(m_itemsInOrder.begin());
-	ItemsInOrder::iterator const end(m_itemsInOrder.end());
-	while (it != end) {
-		delete it->composite;
-		m_itemsInOrder.erase(it++);
-	}
+	dematerializeAll();
+	m_items.clear();
+	m_layout.clear();
 	
 	assert(m_graphicsScene.items().empty());
 	
@@ -1403,6 +1449,255 @@ ThumbnailSequence::Impl::getCompositeItem(
 	return composite;
 }
 
+void
+ThumbnailSequence::Impl::materialize(Item const& item)
+{
+	std::auto_ptr<CompositeItem> composite(getCompositeItem(&item, item.pageInfo));
+	composite->setPos(0.0, item.offset);
+	composite->updateAppearence(item.isSelected(), item.isSelectionLeader());
+	
+	item.incompleteThumbnail = composite->incompleteThumbnail();
+	item.thumbSize = composite->thumbSize();
+	item.localRect = composite->boundingRect();
+	m_typicalLabelSize = composite->labelSize();
+	
+	if (item.composite) {
+		delete item.composite;
+	} else {
+		m_materialized.push_back(&item);
+	}
+	item.composite = composite.release();
+	m_graphicsScene.addItem(item.composite);
+}
+
+void
+ThumbnailSequence::Impl::dematerialize(Item const& item)
+{
+	if (!item.composite) {
+		return;
+	}
+	
+	delete item.composite;
+	item.composite = 0;
+	m_materialized.erase(
+		std::find(m_materialized.begin(), m_materialized.end(), &item)
+	);
+}
+
+void
+ThumbnailSequence::Impl::dematerializeAll()
+{
+	BOOST_FOREACH(Item const* item, m_materialized) {
+		delete item->composite;
+		item->composite = 0;
+	}
+	m_materialized.clear();
+}
+
+void
+ThumbnailSequence::Impl::measure(Item const& item)
+{
+	std::auto_ptr<QGraphicsItem> const thumb(getThumbnail(item.pageInfo));
+	item.incompleteThumbnail = dynamic_cast<IncompleteThumbnail*>(thumb.get()) != 0;
+	item.thumbSize = thumb->boundingRect().size();
+	item.localRect = CompositeItem::estimateBoundingRect(
+		item.thumbSize, m_typicalLabelSize
+	);
+}
+
+void
+ThumbnailSequence::Impl::estimate(Item const& item)
+{
+	item.thumbSize = m_maxLogicalThumbSize;
+	item.localRect = CompositeItem::estimateBoundingRect(
+		item.thumbSize, m_typicalLabelSize
+	);
+}
+
+int
+ThumbnailSequence::Impl::reposition(Item const& item)
+{
+	ItemsById::iterator const id_it(m_itemsById.find(item.pageId()));
+	ItemsInOrder::iterator after_old(m_items.project<ItemsInOrderTag>(id_it));
+	// Notice after_old++ below.
+
+	// Move our item to the beginning of m_itemsInOrder, to make it out of range
+	// we are going to pass to itemInsertPosition().
+	m_itemsInOrder.relocate(m_itemsInOrder.begin(), after_old++);
+
+	int dist = 0;
+	ItemsInOrder::iterator const after_new(
+		itemInsertPosition(
+			++m_itemsInOrder.begin(), m_itemsInOrder.end(),
+			item.pageId(), item.incompleteThumbnail,
+			after_old, &dist
+		)
+	);
+
+	// Move our item to its intended position.
+	m_itemsInOrder.relocate(after_new, m_itemsInOrder.begin());
+	
+	return dist;
+}
+
+void
+ThumbnailSequence::Impl::rebuildLayoutIndex()
+{
+	m_layout.clear();
+	m_layout.reserve(m_items.size());
+	BOOST_FOREACH(Item const& item, m_itemsInOrder) {
+		item.layoutIdx = m_layout.size();
+		m_layout.push_back(&item);
+	}
+}
+
+void
+ThumbnailSequence::Impl::relayout(size_t const from)
+{
+	double offset = 0.0;
+	if (from > 0 && from <= m_layout.size()) {
+		Item const* prev = m_layout[from - 1];
+		offset = prev->offset + prev->localRect.height() + SPACING;
+	}
+	
+	for (size_t i = from; i < m_layout.size(); ++i) {
+		Item const* item = m_layout[i];
+		if (item->offset != offset) {
+			item->offset = offset;
+			if (item->composite) {
+				item->composite->setPos(0.0, offset);
+			}
+		}
+		offset += item->localRect.height() + SPACING;
+	}
+	
+	// The scene spans the widest thumbnail horizontally,
+	// and the composite items vertically.
+	m_sceneRect = QRectF(0.0, 0.0, 0.0, 0.0);
+	if (!m_layout.empty()) {
+		double max_thumb_width = 0.0;
+		BOOST_FOREACH(Item const* item, m_layout) {
+			max_thumb_width = std::max(max_thumb_width, item->thumbSize.width());
+		}
+		double const top = m_layout.front()->sceneRect().top();
+		double const bottom = m_layout.back()->sceneRect().bottom();
+		m_sceneRect = QRectF(
+			-0.5 * max_thumb_width, top, max_thumb_width, bottom - top
+		);
+	}
+	commitSceneRect();
+}
+
+void
+ThumbnailSequence::Impl::updateVisibleItems()
+{
+	if (!m_pView) {
+		return;
+	}
+	
+	// Materializing an item reveals its real height, which moves the items
+	// following it, and whether its thumbnail is incomplete, which may move
+	// the item itself.  So we repeat until the layout settles.
+	bool leader_materialized = false;
+	for (int pass = 0; pass < 3; ++pass) {
+		QRectF const visible(
+			m_pView->mapToScene(m_pView->viewport()->rect()).boundingRect()
+		);
+		double const margin = visible.height() * PREFETCH_SCREENS;
+		double const top = visible.top() - margin;
+		double const bottom = visible.bottom() + margin;
+		
+		// Find the first item not entirely above the area.
+		size_t lo = 0;
+		size_t hi = m_layout.size();
+		while (lo < hi) {
+			size_t const mid = (lo + hi) / 2;
+			if (m_layout[mid]->sceneRect().bottom() < top) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		size_t const first = lo;
+		size_t last = first;
+		size_t first_resized = m_layout.size();
+		std::vector<Item const*> misplaced;
+		
+		for (; last < m_layout.size(); ++last) {
+			Item const& item = *m_layout[last];
+			if (item.sceneRect().top() > bottom) {
+				break;
+			}
+			if (!item.composite) {
+				QRectF const old_rect(item.localRect);
+				QSizeF const old_thumb_size(item.thumbSize);
+				bool const was_incomplete = item.incompleteThumbnail;
+				materialize(item);
+				if (item.localRect != old_rect || item.thumbSize != old_thumb_size) {
+					first_resized = std::min(first_resized, last + 1);
+				}
+				if (m_ptrOrderProvider.get() && item.incompleteThumbnail != was_incomplete) {
+					misplaced.push_back(&item);
+				}
+				if (&item == m_pSelectionLeader) {
+					leader_materialized = true;
+				}
+			}
+		}
+		
+		// Get rid of composite items outside of [first, last).
+		std::vector<Item const*> materialized;
+		materialized.reserve(last - first);
+		BOOST_FOREACH(Item const* item, m_materialized) {
+			if (item->layoutIdx >= first && item->layoutIdx < last) {
+				materialized.push_back(item);
+			} else {
+				delete item->composite;
+				item->composite = 0;
+			}
+		}
+		m_materialized.swap(materialized);
+		
+		if (!misplaced.empty()) {
+			// Items between the old and the new positions of each
+			// misplaced item change their positions.
+			BOOST_FOREACH(Item const* item, misplaced) {
+				first_resized = std::min(first_resized, item->layoutIdx);
+				reposition(*item);
+			}
+			rebuildLayoutIndex();
+			BOOST_FOREACH(Item const* item, misplaced) {
+				first_resized = std::min(first_resized, item->layoutIdx);
+			}
+		}
+		
+		if (first_resized == m_layout.size()) {
+			break;
+		}
+		relayout(first_resized);
+	}
+	
+	// The selection leader may have been announced with an estimated
+	// rectangle.  Once it has its real geometry, announce it again,
+	// but only if that's different, or the view would snap to it
+	// whenever scrolling brings it back.
+	if (leader_materialized && m_pSelectionLeader->isSelectionLeader()
+			&& m_pSelectionLeader->sceneRect() != m_announcedLeaderRect) {
+		announceSelectionLeader(
+			m_pSelectionLeader->pageInfo, m_pSelectionLeader->sceneRect(),
+			REDUNDANT_SELECTION
+		);
+	}
+}
+
+void
+ThumbnailSequence::Impl::announceSelectionLeader(
+	PageInfo const& page_info, QRectF const& thumb_rect, SelectionFlags const flags)
+{
+	m_announcedLeaderRect = thumb_rect;
+	m_rOwner.emitNewSelectionLeader(page_info, thumb_rect, flags);
+}
+
 void
 ThumbnailSequence::Impl::commitSceneRect()
 {
@@ -1416,10 +1711,12 @@ ThumbnailSequence::Impl::commitSceneRect()
 
 /*==================== ThumbnailSequence::Item ======================*/
 
-ThumbnailSequence::Item::Item(PageInfo const& page_info, CompositeItem* comp_item)
+ThumbnailSequence::Item::Item(PageInfo const& page_info)
 :	pageInfo(page_info),
-	composite(comp_item),
-	incompleteThumbnail(comp_item->incompleteThumbnail()),
+	composite(0),
+	incompleteThumbnail(false),
+	offset(0.0),
+	layoutIdx(0),
 	m_isSelected(false),
 	m_isSelectionLeader(false)
 {
@@ -1433,6 +1730,10 @@ ThumbnailSequence::Item::setSelected(bool selected) const
 	m_isSelected = selected;
 	m_isSelectionLeader = m_isSelectionLeader && selected;
 	
+	if (!composite) {
+		// Will be taken care of when materialized.
+		return;
+	}
 	if (was_selected != m_isSelected || was_selection_leader != m_isSelectionLeader) {
 		composite->updateAppearence(m_isSelected, m_isSelectionLeader);
 	}
@@ -1449,6 +1750,10 @@ ThumbnailSequence::Item::setSelectionLeader(bool selection_leader) const
 	m_isSelected = m_isSelected || selection_leader;
 	m_isSelectionLeader = selection_leader;
 	
+	if (!composite) {
+		// Will be taken care of when materialized.
+		return;
+	}
 	if (was_selected != m_isSelected || was_selection_leader != m_isSelectionLeader) {
 		composite->updateAppearence(m_isSelected, m_isSelectionLeader);
 	}
@@ -1530,11 +1835,10 @@ ThumbnailSequence::CompositeItem::CompositeItem(
 	QSizeF const thumb_size(thumbnail->boundingRect().size());
 	QSizeF const label_size(label_group->boundingRect().size());
 	
-	int const thumb_label_spacing = 1;
 	thumbnail->setPos(-0.5 * thumb_size.width(), 0.0);
 	label_group->setPos(
 		thumbnail->pos().x() + thumb_size.width() - label_size.width(),
-		thumb_size.height() + thumb_label_spacing
+		thumb_size.height() + THUMB_LABEL_SPACING
 	);
 	
 	addToGroup(thumbnail.release());
@@ -1550,20 +1854,32 @@ ThumbnailSequence::CompositeItem::incompleteThumbnail() const
 	return dynamic_cast<IncompleteThumbnail*>(m_pThumb) != 0;
 }
 
-void
-ThumbnailSequence::CompositeItem::updateSceneRect(QRectF& scene_rect)
+QSizeF
+ThumbnailSequence::CompositeItem::thumbSize() const
 {
-	QRectF rect(m_pThumb->boundingRect());
-	rect.translate(m_pThumb->pos());
-	rect.translate(pos());
-	
-	QRectF bounding_rect(boundingRect());
-	bounding_rect.translate(pos());
-	
-	rect.setTop(bounding_rect.top());
-	rect.setBottom(bounding_rect.bottom());
-	
-	scene_rect |= rect;
+	return m_pThumb->boundingRect().size();
+}
+
+QSizeF
+ThumbnailSequence::CompositeItem::labelSize() const
+{
+	return m_pLabelGroup->boundingRect().size();
+}
+
+QRectF
+ThumbnailSequence::CompositeItem::estimateBoundingRect(
+	QSizeF const& thumb_size, QSizeF const& label_size)
+{
+	// Mirrors the placement done by the constructor and the
+	// adjustments done by boundingRect().
+	double const half_width = 0.5 * thumb_size.width();
+	QRectF rect(
+		-half_width, 0.0, thumb_size.width(),
+		thumb_size.height() + THUMB_LABEL_SPACING + label_size.height()
+	);
+	rect.setLeft(std::min(rect.left(), half_width - label_size.width()));
+	rect.adjust(-100, -5, 100, 3);
+	return rect;
 }
 
 void
@@ -220,6 +220,8 @@ signals:
 	 * below the last page.
 	 */
 	void pastLastPageContextMenuRequested(QPoint const& screen_pos);
+private slots:
+	void viewportChanged();
 private:
 	class Item;
 	class Impl;
@@ -229,7 +231,7 @@ private:
 	class CompositeItem;
 	
 	void emitNewSelectionLeader(
-		PageInfo const& page_info, CompositeItem const* composite,
+		PageInfo const& page_info, QRectF const& thumb_rect,
 		SelectionFlags flags);
 	
 	std::auto_ptr<Impl> m_ptrImpl;
@@ -20,15 +20,27 @@
 #include "ImageMetadata.h"
 #include "Dpi.h"
 #include "Dpm.h"
+#include "NonCopyable.h"
 #include <QtGlobal>
 #include <QSysInfo>
 #include <QIODevice>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QString>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QImage>
 #include <QColor>
 #include <QSize>
 #include <QDebug>
 #include <tiff.h>
 #include <tiffio.h>
+#include <boost/shared_ptr.hpp>
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
 #include <new>
 #include <assert.h>
 
@@ -64,6 +76,85 @@ private:
 };
 
 
+/**
+ * \brief A TIFF file opened by HandlePool.
+ */
+class TiffReader::OpenFile
+{
+	DECLARE_NON_COPYABLE(OpenFile)
+public:
+	OpenFile(QString const& file_path, qint64 file_size, QDateTime const& last_modified)
+	: filePath(file_path), fileSize(file_size),
+	lastModified(last_modified), file(file_path) {}
+	
+	QString const filePath;
+	qint64 const fileSize;
+	QDateTime const lastModified;
+	QFile file;
+	TiffHeader header;
+	
+	/**
+	 * Declared after the file, as it has to be closed first.
+	 */
+	std::auto_ptr<TiffHandle> tif;
+	
+	/**
+	 * Offsets of image file directories, indexed by page number.
+	 */
+	std::vector<toff_t> dirOffsets;
+};
+
+
+/**
+ * \brief Keeps multi-page TIFF files open and indexes their directories.
+ *
+ * libtiff can only find a directory by number by walking the chain of
+ * directories from the first one.  We do that once per file, remembering
+ * the offset of every directory.  The index outlives the file handles,
+ * and is discarded if the file's size or modification time changes.
+ */
+class TiffReader::HandlePool
+{
+public:
+	/**
+	 * \brief Takes an idle file from the pool or opens a new one.
+	 *
+	 * Returns a null pointer if the file can't be opened as TIFF.
+	 * A file that's taken isn't shared with other threads.
+	 */
+	boost::shared_ptr<OpenFile> checkOut(QString const& file_path);
+	
+	/**
+	 * \brief Returns a file to the pool.
+	 *
+	 * Single-page files are closed, as are the least recently used
+	 * ones when there are too many of them.
+	 */
+	void checkIn(boost::shared_ptr<OpenFile> const& file);
+private:
+	enum { MAX_IDLE_FILES = 4 };
+	
+	struct DirIndex
+	{
+		qint64 fileSize;
+		QDateTime lastModified;
+		std::vector<toff_t> dirOffsets;
+	};
+	
+	QMutex m_mutex;
+	
+	/**
+	 * The most recently used files come first.
+	 */
+	std::list<boost::shared_ptr<OpenFile> > m_idleFiles;
+	
+	std::map<QString, DirIndex> m_dirIndexes;
+};
+
+
+TiffReader::HandlePool TiffReader::m_handlePool;
+
+
 template<typename T>
 class TiffReader::TiffBuffer
 {
@@ -297,6 +388,36 @@ TiffReader::readImage(QIODevice& device, int const page_num)
 		return QImage();
 	}
 	
+	return readCurrentPage(tif, header);
+}
+
+QImage
+TiffReader::readImage(QString const& file_path, int const page_num)
+{
+	boost::shared_ptr<OpenFile> const file(m_handlePool.checkOut(file_path));
+	if (!file.get()) {
+		return QImage();
+	}
+	
+	if (page_num < 0 || page_num >= (int)file->dirOffsets.size()) {
+		m_handlePool.checkIn(file);
+		return QImage();
+	}
+	
+	// Should an exception be thrown, the file will be closed
+	// rather than returned to the pool.
+	QImage image;
+	if (TIFFSetSubDirectory(file->tif->handle(), file->dirOffsets[page_num])) {
+		image = readCurrentPage(*file->tif, file->header);
+	}
+	
+	m_handlePool.checkIn(file);
+	return image;
+}
+
+QImage
+TiffReader::readCurrentPage(TiffHandle const& tif, TiffHeader const& header)
+{
 	TiffInfo const info(tif, header);
 	
 	ImageMetadata const metadata(currentPageMetadata(tif));
@@ -511,3 +632,100 @@ TiffReader::readAndUnpackLines(
 		}
 	}
 }
+
+
+/*=========================== TiffReader::HandlePool =========================*/
+
+boost::shared_ptr<TiffReader::OpenFile>
+TiffReader::HandlePool::checkOut(QString const& file_path)
+{
+	QFileInfo const file_info(file_path);
+	qint64 const file_size = file_info.size();
+	QDateTime const last_modified(file_info.lastModified());
+	
+	std::vector<toff_t> dir_offsets;
+	
+	{
+		QMutexLocker const locker(&m_mutex);
+		
+		std::list<boost::shared_ptr<OpenFile> >::iterator it(m_idleFiles.begin());
+		while (it != m_idleFiles.end()) {
+			OpenFile const& file = **it;
+			if (file.filePath != file_path) {
+				++it;
+			} else if (file.fileSize == file_size && file.lastModified == last_modified) {
+				boost::shared_ptr<OpenFile> const taken(*it);
+				m_idleFiles.erase(it);
+				return taken;
+			} else {
+				// The file was changed since we opened it.
+				it = m_idleFiles.erase(it);
+			}
+		}
+		
+		std::map<QString, DirIndex>::const_iterator const idx(
+			m_dirIndexes.find(file_path)
+		);
+		if (idx != m_dirIndexes.end() && idx->second.fileSize == file_size
+				&& idx->second.lastModified == last_modified) {
+			dir_offsets = idx->second.dirOffsets;
+		}
+	}
+	
+	boost::shared_ptr<OpenFile> file(
+		new OpenFile(file_path, file_size, last_modified)
+	);
+	if (!file->file.open(QIODevice::ReadOnly)) {
+		return boost::shared_ptr<OpenFile>();
+	}
+	
+	file->header = readHeader(file->file);
+	if (!checkHeader(file->header)) {
+		return boost::shared_ptr<OpenFile>();
+	}
+	
+	file->tif.reset(
+		new TiffHandle(
+			TIFFClientOpen(
+				"file", "rBm", &file->file, &deviceRead, &deviceWrite,
+				&deviceSeek, &deviceClose, &deviceSize,
+				&deviceMap, &deviceUnmap
+			)
+		)
+	);
+	if (!file->tif->handle()) {
+		return boost::shared_ptr<OpenFile>();
+	}
+	
+	if (dir_offsets.empty()) {
+		TIFF* const tif = file->tif->handle();
+		do {
+			dir_offsets.push_back(TIFFCurrentDirOffset(tif));
+		} while (TIFFReadDirectory(tif));
+		
+		QMutexLocker const locker(&m_mutex);
+		DirIndex& index = m_dirIndexes[file_path];
+		index.fileSize = file_size;
+		index.lastModified = last_modified;
+		index.dirOffsets = dir_offsets;
+	}
+	
+	file->dirOffsets.swap(dir_offsets);
+	return file;
+}
+
+void
+TiffReader::HandlePool::checkIn(boost::shared_ptr<OpenFile> const& file)
+{
+	if (file->dirOffsets.size() <= 1) {
+		// Single-page files are cheap to open.
+		return;
+	}
+	
+	QMutexLocker const locker(&m_mutex);
+	
+	m_idleFiles.push_front(file);
+	while (m_idleFiles.size() > MAX_IDLE_FILES) {
+		m_idleFiles.pop_back();
+	}
+}
@@ -24,6 +24,7 @@
 
 class QIODevice;
 class QImage;
+class QString;
 class ImageMetadata;
 class Dpi;
 
@@ -46,11 +47,30 @@ public:
 	 * \return The resulting image, or a null image in case of failure.
 	 */
 	static QImage readImage(QIODevice& device, int page_num = 0);
+	
+	/**
+	 * \brief Reads a page of a TIFF file.
+	 *
+	 * Unlike the QIODevice version, this one keeps a few multi-page
+	 * files open between calls, and remembers where each of their
+	 * pages is located, so that reading any page takes a single seek
+	 * rather than walking the directory chain from the start.
+	 * This function is thread-safe.
+	 *
+	 * \return The resulting image, or a null image in case of failure.
+	 */
+	static QImage readImage(QString const& file_path, int page_num = 0);
 private:
 	class TiffHeader;
 	class TiffHandle;
 	struct TiffInfo;
 	template<typename T> class TiffBuffer;
+	class OpenFile;
+	class HandlePool;
+	
+	static QImage readCurrentPage(TiffHandle const& tif, TiffHeader const& header);
+	
+	static HandlePool m_handlePool;
 	
 	static TiffHeader readHeader(QIODevice& device);
 	
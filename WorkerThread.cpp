@@ -18,10 +18,16 @@
 #include "WorkerThread.h"
 #include "WorkerThread.h.moc"
 #include "ThreadPriority.h"
+#include "MemoryBudget.h"
+#include <boost/bind.hpp>
 #include <QCoreApplication>
 #include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
 #include <QEvent>
 #include <QSettings>
+#include <QTime>
 #include <assert.h>
 
 #if defined(Q_OS_LINUX) // For Linux updatePriority()
@@ -29,6 +35,61 @@
 #include <errno.h>
 #include <sys/resource.h>
 #endif
+#include <deque>
+
+/**
+ * \brief Runs BackgroundTask continuations, one at a time, in FIFO order.
+ *
+ * Also relays the results of tasks that finished without a continuation,
+ * so that the results come out in the order the tasks were submitted.
+ */
+class WorkerThread::ContinuationThread : public QThread
+{
+public:
+	ContinuationThread(Impl& result_receiver);
+	
+	/**
+	 * \brief Waits for the thread to exit.  \see requestExit()
+	 */
+	virtual ~ContinuationThread();
+	
+	/**
+	 * \brief Makes the thread exit once the continuation being run finishes.
+	 *
+	 * Continuations still in the queue are discarded, and so will be
+	 * anything submitted afterwards.  Doesn't block.
+	 */
+	void requestExit();
+	
+	/**
+	 * \brief Queues a continuation or a finished result.
+	 *
+	 * Blocks while MAX_QUEUED items are already waiting, which keeps
+	 * the submitting thread from running too far ahead.
+	 */
+	void submit(BackgroundTaskPtr const& task,
+		BackgroundTask::Continuation const& continuation,
+		FilterResultPtr const& result);
+protected:
+	virtual void run();
+private:
+	enum { MAX_QUEUED = 1 };
+	
+	struct Item
+	{
+		BackgroundTaskPtr task;
+		BackgroundTask::Continuation continuation;
+		FilterResultPtr result;
+	};
+	
+	Impl& m_rResultReceiver;
+	QMutex m_mutex;
+	QWaitCondition m_cond;
+	std::deque<Item> m_queue;
+	bool m_started;
+	bool m_exiting;
+};
+
 
 class WorkerThread::Dispatcher : public QObject
 {
@@ -39,7 +100,11 @@ public:
 		ThreadRestartRequired
 	};
 
-	Dispatcher(Impl& owner);
+	/**
+	 * \param continuation_thread If provided, batch tasks are allowed
+	 *        to finish there.
+	 */
+	Dispatcher(Impl& owner, ContinuationThread* continuation_thread);
 
 	UpdatePriorityResult updateThreadPriority(BackgroundTask const& task);
 
@@ -49,7 +114,10 @@ protected:
 private:
 	void processTask(BackgroundTaskPtr const& task);
 
+	void postPreview(BackgroundTask* task, FilterResultPtr const& result);
+
 	Impl& m_rOwner;
+	ContinuationThread* m_pContinuationThread;
 
 	/**
 	 * This one will be set if we decide we need to restart
@@ -64,7 +132,7 @@ class WorkerThread::Impl : public QThread
 public:
 	enum { NormalExit = 0, ExitForRestart };
 
-	Impl(WorkerThread& owner);
+	Impl(WorkerThread& owner, bool pipelined);
 	
 	~Impl();
 	
@@ -79,6 +147,7 @@ private:
 	static QEvent::Type const ThreadRestartEvent = (QEvent::Type)(QEvent::User + 1);
 
 	WorkerThread& m_rOwner;
+	std::auto_ptr<ContinuationThread> m_ptrContinuationThread;
 	Dispatcher m_dispatcher;
 	bool m_threadStarted;
 };
@@ -98,14 +167,18 @@ private:
 class WorkerThread::TaskResultEvent : public QEvent
 {
 public:
-	TaskResultEvent(BackgroundTaskPtr const& task, FilterResultPtr const& result);
+	TaskResultEvent(BackgroundTaskPtr const& task,
+		FilterResultPtr const& result, bool preview = false);
 	
 	BackgroundTaskPtr const& task() const { return m_ptrTask; }
 	
 	FilterResultPtr const& result() const { return m_ptrResult; }
+	
+	bool isPreview() const { return m_preview; }
 private:
 	BackgroundTaskPtr m_ptrTask;
 	FilterResultPtr m_ptrResult;
+	bool m_preview;
 };
 
 
@@ -113,8 +186,9 @@ private:
 
 WorkerThread::WorkerThread(QObject* parent)
 :	QObject(parent),
-	m_ptrImpl(new Impl(*this))
+	m_pipelined(QSettings().value("settings/pipelined_batch_processing", true).toBool())
 {
+	m_ptrImpl.reset(new Impl(*this, m_pipelined));
 }
 
 WorkerThread::~WorkerThread()
@@ -127,6 +201,12 @@ WorkerThread::shutdown()
 	m_ptrImpl.reset();
 }
 
+int
+WorkerThread::batchPipelineDepth() const
+{
+	return m_pipelined ? 2 : 1;
+}
+
 void
 WorkerThread::performTask(BackgroundTaskPtr const& task)
 {
@@ -142,11 +222,20 @@ WorkerThread::emitTaskResult(
 	emit taskResult(task, result);
 }
 
+void
+WorkerThread::emitTaskPreview(
+	BackgroundTaskPtr const& task, FilterResultPtr const& result)
+{
+	emit taskPreview(task, result);
+}
+
 
 /*======================== WorkerThread::Dispatcher ========================*/
 
-WorkerThread::Dispatcher::Dispatcher(Impl& owner)
-:	m_rOwner(owner)
+WorkerThread::Dispatcher::Dispatcher(
+	Impl& owner, ContinuationThread* continuation_thread)
+:	m_rOwner(owner),
+	m_pContinuationThread(continuation_thread)
 {
 }
 
@@ -232,23 +321,67 @@ void
 WorkerThread::Dispatcher::processTask(BackgroundTaskPtr const& task)
 {
 	if (task->isCancelled()) {
+		task->releaseMemoryReservation();
 		return;
 	}
 
+	MemoryBudget::PeakMeter peak_meter;
+
+	if (task->type() == BackgroundTask::INTERACTIVE) {
+		// The handler doesn't hold a reference, as the task owns it.
+		task->setPreviewHandler(
+			boost::bind(&Dispatcher::postPreview, this, task.get(), _1)
+		);
+	}
+
+	bool const pipelined = m_pContinuationThread && task->type() == BackgroundTask::BATCH;
+	task->setContinuationAllowed(pipelined);
+
+	QTime timer;
+	timer.start();
 	FilterResultPtr const result((*task)());
-	if (result) {
+	task->addMeasuredTime(timer.elapsed());
+	task->recordCancellationLatency();
+	task->setPreviewHandler(BackgroundTask::PreviewHandler());
+	BackgroundTask::Continuation const continuation(task->takeContinuation());
+
+	qint64 const memory_peak = peak_meter.finish();
+	if (continuation.empty()) {
+		// With a continuation, we've only seen a part of the task.
+		// Its memory usage is going to be estimated instead.
+		task->setMeasuredPeakMemory(memory_peak);
+		task->releaseMemoryReservation();
+	}
+
+	if (pipelined) {
+		// Even if there is no continuation, the result has to wait
+		// for the results of the previous batch tasks.
+		m_pContinuationThread->submit(task, continuation, result);
+	} else if (result) {
 		QCoreApplication::postEvent(
 			&m_rOwner, new TaskResultEvent(task, result)
 		);
 	}
 }
 
+void
+WorkerThread::Dispatcher::postPreview(
+	BackgroundTask* const task, FilterResultPtr const& result)
+{
+	if (result && !task->isCancelled()) {
+		QCoreApplication::postEvent(
+			&m_rOwner, new TaskResultEvent(BackgroundTaskPtr(task), result, true)
+		);
+	}
+}
+
 
 /*========================== WorkerThread::Impl ============================*/
 
-WorkerThread::Impl::Impl(WorkerThread& owner)
+WorkerThread::Impl::Impl(WorkerThread& owner, bool const pipelined)
 :	m_rOwner(owner),
-	m_dispatcher(*this),
+	m_ptrContinuationThread(pipelined ? new ContinuationThread(*this) : 0),
+	m_dispatcher(*this, m_ptrContinuationThread.get()),
 	m_threadStarted(false)
 {
 	m_dispatcher.moveToThread(this);
@@ -257,7 +390,13 @@ WorkerThread::Impl::Impl(WorkerThread& owner)
 WorkerThread::Impl::~Impl()
 {
 	exit(NormalExit);
+	
+	// The dispatcher may be waiting for room in the continuation queue.
+	if (m_ptrContinuationThread.get()) {
+		m_ptrContinuationThread->requestExit();
+	}
 	wait();
+	m_ptrContinuationThread.reset();
 }
 
 void
@@ -289,7 +428,120 @@ WorkerThread::Impl::customEvent(QEvent* event)
 	}
 
 	if (TaskResultEvent* evt = dynamic_cast<TaskResultEvent*>(event)) {
-		m_rOwner.emitTaskResult(evt->task(), evt->result());
+		if (evt->isPreview()) {
+			m_rOwner.emitTaskPreview(evt->task(), evt->result());
+		} else {
+			m_rOwner.emitTaskResult(evt->task(), evt->result());
+		}
+	}
+}
+
+
+/*===================== WorkerThread::ContinuationThread ===================*/
+
+WorkerThread::ContinuationThread::ContinuationThread(Impl& result_receiver)
+:	m_rResultReceiver(result_receiver),
+	m_started(false),
+	m_exiting(false)
+{
+}
+
+WorkerThread::ContinuationThread::~ContinuationThread()
+{
+	requestExit();
+	wait();
+}
+
+void
+WorkerThread::ContinuationThread::requestExit()
+{
+	QMutexLocker locker(&m_mutex);
+	m_exiting = true;
+	m_queue.clear();
+	m_cond.wakeAll();
+}
+
+void
+WorkerThread::ContinuationThread::submit(
+	BackgroundTaskPtr const& task,
+	BackgroundTask::Continuation const& continuation,
+	FilterResultPtr const& result)
+{
+	QMutexLocker locker(&m_mutex);
+	
+	if (!m_started && !m_exiting) {
+		start();
+		m_started = true;
+	}
+	
+	while (m_queue.size() >= MAX_QUEUED && !m_exiting) {
+		m_cond.wait(&m_mutex);
+	}
+	if (m_exiting) {
+		return;
+	}
+	
+	Item item;
+	item.task = task;
+	item.continuation = continuation;
+	item.result = result;
+	m_queue.push_back(item);
+	m_cond.wakeAll();
+}
+
+void
+WorkerThread::ContinuationThread::run()
+{
+	ThreadPriority const prio(
+		ThreadPriority::load(
+			"settings/batch_processing_priority", ThreadPriority::Normal
+		)
+	);
+#if defined(Q_OS_LINUX)
+	// See the comment in Dispatcher::updateThreadPriority().
+	// Failures are ignored, as we can't restart this thread.
+	setpriority(PRIO_PROCESS, 0, prio.toPosixNiceLevel());
+#else
+	setPriority(prio.toQThreadPriority());
+#endif
+	
+	for (;;) {
+		Item item;
+		{
+			QMutexLocker locker(&m_mutex);
+			while (m_queue.empty() && !m_exiting) {
+				m_cond.wait(&m_mutex);
+			}
+			if (m_exiting) {
+				return;
+			}
+			item = m_queue.front();
+			m_queue.pop_front();
+			m_cond.wakeAll();
+		}
+		
+		FilterResultPtr result(item.result);
+		if (!item.continuation.empty() && !item.task->isCancelled()) {
+			// Not measured, but it does overlap with the measurements
+			// of the tasks running on the other thread.
+			MemoryBudget::PeakMeter const peak_meter;
+			QTime timer;
+			timer.start();
+			try {
+				result = item.continuation(*item.task);
+			} catch (BackgroundTask::CancelledException const&) {
+				result.reset();
+			}
+			item.task->addMeasuredTime(timer.elapsed());
+			item.task->recordCancellationLatency();
+		}
+		item.task->releaseMemoryReservation();
+		
+		if (result && !item.task->isCancelled()) {
+			QCoreApplication::postEvent(
+				&m_rResultReceiver, new TaskResultEvent(item.task, result)
+			);
+		}
 	}
 }
 
@@ -307,10 +559,11 @@ WorkerThread::PerformTaskEvent::PerformTaskEvent(
 /*====================== WorkerThread::TaskResultEvent =====================*/
 
 WorkerThread::TaskResultEvent::TaskResultEvent(
-	BackgroundTaskPtr const& task, FilterResultPtr const& result)
+	BackgroundTaskPtr const& task, FilterResultPtr const& result, bool const preview)
 :	QEvent(User),
 	m_ptrTask(task),
-	m_ptrResult(result)
+	m_ptrResult(result),
+	m_preview(preview)
 {
 }
 
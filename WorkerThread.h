@@ -41,19 +41,41 @@ public:
 	 * useful to prematuraly stop task processing.
 	 */
 	void shutdown();
+	
+	/**
+	 * \brief The number of batch tasks worth keeping submitted at once.
+	 *
+	 * With pipelining enabled, the output stage of a batch task runs on
+	 * a separate thread, so the next task can start before the previous
+	 * one is finished.  Results of batch tasks are still delivered in the
+	 * order they were submitted.
+	 */
+	int batchPipelineDepth() const;
 public slots:
 	void performTask(BackgroundTaskPtr const& task);
 signals:
 	void taskResult(BackgroundTaskPtr const& task, FilterResultPtr const& result);
+	
+	/**
+	 * \brief Emitted for results passed to BackgroundTask::reportPreview().
+	 *
+	 * Previews are only collected from interactive tasks.  If any,
+	 * they are emitted before taskResult() for the same task.
+	 */
+	void taskPreview(BackgroundTaskPtr const& task, FilterResultPtr const& result);
 private:
 	void emitTaskResult(BackgroundTaskPtr const& task, FilterResultPtr const& result);
 	
+	void emitTaskPreview(BackgroundTaskPtr const& task, FilterResultPtr const& result);
+	
 	class Impl;
 	class Dispatcher;
+	class ContinuationThread;
 	class PerformTaskEvent;
 	class TaskResultEvent;
 	
 	std::auto_ptr<Impl> m_ptrImpl;
+	bool m_pipelined;
 };
 
 #endif
@@ -0,0 +1,297 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "WriteBehindQueue.h"
+#include "MemoryBudget.h"
+#include "AtomicFileOverwriter.h"
+#include "TiffWriter.h"
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QIODevice>
+#include <boost/foreach.hpp>
+#include <deque>
+
+class WriteBehindQueue::Impl : public QThread
+{
+public:
+	Impl(IntrusivePtr<MemoryBudget> const& memory_budget,
+		JobDoneHandler const& job_done_handler);
+
+	virtual ~Impl();
+
+	void submit(IntrusivePtr<Job> const& job);
+
+	void writeNow(IntrusivePtr<Job> const& job);
+
+	bool isPending(PageId const& page_id) const;
+
+	void flush();
+protected:
+	virtual void run();
+private:
+	mutable QMutex m_mutex;
+	QWaitCondition m_cond;
+	std::deque<IntrusivePtr<Job> > m_queue;
+	IntrusivePtr<MemoryBudget> m_ptrMemoryBudget;
+	JobDoneHandler m_jobDoneHandler;
+
+	/**
+	 * The job being written by our thread, if any.
+	 */
+	IntrusivePtr<Job> m_ptrCurrentJob;
+
+	/**
+	 * The number of jobs queued or being written.
+	 */
+	int m_numUnfinished;
+	bool m_exiting;
+};
+
+
+WriteBehindQueue::WriteBehindQueue(
+	IntrusivePtr<MemoryBudget> const& memory_budget,
+	JobDoneHandler const& job_done_handler)
+:	m_ptrImpl(new Impl(memory_budget, job_done_handler))
+{
+}
+
+WriteBehindQueue::~WriteBehindQueue()
+{
+}
+
+void
+WriteBehindQueue::submit(IntrusivePtr<Job> const& job)
+{
+	m_ptrImpl->submit(job);
+}
+
+void
+WriteBehindQueue::writeNow(IntrusivePtr<Job> const& job)
+{
+	m_ptrImpl->writeNow(job);
+}
+
+bool
+WriteBehindQueue::isPending(PageId const& page_id) const
+{
+	return m_ptrImpl->isPending(page_id);
+}
+
+void
+WriteBehindQueue::flush()
+{
+	m_ptrImpl->flush();
+}
+
+
+/*========================== WriteBehindQueue::Job ==========================*/
+
+WriteBehindQueue::Job::Job(PageId const& page_id)
+:	m_pageId(page_id)
+{
+}
+
+WriteBehindQueue::Job::~Job()
+{
+}
+
+void
+WriteBehindQueue::Job::addImage(QString const& file_path, QImage const& image)
+{
+	m_files.push_back(File(file_path, image));
+}
+
+qint64
+WriteBehindQueue::Job::memoryUsage() const
+{
+	qint64 bytes = 0;
+	BOOST_FOREACH(File const& file, m_files) {
+		bytes += file.image.byteCount();
+	}
+	return bytes;
+}
+
+void
+WriteBehindQueue::Job::run()
+{
+	bool success = true;
+	BOOST_FOREACH(File const& file, m_files) {
+		if (!writeImage(file.filePath, file.image)) {
+			success = false;
+		}
+	}
+	m_files.clear();
+
+	finished(success);
+}
+
+bool
+WriteBehindQueue::Job::writeImage(QString const& file_path, QImage const& image)
+{
+	AtomicFileOverwriter overwriter;
+	QIODevice* const device = overwriter.startWriting(file_path);
+	if (!device) {
+		return false;
+	}
+
+	if (!TiffWriter::writeImage(*device, image)) {
+		overwriter.abort();
+		return false;
+	}
+
+	return overwriter.commit();
+}
+
+
+/*========================== WriteBehindQueue::Impl =========================*/
+
+WriteBehindQueue::Impl::Impl(
+	IntrusivePtr<MemoryBudget> const& memory_budget,
+	JobDoneHandler const& job_done_handler)
+:	m_ptrMemoryBudget(memory_budget),
+	m_jobDoneHandler(job_done_handler),
+	m_numUnfinished(0),
+	m_exiting(false)
+{
+	start();
+}
+
+WriteBehindQueue::Impl::~Impl()
+{
+	{
+		QMutexLocker const locker(&m_mutex);
+		m_exiting = true;
+		m_cond.wakeAll();
+	}
+	wait();
+}
+
+void
+WriteBehindQueue::Impl::submit(IntrusivePtr<Job> const& job)
+{
+	qint64 const bytes = job->memoryUsage();
+
+	QMutexLocker const locker(&m_mutex);
+
+	// If nothing is queued, waiting won't help.
+	while (!m_ptrMemoryBudget->tryReserve(bytes, m_numUnfinished == 0)) {
+		m_cond.wait(&m_mutex);
+	}
+
+	m_queue.push_back(job);
+	++m_numUnfinished;
+	m_cond.wakeAll();
+}
+
+void
+WriteBehindQueue::Impl::writeNow(IntrusivePtr<Job> const& job)
+{
+	int num_dropped = 0;
+	{
+		QMutexLocker const locker(&m_mutex);
+
+		std::deque<IntrusivePtr<Job> >::iterator it(m_queue.begin());
+		while (it != m_queue.end()) {
+			if ((*it)->pageId() == job->pageId()) {
+				m_ptrMemoryBudget->release((*it)->memoryUsage());
+				it = m_queue.erase(it);
+				--m_numUnfinished;
+				++num_dropped;
+			} else {
+				++it;
+			}
+		}
+		if (num_dropped) {
+			m_cond.wakeAll();
+		}
+
+		while (m_ptrCurrentJob && m_ptrCurrentJob->pageId() == job->pageId()) {
+			m_cond.wait(&m_mutex);
+		}
+	}
+
+	if (num_dropped && m_jobDoneHandler) {
+		m_jobDoneHandler();
+	}
+
+	job->run();
+}
+
+bool
+WriteBehindQueue::Impl::isPending(PageId const& page_id) const
+{
+	QMutexLocker const locker(&m_mutex);
+
+	if (m_ptrCurrentJob && m_ptrCurrentJob->pageId() == page_id) {
+		return true;
+	}
+	BOOST_FOREACH(IntrusivePtr<Job> const& job, m_queue) {
+		if (job->pageId() == page_id) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+WriteBehindQueue::Impl::flush()
+{
+	QMutexLocker const locker(&m_mutex);
+
+	while (m_numUnfinished > 0) {
+		m_cond.wait(&m_mutex);
+	}
+}
+
+void
+WriteBehindQueue::Impl::run()
+{
+	QMutexLocker locker(&m_mutex);
+
+	for (;;) {
+		while (m_queue.empty() && !m_exiting) {
+			m_cond.wait(&m_mutex);
+		}
+		if (m_queue.empty()) {
+			// Exiting, with everything written.
+			break;
+		}
+
+		m_ptrCurrentJob = m_queue.front();
+		m_queue.pop_front();
+		qint64 const bytes = m_ptrCurrentJob->memoryUsage();
+
+		locker.unlock();
+		m_ptrCurrentJob->run();
+		locker.relock();
+
+		m_ptrCurrentJob.reset();
+		m_ptrMemoryBudget->release(bytes);
+		--m_numUnfinished;
+		m_cond.wakeAll();
+
+		if (m_jobDoneHandler) {
+			locker.unlock();
+			m_jobDoneHandler();
+			locker.relock();
+		}
+	}
+}
@@ -0,0 +1,148 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WRITE_BEHIND_QUEUE_H_
+#define WRITE_BEHIND_QUEUE_H_
+
+#include "NonCopyable.h"
+#include "RefCountable.h"
+#include "IntrusivePtr.h"
+#include "PageId.h"
+#include <QString>
+#include <QImage>
+#include <QtGlobal>
+#include <boost/function.hpp>
+#include <memory>
+#include <vector>
+
+class MemoryBudget;
+
+/**
+ * \brief Writes images to disk on a dedicated thread.
+ *
+ * This lets batch processing go on with the next page while the output
+ * files of the previous one are being encoded and written.  Images that
+ * are queued or being written reserve their size from the memory budget.
+ * When they don't fit, submit() blocks until some of them are written.
+ * Jobs are written one at a time, in the order they were submitted.
+ *
+ * This class is thread-safe.
+ */
+class WriteBehindQueue : public RefCountable
+{
+	DECLARE_NON_COPYABLE(WriteBehindQueue)
+public:
+	/**
+	 * \brief A set of images to be written, followed by a completion action.
+	 */
+	class Job : public RefCountable
+	{
+	public:
+		/**
+		 * \param page_id The page whose files are written.  A later job
+		 *        for the same page supersedes this one.
+		 */
+		explicit Job(PageId const& page_id);
+
+		virtual ~Job();
+
+		PageId const& pageId() const { return m_pageId; }
+
+		void addImage(QString const& file_path, QImage const& image);
+
+		qint64 memoryUsage() const;
+
+		/**
+		 * \brief Writes the images and then calls finished().
+		 *
+		 * Images are written in TIFF format, each to a temporary
+		 * file first, which then replaces the target file.
+		 */
+		void run();
+	protected:
+		/**
+		 * \brief Called by run() after all images were written.
+		 *
+		 * \param success false if any of the images failed to be written.
+		 */
+		virtual void finished(bool success) = 0;
+	private:
+		struct File
+		{
+			QString filePath;
+			QImage image;
+
+			File(QString const& file_path, QImage const& img)
+			: filePath(file_path), image(img) {}
+		};
+
+		static bool writeImage(QString const& file_path, QImage const& image);
+
+		PageId m_pageId;
+		std::vector<File> m_files;
+	};
+
+	/**
+	 * \brief Called on the writing thread whenever a job leaves the queue,
+	 *        either written or dropped.
+	 */
+	typedef boost::function<void ()> JobDoneHandler;
+
+	explicit WriteBehindQueue(IntrusivePtr<MemoryBudget> const& memory_budget,
+		JobDoneHandler const& job_done_handler = JobDoneHandler());
+
+	/**
+	 * \brief Writes the jobs still in the queue and stops the thread.
+	 */
+	virtual ~WriteBehindQueue();
+
+	/**
+	 * \brief Queues a job for writing.
+	 *
+	 * Blocks while the job doesn't fit into the memory budget,
+	 * unless the queue is empty.
+	 */
+	void submit(IntrusivePtr<Job> const& job);
+
+	/**
+	 * \brief Writes a job on the calling thread, ahead of the queued ones.
+	 *
+	 * Queued jobs for the same page are dropped without being written,
+	 * as this one supersedes them.  If a job for the same page is being
+	 * written, it's waited for, so it can't overwrite this one's files.
+	 * Jobs for other pages don't delay this one.
+	 */
+	void writeNow(IntrusivePtr<Job> const& job);
+
+	/**
+	 * \brief Returns true if a job for the page is queued or being written.
+	 */
+	bool isPending(PageId const& page_id) const;
+
+	/**
+	 * \brief Waits until all the submitted jobs are complete.
+	 */
+	void flush();
+private:
+	class Impl;
+
+	std::auto_ptr<Impl> m_ptrImpl;
+};
+
+#endif
@@ -17,8 +17,6 @@
 */
 
 #include "Settings.h"
-#include "Utils.h"
-#include <QMutexLocker>
 #include <boost/foreach.hpp> // +
 
 namespace deskew
@@ -35,44 +33,34 @@ Settings::~Settings()
 void
 Settings::clear()
 {
-	QMutexLocker locker(&m_mutex);
 	m_perPageParams.clear();
 }
 
 void
 Settings::setPageParams(PageId const& page_id, Params const& params)
 {
-	QMutexLocker locker(&m_mutex);
-	Utils::mapSetValue(m_perPageParams, page_id, params);
+	m_perPageParams.set(page_id, params);
 }
 
 void
 Settings::clearPageParams(PageId const& page_id)
 {
-	QMutexLocker locker(&m_mutex);
 	m_perPageParams.erase(page_id);
 }
 
 std::auto_ptr<Params>
 Settings::getPageParams(PageId const& page_id) const
 {
-	QMutexLocker locker(&m_mutex);
-	
-	PerPageParams::const_iterator it(m_perPageParams.find(page_id));
-	if (it != m_perPageParams.end()) {
-		return std::auto_ptr<Params>(new Params(it->second));
-	} else {
-		return std::auto_ptr<Params>();
-	}
+	return m_perPageParams.get(page_id);
 }
 
 // +
 void
 Settings::setDegress(std::set<PageId> const& pages, Params const& params)
 {
-	QMutexLocker const locker(&m_mutex);
+	PerPageParams::Transaction transaction(m_perPageParams);
 	BOOST_FOREACH(PageId const& page, pages) {
-		Utils::mapSetValue(m_perPageParams, page, params);
+		transaction.set(page, params);
 	}
 }
 
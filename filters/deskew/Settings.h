@@ -23,9 +23,8 @@
 #include "NonCopyable.h"
 #include "PageId.h"
 #include "Params.h"
-#include <QMutex>
+#include "SnapshotMap.h"
 #include <memory>
-#include <map>
 #include <set> // +
 
 namespace deskew
@@ -49,9 +48,8 @@ public:
 	
 	void setDegress(std::set<PageId> const& pages, Params const& params); // +
 private:
-	typedef std::map<PageId, Params> PerPageParams;
+	typedef SnapshotMap<PageId, Params> PerPageParams;
 	
-	mutable QMutex m_mutex;
 	PerPageParams m_perPageParams;
 };
 
@@ -204,15 +204,15 @@ Task::cleanup(TaskStatus const& status, BinaryImage& image, Dpi const& dpi)
 	BinaryImage reduced_image;
 	
 	{
-		ReduceThreshold reductor(image);
+		std::vector<int> thresholds;
 		while (reduced_dpi.horizontal() >= 200 && reduced_dpi.vertical() >= 200) {
-			reductor.reduce(2);
+			thresholds.push_back(2);
 			reduced_dpi = Dpi(
 				reduced_dpi.horizontal() / 2,
 				reduced_dpi.vertical() / 2
 			);
 		}
-		reduced_image = reductor.image();
+		reduced_image = ReduceThreshold(image).reduce(thresholds).image();
 	}
 	
 	status.throwIfCancelled();
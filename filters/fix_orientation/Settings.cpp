@@ -17,7 +17,6 @@
 */
 
 #include "Settings.h"
-#include "Utils.h"
 #include <boost/foreach.hpp>
 
 namespace fix_orientation
@@ -34,7 +33,6 @@ Settings::~Settings()
 void
 Settings::clear()
 {
-	QMutexLocker locker(&m_mutex);
 	m_perImageRotation.clear();
 }
 
@@ -42,39 +40,28 @@ void
 Settings::applyRotation(
 	ImageId const& image_id, OrthogonalRotation const rotation)
 {
-	QMutexLocker locker(&m_mutex);
-	setImageRotationLocked(image_id, rotation);
+	m_perImageRotation.set(image_id, rotation);
 }
 
 void
 Settings::applyRotation(
 	std::set<PageId> const& pages, OrthogonalRotation const rotation)
 {
-	QMutexLocker locker(&m_mutex);
-	
+	PerImageRotation::Transaction transaction(m_perImageRotation);
 	BOOST_FOREACH(PageId const& page, pages) {
-		setImageRotationLocked(page.imageId(), rotation);
+		transaction.set(page.imageId(), rotation);
 	}
 }
 
 OrthogonalRotation
 Settings::getRotationFor(ImageId const& image_id) const
 {
-	QMutexLocker locker(&m_mutex);
-	
-	PerImageRotation::const_iterator it(m_perImageRotation.find(image_id));
-	if (it != m_perImageRotation.end()) {
-		return it->second;
+	PerImageRotation::SnapshotPtr const snapshot(m_perImageRotation.snapshot());
+	if (OrthogonalRotation const* rotation = snapshot->find(image_id)) {
+		return *rotation;
 	} else {
 		return OrthogonalRotation();
 	}
 }
 
-void
-Settings::setImageRotationLocked(
-	ImageId const& image_id, OrthogonalRotation const& rotation)
-{
-	Utils::mapSetValue(m_perImageRotation, image_id, rotation);
-}
-
 } // namespace fix_orientation
@@ -170,13 +170,14 @@ IntrusivePtr<Task>
 Filter::createTask(
 	PageId const& page_id,
 	IntrusivePtr<ThumbnailPixmapCache> const& thumbnail_cache,
+	IntrusivePtr<WriteBehindQueue> const& write_behind,
 	OutputFileNameGenerator const& out_file_name_gen,
 	bool const batch, bool const debug)
 {
 	return IntrusivePtr<Task>(
 		new Task(
 			IntrusivePtr<Filter>(this), m_ptrSettings,
-			thumbnail_cache, page_id, out_file_name_gen,
+			thumbnail_cache, write_behind, page_id, out_file_name_gen,
 			m_ptrOptionsWidget->lastTab(), batch, debug
 		)
 	);
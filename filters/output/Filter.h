@@ -31,6 +31,7 @@
 class PageId;
 class PageSelectionAccessor;
 class ThumbnailPixmapCache;
+class WriteBehindQueue;
 class OutputFileNameGenerator;
 class QString;
 
@@ -62,9 +63,16 @@ public:
 	virtual void loadSettings(
 		ProjectReader const& reader, QDomElement const& filters_el);
 	
+	/**
+	 * \param write_behind The queue batch processing writes output files
+	 *        through, or null if there is none.  Batch tasks queue their
+	 *        files there.  Other tasks write them right away, but first
+	 *        drop what's queued for the same page.
+	 */
 	IntrusivePtr<Task> createTask(
 		PageId const& page_id,
 		IntrusivePtr<ThumbnailPixmapCache> const& thumbnail_cache,
+		IntrusivePtr<WriteBehindQueue> const& write_behind,
 		OutputFileNameGenerator const& out_file_name_gen,
 		bool batch, bool debug);
 	
@@ -20,11 +20,17 @@
 #include "ImageView.h.moc"
 #include "ImagePresentation.h"
 #include "OutputMargins.h"
+#include "InteractionState.h"
+#include <QPainter>
+#include <QFontMetrics>
+#include <QRectF>
+#include <QString>
 
 namespace output
 {
 
-ImageView::ImageView(QImage const& image, QImage const& downscaled_image)
+ImageView::ImageView(
+	QImage const& image, QImage const& downscaled_image, bool const preliminary)
 :	ImageViewBase(
 		image, downscaled_image,
 		ImagePresentation(QTransform(), QRectF(image.rect())),
@@ -35,10 +41,37 @@ ImageView::ImageView(QImage const& image, QImage const& downscaled_image)
 {
 	rootInteractionHandler().makeLastFollower(m_dragHandler);
 	rootInteractionHandler().makeLastFollower(m_zoomHandler);
+	
+	if (preliminary) {
+		interactionState().setDefaultStatusTip(
+			tr("This is a low resolution preview.  The output is still being made.")
+		);
+		rootInteractionHandler().makeLastFollower(*this);
+	}
 }
 
 ImageView::~ImageView()
 {
 }
 
+void
+ImageView::onPaint(QPainter& painter, InteractionState const&)
+{
+	// Only called for previews.
+	
+	painter.setWorldMatrixEnabled(false);
+	
+	QString const text(tr("Preview"));
+	QFontMetrics const fm(painter.font());
+	QRectF rect(fm.boundingRect(text));
+	rect.adjust(-6, -3, 6, 3);
+	rect.moveTopLeft(QPointF(8, 8));
+	
+	painter.setPen(Qt::NoPen);
+	painter.setBrush(QColor(0, 0, 0, 150));
+	painter.drawRect(rect);
+	painter.setPen(Qt::white);
+	painter.drawText(rect, Qt::AlignCenter, text);
+}
+
 } // namespace output
@@ -20,22 +20,35 @@
 #define OUTPUT_IMAGEVIEW_H_
 
 #include "ImageViewBase.h"
+#include "InteractionHandler.h"
 #include "DragHandler.h"
 #include "ZoomHandler.h"
 #include <QColor>
 
+class QPainter;
+class InteractionState;
+
 class ImageTransformation;
 
 namespace output
 {
 
-class ImageView : public ImageViewBase
+class ImageView :
+	public ImageViewBase,
+	private InteractionHandler
 {
 	Q_OBJECT
 public:
-	ImageView(QImage const& image, QImage const& downscaled_image);
+	/**
+	 * \param preliminary Whether the image is a preview to be replaced
+	 *        by the real output.  Such an image is marked as a preview.
+	 */
+	ImageView(QImage const& image, QImage const& downscaled_image,
+		bool preliminary = false);
 	
 	virtual ~ImageView();
+protected:
+	virtual void onPaint(QPainter& painter, InteractionState const& interaction);
 private:
 	DragHandler m_dragHandler;
 	ZoomHandler m_zoomHandler;
@@ -33,6 +33,7 @@
 #include "ZoneSet.h"
 #include "PictureLayerProperty.h"
 #include "FillColorProperty.h"
+#include "FillZoneComparator.h"
 #include "CylindricalSurfaceDewarper.h"
 #include "TextLineTracer.h"
 #include "DewarpingPointMapper.h"
@@ -56,9 +57,11 @@
 #include "imageproc/DrawOver.h"
 #include "imageproc/AdjustBrightness.h"
 #include "imageproc/PolygonRasterizer.h"
+#include "imageproc/SpanBuffer.h"
 #include "imageproc/RasterDewarper.h"
 #include "imageproc/ConnectivityMap.h"
 #include "imageproc/InfluenceMap.h"
+#include "imageproc/PictureDetection.h"
 #include "config.h"
 #include <boost/foreach.hpp>
 #include <boost/bind.hpp>
@@ -74,6 +77,8 @@
 #include <QColor>
 #include <QPen>
 #include <QBrush>
+#include <QString>
+#include <QTime>
 #include <QtGlobal>
 #include <QDebug>
 #include <Qt>
@@ -106,16 +111,6 @@ struct RaiseAboveBackground
 	}
 };
 
-struct CombineInverted
-{
-	static uint8_t transform(uint8_t src, uint8_t dst) {
-		unsigned const dilated = dst;
-		unsigned const eroded = src;
-		unsigned const res = 255 - (255 - dilated) * eroded / 255;
-		return static_cast<uint8_t>(res);
-	}
-};
-
 /**
  * In picture areas we make sure we don't use pure black and pure white colors.
  * These are reserved for text areas.  This behaviour makes it possible to
@@ -311,6 +306,88 @@ OutputGenerator::outputContentRect() const
 	return QRect(m_contentRect.topLeft() - m_cropRect.topLeft(), m_contentRect.size());
 }
 
+qint64
+OutputGenerator::estimatePeakMemory(
+	QSize const& output_size, ColorParams const& color_params,
+	DewarpingMode const& dewarping_mode, DespeckleLevel const despeckle_level)
+{
+	RenderParams const render_params(color_params);
+
+	// Transformed grayscale image, its normalized version and the background.
+	double bytes_per_pixel = 3.0;
+
+	if (render_params.binaryOutput()) {
+		// The B/W content and mask, plus the Format_Mono result.
+		bytes_per_pixel += 0.5;
+	} else {
+		// Transformed colour image and the result, both 32 bits per pixel.
+		bytes_per_pixel += 8.0;
+	}
+
+	if (render_params.mixedOutput()) {
+		// Picture detection intermediates and the binarization mask.
+		bytes_per_pixel += 2.0;
+	}
+
+	if (despeckle_level != DESPECKLE_OFF) {
+		// Despeckling builds a 32-bit connectivity map.
+		bytes_per_pixel += 4.0;
+	}
+
+	if (dewarping_mode != DewarpingMode::OFF) {
+		// Warped and dewarped versions of most of the above coexist.
+		bytes_per_pixel *= 2.0;
+	}
+
+	qint64 const pixels = qint64(output_size.width()) * output_size.height();
+	return qint64(pixels * bytes_per_pixel);
+}
+
+double
+OutputGenerator::estimateCost(
+	QSize const& output_size, ColorParams const& color_params,
+	DewarpingMode const& dewarping_mode, DespeckleLevel const despeckle_level)
+{
+	RenderParams const render_params(color_params);
+
+	// Transformation to grayscale and illumination normalization.
+	double cost_per_pixel = 1.0;
+
+	if (render_params.binaryOutput()) {
+		cost_per_pixel += 0.5;
+	} else {
+		// Colour transformation and the colour post-processing.
+		cost_per_pixel += 1.0;
+	}
+
+	if (render_params.mixedOutput()) {
+		// Picture detection is a series of morphological operations.
+		cost_per_pixel += 3.0;
+	}
+
+	switch (despeckle_level) {
+		case DESPECKLE_OFF:
+			break;
+		case DESPECKLE_CAUTIOUS:
+			cost_per_pixel += 1.0;
+			break;
+		case DESPECKLE_NORMAL:
+			cost_per_pixel += 2.0;
+			break;
+		case DESPECKLE_AGGRESSIVE:
+			cost_per_pixel += 3.0;
+			break;
+	}
+
+	if (dewarping_mode != DewarpingMode::OFF) {
+		// Text line tracing, and everything is done twice.
+		cost_per_pixel *= 3.0;
+	}
+
+	double const pixels = double(output_size.width()) * output_size.height();
+	return pixels * cost_per_pixel;
+}
+
 QImage
 OutputGenerator::normalizeIlluminationGray(
 	TaskStatus const& status,
@@ -321,7 +398,8 @@ OutputGenerator::normalizeIlluminationGray(
 	GrayImage to_be_normalized(
 		transformToGray(
 			input, xform, target_rect,
-			Qt::black // <-- Important!
+			Qt::black, // <-- Important!
+			false, QSizeF(0.9, 0.9), &status
 		)
 	);
 	if (dbg) {
@@ -517,7 +595,10 @@ OutputGenerator::processAsIs(
 			return image;
 		}
 
-		out = transformToGray(input.grayImage(), m_toUncropped, m_cropRect, bg_color);
+		out = transformToGray(
+			input.grayImage(), m_toUncropped, m_cropRect, bg_color,
+			false, QSizeF(0.9, 0.9), &status
+		);
 	} else {
 		if (m_cropRect.isEmpty()) {
 			QImage image(1, 1, QImage::Format_RGB32);
@@ -525,7 +606,10 @@ OutputGenerator::processAsIs(
 			return image;
 		}
 		
-		out = transform(input.origImage(), m_toUncropped, m_cropRect, bg_color);
+		out = transform(
+			input.origImage(), m_toUncropped, m_cropRect, bg_color,
+			false, QSizeF(0.9, 0.9), &status
+		);
 	}
 
 	applyFillZonesInPlace(out, fill_zones);
@@ -597,7 +681,8 @@ OutputGenerator::processWithoutDewarping(
 	} else {
 		maybe_normalized = transform(
 			input.origImage(), m_toUncropped,
-			normalize_illumination_rect, Qt::white
+			normalize_illumination_rect, Qt::white,
+			false, QSizeF(0.9, 0.9), &status
 		);
 	}
 
@@ -701,7 +786,7 @@ OutputGenerator::processWithoutDewarping(
 			transform(
 				input.origImage(), m_toUncropped,
 				normalize_illumination_rect,
-				Qt::white
+				Qt::white, false, QSizeF(0.9, 0.9), &status
 			)
 		);
 		
@@ -887,7 +972,8 @@ OutputGenerator::processWithDewarping(
 		// Transform warped_gray_background to original image coordinates.
 		warped_gray_background = transformToGray(
 			warped_gray_background.toQImage(), background_to_original,
-			input.origImage().rect(), Qt::black, /*weak_background=*/true
+			input.origImage().rect(), Qt::black, /*weak_background=*/true,
+			QSizeF(0.9, 0.9), &status
 		);
 		if (dbg) {
 			dbg->add(warped_gray_background, "orig_background");
@@ -1053,7 +1139,7 @@ OutputGenerator::processWithDewarping(
 	QImage dewarped(
 		dewarp(
 			QTransform(), normalized_original, toOutput(),
-			distortion_model, depth_perception, bg_color
+			distortion_model, depth_perception, bg_color, status
 		)
 	);
 	normalized_original = QImage(); // Save memory.
@@ -1122,7 +1208,7 @@ OutputGenerator::processWithDewarping(
 			dewarp(
 				origToRectInUncroppedSpace(small_margins_rect), warped_bw_mask.toQImage(),
 				rectInUncroppedSpaceToOutput(small_margins_rect),
-				distortion_model, depth_perception, Qt::black
+				distortion_model, depth_perception, Qt::black, status
 			)
 		);
 		if (dbg) {
@@ -1222,7 +1308,8 @@ QImage
 OutputGenerator::dewarp(
 	QTransform const& orig_to_src, QImage const& src,
 	QTransform const& src_to_output, DistortionModel const& distortion_model,
-	DepthPerception const& depth_perception, QColor const& bg_color) const
+	DepthPerception const& depth_perception, QColor const& bg_color,
+	TaskStatus const& status) const
 {
 	CylindricalSurfaceDewarper const dewarper(
 		createDewarper(distortion_model, orig_to_src, depth_perception.value())
@@ -1237,7 +1324,7 @@ OutputGenerator::dewarp(
 	);
 
 	return RasterDewarper::dewarp(
-		src, m_cropRect.size(), dewarper, model_domain, bg_color
+		src, m_cropRect.size(), dewarper, model_domain, bg_color, &status
 	);
 }
 
@@ -1311,75 +1398,38 @@ OutputGenerator::detectPictures(
 	GrayImage const& input_300dpi, TaskStatus const& status,
 	DebugImages* const dbg)
 {
-	// We stretch the range of gray levels to cover the whole
-	// range of [0, 255].  We do it because we want text
-	// and background to be equally far from the center
-	// of the whole range.  Otherwise text printed with a big
-	// font will be considered a picture.
-	GrayImage stretched(stretchGrayRange(input_300dpi, 0.01, 0.01));
-	if (dbg) {
-		dbg->add(stretched, "stretched");
-	}
-	
-	status.throwIfCancelled();
-	
-	GrayImage eroded(erodeGray(stretched, QSize(3, 3), 0x00));
-	if (dbg) {
-		dbg->add(eroded, "eroded");
+	if (!dbg) {
+		return detectPicturesCoarseToFine(input_300dpi, &status);
 	}
 	
-	status.throwIfCancelled();
-	
-	GrayImage dilated(dilateGray(stretched, QSize(3, 3), 0xff));
-	if (dbg) {
-		dbg->add(dilated, "dilated");
-	}
-	
-	stretched = GrayImage(); // Save memory.
-	
-	status.throwIfCancelled();
-	
-	grayRasterOp<CombineInverted>(dilated, eroded);
-	GrayImage gray_gradient(dilated);
-	dilated = GrayImage();
-	eroded = GrayImage();
-	if (dbg) {
-		dbg->add(gray_gradient, "gray_gradient");
-	}
-	
-	status.throwIfCancelled();
-	
-	GrayImage marker(erodeGray(gray_gradient, QSize(35, 35), 0x00));
-	if (dbg) {
-		dbg->add(marker, "marker");
-	}
-	
-	status.throwIfCancelled();
+	// In debug mode we also run the full resolution detection,
+	// to show what the coarse-to-fine one saves and where
+	// their results differ.
+	QTime timer;
+	timer.start();
 	
-	seedFillGrayInPlace(marker, gray_gradient, CONN8);
-	GrayImage reconstructed(marker);
-	marker = GrayImage();
-	if (dbg) {
-		dbg->add(reconstructed, "reconstructed");
-	}
-	
-	status.throwIfCancelled();
-	
-	grayRasterOp<GRopInvert<GRopSrc> >(reconstructed, reconstructed);
-	if (dbg) {
-		dbg->add(reconstructed, "reconstructed_inverted");
-	}
-	
-	status.throwIfCancelled();
-	
-	GrayImage holes_filled(createFramedImage(reconstructed.size()));
-	seedFillGrayInPlace(holes_filled, reconstructed, CONN8);
-	reconstructed = GrayImage();
-	if (dbg) {
-		dbg->add(holes_filled, "holes_filled");
-	}
+	PictureDetectionStages stages;
+	GrayImage const full_areas(
+		imageproc::detectPictures(input_300dpi, 35, &status, &stages)
+	);
+	int const full_msec = timer.elapsed();
+	dbg->add(stages.stretched, "stretched");
+	dbg->add(stages.gradient, "gray_gradient");
+	dbg->add(stages.marker, "marker");
+	dbg->add(stages.reconstructed, "reconstructed");
+	dbg->add(full_areas, QString("holes_filled (%1 ms)").arg(full_msec));
+	stages = PictureDetectionStages(); // Save memory.
+	
+	timer.restart();
+	GrayImage coarse_areas;
+	GrayImage const picture_areas(
+		detectPicturesCoarseToFine(input_300dpi, &status, &coarse_areas)
+	);
+	int const msec = timer.elapsed();
+	dbg->add(coarse_areas, "coarse_picture_areas");
+	dbg->add(picture_areas, QString("refined_picture_areas (%1 ms)").arg(msec));
 	
-	return holes_filled;
+	return picture_areas;
 }
 
 QImage
@@ -1761,7 +1811,25 @@ OutputGenerator::applyFillZonesInPlace(
 	if (zones.empty()) {
 		return;
 	}
+	
+	if (SpanBuffer::canBlend(img)) {
+		// Fill the zones right in the image, touching only their bounding boxes.
+		BOOST_FOREACH(Zone const& zone, zones) {
+			QColor const color(zone.properties().locateOrDefault<FillColorProperty>()->color());
+			QPolygonF const poly(zone.spline().transformed(orig_to_output).toPolygon());
+			if (!poly.boundingRect().toAlignedRect().intersects(img.rect())) {
+				continue;
+			}
+			
+			SpanBuffer const spans(
+				PolygonRasterizer::rasterizeAntialiased(img.size(), poly, Qt::WindingFill)
+			);
+			spans.blend(img, color.rgb());
+		}
+		return;
+	}
 
+	// Other formats go through a full-size ARGB32 canvas.
 	QImage canvas(img.convertToFormat(QImage::Format_ARGB32_Premultiplied));
 	
 	{
@@ -1828,6 +1896,120 @@ OutputGenerator::applyFillZonesInPlace(
 	);
 }
 
+bool
+OutputGenerator::fillZonesArePostProcess(DewarpingMode const& dewarping_mode)
+{
+	return dewarping_mode == DewarpingMode::OFF;
+}
+
+void
+OutputGenerator::applyFillZones(
+	QImage& output, QImage const& unfilled,
+	ZoneSet const& zones, QRect const& area) const
+{
+	assert(output.size() == unfilled.size());
+	assert(output.format() == unfilled.format());
+	
+	QRect const rect(area.intersected(unfilled.rect()));
+	if (rect.isEmpty()) {
+		return;
+	}
+	
+	QTransform const orig_to_rect(
+		toOutput() * QTransform().translate(-rect.x(), -rect.y())
+	);
+	typedef QPointF (QTransform::*MapPointFunc)(QPointF const&) const;
+	boost::function<QPointF(QPointF const&)> const orig_to_patch(
+		boost::bind((MapPointFunc)&QTransform::map, orig_to_rect, _1)
+	);
+	
+	if (unfilled.format() == QImage::Format_Mono
+			|| unfilled.format() == QImage::Format_MonoLSB) {
+		// B/W output is filled the same way process() fills it.
+		BinaryImage patch(unfilled, rect);
+		applyFillZonesInPlace(patch, zones, orig_to_patch);
+		
+		// Rather than making a new image, which would lose the DPI.
+		patch.pasteInto(output, rect.topLeft());
+		return;
+	}
+	
+	// processAsIs() reserves black and white after applying fill zones,
+	// so fill colors have to go through the same adjustment.
+	bool const as_is = !RenderParams(m_colorParams).whiteMargins();
+	
+	QImage patch(unfilled.copy(rect));
+	applyFillZonesInPlace(patch, zones, orig_to_patch);
+	if (as_is) {
+		reserveBlackAndWhite(patch);
+	}
+	
+	if (patch.format() != output.format() || patch.colorTable() != output.colorTable()
+			|| (output.depth() != 8 && output.depth() != 32)) {
+		// Can't copy pixels as they are.  Just redo the whole image.
+		output = unfilled;
+		applyFillZonesInPlace(output, zones);
+		if (as_is) {
+			reserveBlackAndWhite(output);
+		}
+		return;
+	}
+	
+	int const bytes_per_pixel = output.depth() / 8;
+	int const row_bytes = rect.width() * bytes_per_pixel;
+	int const dst_offset = rect.left() * bytes_per_pixel;
+	for (int y = 0; y < rect.height(); ++y) {
+		memcpy(
+			output.scanLine(rect.top() + y) + dst_offset,
+			patch.scanLine(y), row_bytes
+		);
+	}
+}
+
+QRect
+OutputGenerator::fillZonesChangedArea(
+	ZoneSet const& old_zones, ZoneSet const& new_zones) const
+{
+	QTransform const to_output(toOutput());
+	QRect area;
+	
+	// Zones are drawn in order, so it's their positions in the sequence
+	// that are compared.  Removing a zone affects those that follow it,
+	// which is only a problem if they overlap.
+	ZoneSet::const_iterator old_it(old_zones.begin());
+	ZoneSet::const_iterator new_it(new_zones.begin());
+	ZoneSet::const_iterator const old_end(old_zones.end());
+	ZoneSet::const_iterator const new_end(new_zones.end());
+	while (old_it != old_end || new_it != new_end) {
+		bool const have_old = old_it != old_end;
+		bool const have_new = new_it != new_end;
+		if (!have_old || !have_new || !FillZoneComparator::equal(*old_it, *new_it)) {
+			if (have_old) {
+				area |= to_output.map(old_it->spline().toPolygon())
+					.boundingRect().toAlignedRect();
+			}
+			if (have_new) {
+				area |= to_output.map(new_it->spline().toPolygon())
+					.boundingRect().toAlignedRect();
+			}
+		}
+		if (have_old) {
+			++old_it;
+		}
+		if (have_new) {
+			++new_it;
+		}
+	}
+	
+	if (area.isEmpty()) {
+		return area;
+	}
+	
+	// Antialiasing may touch a pixel outside of a polygon's bounding box.
+	area.adjust(-1, -1, 1, 1);
+	return area.intersected(QRect(QPoint(0, 0), outputImageSize()));
+}
+
 QTransform
 OutputGenerator::origToRectInUncroppedSpace(QRect const& rect) const
 {
@@ -24,6 +24,7 @@
 #include "ColorParams.h"
 #include "DepthPerception.h"
 #include "DespeckleLevel.h"
+#include "DewarpingMode.h"
 #include <boost/function.hpp>
 #include <QSize>
 #include <QRect>
@@ -31,6 +32,7 @@
 #include <QColor>
 #include <QPointF>
 #include <QPolygonF>
+#include <QtGlobal>
 #include <vector>
 #include <stdint.h>
 
@@ -98,6 +100,35 @@ public:
 		imageproc::BinaryImage* speckles_image = 0,
 		DebugImages* dbg = 0) const;
 	
+	/**
+	 * \brief Whether fill zones are applied as the last step of process().
+	 *
+	 * If so, the output may be produced by calling process() without
+	 * fill zones and then applyFillZones(), which allows fill zones to be
+	 * changed later without calling process() again.  With dewarping,
+	 * fill zones are applied before the B/W and color layers are combined.
+	 */
+	static bool fillZonesArePostProcess(DewarpingMode const& dewarping_mode);
+	
+	/**
+	 * \brief Applies fill zones to an output produced without them.
+	 *
+	 * \param output The image to update.  It has to be the same size
+	 *        and format as \p unfilled.
+	 * \param unfilled The output of process() called without fill zones.
+	 * \param zones The fill zones to apply.
+	 * \param area The area of \p output to be recomputed, in output
+	 *        image coordinates.  Outside of it, \p output is left as is.
+	 */
+	void applyFillZones(QImage& output, QImage const& unfilled,
+		ZoneSet const& zones, QRect const& area) const;
+	
+	/**
+	 * \brief Returns the area of the output image affected by replacing
+	 *        one set of fill zones with another.
+	 */
+	QRect fillZonesChangedArea(ZoneSet const& old_zones, ZoneSet const& new_zones) const;
+	
 	/**
 	 * Returns the transformation from original to output image coordinates.
 	 */
@@ -109,6 +140,28 @@ public:
 	 * \brief Returns the content rectangle in output image coordinates.
 	 */
 	QRect outputContentRect() const;
+
+	/**
+	 * \brief Roughly estimates the peak memory usage of process(), in bytes.
+	 *
+	 * The estimate is based on the output image size and on which of
+	 * the memory-hungry steps (picture detection, despeckling, dewarping)
+	 * are going to take place.
+	 */
+	static qint64 estimatePeakMemory(
+		QSize const& output_size, ColorParams const& color_params,
+		DewarpingMode const& dewarping_mode, DespeckleLevel despeckle_level);
+
+	/**
+	 * \brief Roughly estimates the processing time of process().
+	 *
+	 * The result is in arbitrary units, proportional to the output
+	 * image area and weighted by the steps that are going to take place.
+	 * It's only meaningful relative to other estimates.
+	 */
+	static double estimateCost(
+		QSize const& output_size, ColorParams const& color_params,
+		DewarpingMode const& dewarping_mode, DespeckleLevel despeckle_level);
 private:
 	QImage processImpl(
 		TaskStatus const& status, FilterData const& input,
@@ -149,7 +202,8 @@ private:
 	QImage dewarp(
 		QTransform const& orig_to_src, QImage const& src,
 		QTransform const& src_to_output, DistortionModel const& distortion_model,
-		DepthPerception const& depth_perception, QColor const& bg_color) const;
+		DepthPerception const& depth_perception, QColor const& bg_color,
+		TaskStatus const& status) const;
 
 	static QSize from300dpi(QSize const& size, Dpi const& target_dpi);
 	
@@ -166,9 +220,15 @@ private:
 		QTransform const& xform, QRect const& target_rect,
 		imageproc::GrayImage* background = 0, DebugImages* dbg = 0);
 	
+	/**
+	 * \brief Runs imageproc::detectPicturesCoarseToFine().
+	 *
+	 * In debug mode, the full resolution imageproc::detectPictures()
+	 * is run as well, and both are timed.
+	 */
 	static imageproc::GrayImage detectPictures(
-		imageproc::GrayImage const& input_300dpi, TaskStatus const& status,
-		DebugImages* dbg = 0);
+		imageproc::GrayImage const& input_300dpi,
+		TaskStatus const& status, DebugImages* dbg = 0);
 	
 	imageproc::BinaryImage estimateBinarizationMask(
 		TaskStatus const& status, imageproc::GrayImage const& gray_source,
@@ -51,6 +51,8 @@ public:
 	
 	explicit OutputImageParams(QDomElement const& el);
 
+	QSize const& outputImageSize() const { return m_size; }
+
 	DewarpingMode const& dewarpingMode() const { return m_dewarpingMode; }
 
 	DistortionModel const& distortionModel() const { return m_distortionModel; }
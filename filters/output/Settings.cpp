@@ -20,7 +20,6 @@
 #include "Params.h"
 #include "PictureLayerProperty.h"
 #include "FillColorProperty.h"
-#include "../../Utils.h"
 #include <boost/foreach.hpp>
 #include <Qt>
 #include <QColor>
@@ -29,6 +28,17 @@
 namespace output
 {
 
+namespace
+{
+
+template<typename T>
+T valueOrDefault(T const* value)
+{
+	return value ? *value : T();
+}
+
+} // anonymous namespace
+
 Settings::Settings()
 :	m_defaultPictureZoneProps(initialPictureZoneProps()),
 	m_defaultFillZoneProps(initialFillZoneProps())
@@ -42,10 +52,12 @@ Settings::~Settings()
 void
 Settings::clear()
 {
-	QMutexLocker const locker(&m_mutex);
+	{
+		QMutexLocker const locker(&m_defaultsMutex);
+		initialPictureZoneProps().swap(m_defaultPictureZoneProps);
+		initialFillZoneProps().swap(m_defaultFillZoneProps);
+	}
 	
-	initialPictureZoneProps().swap(m_defaultPictureZoneProps);
-	initialFillZoneProps().swap(m_defaultFillZoneProps);
 	m_perPageParams.clear();
 	m_perPageOutputParams.clear();
 	m_perPagePictureZones.clear();
@@ -55,205 +67,139 @@ Settings::clear()
 Params
 Settings::getParams(PageId const& page_id) const
 {
-	QMutexLocker const locker(&m_mutex);
-	
-	PerPageParams::const_iterator const it(m_perPageParams.find(page_id));
-	if (it != m_perPageParams.end()) {
-		return it->second;
-	} else {
-		return Params();
-	}
+	PerPageParams::SnapshotPtr const snapshot(m_perPageParams.snapshot());
+	return valueOrDefault(snapshot->find(page_id));
 }
 
 void
 Settings::setParams(PageId const& page_id, Params const& params)
 {
-	QMutexLocker const locker(&m_mutex);
-	Utils::mapSetValue(m_perPageParams, page_id, params);
+	m_perPageParams.set(page_id, params);
 }
 
 void
 Settings::setColorParams(PageId const& page_id, ColorParams const& prms)
 {
-	QMutexLocker const locker(&m_mutex);
-
-	PerPageParams::iterator const it(m_perPageParams.lower_bound(page_id));
-	if (it == m_perPageParams.end() || m_perPageParams.key_comp()(page_id, it->first)) {
-		Params params;
-		params.setColorParams(prms);
-		m_perPageParams.insert(it, PerPageParams::value_type(page_id, params));
-	} else {
-		it->second.setColorParams(prms);
-	}
+	PerPageParams::Transaction transaction(m_perPageParams);
+	Params params(valueOrDefault(transaction.find(page_id)));
+	params.setColorParams(prms);
+	transaction.set(page_id, params);
 }
 
 void
 Settings::setDpi(PageId const& page_id, Dpi const& dpi)
 {
-	QMutexLocker const locker(&m_mutex);
-
-	PerPageParams::iterator const it(m_perPageParams.lower_bound(page_id));
-	if (it == m_perPageParams.end() || m_perPageParams.key_comp()(page_id, it->first)) {
-		Params params;
-		params.setOutputDpi(dpi);
-		m_perPageParams.insert(it, PerPageParams::value_type(page_id, params));
-	} else {
-		it->second.setOutputDpi(dpi);
-	}
+	PerPageParams::Transaction transaction(m_perPageParams);
+	Params params(valueOrDefault(transaction.find(page_id)));
+	params.setOutputDpi(dpi);
+	transaction.set(page_id, params);
 }
 
 void
 Settings::setDewarpingMode(PageId const& page_id, DewarpingMode const& mode)
 {
-	QMutexLocker const locker(&m_mutex);
-
-	PerPageParams::iterator const it(m_perPageParams.lower_bound(page_id));
-	if (it == m_perPageParams.end() || m_perPageParams.key_comp()(page_id, it->first)) {
-		Params params;
-		params.setDewarpingMode(mode);
-		m_perPageParams.insert(it, PerPageParams::value_type(page_id, params));
-	} else {
-		it->second.setDewarpingMode(mode);
-	}
+	PerPageParams::Transaction transaction(m_perPageParams);
+	Params params(valueOrDefault(transaction.find(page_id)));
+	params.setDewarpingMode(mode);
+	transaction.set(page_id, params);
 }
 
 void
 Settings::setDistortionModel(PageId const& page_id, DistortionModel const& model)
 {
-	QMutexLocker const locker(&m_mutex);
-
-	PerPageParams::iterator const it(m_perPageParams.lower_bound(page_id));
-	if (it == m_perPageParams.end() || m_perPageParams.key_comp()(page_id, it->first)) {
-		Params params;
-		params.setDistortionModel(model);
-		m_perPageParams.insert(it, PerPageParams::value_type(page_id, params));
-	} else {
-		it->second.setDistortionModel(model);
-	}
+	PerPageParams::Transaction transaction(m_perPageParams);
+	Params params(valueOrDefault(transaction.find(page_id)));
+	params.setDistortionModel(model);
+	transaction.set(page_id, params);
 }
 
 void
 Settings::setDepthPerception(PageId const& page_id, DepthPerception const& depth_perception)
 {
-	QMutexLocker const locker(&m_mutex);
-
-	PerPageParams::iterator const it(m_perPageParams.lower_bound(page_id));
-	if (it == m_perPageParams.end() || m_perPageParams.key_comp()(page_id, it->first)) {
-		Params params;
-		params.setDepthPerception(depth_perception);
-		m_perPageParams.insert(it, PerPageParams::value_type(page_id, params));
-	} else {
-		it->second.setDepthPerception(depth_perception);
-	}
+	PerPageParams::Transaction transaction(m_perPageParams);
+	Params params(valueOrDefault(transaction.find(page_id)));
+	params.setDepthPerception(depth_perception);
+	transaction.set(page_id, params);
 }
 
 void
 Settings::setDespeckleLevel(PageId const& page_id, DespeckleLevel level)
 {
-	QMutexLocker const locker(&m_mutex);
-
-	PerPageParams::iterator const it(m_perPageParams.lower_bound(page_id));
-	if (it == m_perPageParams.end() || m_perPageParams.key_comp()(page_id, it->first)) {
-		Params params;
-		params.setDespeckleLevel(level);
-		m_perPageParams.insert(it, PerPageParams::value_type(page_id, params));
-	} else {
-		it->second.setDespeckleLevel(level);
-	}
+	PerPageParams::Transaction transaction(m_perPageParams);
+	Params params(valueOrDefault(transaction.find(page_id)));
+	params.setDespeckleLevel(level);
+	transaction.set(page_id, params);
 }
 
 std::auto_ptr<OutputParams>
 Settings::getOutputParams(PageId const& page_id) const
 {
-	QMutexLocker const locker(&m_mutex);
-	
-	PerPageOutputParams::const_iterator const it(m_perPageOutputParams.find(page_id));
-	if (it != m_perPageOutputParams.end()) {
-		return std::auto_ptr<OutputParams>(new OutputParams(it->second));
-	} else {
-		return std::auto_ptr<OutputParams>();
-	}
+	return m_perPageOutputParams.get(page_id);
 }
 
 void
 Settings::removeOutputParams(PageId const& page_id)
 {
-	QMutexLocker const locker(&m_mutex);
 	m_perPageOutputParams.erase(page_id);
 }
 
 void
 Settings::setOutputParams(PageId const& page_id, OutputParams const& params)
 {
-	QMutexLocker const locker(&m_mutex);
-	Utils::mapSetValue(m_perPageOutputParams, page_id, params);
+	m_perPageOutputParams.set(page_id, params);
 }
 
 ZoneSet
 Settings::pictureZonesForPage(PageId const& page_id) const
 {
-	QMutexLocker const locker(&m_mutex);
-
-	PerPageZones::const_iterator const it(m_perPagePictureZones.find(page_id));
-	if (it != m_perPagePictureZones.end()) {
-		return it->second;
-	} else {
-		return ZoneSet();
-	}
+	PerPageZones::SnapshotPtr const snapshot(m_perPagePictureZones.snapshot());
+	return valueOrDefault(snapshot->find(page_id));
 }
 
 ZoneSet
 Settings::fillZonesForPage(PageId const& page_id) const
 {
-	QMutexLocker const locker(&m_mutex);
-
-	PerPageZones::const_iterator const it(m_perPageFillZones.find(page_id));
-	if (it != m_perPageFillZones.end()) {
-		return it->second;
-	} else {
-		return ZoneSet();
-	}
+	PerPageZones::SnapshotPtr const snapshot(m_perPageFillZones.snapshot());
+	return valueOrDefault(snapshot->find(page_id));
 }
 
 void
 Settings::setPictureZones(PageId const& page_id, ZoneSet const& zones)
 {
-	QMutexLocker const locker(&m_mutex);
-	Utils::mapSetValue(m_perPagePictureZones, page_id, zones);
+	m_perPagePictureZones.set(page_id, zones);
 }
 
 void
 Settings::setFillZones(PageId const& page_id, ZoneSet const& zones)
 {
-	QMutexLocker const locker(&m_mutex);
-	Utils::mapSetValue(m_perPageFillZones, page_id, zones);
+	m_perPageFillZones.set(page_id, zones);
 }
 
 PropertySet
 Settings::defaultPictureZoneProperties() const
 {
-	QMutexLocker const locker(&m_mutex);
+	QMutexLocker const locker(&m_defaultsMutex);
 	return m_defaultPictureZoneProps;
 }
 
 PropertySet
 Settings::defaultFillZoneProperties() const
 {
-	QMutexLocker const locker(&m_mutex);
+	QMutexLocker const locker(&m_defaultsMutex);
 	return m_defaultFillZoneProps;
 }
 
 void
 Settings::setDefaultPictureZoneProperties(PropertySet const& props)
 {
-	QMutexLocker const locker(&m_mutex);
+	QMutexLocker const locker(&m_defaultsMutex);
 	m_defaultPictureZoneProps = props;
 }
 
 void
 Settings::setDefaultFillZoneProperties(PropertySet const& props)
 {
-	QMutexLocker const locker(&m_mutex);
+	QMutexLocker const locker(&m_defaultsMutex);
 	m_defaultFillZoneProps = props;
 }
 
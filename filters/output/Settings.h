@@ -30,8 +30,8 @@
 #include "DespeckleLevel.h"
 #include "ZoneSet.h"
 #include "PropertySet.h"
+#include "SnapshotMap.h"
 #include <QMutex>
-#include <map>
 #include <memory>
 
 namespace output
@@ -47,6 +47,13 @@ public:
 	
 	virtual ~Settings();
 	
+	/**
+	 * \brief Resets everything to the initial state.
+	 *
+	 * Not atomic: the per-page maps are cleared one after another,
+	 * so a concurrent reader may see some of them cleared and
+	 * others not yet.  Only to be called when no tasks are running.
+	 */
 	void clear();
 	
 	Params getParams(PageId const& page_id) const;
@@ -91,19 +98,19 @@ public:
 
 	void setDefaultFillZoneProperties(PropertySet const& props);
 private:
-	typedef std::map<PageId, Params> PerPageParams;
-	typedef std::map<PageId, OutputParams> PerPageOutputParams;
-	typedef std::map<PageId, ZoneSet> PerPageZones;
+	typedef SnapshotMap<PageId, Params> PerPageParams;
+	typedef SnapshotMap<PageId, OutputParams> PerPageOutputParams;
+	typedef SnapshotMap<PageId, ZoneSet> PerPageZones;
 	
 	static PropertySet initialPictureZoneProps();
 
 	static PropertySet initialFillZoneProps();
 
-	mutable QMutex m_mutex;
 	PerPageParams m_perPageParams;
 	PerPageOutputParams m_perPageOutputParams;
 	PerPageZones m_perPagePictureZones;
 	PerPageZones m_perPageFillZones;
+	mutable QMutex m_defaultsMutex; // Protects the two members below.
 	PropertySet m_defaultPictureZoneProps;
 	PropertySet m_defaultFillZoneProps;
 };
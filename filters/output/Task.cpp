@@ -28,6 +28,7 @@
 #include "RenderParams.h"
 #include "FilterUiInterface.h"
 #include "TaskStatus.h"
+#include "BackgroundTask.h"
 #include "FilterData.h"
 #include "ImageView.h"
 #include "ImageViewTab.h"
@@ -45,6 +46,7 @@
 #include "DewarpingView.h"
 #include "DewarpingPointMapper.h"
 #include "ImageId.h"
+#include "ImageMetadata.h"
 #include "PageId.h"
 #include "Dpi.h"
 #include "Dpm.h"
@@ -53,7 +55,7 @@
 #include "ThumbnailPixmapCache.h"
 #include "DebugImages.h"
 #include "OutputGenerator.h"
-#include "TiffWriter.h"
+#include "WriteBehindQueue.h"
 #include "ImageLoader.h"
 #include "ErrorWidget.h"
 #include "imageproc/BinaryImage.h"
@@ -61,6 +63,7 @@
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 #include <QImage>
+#include <QPolygonF>
 #include <QString>
 #include <QObject>
 #include <QFile>
@@ -69,6 +72,7 @@
 #include <QTabWidget>
 #include <QCoreApplication>
 #include <QDebug>
+#include <algorithm>
 
 using namespace imageproc;
 
@@ -121,14 +125,100 @@ private:
 };
 
 
+/**
+ * \brief Shows a low resolution output while the real one is being made.
+ *
+ * It's never written to disk, so that OutputParams and thumbnails
+ * only ever reflect the output at the requested DPI.
+ */
+class Task::PreviewUpdater : public FilterResult
+{
+public:
+	PreviewUpdater(IntrusivePtr<Filter> const& filter, QImage const& image);
+	
+	virtual void updateUI(FilterUiInterface* ui);
+	
+	virtual IntrusivePtr<AbstractFilter> filter() { return m_ptrFilter; }
+private:
+	IntrusivePtr<Filter> m_ptrFilter;
+	QImage m_image;
+	QImage m_downscaledImage;
+};
+
+
+/**
+ * \brief Calls Task::generate() on another thread.
+ */
+class Task::Continuation
+{
+public:
+	Continuation(IntrusivePtr<Task> const& task, FilterData const& data,
+		QPolygonF const& content_rect_phys, QPolygonF const& page_rect_phys)
+	: m_ptrTask(task), m_data(data),
+	m_contentRectPhys(content_rect_phys), m_pageRectPhys(page_rect_phys) {}
+	
+	FilterResultPtr operator()(TaskStatus const& status) const {
+		return m_ptrTask->generate(status, m_data, m_contentRectPhys, m_pageRectPhys);
+	}
+private:
+	IntrusivePtr<Task> m_ptrTask;
+	FilterData m_data;
+	QPolygonF m_contentRectPhys;
+	QPolygonF m_pageRectPhys;
+};
+
+
+/**
+ * \brief Writes the output files of a page and then updates its OutputParams
+ *        and the thumbnail of the output file.
+ *
+ * OutputParams record the sizes and modification times of output files,
+ * so they can only be updated once the files are written.  Likewise,
+ * the thumbnail is only replaced once the file it represents exists.
+ */
+class Task::OutputWriteJob : public WriteBehindQueue::Job
+{
+public:
+	OutputWriteJob(IntrusivePtr<Settings> const& settings,
+		IntrusivePtr<ThumbnailPixmapCache> const& thumbnail_cache,
+		PageId const& page_id, OutputFileNameGenerator const& out_file_name_gen,
+		OutputImageParams const& output_image_params,
+		ZoneSet const& picture_zones, ZoneSet const& fill_zones,
+		QString const& out_file_path, QString const& automask_file_path,
+		QString const& speckles_file_path, QImage const& out_img);
+	
+	/**
+	 * \brief Makes the job invalidate OutputParams when finished.
+	 */
+	void markFailed() { m_failed = true; }
+protected:
+	virtual void finished(bool success);
+private:
+	IntrusivePtr<Settings> m_ptrSettings;
+	IntrusivePtr<ThumbnailPixmapCache> m_ptrThumbnailCache;
+	PageId m_pageId;
+	OutputFileNameGenerator m_outFileNameGen;
+	OutputImageParams m_outputImageParams;
+	ZoneSet m_pictureZones;
+	ZoneSet m_fillZones;
+	QString m_outFilePath;
+	QString m_automaskFilePath;
+	QString m_specklesFilePath;
+	QImage m_outImage;
+	bool m_failed;
+};
+
+
 Task::Task(IntrusivePtr<Filter> const& filter,
 	IntrusivePtr<Settings> const& settings,
 	IntrusivePtr<ThumbnailPixmapCache> const& thumbnail_cache,
+	IntrusivePtr<WriteBehindQueue> const& write_behind,
 	PageId const& page_id, OutputFileNameGenerator const& out_file_name_gen,
 	ImageViewTab const last_tab, bool const batch, bool const debug)
 :	m_ptrFilter(filter),
 	m_ptrSettings(settings),
 	m_ptrThumbnailCache(thumbnail_cache),
+	m_ptrWriteBehind(write_behind),
 	m_pageId(page_id),
 	m_outFileNameGen(out_file_name_gen),
 	m_lastTab(last_tab),
@@ -151,6 +241,29 @@ Task::process(
 {
 	status.throwIfCancelled();
 	
+	if (m_batchProcessing) {
+		BackgroundTask const* const task = dynamic_cast<BackgroundTask const*>(&status);
+		if (task && task->continuationAllowed()) {
+			// Let the earlier stages of the next page run while
+			// this one is being generated.
+			task->continueElsewhere(
+				Continuation(
+					IntrusivePtr<Task>(this), data,
+					content_rect_phys, page_rect_phys
+				)
+			);
+			return FilterResultPtr();
+		}
+	}
+	
+	return generate(status, data, content_rect_phys, page_rect_phys);
+}
+
+FilterResultPtr
+Task::generate(
+	TaskStatus const& status, FilterData const& data,
+	QPolygonF const& content_rect_phys, QPolygonF const& page_rect_phys)
+{
 	Params const params(m_ptrSettings->getParams(m_pageId));
 	RenderParams const render_params(params.colorParams());
 	QString const out_file_path(m_outFileNameGen.filePathFor(m_pageId));
@@ -168,6 +281,11 @@ Task::process(
 	);
 	QFileInfo speckles_file_info(speckles_file_path);
 
+	QString const unfilled_dir(Utils::unfilledDir(m_outFileNameGen.outDir()));
+	QString const unfilled_file_path(
+		QDir(unfilled_dir).absoluteFilePath(out_file_info.fileName())
+	);
+
 	bool const need_picture_editor = render_params.mixedOutput() && !m_batchProcessing;
 	bool const need_speckles_image = params.despeckleLevel() != DESPECKLE_OFF
 		&& params.colorParams().colorMode() != ColorParams::COLOR_GRAYSCALE && !m_batchProcessing;
@@ -187,13 +305,20 @@ Task::process(
 	ZoneSet const new_picture_zones(m_ptrSettings->pictureZonesForPage(m_pageId));
 	ZoneSet const new_fill_zones(m_ptrSettings->fillZonesForPage(m_pageId));
 	
+	// If so, we keep a copy of the output without fill zones,
+	// to be able to redraw just the areas of changed fill zones.
+	bool const fill_zones_post_process = OutputGenerator::fillZonesArePostProcess(
+		params.dewarpingMode()
+	);
+	
+	std::auto_ptr<OutputParams> const stored_output_params(
+		m_ptrSettings->getOutputParams(m_pageId)
+	);
+	
 	bool need_reprocess = false;
+	bool need_refill = false;
 	do { // Just to be able to break from it.
 		
-		std::auto_ptr<OutputParams> stored_output_params(
-			m_ptrSettings->getOutputParams(m_pageId)
-		);
-		
 		if (!stored_output_params.get()) {
 			need_reprocess = true;
 			break;
@@ -210,8 +335,11 @@ Task::process(
 		}
 
 		if (!FillZoneComparator::equal(stored_output_params->fillZones(), new_fill_zones)) {
-			need_reprocess = true;
-			break;
+			if (!fill_zones_post_process) {
+				need_reprocess = true;
+				break;
+			}
+			need_refill = true;
 		}
 		
 		if (!out_file_info.exists()) {
@@ -277,6 +405,20 @@ Task::process(
 		}
 	}
 
+	QImage unfilled_img;
+	if (need_refill && !need_reprocess) {
+		if (stored_output_params->fillZones().empty()) {
+			unfilled_img = out_img;
+		} else {
+			QFile unfilled_file(unfilled_file_path);
+			if (unfilled_file.open(QIODevice::ReadOnly)) {
+				unfilled_img = ImageLoader::load(unfilled_file, 0);
+			}
+		}
+		need_reprocess = unfilled_img.size() != out_img.size()
+			|| unfilled_img.format() != out_img.format();
+	}
+
 	if (need_reprocess) {
 		// Even in batch processing mode we should still write automask, because it
 		// will be needed when we view the results back in interactive mode.
@@ -290,8 +432,16 @@ Task::process(
 		automask_img = BinaryImage();
 		speckles_img = BinaryImage();
 
+		if (m_lastTab == TAB_OUTPUT) {
+			reportPreview(
+				status, data, params, new_picture_zones,
+				new_fill_zones, content_rect_phys, page_rect_phys
+			);
+		}
+
 		out_img = generator.process(
-			status, data, new_picture_zones, new_fill_zones,
+			status, data, new_picture_zones,
+			fill_zones_post_process ? ZoneSet() : new_fill_zones,
 			params.dewarpingMode() != DewarpingMode::OFF
 			? params.distortionModel() : DistortionModel(),
 			params.depthPerception(),
@@ -299,6 +449,14 @@ Task::process(
 			write_speckles_file ? &speckles_img : 0,
 			m_ptrDbg.get()
 		);
+		
+		unfilled_img = QImage();
+		if (fill_zones_post_process && !new_fill_zones.empty()) {
+			unfilled_img = out_img;
+			generator.applyFillZones(
+				out_img, unfilled_img, new_fill_zones, out_img.rect()
+			);
+		}
 
 		if (write_speckles_file && speckles_img.isNull()) {
 			// Even if despeckling didn't actually take place, we still need
@@ -307,48 +465,74 @@ Task::process(
 			BinaryImage(out_img.size(), WHITE).swap(speckles_img);
 		}
 
-		bool invalidate_params = false;
+		IntrusivePtr<OutputWriteJob> const job(
+			new OutputWriteJob(
+				m_ptrSettings, m_ptrThumbnailCache, m_pageId, m_outFileNameGen,
+				new_output_image_params, new_picture_zones, new_fill_zones,
+				out_file_path, write_automask ? automask_file_path : QString(),
+				write_speckles_file ? speckles_file_path : QString(), out_img
+			)
+		);
 		
-		if (!TiffWriter::writeImage(out_file_path, out_img)) {
-			invalidate_params = true;
-		} else {
-			deleteMutuallyExclusiveOutputFiles();
-		}
-
+		job->addImage(out_file_path, out_img);
 		if (write_automask) {
 			if (!QDir().mkpath(automask_dir)) {
-				invalidate_params = true;
-			} else if (!TiffWriter::writeImage(automask_file_path, automask_img.toQImage())) {
-				invalidate_params = true;
+				job->markFailed();
+			} else {
+				job->addImage(automask_file_path, automask_img.toQImage());
 			}
 		}
 		if (write_speckles_file) {
 			if (!QDir().mkpath(speckles_dir)) {
-				invalidate_params = true;
-			} else if (!TiffWriter::writeImage(speckles_file_path, speckles_img.toQImage())) {
-				invalidate_params = true;
+				job->markFailed();
+			} else {
+				job->addImage(speckles_file_path, speckles_img.toQImage());
 			}
 		}
-
-		if (invalidate_params) {
-			m_ptrSettings->removeOutputParams(m_pageId);
+		if (unfilled_img.isNull() || m_batchProcessing) {
+			// The unfilled copy only speeds up editing fill zones,
+			// so we don't spend disk space on it in batch mode.
+			// The first edit will reprocess the page and create it.
+			QFile::remove(unfilled_file_path);
+		} else if (!QDir().mkpath(unfilled_dir)) {
+			job->markFailed();
 		} else {
-			// Note that we can't reuse *_file_info objects
-			// as we've just overwritten those files.
-			OutputParams const out_params(
-				new_output_image_params,
-				OutputFileParams(QFileInfo(out_file_path)),
-				write_automask ? OutputFileParams(QFileInfo(automask_file_path))
-				: OutputFileParams(),
-				write_speckles_file ? OutputFileParams(QFileInfo(speckles_file_path))
-				: OutputFileParams(),
-				new_picture_zones, new_fill_zones
-			);
-
-			m_ptrSettings->setOutputParams(m_pageId, out_params);
+			job->addImage(unfilled_file_path, unfilled_img);
 		}
 		
-		m_ptrThumbnailCache->recreateThumbnail(ImageId(out_file_path), out_img);
+		submitWriteJob(job);
+	} else if (need_refill) {
+		ZoneSet const& old_fill_zones = stored_output_params->fillZones();
+		generator.applyFillZones(
+			out_img, unfilled_img, new_fill_zones,
+			generator.fillZonesChangedArea(old_fill_zones, new_fill_zones)
+		);
+		
+		// Automask and speckles files remain as they are.
+		IntrusivePtr<OutputWriteJob> const job(
+			new OutputWriteJob(
+				m_ptrSettings, m_ptrThumbnailCache, m_pageId, m_outFileNameGen,
+				new_output_image_params, new_picture_zones, new_fill_zones,
+				out_file_path,
+				stored_output_params->automaskFileParams().isValid()
+				? automask_file_path : QString(),
+				stored_output_params->specklesFileParams().isValid()
+				? speckles_file_path : QString(), out_img
+			)
+		);
+		
+		job->addImage(out_file_path, out_img);
+		if (new_fill_zones.empty()) {
+			QFile::remove(unfilled_file_path);
+		} else if (old_fill_zones.empty()) {
+			if (!QDir().mkpath(unfilled_dir)) {
+				job->markFailed();
+			} else {
+				job->addImage(unfilled_file_path, unfilled_img);
+			}
+		}
+		
+		submitWriteJob(job);
 	}
 
 	DespeckleState const despeckle_state(
@@ -375,36 +559,241 @@ Task::process(
 	);
 }
 
+qint64
+Task::estimatePeakMemory(ImageMetadata const& orig_metadata) const
+{
+	Params const params(m_ptrSettings->getParams(m_pageId));
+	return OutputGenerator::estimatePeakMemory(
+		estimateOutputSize(orig_metadata, params), params.colorParams(),
+		params.dewarpingMode(), params.despeckleLevel()
+	);
+}
+
+double
+Task::estimateCost(ImageMetadata const& orig_metadata) const
+{
+	Params const params(m_ptrSettings->getParams(m_pageId));
+	return OutputGenerator::estimateCost(
+		estimateOutputSize(orig_metadata, params), params.colorParams(),
+		params.dewarpingMode(), params.despeckleLevel()
+	);
+}
+
+QSize
+Task::estimateOutputSize(ImageMetadata const& orig_metadata, Params const& params) const
+{
+	QSize output_size;
+	std::auto_ptr<OutputParams> const stored_output_params(
+		m_ptrSettings->getOutputParams(m_pageId)
+	);
+	if (stored_output_params.get()) {
+		output_size = stored_output_params->outputImageParams().outputImageSize();
+	} else {
+		// We don't know the content and page boxes yet,
+		// so assume the whole image at the output DPI.
+		output_size = orig_metadata.size();
+		Dpi const orig_dpi(orig_metadata.dpi());
+		Dpi const output_dpi(params.outputDpi());
+		if (!orig_dpi.isNull() && !output_dpi.isNull()) {
+			output_size.setWidth(
+				qRound(double(output_size.width()) * output_dpi.horizontal()
+				/ orig_dpi.horizontal())
+			);
+			output_size.setHeight(
+				qRound(double(output_size.height()) * output_dpi.vertical()
+				/ orig_dpi.vertical())
+			);
+		}
+	}
+
+	return output_size;
+}
+
+void
+Task::submitWriteJob(IntrusivePtr<OutputWriteJob> const& job)
+{
+	if (!m_ptrWriteBehind) {
+		job->run();
+	} else if (m_batchProcessing) {
+		// Let the next page be processed while these files are written.
+		m_ptrWriteBehind->submit(job);
+	} else {
+		// Batch processing is going on, and files it hasn't written yet
+		// for this page must not overwrite ours later.
+		m_ptrWriteBehind->writeNow(job);
+	}
+}
+
+/**
+ * \brief Makes a quick output at a fraction of the output DPI and shows it.
+ *
+ * Nothing is done in batch mode, if the task is run by no one who wants
+ * previews, or if the output DPI is already low enough for the real output
+ * to be quick.  The preview is marked as such on screen.
+ */
+void
+Task::reportPreview(
+	TaskStatus const& status, FilterData const& data,
+	Params const& params, ZoneSet const& picture_zones,
+	ZoneSet const& fill_zones, QPolygonF const& content_rect_phys,
+	QPolygonF const& page_rect_phys)
+{
+	int const scale = 4;
+	int const min_preview_dpi = 75;
+
+	if (m_batchProcessing) {
+		// No one looks at individual pages during batch processing,
+		// and the time is better spent on the real output.
+		return;
+	}
+
+	BackgroundTask const* const task = dynamic_cast<BackgroundTask const*>(&status);
+	if (!task || !task->wantsPreview()) {
+		return;
+	}
+
+	Dpi const output_dpi(params.outputDpi());
+	Dpi const preview_dpi(output_dpi.horizontal() / scale, output_dpi.vertical() / scale);
+	if (std::min(preview_dpi.horizontal(), preview_dpi.vertical()) < min_preview_dpi) {
+		return;
+	}
+
+	OutputGenerator const generator(
+		preview_dpi, params.colorParams(), params.despeckleLevel(),
+		data.xform(), content_rect_phys, page_rect_phys
+	);
+
+	// No automask or speckles - the preview has no editors to show them.
+	QImage const preview(
+		generator.process(
+			status, data, picture_zones, fill_zones,
+			params.dewarpingMode() != DewarpingMode::OFF
+			? params.distortionModel() : DistortionModel(),
+			params.depthPerception()
+		)
+	);
+
+	status.throwIfCancelled();
+
+	task->reportPreview(FilterResultPtr(new PreviewUpdater(m_ptrFilter, preview)));
+}
+
 /**
  * Delete output files mutually exclusive to m_pageId.
  */
 void
-Task::deleteMutuallyExclusiveOutputFiles()
+Task::deleteMutuallyExclusiveOutputFiles(
+	PageId const& page_id, OutputFileNameGenerator const& out_file_name_gen)
 {
-	switch (m_pageId.subPage()) {
+	switch (page_id.subPage()) {
 		case PageId::SINGLE_PAGE:
-			QFile::remove(
-				m_outFileNameGen.filePathFor(
-					PageId(m_pageId.imageId(), PageId::LEFT_PAGE)
-				)
+			deleteOutputFile(
+				PageId(page_id.imageId(), PageId::LEFT_PAGE), out_file_name_gen
 			);
-			QFile::remove(
-				m_outFileNameGen.filePathFor(
-					PageId(m_pageId.imageId(), PageId::RIGHT_PAGE)
-				)
+			deleteOutputFile(
+				PageId(page_id.imageId(), PageId::RIGHT_PAGE), out_file_name_gen
 			);
 			break;
 		case PageId::LEFT_PAGE:
 		case PageId::RIGHT_PAGE:
-			QFile::remove(
-				m_outFileNameGen.filePathFor(
-					PageId(m_pageId.imageId(), PageId::SINGLE_PAGE)
-				)
+			deleteOutputFile(
+				PageId(page_id.imageId(), PageId::SINGLE_PAGE), out_file_name_gen
 			);
 			break;
 	}
 }
 
+/**
+ * Delete the output file of \p page_id together with its unfilled copy.
+ */
+void
+Task::deleteOutputFile(
+	PageId const& page_id, OutputFileNameGenerator const& out_file_name_gen)
+{
+	QString const out_file_path(out_file_name_gen.filePathFor(page_id));
+	QFile::remove(out_file_path);
+	
+	QString const unfilled_dir(Utils::unfilledDir(out_file_name_gen.outDir()));
+	QFile::remove(
+		QDir(unfilled_dir).absoluteFilePath(QFileInfo(out_file_path).fileName())
+	);
+}
+
+
+/*========================= Task::OutputWriteJob ========================*/
+
+Task::OutputWriteJob::OutputWriteJob(
+	IntrusivePtr<Settings> const& settings,
+	IntrusivePtr<ThumbnailPixmapCache> const& thumbnail_cache,
+	PageId const& page_id, OutputFileNameGenerator const& out_file_name_gen,
+	OutputImageParams const& output_image_params,
+	ZoneSet const& picture_zones, ZoneSet const& fill_zones,
+	QString const& out_file_path, QString const& automask_file_path,
+	QString const& speckles_file_path, QImage const& out_img)
+:	WriteBehindQueue::Job(page_id),
+	m_ptrSettings(settings),
+	m_ptrThumbnailCache(thumbnail_cache),
+	m_pageId(page_id),
+	m_outFileNameGen(out_file_name_gen),
+	m_outputImageParams(output_image_params),
+	m_pictureZones(picture_zones),
+	m_fillZones(fill_zones),
+	m_outFilePath(out_file_path),
+	m_automaskFilePath(automask_file_path),
+	m_specklesFilePath(speckles_file_path),
+	m_outImage(out_img),
+	m_failed(false)
+{
+}
+
+void
+Task::OutputWriteJob::finished(bool const success)
+{
+	if (!success || m_failed) {
+		m_ptrSettings->removeOutputParams(m_pageId);
+		return;
+	}
+	
+	deleteMutuallyExclusiveOutputFiles(m_pageId, m_outFileNameGen);
+	
+	// Note that we can't reuse *_file_info objects
+	// as we've just overwritten those files.
+	OutputParams const out_params(
+		m_outputImageParams,
+		OutputFileParams(QFileInfo(m_outFilePath)),
+		m_automaskFilePath.isEmpty() ? OutputFileParams()
+		: OutputFileParams(QFileInfo(m_automaskFilePath)),
+		m_specklesFilePath.isEmpty() ? OutputFileParams()
+		: OutputFileParams(QFileInfo(m_specklesFilePath)),
+		m_pictureZones, m_fillZones
+	);
+	
+	m_ptrSettings->setOutputParams(m_pageId, out_params);
+	
+	m_ptrThumbnailCache->recreateThumbnail(ImageId(m_outFilePath), m_outImage);
+}
+
+
+/*========================== Task::PreviewUpdater =======================*/
+
+Task::PreviewUpdater::PreviewUpdater(
+	IntrusivePtr<Filter> const& filter, QImage const& image)
+:	m_ptrFilter(filter),
+	m_image(image),
+	m_downscaledImage(ImageView::createDownscaledImage(image))
+{
+}
+
+void
+Task::PreviewUpdater::updateUI(FilterUiInterface* ui)
+{
+	// This function is executed from the GUI thread.
+	
+	ui->setImageWidget(
+		new ImageView(m_image, m_downscaledImage, true), ui->TRANSFER_OWNERSHIP
+	);
+}
+
 
 /*============================ Task::UiUpdater ==========================*/
 
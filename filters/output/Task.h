@@ -26,17 +26,20 @@
 #include "ImageViewTab.h"
 #include "OutputFileNameGenerator.h"
 #include <QColor>
+#include <QtGlobal>
 #include <memory>
 
 class DebugImages;
 class TaskStatus;
 class FilterData;
 class ThumbnailPixmapCache;
+class WriteBehindQueue;
 class ImageTransformation;
 class QPolygonF;
 class QSize;
 class QImage;
 class Dpi;
+class ImageMetadata;
 
 namespace imageproc
 {
@@ -48,6 +51,8 @@ namespace output
 
 class Filter;
 class Settings;
+class Params;
+class ZoneSet;
 
 class Task : public RefCountable
 {
@@ -56,6 +61,7 @@ public:
 	Task(IntrusivePtr<Filter> const& filter,
 		IntrusivePtr<Settings> const& settings,
 		IntrusivePtr<ThumbnailPixmapCache> const& thumbnail_cache,
+		IntrusivePtr<WriteBehindQueue> const& write_behind,
 		PageId const& page_id, OutputFileNameGenerator const& out_file_name_gen,
 		ImageViewTab last_tab, bool batch, bool debug);
 	
@@ -65,14 +71,51 @@ public:
 		TaskStatus const& status, FilterData const& data,
 		QPolygonF const& content_rect_phys,
 		QPolygonF const& page_rect_phys);
+
+	/**
+	 * \brief Estimates the peak memory usage of process(), in bytes.
+	 *
+	 * The output image size is taken from the stored OutputParams,
+	 * if available, or derived from the original image otherwise.
+	 */
+	qint64 estimatePeakMemory(ImageMetadata const& orig_metadata) const;
+
+	/**
+	 * \brief Estimates the processing time of process(), in the units
+	 *        of OutputGenerator::estimateCost().
+	 */
+	double estimateCost(ImageMetadata const& orig_metadata) const;
 private:
 	class UiUpdater;
+	class PreviewUpdater;
+	class OutputWriteJob;
+	class Continuation;
+	
+	QSize estimateOutputSize(ImageMetadata const& orig_metadata, Params const& params) const;
+
+	FilterResultPtr generate(
+		TaskStatus const& status, FilterData const& data,
+		QPolygonF const& content_rect_phys,
+		QPolygonF const& page_rect_phys);
+	
+	void submitWriteJob(IntrusivePtr<OutputWriteJob> const& job);
+	
+	void reportPreview(
+		TaskStatus const& status, FilterData const& data,
+		Params const& params, ZoneSet const& picture_zones,
+		ZoneSet const& fill_zones, QPolygonF const& content_rect_phys,
+		QPolygonF const& page_rect_phys);
+	
+	static void deleteMutuallyExclusiveOutputFiles(
+		PageId const& page_id, OutputFileNameGenerator const& out_file_name_gen);
 	
-	void deleteMutuallyExclusiveOutputFiles();
+	static void deleteOutputFile(
+		PageId const& page_id, OutputFileNameGenerator const& out_file_name_gen);
 
 	IntrusivePtr<Filter> m_ptrFilter;
 	IntrusivePtr<Settings> m_ptrSettings;
 	IntrusivePtr<ThumbnailPixmapCache> m_ptrThumbnailCache;
+	IntrusivePtr<WriteBehindQueue> m_ptrWriteBehind;
 	std::auto_ptr<DebugImages> m_ptrDbg;
 	PageId m_pageId;
 	OutputFileNameGenerator m_outFileNameGen;
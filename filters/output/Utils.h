@@ -35,6 +35,11 @@ public:
 
 	static QString specklesDir(QString const& out_dir);
 	
+	/**
+	 * \brief The directory for output images without fill zones applied.
+	 */
+	static QString unfilledDir(QString const& out_dir);
+	
 	static QTransform scaleFromToDpi(Dpi const& from, Dpi const& to);
 };
 
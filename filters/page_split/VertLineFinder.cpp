@@ -31,6 +31,7 @@
 #include <boost/foreach.hpp>
 #include <QLineF>
 #include <QSizeF>
+#include <QRect>
 #include <QColor>
 #include <QImage>
 #include <QPainter>
@@ -141,6 +142,10 @@ VertLineFinder::findLines(
 	
 	unsigned weight_table[256];
 	buildWeightTable(weight_table);
+	
+	// Levels 0 and 1 are too weak to be considered.
+	weight_table[0] = 0;
+	weight_table[1] = 0;
 
 	// We don't want to process areas too close to the vertical edges.
 	double const margin_mm = 3.5;
@@ -148,16 +153,10 @@ VertLineFinder::findLines(
 
 	int const x_limit = raster_lines.width() - margin;
 	int const height = raster_lines.height();
-	uint8_t const* line = raster_lines.data();
-	int const stride = raster_lines.stride();
-	for (int y = 0; y < height; ++y, line += stride) {
-		for (int x = margin; x < x_limit; ++x) {
-			unsigned const val = line[x];
-			if (val > 1) {
-				line_detector.process(x, y, weight_table[val]);
-			}
-		}
-	}
+	line_detector.process(
+		raster_lines, weight_table,
+		QRect(margin, 0, x_limit - margin, height)
+	);
 	
 	unsigned const min_quality = (unsigned)(height * line_thickness * 1.8) + 1;
 	
@@ -125,7 +125,8 @@ ContentBoxFinder::findContentBox(
 		transformToGray(
 			data.grayImage(), xform_150dpi.transform(),
 			xform_150dpi.resultingRect().toRect(),
-			QColor(darkest_gray_level, darkest_gray_level, darkest_gray_level)
+			QColor(darkest_gray_level, darkest_gray_level, darkest_gray_level),
+			false, QSizeF(0.9, 0.9), &status
 		)
 	);
 	// Note that we fill new areas that appear as a result of
@@ -135,7 +136,7 @@ ContentBoxFinder::findContentBox(
 		dbg->add(gray150, "gray150");
 	}
 	
-	BinaryImage bw150(binarizeWolf(gray150, QSize(51, 51), 50));
+	BinaryImage bw150(binarizeWolf(gray150, QSize(51, 51), 50, 254, &status));
 	if (dbg) {
 		dbg->add(bw150, "bw150");
 	}
@@ -177,7 +178,7 @@ ContentBoxFinder::findContentBox(
 	
 	status.throwIfCancelled();
 	
-	BinaryImage shadows_dilated(seedFill(shadows_seed, dilated, CONN8));
+	BinaryImage shadows_dilated(seedFill(shadows_seed, dilated, CONN8, &status));
 	dilated.release();
 	if (dbg) {
 		dbg->add(shadows_dilated, "shadows_dilated");
@@ -1354,7 +1355,7 @@ ContentBoxFinder::filterShadows(
 	BinaryImage borders(shadows.size(), WHITE);
 	borders.fillExcept(borders.rect().adjusted(1, 1, -1, -1), BLACK);
 	
-	BinaryImage touching_shadows(seedFill(borders, shadows, CONN8));
+	BinaryImage touching_shadows(seedFill(borders, shadows, CONN8, &status));
 	rasterOp<RopXor<RopSrc, RopDst> >(shadows, touching_shadows);
 	if (dbg) {
 		dbg->add(shadows, "non_border_shadows");
@@ -1362,7 +1363,7 @@ ContentBoxFinder::filterShadows(
 	
 	if (shadows.countBlackPixels()) {
 		BinaryImage inv_shadows(shadows.inverted());
-		BinaryImage mask(seedFill(borders, inv_shadows, CONN8));
+		BinaryImage mask(seedFill(borders, inv_shadows, CONN8, &status));
 		borders.release();
 		rasterOp<RopOr<RopNot<RopDst>, RopSrc> >(mask, shadows);
 		if (dbg) {
@@ -1372,7 +1373,7 @@ ContentBoxFinder::filterShadows(
 		BinaryImage text_mask(estimateTextMask(inv_shadows, mask, dbg));
 		inv_shadows.release();
 		mask.release();
-		text_mask = seedFill(text_mask, shadows, CONN8);
+		text_mask = seedFill(text_mask, shadows, CONN8, &status);
 		if (dbg) {
 			dbg->add(text_mask, "misclassified_shadows");
 		}
@@ -1439,7 +1440,7 @@ ContentBoxFinder::filterShadows(
 	
 	status.throwIfCancelled();
 	
-	BinaryImage non_shadows(seedFill(opened, shadows, CONN8));
+	BinaryImage non_shadows(seedFill(opened, shadows, CONN8, &status));
 	opened.release();
 	if (dbg) {
 		dbg->add(non_shadows, "non_shadows");
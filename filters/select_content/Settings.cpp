@@ -17,8 +17,6 @@
 */
 
 #include "Settings.h"
-#include "Utils.h"
-#include <QMutexLocker>
 
 namespace select_content
 {
@@ -34,35 +32,25 @@ Settings::~Settings()
 void
 Settings::clear()
 {
-	QMutexLocker locker(&m_mutex);
 	m_pageParams.clear();
 }
 
 void
 Settings::setPageParams(PageId const& page_id, Params const& params)
 {
-	QMutexLocker locker(&m_mutex);
-	Utils::mapSetValue(m_pageParams, page_id, params);
+	m_pageParams.set(page_id, params);
 }
 
 void
 Settings::clearPageParams(PageId const& page_id)
 {
-	QMutexLocker locker(&m_mutex);
 	m_pageParams.erase(page_id);
 }
 
 std::auto_ptr<Params>
 Settings::getPageParams(PageId const& page_id) const
 {
-	QMutexLocker locker(&m_mutex);
-	
-	PageParams::const_iterator const it(m_pageParams.find(page_id));
-	if (it != m_pageParams.end()) {
-		return std::auto_ptr<Params>(new Params(it->second));
-	} else {
-		return std::auto_ptr<Params>();
-	}
+	return m_pageParams.get(page_id);
 }
 
 } // namespace select_content
@@ -0,0 +1,255 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SNAPSHOT_MAP_H_
+#define SNAPSHOT_MAP_H_
+
+#include "NonCopyable.h"
+#include "RefCountable.h"
+#include "IntrusivePtr.h"
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtGlobal>
+#include <memory>
+#include <map>
+
+/**
+ * \brief A thread-safe map that readers access through immutable snapshots.
+ *
+ * Reads are not lock-free: snapshot() locks a mutex for as long as it
+ * takes to copy a reference-counted pointer.  A plain atomic swap won't
+ * do, as a reader could load the pointer just before the last reference
+ * to it is dropped by a writer.  Lookups in a snapshot don't lock anything,
+ * so readers should take one snapshot and do all their lookups in it.
+ * Writers build a modified copy and publish it in one go.  Values are shared between
+ * snapshots, so a write copies a map of pointers rather than the values.
+ * Use Transaction to publish several changes at once.
+ *
+ * Every published change increments a version number, and each value
+ * remembers the version it was written at.  Comparing versions is a cheap
+ * way to find out whether a value has changed.  Version 0 means no value.
+ */
+template<typename K, typename V>
+class SnapshotMap
+{
+	DECLARE_NON_COPYABLE(SnapshotMap)
+private:
+	class Entry : public RefCountable
+	{
+	public:
+		Entry(V const& value, quint64 version) : value(value), version(version) {}
+		
+		V const value;
+		quint64 const version;
+	};
+	
+	typedef std::map<K, IntrusivePtr<Entry const> > Entries;
+public:
+	class Transaction;
+	
+	class Snapshot : public RefCountable
+	{
+		// Member-wise copying is OK.
+		friend class SnapshotMap;
+		friend class Transaction;
+	public:
+		Snapshot() : m_version(0) {}
+		
+		/**
+		 * \brief Returns the value for a key, or null if there is none.
+		 *
+		 * The value stays valid for as long as the snapshot is alive.
+		 */
+		V const* find(K const& key) const;
+		
+		quint64 version(K const& key) const;
+		
+		quint64 version() const { return m_version; }
+	private:
+		Entries m_entries;
+		quint64 m_version;
+	};
+	
+	typedef IntrusivePtr<Snapshot const> SnapshotPtr;
+	
+	/**
+	 * \brief A batch of changes published at once.
+	 *
+	 * Writers are serialized, so a transaction may read a value and
+	 * write it back without losing concurrent updates.  The changes
+	 * become visible when the transaction is destroyed.
+	 */
+	class Transaction
+	{
+		DECLARE_NON_COPYABLE(Transaction)
+	public:
+		explicit Transaction(SnapshotMap& owner);
+		
+		~Transaction();
+		
+		/**
+		 * \brief Like Snapshot::find(), but sees the changes made so far.
+		 */
+		V const* find(K const& key) const { return m_ptrDraft->find(key); }
+		
+		void set(K const& key, V const& value);
+		
+		void erase(K const& key);
+		
+		void clear();
+	private:
+		SnapshotMap& m_rOwner;
+		QMutexLocker m_locker;
+		IntrusivePtr<Snapshot> m_ptrDraft;
+		bool m_modified;
+	};
+	
+	SnapshotMap() : m_ptrSnapshot(new Snapshot) {}
+	
+	/**
+	 * \brief Returns the current state of the map.
+	 *
+	 * Briefly locks a mutex shared with writers publishing their changes.
+	 */
+	SnapshotPtr snapshot() const;
+	
+	/**
+	 * \brief Returns a copy of the value for a key, or null if there is none.
+	 */
+	std::auto_ptr<V> get(K const& key) const;
+	
+	quint64 version(K const& key) const { return snapshot()->version(key); }
+	
+	void set(K const& key, V const& value) { Transaction(*this).set(key, value); }
+	
+	void erase(K const& key) { Transaction(*this).erase(key); }
+	
+	void clear() { Transaction(*this).clear(); }
+private:
+	void publish(SnapshotPtr const& snapshot);
+	
+	mutable QMutex m_snapshotMutex;
+	QMutex m_writeMutex;
+	SnapshotPtr m_ptrSnapshot;
+};
+
+
+template<typename K, typename V>
+V const*
+SnapshotMap<K, V>::Snapshot::find(K const& key) const
+{
+	typename Entries::const_iterator const it(m_entries.find(key));
+	if (it == m_entries.end()) {
+		return 0;
+	}
+	return &it->second->value;
+}
+
+template<typename K, typename V>
+quint64
+SnapshotMap<K, V>::Snapshot::version(K const& key) const
+{
+	typename Entries::const_iterator const it(m_entries.find(key));
+	if (it == m_entries.end()) {
+		return 0;
+	}
+	return it->second->version;
+}
+
+template<typename K, typename V>
+SnapshotMap<K, V>::Transaction::Transaction(SnapshotMap& owner)
+:	m_rOwner(owner),
+	m_locker(&owner.m_writeMutex),
+	m_ptrDraft(new Snapshot(*owner.m_ptrSnapshot)),
+	m_modified(false)
+{
+	// Only writers replace m_ptrSnapshot, and we are holding
+	// the writers' mutex, so no need for m_snapshotMutex here.
+	++m_ptrDraft->m_version;
+}
+
+template<typename K, typename V>
+SnapshotMap<K, V>::Transaction::~Transaction()
+{
+	if (m_modified) {
+		m_rOwner.publish(m_ptrDraft);
+	}
+}
+
+template<typename K, typename V>
+void
+SnapshotMap<K, V>::Transaction::set(K const& key, V const& value)
+{
+	IntrusivePtr<Entry const> const entry(new Entry(value, m_ptrDraft->m_version));
+	m_ptrDraft->m_entries[key] = entry;
+	m_modified = true;
+}
+
+template<typename K, typename V>
+void
+SnapshotMap<K, V>::Transaction::erase(K const& key)
+{
+	if (m_ptrDraft->m_entries.erase(key)) {
+		m_modified = true;
+	}
+}
+
+template<typename K, typename V>
+void
+SnapshotMap<K, V>::Transaction::clear()
+{
+	if (!m_ptrDraft->m_entries.empty()) {
+		m_ptrDraft->m_entries.clear();
+		m_modified = true;
+	}
+}
+
+template<typename K, typename V>
+typename SnapshotMap<K, V>::SnapshotPtr
+SnapshotMap<K, V>::snapshot() const
+{
+	QMutexLocker const locker(&m_snapshotMutex);
+	return m_ptrSnapshot;
+}
+
+template<typename K, typename V>
+std::auto_ptr<V>
+SnapshotMap<K, V>::get(K const& key) const
+{
+	SnapshotPtr const snap(snapshot());
+	if (V const* value = snap->find(key)) {
+		return std::auto_ptr<V>(new V(*value));
+	}
+	return std::auto_ptr<V>();
+}
+
+template<typename K, typename V>
+void
+SnapshotMap<K, V>::publish(SnapshotPtr const& snapshot)
+{
+	SnapshotPtr old_snapshot(snapshot);
+	{
+		QMutexLocker const locker(&m_snapshotMutex);
+		m_ptrSnapshot.swap(old_snapshot);
+	}
+	// The old snapshot, if no longer referenced, is destroyed
+	// outside of the lock.
+}
+
+#endif
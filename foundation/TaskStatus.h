@@ -31,4 +31,29 @@ public:
 	virtual void throwIfCancelled() const = 0;
 };
 
+/**
+ * \brief A cancellation checkpoint for the loops of long-running kernels.
+ *
+ * Every \p interval calls to poll() result in one call to
+ * TaskStatus::throwIfCancelled().  A null status is allowed
+ * and means the work can't be cancelled.
+ */
+class TaskStatusPoller
+{
+public:
+	explicit TaskStatusPoller(TaskStatus const* status, int interval = 16)
+	: m_pStatus(status), m_interval(interval), m_countdown(interval) {}
+
+	void poll() {
+		if (m_pStatus && --m_countdown <= 0) {
+			m_countdown = m_interval;
+			m_pStatus->throwIfCancelled();
+		}
+	}
+private:
+	TaskStatus const* m_pStatus;
+	int m_interval;
+	int m_countdown;
+};
+
 #endif
@@ -21,6 +21,7 @@
 #include "BinaryThreshold.h"
 #include "Grayscale.h"
 #include "IntegralImage.h"
+#include "TaskStatus.h"
 #include <QImage>
 #include <QRect>
 #include <QDebug>
@@ -136,7 +137,8 @@ BinaryImage binarizeSauvola(QImage const& src, QSize const window_size)
 
 BinaryImage binarizeWolf(
 	QImage const& src, QSize const window_size,
-	unsigned char const lower_bound, unsigned char const upper_bound)
+	unsigned char const lower_bound, unsigned char const upper_bound,
+	TaskStatus const* const status)
 {
 	if (window_size.isEmpty()) {
 		throw std::invalid_argument("binarizeWolf: invalid window_size");
@@ -179,7 +181,10 @@ BinaryImage binarizeWolf(
 	
 	double max_deviation = 0;
 	
+	TaskStatusPoller poller(status);
 	for (int y = 0; y < h; ++y) {
+		poller.poll();
+		
 		int const top = std::max(0, y - window_lower_half);
 		int const bottom = std::min(h, y + window_upper_half); // exclusive
 		
@@ -213,6 +218,8 @@ BinaryImage binarizeWolf(
 	
 	gray_line = gray.bits();
 	for (int y = 0; y < h; ++y, gray_line += gray_bpl, bw_line += bw_wpl) {
+		poller.poll();
+		
 		for (int x = 0; x < w; ++x) {
 			float const mean = means[y * w + x];
 			float const deviation = deviations[y * w + x];
@@ -22,6 +22,7 @@
 #include <QSize>
 
 class QImage;
+class TaskStatus;
 
 namespace imageproc
 {
@@ -72,10 +73,13 @@ BinaryImage binarizeSauvola(QImage const& src, QSize window_size);
  * \param window_size The dimensions of a pixel neighborhood to consider.
  * \param lower_bound The minimum possible gray level that can be made white.
  * \param upper_bound The maximum possible gray level that can be made black.
+ * \param status If provided, it's polled every few lines, and binarization
+ *        stops with an exception if it gets cancelled.
  */
 BinaryImage binarizeWolf(
 	QImage const& src, QSize window_size,
-	unsigned char lower_bound = 1, unsigned char upper_bound = 254);
+	unsigned char lower_bound = 1, unsigned char upper_bound = 254,
+	TaskStatus const* status = 0);
 
 } // namespace imageproc
 
@@ -19,11 +19,15 @@
 #include "BinaryImage.h"
 #include "ByteOrder.h"
 #include "BitOps.h"
+#include "ConversionKernels.h"
+#include "ImageStorage.h"
 #include <QAtomicInt>
 #include <QImage>
 #include <QRect>
+#include <QPoint>
 #include <new>
 #include <memory>
+#include <vector>
 #include <stdexcept>
 #include <algorithm>
 #include <stddef.h>
@@ -461,13 +465,16 @@ BinaryImage::countBlackPixels(QRect const& rect) const
 			}
 		}
 	} else {
+		int const num_inner_words = last_word_idx - first_word_idx - 1;
+		if (first_word_idx == 0 && num_inner_words + 2 == m_wpl
+				&& r.left() == 0 && last_word_unused_bits == 0) {
+			// Whole lines without padding, which is one contiguous block.
+			return countNonZeroBits(line, m_wpl * r.height());
+		}
 		for (int y = top; y <= bottom; ++y, line += m_wpl) {
-			int idx = first_word_idx;
-			count += countNonZeroBits(line[idx] & first_word_mask);
-			for (++idx; idx != last_word_idx; ++idx) {
-				count += countNonZeroBits(line[idx]);
-			}
-			count += countNonZeroBits(line[idx] & last_word_mask);
+			count += countNonZeroBits(line[first_word_idx] & first_word_mask);
+			count += countNonZeroBits(line + first_word_idx + 1, num_inner_words);
+			count += countNonZeroBits(line[last_word_idx] & last_word_mask);
 		}
 	}
 	
@@ -606,6 +613,42 @@ BinaryImage::toQImage() const
 	return dst;
 }
 
+void
+BinaryImage::pasteInto(QImage& image, QPoint const& pos) const
+{
+	if ((image.format() != QImage::Format_Mono
+			&& image.format() != QImage::Format_MonoLSB)
+			|| image.numColors() != 2) {
+		throw std::invalid_argument("BinaryImage::pasteInto: not a B/W image");
+	}
+	
+	QRect const dst_rect(
+		QRect(pos, size()).intersected(image.rect())
+	);
+	if (dst_rect.isEmpty()) {
+		return;
+	}
+	
+	int const black_idx = qGray(image.color(1)) < qGray(image.color(0)) ? 1 : 0;
+	bool const lsb = image.format() == QImage::Format_MonoLSB;
+	uint32_t const msb = uint32_t(1) << 31;
+	
+	uint32_t const* src_line = data() + (dst_rect.top() - pos.y()) * m_wpl;
+	for (int y = dst_rect.top(); y <= dst_rect.bottom(); ++y, src_line += m_wpl) {
+		uint8_t* const dst_line = image.scanLine(y);
+		for (int x = dst_rect.left(); x <= dst_rect.right(); ++x) {
+			int const src_x = x - pos.x();
+			bool const black = (src_line[src_x >> 5] & (msb >> (src_x & 31))) != 0;
+			uint8_t const mask = lsb ? (1 << (x & 7)) : (0x80 >> (x & 7));
+			if ((black ? black_idx : 1 - black_idx) != 0) {
+				dst_line[x >> 3] |= mask;
+			} else {
+				dst_line[x >> 3] &= ~mask;
+			}
+		}
+	}
+}
+
 void
 BinaryImage::copyIfShared()
 {
@@ -788,45 +831,34 @@ BinaryImage::fromIndexed8(
 	BinaryImage dst(width, height);
 	int const dst_wpl = dst.wordsPerLine();
 	uint32_t* dst_line = dst.data();
-	int const last_word_idx = (width - 1) >> 5;
-	int const last_word_bits = width - (last_word_idx << 5);
-	int const last_word_unused_bits = 32 - last_word_bits;
 	
 	int const num_colors = image.numColors();
 	assert(num_colors <= 256);
-	int color_to_gray[256];
+	uint8_t color_to_gray[256];
+	bool identity_palette = (num_colors == 256);
 	int color_idx = 0;
 	for (; color_idx < num_colors; ++color_idx) {
 		color_to_gray[color_idx] = qGray(image.color(color_idx));
+		identity_palette = identity_palette && color_to_gray[color_idx] == color_idx;
 	}
 	for (; color_idx < 256; ++color_idx) {
 		color_to_gray[color_idx] = 0; // just in case
 	}
 	
+	std::vector<uint8_t> gray_line;
+	if (!identity_palette) {
+		gray_line.resize(width);
+	}
+	
 	for (int i = height; i > 0; --i) {
-		for (int j = 0; j < last_word_idx; ++j) {
-			uint8_t const* const src_pos = &src_line[j << 5];
-			uint32_t word = 0;
-			for (int bit = 0; bit < 32; ++bit) {
-				word <<= 1;
-				if (color_to_gray[src_pos[bit]] < threshold) {
-					word |= uint32_t(1);
-				}
-			}
-			dst_line[j] = word;
-		}
-		
-		// Handle the last word.
-		uint8_t const* const src_pos = &src_line[last_word_idx << 5];
-		uint32_t word = 0;
-		for (int bit = 0; bit < last_word_bits; ++bit) {
-			word <<= 1;
-			if (color_to_gray[src_pos[bit]] < threshold) {
-				word |= uint32_t(1);
+		if (identity_palette) {
+			conversion_kernels::thresholdGray(src_line, dst_line, width, threshold);
+		} else {
+			for (int x = 0; x < width; ++x) {
+				gray_line[x] = color_to_gray[src_line[x]];
 			}
+			conversion_kernels::thresholdGray(&gray_line[0], dst_line, width, threshold);
 		}
-		word <<= last_word_unused_bits;
-		dst_line[last_word_idx] = word;
 		
 		dst_line += dst_wpl;
 		src_line += src_bpl;
@@ -834,15 +866,6 @@ BinaryImage::fromIndexed8(
 	return dst;
 }
 
-static inline uint32_t thresholdRgb32(QRgb const c, int const threshold)
-{
-	// gray = (R * 11 + G * 16 + B * 5) / 32;
-	// return (gray < threshold) ? 1 : 0;
-	
-	int const sum = qRed(c)*11 + qGreen(c)*16 + qBlue(c)*5;
-	return (sum < threshold * 32) ? 1 : 0;
-}
-
 BinaryImage
 BinaryImage::fromRgb32(
 	QImage const& image, QRect const& rect, int const threshold)
@@ -858,54 +881,15 @@ BinaryImage::fromRgb32(
 	BinaryImage dst(width, height);
 	int const dst_wpl = dst.wordsPerLine();
 	uint32_t* dst_line = dst.data();
-	int const last_word_idx = (width - 1) >> 5;
-	int const last_word_bits = width - (last_word_idx << 5);
-	int const last_word_unused_bits = 32 - last_word_bits;
 	
 	for (int i = height; i > 0; --i) {
-		for (int j = 0; j < last_word_idx; ++j) {
-			QRgb const* const src_pos = &src_line[j << 5];
-			uint32_t word = 0;
-			for (int bit = 0; bit < 32; ++bit) {
-				word <<= 1;
-				word |= thresholdRgb32(src_pos[bit], threshold);
-			}
-			dst_line[j] = word;
-		}
-		
-		// Handle the last word.
-		QRgb const* const src_pos = &src_line[last_word_idx << 5];
-		uint32_t word = 0;
-		for (int bit = 0; bit < last_word_bits; ++bit) {
-			word <<= 1;
-			word |= thresholdRgb32(src_pos[bit], threshold);
-		}
-		word <<= last_word_unused_bits;
-		dst_line[last_word_idx] = word;
-		
+		conversion_kernels::thresholdRgb32(src_line, dst_line, width, threshold);
 		dst_line += dst_wpl;
 		src_line += src_wpl;
 	}
 	return dst;
 }
 
-static inline uint32_t thresholdArgbPM(QRgb const pm, int const threshold)
-{
-	int const alpha = qAlpha(pm);
-	if (alpha == 0) {
-		return 1; // black
-	}
-	
-	// R = R_PM * 255 / alpha;
-	// G = G_PM * 255 / alpha;
-	// B = B_PM * 255 / alpha;
-	// gray = (R * 11 + G * 16 + B * 5) / 32;
-	// return (gray < threshold) ? 1 : 0;
-	
-	int const sum = qRed(pm)*(255*11) + qGreen(pm)*(255*16) + qBlue(pm)*(255*5);
-	return (sum < alpha * threshold * 32) ? 1 : 0;
-}
-
 BinaryImage
 BinaryImage::fromArgb32Premultiplied(
 	QImage const& image, QRect const& rect, int const threshold)
@@ -921,31 +905,11 @@ BinaryImage::fromArgb32Premultiplied(
 	BinaryImage dst(width, height);
 	int const dst_wpl = dst.wordsPerLine();
 	uint32_t* dst_line = dst.data();
-	int const last_word_idx = (width - 1) >> 5;
-	int const last_word_bits = width - (last_word_idx << 5);
-	int const last_word_unused_bits = 32 - last_word_bits;
 	
 	for (int i = height; i > 0; --i) {
-		for (int j = 0; j < last_word_idx; ++j) {
-			QRgb const* const src_pos = &src_line[j << 5];
-			uint32_t word = 0;
-			for (int bit = 0; bit < 32; ++bit) {
-				word <<= 1;
-				word |= thresholdArgbPM(src_pos[bit], threshold);
-			}
-			dst_line[j] = word;
-		}
-		
-		// Handle the last word.
-		QRgb const* const src_pos = &src_line[last_word_idx << 5];
-		uint32_t word = 0;
-		for (int bit = 0; bit < last_word_bits; ++bit) {
-			word <<= 1;
-			word |= thresholdArgbPM(src_pos[bit], threshold);
-		}
-		word <<= last_word_unused_bits;
-		dst_line[last_word_idx] = word;
-		
+		conversion_kernels::thresholdArgb32Premultiplied(
+			src_line, dst_line, width, threshold
+		);
 		dst_line += dst_wpl;
 		src_line += src_wpl;
 	}
@@ -1036,7 +1000,19 @@ BinaryImage::isLineMonotone(
 	uint32_t const* const line, int const last_word_idx,
 	uint32_t const last_word_mask, uint32_t const modifier)
 {
-	for (int i = 0; i < last_word_idx; ++i) {
+	// Checking a block of words with a single branch lets the
+	// compiler vectorize the loop, and most lines we scan are empty.
+	int i = 0;
+	for (; i + 8 <= last_word_idx; i += 8) {
+		uint32_t acc = 0;
+		for (int j = 0; j < 8; ++j) {
+			acc |= line[i + j] ^ modifier;
+		}
+		if (acc) {
+			return false;
+		}
+	}
+	for (; i < last_word_idx; ++i) {
 		uint32_t const word = line[i] ^ modifier;
 		if (word) {
 			return false;
@@ -1113,15 +1089,19 @@ bool operator==(BinaryImage const& lhs, BinaryImage const& rhs)
 	int const last_word_idx = last_bit_idx / 32;
 	uint32_t const last_word_mask = ~uint32_t(0) << (31 - last_bit_idx % 32);
 	
+	if (lhs_wpl == rhs_wpl && lhs_wpl == last_word_idx + 1 && ~last_word_mask == 0) {
+		// No padding anywhere, so compare everything in one go.
+		return memcmp(lhs_line, rhs_line, lhs_wpl * lhs.height() * 4) == 0;
+	}
+	
 	for (int i = lhs.height(); i > 0; --i) {
-		int j = 0;
-		for (; j < last_word_idx; ++j) {
-			if (lhs_line[j] != rhs_line[j]) {
-				return false;
-			}
+		// memcmp() is vectorized in any decent C library.
+		if (memcmp(lhs_line, rhs_line, last_word_idx * 4) != 0) {
+			return false;
 		}
 		
 		// Handle the last (possibly incomplete) word.
+		int const j = last_word_idx;
 		if ((lhs_line[j] & last_word_mask) != (rhs_line[j] & last_word_mask)) {
 			return false;
 		}
@@ -1141,7 +1121,7 @@ BinaryImage::SharedData::unref() const
 {
 	if (!m_refCounter.deref()) {
 		this->~SharedData();
-		free((void*)this);
+		ImageStorage::release((void*)this);
 	}
 }
 
@@ -1149,17 +1129,15 @@ void*
 BinaryImage::SharedData::operator new(size_t, NumWords const num_words)
 {
 	SharedData* sd = 0;
-	void* addr = malloc(((char*)&sd->m_data[0] - (char*)sd) + num_words.numWords * 4);
-	if (!addr) {
-		throw std::bad_alloc();
-	}
-	return addr;
+	return ImageStorage::allocate(
+		((char*)&sd->m_data[0] - (char*)sd) + num_words.numWords * 4
+	);
 }
 
 void
 BinaryImage::SharedData::operator delete(void* addr, NumWords)
 {
-	free(addr);
+	ImageStorage::release(addr);
 }
 
 } // namespace imageproc
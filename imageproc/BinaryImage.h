@@ -26,6 +26,7 @@
 #include <stdint.h>
 
 class QImage;
+class QPoint;
 
 namespace imageproc
 {
@@ -239,6 +240,19 @@ public:
 	 * \brief Convert to a QImage with Format_Mono.
 	 */
 	QImage toQImage() const;
+	
+	/**
+	 * \brief Copies this image into an existing Mono or MonoLSB QImage.
+	 *
+	 * The QImage must have two colors.  Black pixels get the darker one.
+	 * Pixels falling outside of \p image are skipped.  Unlike toQImage(),
+	 * this keeps the DPI, the color table and everything else about
+	 * the target image.
+	 *
+	 * \param image The image to copy into.
+	 * \param pos Where the top-left corner of this image goes in \p image.
+	 */
+	void pasteInto(QImage& image, QPoint const& pos) const;
 private:
 	class SharedData;
 	
@@ -17,6 +17,10 @@
 */
 
 #include "BitOps.h"
+#include "CpuFeatures.h"
+#if defined(_MSC_VER) && defined(IMAGEPROC_HAVE_POPCNT)
+#include <intrin.h>
+#endif
 
 namespace imageproc
 {
@@ -80,5 +84,70 @@ unsigned char const reversedBits[256] = {
 
 } // namespace detail
 
+namespace
+{
+
+inline int countBitsSwar(uint32_t word)
+{
+	word -= (word >> 1) & 0x55555555;
+	word = (word & 0x33333333) + ((word >> 2) & 0x33333333);
+	word = (word + (word >> 4)) & 0x0F0F0F0F;
+	return (word * 0x01010101) >> 24;
+}
+
+int countNonZeroBitsGeneric(uint32_t const* words, int const num_words)
+{
+	int count = 0;
+	for (int i = 0; i < num_words; ++i) {
+		count += countBitsSwar(words[i]);
+	}
+	return count;
+}
+
+#ifdef IMAGEPROC_HAVE_POPCNT
+
+IMAGEPROC_TARGET_POPCNT
+int countNonZeroBitsPopcnt(uint32_t const* words, int const num_words)
+{
+	// Independent accumulators let several POPCNTs run in parallel.
+	int c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+	int i = 0;
+	for (; i + 4 <= num_words; i += 4) {
+#if defined(_MSC_VER)
+		c0 += __popcnt(words[i]);
+		c1 += __popcnt(words[i + 1]);
+		c2 += __popcnt(words[i + 2]);
+		c3 += __popcnt(words[i + 3]);
+#else
+		c0 += __builtin_popcount(words[i]);
+		c1 += __builtin_popcount(words[i + 1]);
+		c2 += __builtin_popcount(words[i + 2]);
+		c3 += __builtin_popcount(words[i + 3]);
+#endif
+	}
+	for (; i < num_words; ++i) {
+#if defined(_MSC_VER)
+		c0 += __popcnt(words[i]);
+#else
+		c0 += __builtin_popcount(words[i]);
+#endif
+	}
+	return c0 + c1 + c2 + c3;
+}
+
+#endif // IMAGEPROC_HAVE_POPCNT
+
+} // anonymous namespace
+
+int countNonZeroBits(uint32_t const* words, int const num_words)
+{
+#ifdef IMAGEPROC_HAVE_POPCNT
+	if (CpuFeatures::hasPopcnt()) {
+		return countNonZeroBitsPopcnt(words, num_words);
+	}
+#endif
+	return countNonZeroBitsGeneric(words, num_words);
+}
+
 } // namespace imageproc
 
@@ -19,6 +19,8 @@
 #ifndef IMAGEPROC_BITOPS_H_
 #define IMAGEPROC_BITOPS_H_
 
+#include <stdint.h>
+
 namespace imageproc
 {
 
@@ -176,6 +178,13 @@ int countNonZeroBits(T const val)
 	return detail::NonZeroBits<T, sizeof(T)>::count(val);
 }
 
+/**
+ * \brief Counts the set bits in an array of words.
+ *
+ * Uses the POPCNT instruction where the CPU supports it.
+ */
+int countNonZeroBits(uint32_t const* words, int num_words);
+
 template<typename T>
 T reverseBits(T const val)
 {
@@ -0,0 +1,365 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ConversionKernels.h"
+#include "CpuFeatures.h"
+#include "BitOps.h"
+#include <QColor>
+#include <algorithm>
+#include <string.h>
+#ifdef IMAGEPROC_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef IMAGEPROC_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+namespace imageproc
+{
+
+namespace conversion_kernels
+{
+
+namespace
+{
+
+/**
+ * Pixels are converted to gray in chunks of this size before being
+ * thresholded.  Has to be a multiple of 32.
+ */
+int const CHUNK_SIZE = 512;
+
+inline uint32_t blackIfArgbPM(uint32_t const pm, int const threshold)
+{
+	int const alpha = qAlpha(pm);
+	if (alpha == 0) {
+		return 1;
+	}
+	int const sum = qRed(pm)*(255*11) + qGreen(pm)*(255*16) + qBlue(pm)*(255*5);
+	return (sum < alpha * threshold * 32) ? 1 : 0;
+}
+
+/**
+ * Packs up to 32 gray levels into a word, leftmost pixel first.
+ */
+inline uint32_t packGrayWord(
+	uint8_t const* src, int const num_pixels, int const threshold)
+{
+	uint32_t word = 0;
+	for (int i = 0; i < num_pixels; ++i) {
+		word <<= 1;
+		word |= (src[i] < threshold) ? 1 : 0;
+	}
+	return word << (32 - num_pixels);
+}
+
+void rgb32ToGrayGeneric(uint32_t const* src, uint8_t* dst, int const num_pixels)
+{
+	for (int i = 0; i < num_pixels; ++i) {
+		dst[i] = static_cast<uint8_t>(qGray(src[i]));
+	}
+}
+
+#ifndef IMAGEPROC_HAVE_SSE2
+void thresholdGrayGeneric(
+	uint8_t const* src, uint32_t* dst_words, int const num_pixels, int const threshold)
+{
+	int const full_words = num_pixels >> 5;
+	for (int i = 0; i < full_words; ++i, src += 32) {
+		dst_words[i] = packGrayWord(src, 32, threshold);
+	}
+	if (num_pixels & 31) {
+		dst_words[full_words] = packGrayWord(src, num_pixels & 31, threshold);
+	}
+}
+#endif
+
+void thresholdArgbPMGeneric(
+	uint32_t const* src, uint32_t* dst_words, int const num_pixels, int const threshold)
+{
+	int const num_words = (num_pixels + 31) >> 5;
+	for (int i = 0; i < num_words; ++i, src += 32) {
+		int const bits = std::min(32, num_pixels - (i << 5));
+		uint32_t word = 0;
+		for (int bit = 0; bit < bits; ++bit) {
+			word <<= 1;
+			word |= blackIfArgbPM(src[bit], threshold);
+		}
+		dst_words[i] = word << (32 - bits);
+	}
+}
+
+#ifdef IMAGEPROC_HAVE_SSE2
+
+/**
+ * Computes R * 11 + G * 16 + B * 5 of 4 pixels, which is qGray() * 32
+ * before rounding down.
+ */
+inline __m128i weightedSumSse2(__m128i const px)
+{
+	// Lanes of 0x00RR00BB, multiplied and added as 16-bit pairs.
+	__m128i const rb = _mm_and_si128(px, _mm_set1_epi32(0x00ff00ff));
+	__m128i const g = _mm_and_si128(_mm_srli_epi32(px, 8), _mm_set1_epi32(0xff));
+	__m128i sum = _mm_madd_epi16(rb, _mm_set1_epi32((11 << 16) | 5));
+	sum = _mm_add_epi32(sum, _mm_slli_epi32(g, 4));
+	return sum;
+}
+
+void rgb32ToGraySse2(uint32_t const* src, uint8_t* dst, int const num_pixels)
+{
+	int i = 0;
+	for (; i + 16 <= num_pixels; i += 16) {
+		__m128i const* const p = reinterpret_cast<__m128i const*>(src + i);
+		__m128i const g0 = _mm_srli_epi32(weightedSumSse2(_mm_loadu_si128(p)), 5);
+		__m128i const g1 = _mm_srli_epi32(weightedSumSse2(_mm_loadu_si128(p + 1)), 5);
+		__m128i const g2 = _mm_srli_epi32(weightedSumSse2(_mm_loadu_si128(p + 2)), 5);
+		__m128i const g3 = _mm_srli_epi32(weightedSumSse2(_mm_loadu_si128(p + 3)), 5);
+		__m128i const packed = _mm_packus_epi16(
+			_mm_packs_epi32(g0, g1), _mm_packs_epi32(g2, g3)
+		);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+	}
+	rgb32ToGrayGeneric(src + i, dst + i, num_pixels - i);
+}
+
+/**
+ * \p threshold has to be in [1, 255].
+ */
+void thresholdGraySse2(
+	uint8_t const* src, uint32_t* dst_words, int const num_pixels, int const threshold)
+{
+	// Unsigned comparison through signed one.
+	__m128i const bias = _mm_set1_epi8(char(0x80));
+	__m128i const thr = _mm_set1_epi8(char(threshold ^ 0x80));
+	
+	int const full_words = num_pixels >> 5;
+	for (int i = 0; i < full_words; ++i, src += 32) {
+		__m128i const* const p = reinterpret_cast<__m128i const*>(src);
+		__m128i const lo = _mm_xor_si128(_mm_loadu_si128(p), bias);
+		__m128i const hi = _mm_xor_si128(_mm_loadu_si128(p + 1), bias);
+		uint32_t const bits = uint32_t(_mm_movemask_epi8(_mm_cmplt_epi8(lo, thr)))
+			| (uint32_t(_mm_movemask_epi8(_mm_cmplt_epi8(hi, thr))) << 16);
+		// movemask puts the leftmost pixel into the least significant bit.
+		dst_words[i] = reverseBits(bits);
+	}
+	if (num_pixels & 31) {
+		dst_words[full_words] = packGrayWord(src, num_pixels & 31, threshold);
+	}
+}
+
+/**
+ * Returns all ones in 32-bit lanes of pixels that come out black.
+ * \p thr32 holds threshold * 32 in 32-bit lanes, which has to fit
+ * a signed 16-bit integer.
+ */
+inline __m128i blackMaskArgbPMSse2(__m128i const px, __m128i const thr32)
+{
+	__m128i const alpha = _mm_srli_epi32(px, 24);
+	__m128i const sum = weightedSumSse2(px);
+	// sum * 255 < alpha * threshold * 32
+	__m128i const lhs = _mm_sub_epi32(_mm_slli_epi32(sum, 8), sum);
+	__m128i const rhs = _mm_madd_epi16(alpha, thr32);
+	return _mm_or_si128(
+		_mm_cmplt_epi32(lhs, rhs), _mm_cmpeq_epi32(alpha, _mm_setzero_si128())
+	);
+}
+
+void thresholdArgbPMSse2(
+	uint32_t const* src, uint32_t* dst_words, int const num_pixels, int const threshold)
+{
+	__m128i const thr32 = _mm_set1_epi32(threshold * 32);
+	
+	int const full_words = num_pixels >> 5;
+	for (int i = 0; i < full_words; ++i, src += 32) {
+		__m128i const* p = reinterpret_cast<__m128i const*>(src);
+		uint32_t bits = 0;
+		for (int half = 0; half < 2; ++half, p += 4) {
+			__m128i const m0 = blackMaskArgbPMSse2(_mm_loadu_si128(p), thr32);
+			__m128i const m1 = blackMaskArgbPMSse2(_mm_loadu_si128(p + 1), thr32);
+			__m128i const m2 = blackMaskArgbPMSse2(_mm_loadu_si128(p + 2), thr32);
+			__m128i const m3 = blackMaskArgbPMSse2(_mm_loadu_si128(p + 3), thr32);
+			__m128i const mask = _mm_packs_epi16(
+				_mm_packs_epi32(m0, m1), _mm_packs_epi32(m2, m3)
+			);
+			bits |= uint32_t(_mm_movemask_epi8(mask)) << (half * 16);
+		}
+		dst_words[i] = reverseBits(bits);
+	}
+	if (num_pixels & 31) {
+		thresholdArgbPMGeneric(src, dst_words + full_words, num_pixels & 31, threshold);
+	}
+}
+
+#endif // IMAGEPROC_HAVE_SSE2
+
+#ifdef IMAGEPROC_HAVE_AVX2
+
+IMAGEPROC_TARGET_AVX2
+inline __m256i grayFromRgb32Avx2(__m256i const px)
+{
+	__m256i const rb = _mm256_and_si256(px, _mm256_set1_epi32(0x00ff00ff));
+	__m256i const g = _mm256_and_si256(_mm256_srli_epi32(px, 8), _mm256_set1_epi32(0xff));
+	__m256i sum = _mm256_madd_epi16(rb, _mm256_set1_epi32((11 << 16) | 5));
+	sum = _mm256_add_epi32(sum, _mm256_slli_epi32(g, 4));
+	return _mm256_srli_epi32(sum, 5);
+}
+
+IMAGEPROC_TARGET_AVX2
+void rgb32ToGrayAvx2(uint32_t const* src, uint8_t* dst, int const num_pixels)
+{
+	// Packing works within 128-bit lanes, which leaves groups of
+	// 4 pixels in this order.
+	__m256i const unshuffle = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	
+	int i = 0;
+	for (; i + 32 <= num_pixels; i += 32) {
+		__m256i const* const p = reinterpret_cast<__m256i const*>(src + i);
+		__m256i const g0 = grayFromRgb32Avx2(_mm256_loadu_si256(p));
+		__m256i const g1 = grayFromRgb32Avx2(_mm256_loadu_si256(p + 1));
+		__m256i const g2 = grayFromRgb32Avx2(_mm256_loadu_si256(p + 2));
+		__m256i const g3 = grayFromRgb32Avx2(_mm256_loadu_si256(p + 3));
+		__m256i const packed = _mm256_packus_epi16(
+			_mm256_packs_epi32(g0, g1), _mm256_packs_epi32(g2, g3)
+		);
+		_mm256_storeu_si256(
+			reinterpret_cast<__m256i*>(dst + i),
+			_mm256_permutevar8x32_epi32(packed, unshuffle)
+		);
+	}
+	rgb32ToGraySse2(src + i, dst + i, num_pixels - i);
+}
+
+IMAGEPROC_TARGET_AVX2
+void thresholdGrayAvx2(
+	uint8_t const* src, uint32_t* dst_words, int const num_pixels, int const threshold)
+{
+	__m256i const bias = _mm256_set1_epi8(char(0x80));
+	__m256i const thr = _mm256_set1_epi8(char(threshold ^ 0x80));
+	
+	int const full_words = num_pixels >> 5;
+	for (int i = 0; i < full_words; ++i, src += 32) {
+		__m256i const px = _mm256_xor_si256(
+			_mm256_loadu_si256(reinterpret_cast<__m256i const*>(src)), bias
+		);
+		uint32_t const bits = uint32_t(_mm256_movemask_epi8(_mm256_cmpgt_epi8(thr, px)));
+		dst_words[i] = reverseBits(bits);
+	}
+	if (num_pixels & 31) {
+		dst_words[full_words] = packGrayWord(src, num_pixels & 31, threshold);
+	}
+}
+
+#endif // IMAGEPROC_HAVE_AVX2
+
+/**
+ * Handles thresholds for which every pixel comes out the same.
+ * Returns false if \p threshold is in [1, 255].
+ */
+bool fillTrivial(uint32_t* dst_words, int const num_pixels, int const threshold)
+{
+	if (threshold > 0 && threshold <= 255) {
+		return false;
+	}
+	
+	int const num_words = (num_pixels + 31) >> 5;
+	if (threshold <= 0) {
+		memset(dst_words, 0, num_words * 4);
+	} else {
+		memset(dst_words, 0xff, num_words * 4);
+		if (num_pixels & 31) {
+			dst_words[num_words - 1] = ~uint32_t(0) << (32 - (num_pixels & 31));
+		}
+	}
+	return true;
+}
+
+} // anonymous namespace
+
+void rgb32ToGray(uint32_t const* src, uint8_t* dst, int const num_pixels)
+{
+#ifdef IMAGEPROC_HAVE_AVX2
+	if (CpuFeatures::hasAvx2()) {
+		rgb32ToGrayAvx2(src, dst, num_pixels);
+		return;
+	}
+#endif
+#ifdef IMAGEPROC_HAVE_SSE2
+	rgb32ToGraySse2(src, dst, num_pixels);
+#else
+	rgb32ToGrayGeneric(src, dst, num_pixels);
+#endif
+}
+
+void rgb888ToGray(uint8_t const* src, uint8_t* dst, int const num_pixels)
+{
+	// Three-byte pixels don't map well onto SSE2 without byte shuffles,
+	// so we just avoid the per-pixel QImage::pixel() overhead here.
+	for (int i = 0; i < num_pixels; ++i, src += 3) {
+		dst[i] = static_cast<uint8_t>((src[0] * 11 + src[1] * 16 + src[2] * 5) >> 5);
+	}
+}
+
+void thresholdGray(
+	uint8_t const* src, uint32_t* dst_words, int const num_pixels, int const threshold)
+{
+	if (fillTrivial(dst_words, num_pixels, threshold)) {
+		return;
+	}
+#ifdef IMAGEPROC_HAVE_AVX2
+	if (CpuFeatures::hasAvx2()) {
+		thresholdGrayAvx2(src, dst_words, num_pixels, threshold);
+		return;
+	}
+#endif
+#ifdef IMAGEPROC_HAVE_SSE2
+	thresholdGraySse2(src, dst_words, num_pixels, threshold);
+#else
+	thresholdGrayGeneric(src, dst_words, num_pixels, threshold);
+#endif
+}
+
+void thresholdRgb32(
+	uint32_t const* src, uint32_t* dst_words, int const num_pixels, int const threshold)
+{
+	if (fillTrivial(dst_words, num_pixels, threshold)) {
+		return;
+	}
+	
+	uint8_t gray[CHUNK_SIZE];
+	for (int offset = 0; offset < num_pixels; offset += CHUNK_SIZE) {
+		int const chunk = std::min(CHUNK_SIZE, num_pixels - offset);
+		rgb32ToGray(src + offset, gray, chunk);
+		thresholdGray(gray, dst_words + (offset >> 5), chunk, threshold);
+	}
+}
+
+void thresholdArgb32Premultiplied(
+	uint32_t const* src, uint32_t* dst_words, int const num_pixels, int const threshold)
+{
+#ifdef IMAGEPROC_HAVE_SSE2
+	if (threshold >= 0 && threshold < 1024) {
+		thresholdArgbPMSse2(src, dst_words, num_pixels, threshold);
+		return;
+	}
+#endif
+	thresholdArgbPMGeneric(src, dst_words, num_pixels, threshold);
+}
+
+} // namespace conversion_kernels
+
+} // namespace imageproc
@@ -0,0 +1,78 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGEPROC_CONVERSION_KERNELS_H_
+#define IMAGEPROC_CONVERSION_KERNELS_H_
+
+#include <stdint.h>
+
+namespace imageproc
+{
+
+/**
+ * \brief Per-line pixel format conversions used by toGrayscale()
+ *        and the BinaryImage constructors.
+ *
+ * These pick the widest instruction set the CPU supports at runtime.
+ * Results are bit-exact with the scalar formulas, that is qGray() for
+ * gray levels and BinaryThreshold semantics for binarization.
+ */
+namespace conversion_kernels
+{
+
+/**
+ * \brief Converts RGB32 or ARGB32 pixels to gray levels, ignoring alpha.
+ */
+void rgb32ToGray(uint32_t const* src, uint8_t* dst, int num_pixels);
+
+/**
+ * \brief Converts RGB888 pixels (R, G, B byte order) to gray levels.
+ */
+void rgb888ToGray(uint8_t const* src, uint8_t* dst, int num_pixels);
+
+/**
+ * \brief Packs gray levels into BinaryImage words.
+ *
+ * Levels below \p threshold become black (set) bits.  The most significant
+ * bit of each word corresponds to the leftmost pixel.  Exactly
+ * (num_pixels + 31) / 32 words are written, with the bits past
+ * \p num_pixels in the last word set to zero.
+ */
+void thresholdGray(
+	uint8_t const* src, uint32_t* dst_words, int num_pixels, int threshold);
+
+/**
+ * \brief Same as thresholdGray(), but for RGB32 or ARGB32 pixels.
+ */
+void thresholdRgb32(
+	uint32_t const* src, uint32_t* dst_words, int num_pixels, int threshold);
+
+/**
+ * \brief Same as thresholdGray(), but for premultiplied ARGB32 pixels.
+ *
+ * The pixels are unpremultiplied before taking their gray level.
+ * Fully transparent pixels are considered black.
+ */
+void thresholdArgb32Premultiplied(
+	uint32_t const* src, uint32_t* dst_words, int num_pixels, int threshold);
+
+} // namespace conversion_kernels
+
+} // namespace imageproc
+
+#endif
@@ -0,0 +1,150 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "CpuFeatures.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#endif
+#include <stdint.h>
+
+namespace imageproc
+{
+
+namespace
+{
+
+struct CpuidRegs
+{
+	uint32_t eax;
+	uint32_t ebx;
+	uint32_t ecx;
+	uint32_t edx;
+};
+
+bool cpuid(uint32_t const leaf, uint32_t const subleaf, CpuidRegs& regs)
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	int info[4];
+	__cpuid(info, 0);
+	if (uint32_t(info[0]) < leaf) {
+		return false;
+	}
+	__cpuidex(info, leaf, subleaf);
+	regs.eax = info[0];
+	regs.ebx = info[1];
+	regs.ecx = info[2];
+	regs.edx = info[3];
+	return true;
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	if (__get_cpuid_max(0, 0) < leaf) {
+		return false;
+	}
+	__cpuid_count(leaf, subleaf, regs.eax, regs.ebx, regs.ecx, regs.edx);
+	return true;
+#else
+	(void)leaf;
+	(void)subleaf;
+	(void)regs;
+	return false;
+#endif
+}
+
+/**
+ * Returns the lower 32 bits of XCR0, which tell which register
+ * states the OS saves on context switches.
+ */
+uint32_t osEnabledXStates()
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	return uint32_t(_xgetbv(0));
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	uint32_t eax, edx;
+	__asm__ __volatile__(".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c"(0));
+	return eax;
+#else
+	return 0;
+#endif
+}
+
+bool detectSse2()
+{
+	CpuidRegs regs;
+	if (!cpuid(1, 0, regs)) {
+		return false;
+	}
+	return (regs.edx & (uint32_t(1) << 26)) != 0;
+}
+
+bool detectAvx2()
+{
+	CpuidRegs regs;
+	if (!cpuid(1, 0, regs)) {
+		return false;
+	}
+	uint32_t const osxsave_and_avx = (uint32_t(1) << 27) | (uint32_t(1) << 28);
+	if ((regs.ecx & osxsave_and_avx) != osxsave_and_avx) {
+		return false;
+	}
+	
+	// The OS has to preserve both the XMM and the YMM state.
+	if ((osEnabledXStates() & 6) != 6) {
+		return false;
+	}
+	
+	if (!cpuid(7, 0, regs)) {
+		return false;
+	}
+	return (regs.ebx & (uint32_t(1) << 5)) != 0;
+}
+
+bool detectPopcnt()
+{
+	CpuidRegs regs;
+	if (!cpuid(1, 0, regs)) {
+		return false;
+	}
+	return (regs.ecx & (uint32_t(1) << 23)) != 0;
+}
+
+bool const s_hasSse2 = detectSse2();
+bool const s_hasAvx2 = detectAvx2();
+bool const s_hasPopcnt = detectPopcnt();
+
+} // anonymous namespace
+
+bool
+CpuFeatures::hasSse2()
+{
+	return s_hasSse2;
+}
+
+bool
+CpuFeatures::hasAvx2()
+{
+	return s_hasAvx2;
+}
+
+bool
+CpuFeatures::hasPopcnt()
+{
+	return s_hasPopcnt;
+}
+
+} // namespace imageproc
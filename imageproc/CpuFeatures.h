@@ -0,0 +1,85 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGEPROC_CPU_FEATURES_H_
+#define IMAGEPROC_CPU_FEATURES_H_
+
+/**
+ * IMAGEPROC_HAVE_SSE2 is defined when SSE2 intrinsics may be used
+ * unconditionally, that is when the compiler targets SSE2 anyway.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define IMAGEPROC_HAVE_SSE2 1
+#endif
+
+/**
+ * IMAGEPROC_HAVE_AVX2 is defined when the compiler is able to emit AVX2
+ * code for individual functions marked with IMAGEPROC_TARGET_AVX2.
+ * Such functions may only be called if CpuFeatures::hasAvx2() is true.
+ */
+#if defined(IMAGEPROC_HAVE_SSE2)
+#	if defined(__clang__) || (defined(__GNUC__) && \
+		(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#		define IMAGEPROC_HAVE_AVX2 1
+#		define IMAGEPROC_TARGET_AVX2 __attribute__((target("avx2")))
+#	elif defined(_MSC_VER) && _MSC_VER >= 1800
+#		define IMAGEPROC_HAVE_AVX2 1
+#		define IMAGEPROC_TARGET_AVX2
+#	endif
+#endif
+
+/**
+ * IMAGEPROC_HAVE_POPCNT is defined when the compiler is able to emit
+ * the POPCNT instruction for individual functions marked with
+ * IMAGEPROC_TARGET_POPCNT.  Such functions may only be called
+ * if CpuFeatures::hasPopcnt() is true.
+ */
+#if defined(IMAGEPROC_HAVE_SSE2)
+#	if defined(__clang__) || defined(__GNUC__)
+#		define IMAGEPROC_HAVE_POPCNT 1
+#		define IMAGEPROC_TARGET_POPCNT __attribute__((target("popcnt")))
+#	elif defined(_MSC_VER)
+#		define IMAGEPROC_HAVE_POPCNT 1
+#		define IMAGEPROC_TARGET_POPCNT
+#	endif
+#endif
+
+namespace imageproc
+{
+
+/**
+ * \brief Instruction set extensions supported by the CPU we are running on.
+ *
+ * The detection is done once, at program startup.
+ */
+class CpuFeatures
+{
+public:
+	static bool hasSse2();
+	
+	/**
+	 * \brief Returns true if both the CPU and the OS support AVX2.
+	 */
+	static bool hasAvx2();
+	
+	static bool hasPopcnt();
+};
+
+} // namespace imageproc
+
+#endif
@@ -20,37 +20,23 @@
 */
 
 #include "GaussBlur.h"
-#include "Grayscale.h"
+#include "GrayImage.h"
 #include "Constants.h"
+#include "AlignedArray.h"
 #include <QImage>
 #include <QDebug>
-#include <vector>
 #include <algorithm>
 #include <math.h>
 #include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#endif
 
 namespace imageproc
 {
 
-static void transfer_pixels(
-	double const* src1, double const* src2,
-	unsigned char* dest, int const dest_step, int const count)
-{
-	for (int i = 0; i < count; ++i) {
-		int sum = (int)floor(*src1 + *src2 + 0.5);
-		if (sum > 255) {
-			sum = 255;
-		} else if (sum < 0) {
-			sum = 0;
-		}
-		*dest = (unsigned char)sum;
-		
-		++src1;
-		++src2;
-		dest += dest_step;
-	}
-}
-
 static void find_iir_constants(
 	double* n_p, double *n_m, double *d_p,
         double* d_m, double *bd_p, double *bd_m, double std_dev)
@@ -115,109 +101,240 @@ static void find_iir_constants(
 	}
 }
 
-static QImage gaussBlurGrayToGray(QImage const& src, double const std_dev)
+namespace
+{
+
+/**
+ * The number of columns (for the vertical pass) or lines (for the horizontal
+ * pass) processed together.  Pixels of such a block are stored interleaved,
+ * so that the recursive filter becomes a series of operations on contiguous
+ * vectors of BLOCK_SIZE floats.
+ */
+int const BLOCK_SIZE = 16;
+
+struct IirCoefficients
 {
-	int const width = src.width();
-	int const height = src.height();
+	float n_p[5];
+	float n_m[5];
+	float d_p[5];
+	float d_m[5];
+	float edge_p[5]; // n_p[i] - bd_p[i]
+	float edge_m[5]; // n_m[i] - bd_m[i]
 	
-	std::vector<double> val_p(std::max(width, height), 0);
-	std::vector<double> val_m(std::max(width, height), 0);
+	explicit IirCoefficients(double std_dev);
+};
+
+IirCoefficients::IirCoefficients(double const std_dev)
+{
+	double n_p_[5], n_m_[5], d_p_[5], d_m_[5], bd_p_[5], bd_m_[5];
+	find_iir_constants(n_p_, n_m_, d_p_, d_m_, bd_p_, bd_m_, std_dev);
+	for (int i = 0; i <= 4; ++i) {
+		n_p[i] = (float)n_p_[i];
+		n_m[i] = (float)n_m_[i];
+		d_p[i] = (float)d_p_[i];
+		d_m[i] = (float)d_m_[i];
+		edge_p[i] = (float)(n_p_[i] - bd_p_[i]);
+		edge_m[i] = (float)(n_m_[i] - bd_m_[i]);
+	}
+}
+
+/**
+ * acc[i] += src[i] * k, for i in [0, BLOCK_SIZE)
+ * Both acc and src have to be 16-byte aligned.
+ */
+inline void mulAddBlock(float* acc, float const* src, float const k)
+{
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	__m128 const kk = _mm_set1_ps(k);
+	for (int i = 0; i < BLOCK_SIZE; i += 4) {
+		__m128 const a = _mm_load_ps(acc + i);
+		__m128 const s = _mm_load_ps(src + i);
+		_mm_store_ps(acc + i, _mm_add_ps(a, _mm_mul_ps(s, kk)));
+	}
+#else
+	for (int i = 0; i < BLOCK_SIZE; ++i) {
+		acc[i] += src[i] * k;
+	}
+#endif
+}
+
+/**
+ * \brief Applies the causal and anti-causal recursive filters to
+ *        BLOCK_SIZE interleaved signals at once.
+ *
+ * \param in Input signals, in[pos * BLOCK_SIZE + signal_idx].
+ * \param out Filtered signals, in the same layout.
+ * \param tmp Scratch space of the same size as \p in and \p out.
+ * \param len The length of each signal.
+ */
+void iirFilterBlock(
+	float const* const in, float* const out, float* const tmp,
+	int const len, IirCoefficients const& k)
+{
+	int const B = BLOCK_SIZE;
+	size_t const block_bytes = B * sizeof(float);
 	
-	double n_p[5], n_m[5], d_p[5], d_m[5], bd_p[5], bd_m[5];
-	find_iir_constants(n_p, n_m, d_p, d_m, bd_p, bd_m, std_dev);
+	// Causal pass into out.
+	float const* const initial_p = in;
+	for (int pos = 0; pos < len; ++pos) {
+		float* const vp = out + pos * B;
+		memset(vp, 0, block_bytes);
+		int const terms = std::min(pos, 4);
+		int i = 0;
+		for (; i <= terms; ++i) {
+			mulAddBlock(vp, in + (pos - i) * B, k.n_p[i]);
+			if (i != 0) {
+				mulAddBlock(vp, vp - i * B, -k.d_p[i]);
+			}
+		}
+		for (; i <= 4; ++i) {
+			mulAddBlock(vp, initial_p, k.edge_p[i]);
+		}
+	}
 	
-	QImage dst(width, height, QImage::Format_Indexed8);
-	dst.setColorTable(createGrayscalePalette());
+	// Anti-causal pass into tmp.
+	float const* const initial_m = in + (len - 1) * B;
+	for (int pos = len - 1; pos >= 0; --pos) {
+		float* const vm = tmp + pos * B;
+		memset(vm, 0, block_bytes);
+		int const terms = std::min(len - 1 - pos, 4);
+		int i = 0;
+		for (; i <= terms; ++i) {
+			mulAddBlock(vm, in + (pos + i) * B, k.n_m[i]);
+			if (i != 0) {
+				mulAddBlock(vm, vm + i * B, -k.d_m[i]);
+			}
+		}
+		for (; i <= 4; ++i) {
+			mulAddBlock(vm, initial_m, k.edge_m[i]);
+		}
+	}
 	
-	unsigned char const* const src_data = src.bits();
-	unsigned char* const dst_data = dst.bits();
-	int const src_bpl = src.bytesPerLine();
-	int const dst_bpl = dst.bytesPerLine();
+	int const total = len * B;
+	for (int i = 0; i < total; ++i) {
+		out[i] += tmp[i];
+	}
+}
+
+inline uint8_t clampToGray(float const val)
+{
+	if (val <= 0.0f) {
+		return 0;
+	} else if (val >= 255.0f) {
+		return 255;
+	} else {
+		return static_cast<uint8_t>(val + 0.5f);
+	}
+}
+
+/**
+ * Blurs 8-bit grayscale data in place.  The vertical pass processes
+ * BLOCK_SIZE columns at a time, reading them row by row, which is
+ * much more cache friendly than walking individual columns.  The
+ * horizontal pass processes BLOCK_SIZE lines at a time.
+ */
+void gaussBlurInPlace(
+	uint8_t* const data, int const stride,
+	int const width, int const height, double const std_dev)
+{
+	IirCoefficients const k(std_dev);
+	int const B = BLOCK_SIZE;
+	size_t const buf_size = std::max(width, height) * B;
+	AlignedArray<float, 4> in(buf_size);
+	AlignedArray<float, 4> out(buf_size);
+	AlignedArray<float, 4> tmp(buf_size);
 	
 	// Vertical pass.
-	for (int x = 0; x < width; ++x) {
-		memset(&val_p[0], 0, height * sizeof(double));
-		memset(&val_m[0], 0, height * sizeof(double));
+	for (int x0 = 0; x0 < width; x0 += B) {
+		int const block_width = std::min(B, width - x0);
 		
-		unsigned char const* sp_p = src_data + x;
-		unsigned char const* sp_m = sp_p + (height - 1) * src_bpl;
-		double* vp = &val_p[0];
-		double* vm = &val_m[0] + height - 1;
-		unsigned char const initial_p = sp_p[0];
-		unsigned char const initial_m = sp_m[0];
-		
-		for (int y = 0; y < height; ++y) {
-			int const terms = std::min(y, 4);
+		uint8_t const* line = data + x0;
+		float* p = in.data();
+		for (int y = 0; y < height; ++y, line += stride, p += B) {
 			int i = 0;
-			int sp_off = 0;
-			for (; i <= terms; ++i, sp_off += src_bpl) {
-				*vp += n_p[i] * sp_p[-sp_off] - d_p[i] * vp[-i];
-				*vm += n_m[i] * sp_m[sp_off] - d_m[i] * vm[i];
+			for (; i < block_width; ++i) {
+				p[i] = line[i];
 			}
-			for (; i <= 4; ++i) {
-				*vp += (n_p[i] - bd_p[i]) * initial_p;
-				*vm += (n_m[i] - bd_m[i]) * initial_m;
+			for (; i < B; ++i) {
+				p[i] = 0.0f;
 			}
-			sp_p += src_bpl;
-			sp_m -= src_bpl;
-			++vp;
-			--vm;
 		}
 		
-		transfer_pixels(&val_p[0], &val_m[0], dst_data + x, dst_bpl, height);
+		iirFilterBlock(in.data(), out.data(), tmp.data(), height, k);
+		
+		uint8_t* dst_line = data + x0;
+		p = out.data();
+		for (int y = 0; y < height; ++y, dst_line += stride, p += B) {
+			for (int i = 0; i < block_width; ++i) {
+				dst_line[i] = clampToGray(p[i]);
+			}
+		}
 	}
 	
 	// Horizontal pass.
-	unsigned char* dst_line = dst_data;
-	for (int y = 0; y < height; ++y, dst_line += dst_bpl) {
-		memset(&val_p[0], 0, width * sizeof(double));
-		memset(&val_m[0], 0, width * sizeof(double));
+	for (int y0 = 0; y0 < height; y0 += B) {
+		int const block_height = std::min(B, height - y0);
 		
-		unsigned char const* sp_p = dst_line;
-		unsigned char const* sp_m = dst_line + width - 1;
-		double* vp = &val_p[0];
-		double* vm = &val_m[0] + width - 1;
-		unsigned char const initial_p = sp_p[0];
-		unsigned char const initial_m = sp_m[0];
-		
-		for (int x = 0; x < width; ++x) {
-			int const terms = std::min(x, 4);
-			int i = 0;
-			for (; i <= terms; ++i) {
-				*vp += n_p[i] * sp_p[-i] - d_p[i] * vp[-i];
-				*vm += n_m[i] * sp_m[i] - d_m[i] * vm[i];
+		uint8_t const* line = data + y0 * stride;
+		for (int i = 0; i < block_height; ++i, line += stride) {
+			float* p = in.data() + i;
+			for (int x = 0; x < width; ++x, p += B) {
+				*p = line[x];
 			}
-			for (; i <= 4; ++i) {
-				*vp += (n_p[i] - bd_p[i]) * initial_p;
-				*vm += (n_m[i] - bd_m[i]) * initial_m;
+		}
+		for (int i = block_height; i < B; ++i) {
+			float* p = in.data() + i;
+			for (int x = 0; x < width; ++x, p += B) {
+				*p = 0.0f;
 			}
-			++sp_p;
-			--sp_m;
-			++vp;
-			--vm;
 		}
 		
-		transfer_pixels(&val_p[0], &val_m[0], dst_line, 1, width);
+		iirFilterBlock(in.data(), out.data(), tmp.data(), width, k);
+		
+		uint8_t* dst_line = data + y0 * stride;
+		for (int i = 0; i < block_height; ++i, dst_line += stride) {
+			float const* p = out.data() + i;
+			for (int x = 0; x < width; ++x, p += B) {
+				dst_line[x] = clampToGray(*p);
+			}
+		}
 	}
-	
-	return dst;
 }
 
-QImage gaussBlurGray(QImage const& src, double radius)
+double radiusToStdDev(double radius)
 {
-	if (src.isNull()) {
-		return QImage();
-	}
-	
 	if (radius < 1.0) {
 		// This algorithm doesn't work for radiused less than one.
 		radius = 1.0;
 	}
 	radius += 1.0; // Include the center pixel.
 	
-	double const std_dev = sqrt((radius * radius) / (-2.0 * log(1.0 / 255.0)));
+	return sqrt((radius * radius) / (-2.0 * log(1.0 / 255.0)));
+}
+
+} // anonymous namespace
+
+QImage gaussBlurGray(QImage const& src, double const radius)
+{
+	if (src.isNull()) {
+		return QImage();
+	}
+	
+	return gaussBlurGray(GrayImage(src), radius).toQImage();
+}
+
+GrayImage gaussBlurGray(GrayImage const& src, double const radius)
+{
+	if (src.isNull()) {
+		return GrayImage();
+	}
 	
-	return gaussBlurGrayToGray(toGrayscale(src), std_dev);
+	GrayImage dst(src);
+	gaussBlurInPlace(
+		dst.data(), dst.stride(), dst.width(),
+		dst.height(), radiusToStdDev(radius)
+	);
+	return dst;
 }
 
 } // namespace imageproc
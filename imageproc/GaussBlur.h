@@ -24,8 +24,21 @@ class QImage;
 namespace imageproc
 {
 
+class GrayImage;
+
+/**
+ * \brief Applies a gaussian blur to a grayscale version of an image.
+ *
+ * A recursive (IIR) approximation is used, so the running time
+ * doesn't depend on the radius.
+ */
 QImage gaussBlurGray(QImage const& src, double radius);
 
+/**
+ * \brief Same as above, but avoids converting to and from QImage.
+ */
+GrayImage gaussBlurGray(GrayImage const& src, double radius);
+
 } // namespace imageproc
 
 #endif
@@ -18,6 +18,8 @@
 
 #include "GrayImage.h"
 #include "Grayscale.h"
+#include <QtGlobal>
+#include <string.h>
 
 namespace imageproc
 {
@@ -28,13 +30,71 @@ GrayImage::GrayImage(QSize size)
 		return;
 	}
 
-	m_image = QImage(size, QImage::Format_Indexed8);
+	m_image = ImageStorage::createImage(size, QImage::Format_Indexed8, m_buffer);
 	m_image.setColorTable(createGrayscalePalette());
 }
 
 GrayImage::GrayImage(QImage const& image)
-:	m_image(toGrayscale(image))
 {
+	if (image.isNull()) {
+		return;
+	}
+
+	if (image.format() == QImage::Format_Indexed8 && image.isGrayscale()) {
+		// No conversion is necessary, so we share the pixels.
+		m_image = toGrayscale(image);
+		return;
+	}
+
+	GrayImage(image.size()).swap(*this);
+	toGrayscale(image, m_image);
+}
+
+GrayImage::GrayImage(GrayImage const& other)
+:	m_image(other.m_image),
+	m_buffer(other.m_buffer)
+{
+}
+
+GrayImage::~GrayImage()
+{
+	ImageStorage::retire(m_image, m_buffer);
+}
+
+GrayImage&
+GrayImage::operator=(GrayImage const& other)
+{
+	GrayImage(other).swap(*this);
+	return *this;
+}
+
+void
+GrayImage::swap(GrayImage& other)
+{
+	qSwap(m_image, other.m_image);
+	m_buffer.swap(other.m_buffer);
+}
+
+void
+GrayImage::copyPixels()
+{
+	GrayImage copy(m_image.size());
+	copy.m_image.setDotsPerMeterX(m_image.dotsPerMeterX());
+	copy.m_image.setDotsPerMeterY(m_image.dotsPerMeterY());
+
+	int const width = m_image.width();
+	int const height = m_image.height();
+	uint8_t const* src_line = static_cast<QImage const&>(m_image).bits();
+	uint8_t* dst_line = copy.m_image.bits();
+	int const src_stride = m_image.bytesPerLine();
+	int const dst_stride = copy.m_image.bytesPerLine();
+	for (int y = 0; y < height; ++y) {
+		memcpy(dst_line, src_line, width);
+		src_line += src_stride;
+		dst_line += dst_stride;
+	}
+
+	copy.swap(*this);
 }
 
 } // namespace imageproc
@@ -19,6 +19,7 @@
 #ifndef IMAGEPROC_GRAYIMAGE_H_
 #define IMAGEPROC_GRAYIMAGE_H_
 
+#include "ImageStorage.h"
 #include <QImage>
 #include <QSize>
 #include <QRect>
@@ -29,6 +30,8 @@ namespace imageproc
 
 /**
  * \brief A wrapper class around QImage that is always guaranteed to be 8-bit grayscale.
+ *
+ * Large images have their pixels allocated by ImageStorage.
  */
 class GrayImage
 {
@@ -52,6 +55,14 @@ public:
 	 */
 	explicit GrayImage(QImage const& image);
 
+	GrayImage(GrayImage const& other);
+
+	~GrayImage();
+
+	GrayImage& operator=(GrayImage const& other);
+
+	void swap(GrayImage& other);
+
 	/**
 	 * \brief Returns a const reference to the underlying QImage.
 	 *
@@ -64,9 +75,9 @@ public:
 
 	bool isNull() const { return m_image.isNull(); }
 
-	void fill(uint8_t color) { m_image.fill(color); }
+	void fill(uint8_t color) { detach(); m_image.fill(color); }
 
-	uint8_t* data() { return m_image.bits(); }
+	uint8_t* data() { detach(); return m_image.bits(); }
 
 	uint8_t const* data() const { return m_image.bits(); }
 
@@ -87,9 +98,29 @@ public:
 
 	int height() const { return m_image.height(); }
 private:
+	/**
+	 * \brief Makes sure writing to m_image won't affect its copies.
+	 *
+	 * QImage would copy shared pixels to the heap by itself.
+	 * We copy them to ImageStorage instead.
+	 */
+	void detach() {
+		if (m_buffer.get() && !m_image.isDetached()) {
+			copyPixels();
+		}
+	}
+
+	void copyPixels();
+
 	QImage m_image;
+	ImageStorage::ImageBuffer m_buffer;
 };
 
+inline void swap(GrayImage& o1, GrayImage& o2)
+{
+	o1.swap(o2);
+}
+
 inline bool operator==(GrayImage const& lhs, GrayImage const& rhs) {
 	return lhs.toQImage() == rhs.toQImage();
 }
@@ -20,6 +20,7 @@
 #include "GrayImage.h"
 #include "BinaryImage.h"
 #include "BitOps.h"
+#include "ConversionKernels.h"
 #include <QImage>
 #include <QColor>
 #include <QtGlobal>
@@ -31,14 +32,11 @@
 namespace imageproc
 {
 
-static QImage monoMsbToGrayscale(QImage const& src)
+static void monoMsbToGrayscale(QImage const& src, QImage& dst)
 {
 	int const width = src.width();
 	int const height = src.height();
 	
-	QImage dst(width, height, QImage::Format_Indexed8);
-	dst.setColorTable(createGrayscalePalette());
-	
 	uint8_t const* src_line = src.bits();
 	uint8_t* dst_line = dst.bits();
 	int const src_bpl = src.bytesPerLine();
@@ -64,21 +62,13 @@ static QImage monoMsbToGrayscale(QImage const& src)
 		src_line += src_bpl;
 		dst_line += dst_bpl;
 	}
-	
-	dst.setDotsPerMeterX(src.dotsPerMeterX());
-	dst.setDotsPerMeterY(src.dotsPerMeterY());
-	
-	return dst;
 }
 
-static QImage monoLsbToGrayscale(QImage const& src)
+static void monoLsbToGrayscale(QImage const& src, QImage& dst)
 {
 	int const width = src.width();
 	int const height = src.height();
 	
-	QImage dst(width, height, QImage::Format_Indexed8);
-	dst.setColorTable(createGrayscalePalette());
-	
 	uint8_t const* src_line = src.bits();
 	uint8_t* dst_line = dst.bits();
 	int const src_bpl = src.bytesPerLine();
@@ -104,35 +94,66 @@ static QImage monoLsbToGrayscale(QImage const& src)
 		src_line += src_bpl;
 		dst_line += dst_bpl;
 	}
-	
-	dst.setDotsPerMeterX(src.dotsPerMeterX());
-	dst.setDotsPerMeterY(src.dotsPerMeterY());
-	
-	return dst;
 }
 
-static QImage anyToGrayscale(QImage const& src)
+static void anyToGrayscale(QImage const& src, QImage& dst)
 {
 	int const width = src.width();
 	int const height = src.height();
 	
-	QImage dst(width, height, QImage::Format_Indexed8);
-	dst.setColorTable(createGrayscalePalette());
-	
 	uint8_t* dst_line = dst.bits();
 	int const dst_bpl = dst.bytesPerLine();
 	
-	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			dst_line[x] = static_cast<uint8_t>(qGray(src.pixel(x, y)));
+	uint8_t const* src_line = src.bits();
+	int const src_bpl = src.bytesPerLine();
+	
+	switch (src.format()) {
+		case QImage::Format_RGB32:
+		case QImage::Format_ARGB32:
+			for (int y = 0; y < height; ++y) {
+				conversion_kernels::rgb32ToGray(
+					reinterpret_cast<uint32_t const*>(src_line), dst_line, width
+				);
+				src_line += src_bpl;
+				dst_line += dst_bpl;
+			}
+			break;
+#if QT_VERSION >= 0x040400
+		case QImage::Format_RGB888:
+			for (int y = 0; y < height; ++y) {
+				conversion_kernels::rgb888ToGray(src_line, dst_line, width);
+				src_line += src_bpl;
+				dst_line += dst_bpl;
+			}
+			break;
+#endif
+		case QImage::Format_Indexed8: {
+			uint8_t color_to_gray[256];
+			int const num_colors = std::min(src.numColors(), 256);
+			for (int i = 0; i < num_colors; ++i) {
+				color_to_gray[i] = static_cast<uint8_t>(qGray(src.color(i)));
+			}
+			for (int i = num_colors; i < 256; ++i) {
+				color_to_gray[i] = 0; // just in case
+			}
+			for (int y = 0; y < height; ++y) {
+				for (int x = 0; x < width; ++x) {
+					dst_line[x] = color_to_gray[src_line[x]];
+				}
+				src_line += src_bpl;
+				dst_line += dst_bpl;
+			}
+			break;
 		}
-		dst_line += dst_bpl;
+		default:
+			for (int y = 0; y < height; ++y) {
+				for (int x = 0; x < width; ++x) {
+					dst_line[x] = static_cast<uint8_t>(qGray(src.pixel(x, y)));
+				}
+				dst_line += dst_bpl;
+			}
+			break;
 	}
-	
-	dst.setDotsPerMeterX(src.dotsPerMeterX());
-	dst.setDotsPerMeterY(src.dotsPerMeterY());
-	
-	return dst;
 }
 
 QVector<QRgb> createGrayscalePalette()
@@ -150,46 +171,50 @@ QImage toGrayscale(QImage const& src)
 		return src;
 	}
 	
+	if (src.format() == QImage::Format_Indexed8 && src.isGrayscale()) {
+		if (src.numColors() == 256) {
+			return src;
+		} else {
+			QImage dst(src);
+			dst.setColorTable(createGrayscalePalette());
+			return dst;
+		}
+	}
+	
+	QImage dst(src.width(), src.height(), QImage::Format_Indexed8);
+	dst.setColorTable(createGrayscalePalette());
+	toGrayscale(src, dst);
+	return dst;
+}
+
+void toGrayscale(QImage const& src, QImage& dst)
+{
 	switch (src.format()) {
 	case QImage::Format_Mono:
-		return monoMsbToGrayscale(src);
+		monoMsbToGrayscale(src, dst);
+		break;
 	case QImage::Format_MonoLSB:
-		return monoLsbToGrayscale(src);
-	case QImage::Format_Indexed8:
-		if (src.isGrayscale()) {
-			if (src.numColors() == 256) {
-				return src;
-			} else {
-				QImage dst(src);
-				dst.setColorTable(createGrayscalePalette());
-				return dst;
-			}
-		}
-		// fall though
+		monoLsbToGrayscale(src, dst);
+		break;
 	default:
-		return anyToGrayscale(src);
+		anyToGrayscale(src, dst);
+		break;
 	}
+	
+	dst.setDotsPerMeterX(src.dotsPerMeterX());
+	dst.setDotsPerMeterY(src.dotsPerMeterY());
 }
 
-QImage stretchGrayRange(
-	QImage const& src,
-	double const black_clip_fraction, double const white_clip_fraction)
+void grayRangeStretchMapping(
+	QImage const& src, double const black_clip_fraction,
+	double const white_clip_fraction, uint8_t gray_mapping[256])
 {
-	if (src.isNull()) {
-		return QImage();
-	}
-	
-	QImage dst(toGrayscale(src));
+	GrayscaleHistogram const hist(src);
 	
-	int const width = dst.width();
-	int const height = dst.height();
-	
-	int const num_pixels = width * height;
+	int const num_pixels = src.width() * src.height();
 	int black_clip_pixels = qRound(black_clip_fraction * num_pixels);
 	int white_clip_pixels = qRound(white_clip_fraction * num_pixels);
 	
-	GrayscaleHistogram const hist(dst);
-	
 	int min = 0;
 	for (; min <= 255; ++min) {
 		if (black_clip_pixels < hist[min]) {
@@ -206,8 +231,6 @@ QImage stretchGrayRange(
 		white_clip_pixels -= hist[max];
 	}
 	
-	uint8_t gray_mapping[256];
-	
 	if (min >= max) {
 		int const avg = (min + max) / 2;
 		for (int i = 0; i <= avg; ++i) {
@@ -225,7 +248,25 @@ QImage stretchGrayRange(
 			gray_mapping[i] = static_cast<uint8_t>(dst_level);
 		}
 	}
+}
+
+QImage stretchGrayRange(
+	QImage const& src,
+	double const black_clip_fraction, double const white_clip_fraction)
+{
+	if (src.isNull()) {
+		return QImage();
+	}
+	
+	QImage dst(toGrayscale(src));
+	
+	uint8_t gray_mapping[256];
+	grayRangeStretchMapping(
+		dst, black_clip_fraction, white_clip_fraction, gray_mapping
+	);
 	
+	int const width = dst.width();
+	int const height = dst.height();
 	uint8_t* line = dst.bits();
 	int const bpl = dst.bytesPerLine();
 	
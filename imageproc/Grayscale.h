@@ -71,6 +71,15 @@ QVector<QRgb> createGrayscalePalette();
  */
 QImage toGrayscale(QImage const& src);
 
+/**
+ * \brief Convert a non-null image from any format to grayscale, into an existing image.
+ *
+ * \param src The source image in any format.
+ * \param dst An 8-bit indexed image of the same size as \p src,
+ *        with a grayscale palette.
+ */
+void toGrayscale(QImage const& src, QImage& dst);
+
 /**
  * \brief Stetch the distribution of gray levels to cover the whole range.
  *
@@ -85,6 +94,22 @@ QImage toGrayscale(QImage const& src);
 QImage stretchGrayRange(QImage const& src, double black_clip_fraction = 0.0,
 	double white_clip_fraction = 0.0);
 
+/**
+ * \brief Computes the gray level mapping stretchGrayRange() would apply.
+ *
+ * This allows applying a mapping derived from one image (say, a downscaled
+ * version) to another one, or to a part of it.
+ *
+ * \param src The image to build the histogram from.  It doesn't have to
+ *        be grayscale.
+ * \param black_clip_fraction Same as for stretchGrayRange().
+ * \param white_clip_fraction Same as for stretchGrayRange().
+ * \param mapping Receives the output gray level for each input one.
+ */
+void grayRangeStretchMapping(
+	QImage const& src, double black_clip_fraction,
+	double white_clip_fraction, uint8_t mapping[256]);
+
 /**
  * \brief Create a grayscale image consisting of a 1 pixel frame and an inner area.
  *
@@ -27,6 +27,8 @@
 #include "RasterOp.h"
 #include "SeedFill.h"
 #include "Grayscale.h"
+#include "GrayImage.h"
+#include "CpuFeatures.h"
 #include <QSize>
 #include <QRect>
 #include <QPoint>
@@ -36,11 +38,17 @@
 #include <QColor>
 #include <QPainter>
 #include <QDebug>
+#include <QThread>
+#include <QtConcurrentMap>
+#include <QtGlobal>
 #include <boost/foreach.hpp>
 #include <algorithm>
 #include <math.h>
 #include <stdint.h>
 #include <assert.h>
+#ifdef IMAGEPROC_HAVE_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace imageproc
 {
@@ -54,6 +62,53 @@ public:
 };
 
 
+/**
+ * A range of points accumulated into a histogram of its own,
+ * so that several ranges may be processed in parallel.
+ */
+class HoughLineDetector::PartialHistogram
+{
+public:
+	WeightedPoint const* begin;
+	WeightedPoint const* end;
+	std::vector<unsigned> hist;
+	
+	PartialHistogram() : begin(0), end(0) {}
+};
+
+
+class HoughLineDetector::PartialAccumulator
+{
+public:
+	PartialAccumulator(HoughLineDetector const& owner) : m_rOwner(owner) {}
+	
+	void operator()(PartialHistogram& partial) const {
+		partial.hist.resize(m_rOwner.m_histogram.size(), 0);
+		m_rOwner.accumulate(partial.begin, partial.end, &partial.hist[0]);
+	}
+private:
+	HoughLineDetector const& m_rOwner;
+};
+
+
+namespace
+{
+
+/**
+ * Batches smaller than this are not worth splitting between threads.
+ */
+int const MIN_POINTS_PER_THREAD = 20000;
+
+/**
+ * Fixed-point arithmetic is only used if it provides
+ * at least this many fractional bits for distance bins.
+ */
+int const MIN_FIXED_SHIFT = 10;
+
+} // anonymous namespace
+
+
+
 HoughLineDetector::HoughLineDetector(
 	QSize const& input_dimensions, double const distance_resolution,
 	double const start_angle, double const angle_delta, int const num_angles)
@@ -97,23 +152,174 @@ HoughLineDetector::HoughLineDetector(
 	m_histWidth = max_bin + 1;
 	m_histHeight = num_angles;
 	m_histogram.resize(m_histWidth * m_histHeight, 0);
+	
+	// Bins are computed as (cos * x + sin * y + bias) >> m_fixedShift,
+	// with cos and sin being 16-bit and the sums being 32-bit.
+	// We take the largest shift that fits both.  Coordinates have to
+	// fit 16 bits as well.
+	double const max_abs_sum = (max_x + max_y + m_distanceBias)
+		* m_recipDistanceResolution + 1.0;
+	m_fixedShift = 0;
+	while (m_fixedShift < 24) {
+		double const scale = double(1 << (m_fixedShift + 1));
+		if (m_recipDistanceResolution * scale >= 32767.0 ||
+				max_abs_sum * scale >= double(1 << 30)) {
+			break;
+		}
+		++m_fixedShift;
+	}
+	m_fixedPointUsable = m_fixedShift >= MIN_FIXED_SHIFT
+		&& max_x < 32768 && max_y < 32768;
+	
+	double const scale = double(1 << m_fixedShift);
+	m_numPaddedAngles = (num_angles + 3) & ~3;
+	m_fixedUnitVectors.resize(m_numPaddedAngles * 2, 0);
+	for (int i = 0; i < num_angles; ++i) {
+		QPointF const& uv = m_angleUnitVectors[i];
+		m_fixedUnitVectors[i * 2] = (int16_t)floor(
+			uv.x() * m_recipDistanceResolution * scale + 0.5
+		);
+		m_fixedUnitVectors[i * 2 + 1] = (int16_t)floor(
+			uv.y() * m_recipDistanceResolution * scale + 0.5
+		);
+	}
+	m_fixedBias = (int32_t)floor(
+		(m_distanceBias * m_recipDistanceResolution + 0.5) * scale + 0.5
+	);
 }
 
 void
 HoughLineDetector::process(int x, int y, unsigned weight)
 {
-	unsigned* hist_line = &m_histogram[0];
+	WeightedPoint const point(x, y, weight);
+	accumulate(&point, &point + 1, &m_histogram[0]);
+}
+
+void
+HoughLineDetector::process(std::vector<WeightedPoint> const& points)
+{
+	if (points.empty()) {
+		return;
+	}
 	
-	BOOST_FOREACH (QPointF const& uv, m_angleUnitVectors) {
-		double const distance = uv.x() * x + uv.y() * y;
-		double const biased_distance = distance + m_distanceBias;
-		
-		int const bin = (int)(biased_distance * m_recipDistanceResolution + 0.5);
-		assert(bin >= 0 && bin < m_histWidth);
-		hist_line[bin] += weight;
+	WeightedPoint const* const begin = &points[0];
+	int const num_points = points.size();
+	int const num_chunks = std::min(
+		std::max(1, QThread::idealThreadCount()),
+		num_points / MIN_POINTS_PER_THREAD
+	);
+	if (num_chunks <= 1) {
+		accumulate(begin, begin + num_points, &m_histogram[0]);
+		return;
+	}
+	
+	std::vector<PartialHistogram> partials(num_chunks);
+	int const chunk_size = num_points / num_chunks;
+	for (int i = 0; i < num_chunks; ++i) {
+		partials[i].begin = begin + i * chunk_size;
+		partials[i].end = i == num_chunks - 1
+			? begin + num_points : partials[i].begin + chunk_size;
+	}
+	
+	QtConcurrent::blockingMap(partials, PartialAccumulator(*this));
+	
+	size_t const hist_size = m_histogram.size();
+	BOOST_FOREACH (PartialHistogram const& partial, partials) {
+		unsigned const* src = &partial.hist[0];
+		unsigned* dst = &m_histogram[0];
+		for (size_t i = 0; i < hist_size; ++i) {
+			dst[i] += src[i];
+		}
+	}
+}
+
+void
+HoughLineDetector::process(GrayImage const& image,
+	unsigned const weight_table[256], QRect const& area)
+{
+	QRect const rect(area.intersected(image.rect()));
+	if (rect.isEmpty()) {
+		return;
+	}
+	
+	std::vector<WeightedPoint> points;
+	
+	uint8_t const* line = image.data() + rect.top() * image.stride();
+	int const stride = image.stride();
+	for (int y = rect.top(); y <= rect.bottom(); ++y) {
+		for (int x = rect.left(); x <= rect.right(); ++x) {
+			unsigned const weight = weight_table[line[x]];
+			if (weight != 0) {
+				points.push_back(WeightedPoint(x, y, weight));
+			}
+		}
+		line += stride;
+	}
+	
+	process(points);
+}
+
+void
+HoughLineDetector::accumulate(
+	WeightedPoint const* p, WeightedPoint const* const end,
+	unsigned* const hist) const
+{
+	if (!m_fixedPointUsable) {
+		for (; p != end; ++p) {
+			unsigned* hist_line = hist;
+			BOOST_FOREACH (QPointF const& uv, m_angleUnitVectors) {
+				double const distance = uv.x() * p->x + uv.y() * p->y;
+				double const biased_distance = distance + m_distanceBias;
+				
+				int const bin = (int)(biased_distance * m_recipDistanceResolution + 0.5);
+				assert(bin >= 0 && bin < m_histWidth);
+				hist_line[bin] += p->weight;
+				
+				hist_line += m_histWidth;
+			}
+		}
+		return;
+	}
+	
+	std::vector<int32_t> bins(m_numPaddedAngles);
+	int const max_bin = m_histWidth - 1;
+	
+	for (; p != end; ++p) {
+		fixedPointBins(p->x, p->y, &bins[0]);
 		
-		hist_line += m_histWidth;
+		unsigned* hist_line = hist;
+		for (int i = 0; i < m_histHeight; ++i) {
+			hist_line[qBound(0, bins[i], max_bin)] += p->weight;
+			hist_line += m_histWidth;
+		}
+	}
+}
+
+void
+HoughLineDetector::fixedPointBins(int const x, int const y, int32_t* bins) const
+{
+	int16_t const* uv = &m_fixedUnitVectors[0];
+	
+#ifdef IMAGEPROC_HAVE_SSE2
+	// Every 32-bit lane holds an (x, y) pair of 16-bit values,
+	// which _mm_madd_epi16() multiplies by a (cos, sin) pair
+	// and sums up, producing 4 angles at once.
+	__m128i const xy = _mm_set1_epi32(
+		int32_t((uint32_t(y) << 16) | (uint32_t(x) & 0xffff))
+	);
+	__m128i const bias = _mm_set1_epi32(m_fixedBias);
+	__m128i const shift = _mm_cvtsi32_si128(m_fixedShift);
+	for (int i = 0; i < m_numPaddedAngles; i += 4) {
+		__m128i const cs = _mm_loadu_si128((__m128i const*)(uv + i * 2));
+		__m128i const sum = _mm_add_epi32(_mm_madd_epi16(cs, xy), bias);
+		_mm_storeu_si128((__m128i*)(bins + i), _mm_sra_epi32(sum, shift));
+	}
+#else
+	for (int i = 0; i < m_numPaddedAngles; ++i) {
+		int32_t const sum = uv[i * 2] * x + uv[i * 2 + 1] * y + m_fixedBias;
+		bins[i] = sum >> m_fixedShift;
 	}
+#endif
 }
 
 QImage
@@ -21,8 +21,10 @@
 
 #include <QPointF>
 #include <vector>
+#include <stdint.h>
 
 class QSize;
+class QRect;
 class QLineF;
 class QImage;
 
@@ -30,6 +32,7 @@ namespace imageproc
 {
 
 class BinaryImage;
+class GrayImage;
 
 /**
  * \brief A line detected by HoughLineDetector.
@@ -76,6 +79,16 @@ private:
 class HoughLineDetector
 {
 public:
+	struct WeightedPoint
+	{
+		int x;
+		int y;
+		unsigned weight;
+		
+		WeightedPoint(int x_, int y_, unsigned weight_)
+		: x(x_), y(y_), weight(weight_) {}
+	};
+	
 	/**
 	 * \brief A line finder based on Hough transform.
 	 *
@@ -99,9 +112,29 @@ public:
 	
 	/**
 	 * \brief Processes a point with a specified weight.
+	 *
+	 * When there are many points, prefer the batch versions,
+	 * which spread the work across CPU cores.
 	 */
 	void process(int x, int y, unsigned weight = 1);
 	
+	/**
+	 * \brief Processes a batch of weighted points.
+	 */
+	void process(std::vector<WeightedPoint> const& points);
+	
+	/**
+	 * \brief Processes pixels of a grayscale image as weighted points.
+	 *
+	 * \param image The image, which must not exceed input_dimensions
+	 *        passed to the constructor.
+	 * \param weight_table Maps gray levels to weights.  Pixels with
+	 *        zero weight are skipped.
+	 * \param area The area of \p image to process.
+	 */
+	void process(GrayImage const& image,
+		unsigned const weight_table[256], QRect const& area);
+	
 	QImage visualizeHoughSpace(unsigned lower_bound) const;
 	
 	/**
@@ -113,8 +146,35 @@ public:
 	 * \param quality_lower_bound The minimum acceptable line quality.
 	 */
 	std::vector<HoughLine> findLines(unsigned quality_lower_bound) const;
+	
+	/**
+	 * \brief The accumulated votes.
+	 *
+	 * Each angle has a row of histogramWidth() distance bins.
+	 */
+	std::vector<unsigned> const& histogram() const { return m_histogram; }
+	
+	int histogramWidth() const { return m_histWidth; }
 private:
 	class GreaterQualityFirst;
+	class PartialHistogram;
+	class PartialAccumulator;
+	
+	/**
+	 * \brief Adds points in [begin, end) to \p hist.
+	 *
+	 * \p hist has the same layout as m_histogram.
+	 */
+	void accumulate(WeightedPoint const* begin,
+		WeightedPoint const* end, unsigned* hist) const;
+	
+	/**
+	 * \brief Computes histogram bins for a point, for every angle.
+	 *
+	 * \p bins has to hold m_numPaddedAngles elements.
+	 * The bins may be out of range by one, due to rounding.
+	 */
+	void fixedPointBins(int x, int y, int32_t* bins) const;
 	
 	static BinaryImage findHistogramPeaks(
 		std::vector<unsigned> const& hist, int width, int height,
@@ -182,6 +242,32 @@ private:
 	 * The height of m_histogram.
 	 */
 	int m_histHeight;
+	
+	/**
+	 * Cosines and sines of angles divided by m_distanceResolution
+	 * and multiplied by 2^m_fixedShift, interleaved.  Padded with
+	 * zeros to m_numPaddedAngles angles.
+	 */
+	std::vector<int16_t> m_fixedUnitVectors;
+	
+	/**
+	 * m_distanceBias / m_distanceResolution + 0.5, multiplied by 2^m_fixedShift.
+	 */
+	int32_t m_fixedBias;
+	
+	int m_fixedShift;
+	
+	/**
+	 * m_histHeight rounded up to a multiple of 4.
+	 */
+	int m_numPaddedAngles;
+	
+	/**
+	 * False if input dimensions or distance resolution don't allow
+	 * fixed-point arithmetic with enough precision, in which case
+	 * we fall back to floating point.
+	 */
+	bool m_fixedPointUsable;
 };
 
 } // namespace imageproc
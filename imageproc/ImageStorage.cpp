@@ -0,0 +1,284 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ImageStorage.h"
+#include <QTemporaryFile>
+#include <QFile>
+#include <QDir>
+#include <QString>
+#include <QSize>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtGlobal>
+#include <new>
+#include <memory>
+#include <list>
+#include <limits>
+#include <stdlib.h>
+#if defined(Q_OS_UNIX)
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
+
+namespace imageproc
+{
+
+/**
+ * Only truly huge images go to disk by default.  A lower threshold,
+ * like 16 MiB to cover 600 DPI grayscale pages, can be set through
+ * "settings/mapped_image_threshold_mb".
+ */
+size_t const ImageStorage::DEFAULT_MAPPING_THRESHOLD = size_t(256) << 20;
+
+namespace
+{
+
+/**
+ * Precedes every buffer.  Its size keeps buffers 16-byte aligned.
+ */
+union BlockHeader
+{
+	struct
+	{
+		/**
+		 * Null for heap buffers.
+		 */
+		QTemporaryFile* file;
+		
+		/**
+		 * The size of the block including the header.
+		 */
+		size_t size;
+	} info;
+	
+	char padding[16];
+};
+
+size_t mapping_threshold = ImageStorage::DEFAULT_MAPPING_THRESHOLD;
+
+/**
+ * An image whose buffer has no other owners, kept until
+ * no one else references the image.
+ */
+struct RetiredImage
+{
+	QImage image;
+	ImageStorage::ImageBuffer buffer;
+	
+	RetiredImage(QImage const& img, ImageStorage::ImageBuffer const& buf)
+	: image(img), buffer(buf) {}
+};
+
+QMutex retired_images_mutex;
+std::list<RetiredImage> retired_images;
+
+/**
+ * \brief Releases the buffers of retired images that are no longer shared.
+ *
+ * Must be called with retired_images_mutex locked.
+ */
+void releaseUnsharedRetiredImages()
+{
+	std::list<RetiredImage>::iterator it(retired_images.begin());
+	while (it != retired_images.end()) {
+		if (it->image.isDetached()) {
+			it = retired_images.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+int bitsPerPixel(QImage::Format const format)
+{
+	switch (format) {
+		case QImage::Format_Mono:
+		case QImage::Format_MonoLSB:
+			return 1;
+		case QImage::Format_Indexed8:
+			return 8;
+		case QImage::Format_RGB32:
+		case QImage::Format_ARGB32:
+		case QImage::Format_ARGB32_Premultiplied:
+			return 32;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * \brief Creates a temporary file of the given size and maps it.
+ *
+ * \return The address of the mapping, or null on failure.
+ */
+void* mapTemporaryFile(size_t const size, QTemporaryFile*& file_out)
+{
+	std::auto_ptr<QTemporaryFile> file(
+		new QTemporaryFile(QDir::temp().absoluteFilePath("imageproc_XXXXXX"))
+	);
+	if (!file->open()) {
+		return 0;
+	}
+	
+	if (!file->resize(qint64(size))) {
+		return 0;
+	}
+	
+#if defined(Q_OS_LINUX)
+	// Otherwise, running out of disk space would result
+	// in SIGBUS when writing to a page of the mapping.
+	if (posix_fallocate(file->handle(), 0, size) != 0) {
+		return 0;
+	}
+#endif
+	
+	uchar* const addr = file->map(0, qint64(size));
+	if (!addr) {
+		return 0;
+	}
+	
+#if defined(Q_OS_UNIX)
+	// The mapping outlives the file's name.
+	QFile::remove(file->fileName());
+#endif
+	
+	file_out = file.release();
+	return addr;
+}
+
+} // anonymous namespace
+
+void*
+ImageStorage::allocate(size_t const bytes)
+{
+	size_t const size = bytes + sizeof(BlockHeader);
+	if (size < bytes) {
+		throw std::bad_alloc();
+	}
+	
+	void* addr = 0;
+	QTemporaryFile* file = 0;
+	if (mapping_threshold != 0 && bytes >= mapping_threshold) {
+		addr = mapTemporaryFile(size, file);
+	}
+	if (!addr) {
+		addr = malloc(size);
+		if (!addr) {
+			throw std::bad_alloc();
+		}
+	}
+	
+	BlockHeader* const header = static_cast<BlockHeader*>(addr);
+	header->info.file = file;
+	header->info.size = size;
+	return header + 1;
+}
+
+void
+ImageStorage::release(void* const buffer)
+{
+	if (!buffer) {
+		return;
+	}
+	
+	BlockHeader* const header = static_cast<BlockHeader*>(buffer) - 1;
+	QTemporaryFile* const file = header->info.file;
+	if (!file) {
+		free(header);
+		return;
+	}
+	
+#if defined(Q_OS_LINUX) && defined(MADV_REMOVE)
+	// Discard the pages and free the disk space right away, rather than
+	// having the dirty pages written back to a file no one will read.
+	madvise(header, header->info.size, MADV_REMOVE);
+#endif
+	
+	file->unmap(reinterpret_cast<uchar*>(header));
+	delete file;
+}
+
+QImage
+ImageStorage::createImage(
+	QSize const& size, QImage::Format const format, ImageBuffer& buffer)
+{
+	buffer.reset();
+	
+	int const bpp = bitsPerPixel(format);
+	if (mapping_threshold == 0 || bpp == 0 || size.isEmpty()) {
+		return QImage(size, format);
+	}
+	
+	// The same line alignment QImage uses.
+	qint64 const bpl = ((qint64(size.width()) * bpp + 31) >> 5) << 2;
+	qint64 const bytes = bpl * size.height();
+	if (bytes < qint64(mapping_threshold) || bpl > std::numeric_limits<int>::max()
+			|| quint64(bytes) > std::numeric_limits<size_t>::max()) {
+		return QImage(size, format);
+	}
+	
+	{
+		QMutexLocker const locker(&retired_images_mutex);
+		releaseUnsharedRetiredImages();
+	}
+	
+	void* const pixels = allocate(size_t(bytes));
+	buffer = ImageBuffer(pixels, &ImageStorage::release);
+	
+	return QImage(
+		static_cast<uchar*>(pixels), size.width(), size.height(), int(bpl), format
+	);
+}
+
+void
+ImageStorage::retire(QImage& image, ImageBuffer& buffer)
+{
+	if (!buffer) {
+		image = QImage();
+		return;
+	}
+	
+	// Holders of the same buffer retire under the mutex, so the last
+	// one of them reliably sees a use count of 1.
+	QMutexLocker const locker(&retired_images_mutex);
+	
+	releaseUnsharedRetiredImages();
+	
+	if (buffer.use_count() == 1 && !image.isNull() && !image.isDetached()) {
+		// Copies of the image are still around, and they need the pixels.
+		retired_images.push_back(RetiredImage(image, buffer));
+	}
+	
+	image = QImage();
+	buffer.reset();
+}
+
+size_t
+ImageStorage::mappingThreshold()
+{
+	return mapping_threshold;
+}
+
+void
+ImageStorage::setMappingThreshold(size_t const bytes)
+{
+	mapping_threshold = bytes;
+}
+
+} // namespace imageproc
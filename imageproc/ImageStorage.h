@@ -0,0 +1,108 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGEPROC_IMAGE_STORAGE_H_
+#define IMAGEPROC_IMAGE_STORAGE_H_
+
+#include <QImage>
+#include <boost/shared_ptr.hpp>
+#include <stddef.h>
+
+class QSize;
+
+namespace imageproc
+{
+
+/**
+ * \brief Allocates pixel buffers for image classes.
+ *
+ * Small buffers come from the heap.  Buffers of at least mappingThreshold()
+ * bytes are backed by temporary files mapped into memory, so that under
+ * memory pressure the OS pages them out to those files, rather than to swap
+ * or, with no swap, rather than killing the process.  Where the OS allows,
+ * a temporary file is removed right after being mapped, so nothing is left
+ * behind after a crash.  If a file can't be created or mapped, the heap
+ * is used instead.
+ *
+ * This class is thread-safe, except for setMappingThreshold().
+ */
+class ImageStorage
+{
+public:
+	/**
+	 * \brief Owns the pixels of an image returned by createImage().
+	 */
+	typedef boost::shared_ptr<void> ImageBuffer;
+	
+	static size_t const DEFAULT_MAPPING_THRESHOLD;
+	
+	/**
+	 * \brief Allocates a buffer aligned to a 16 byte boundary.
+	 *
+	 * \throw std::bad_alloc
+	 */
+	static void* allocate(size_t bytes);
+	
+	/**
+	 * \brief Releases a buffer returned by allocate().
+	 *
+	 * A null pointer is ignored.
+	 */
+	static void release(void* buffer);
+	
+	/**
+	 * \brief Creates an uninitialized image with pixels from allocate().
+	 *
+	 * QImage can't release pixels it doesn't own, so their owner is
+	 * returned in \p buffer.  Images below mappingThreshold() are ordinary
+	 * QImages, in which case \p buffer is set to null.  For indexed formats,
+	 * the caller has to set up the color table.
+	 *
+	 * The image may be copied freely, but a copy that is written to while
+	 * being shared makes QImage copy the pixels to the heap.  The last
+	 * holder of \p buffer has to pass it to retire() together with the image.
+	 *
+	 * \throw std::bad_alloc
+	 */
+	static QImage createImage(QSize const& size, QImage::Format format, ImageBuffer& buffer);
+	
+	/**
+	 * \brief Drops an image created by createImage() and its buffer.
+	 *
+	 * If this was the last reference to \p buffer, its pixels are released,
+	 * either right away or, if copies of \p image are still around,
+	 * by a later call to createImage() or retire() that finds them gone.
+	 * Both arguments are reset.
+	 */
+	static void retire(QImage& image, ImageBuffer& buffer);
+	
+	static size_t mappingThreshold();
+	
+	/**
+	 * \brief Sets the minimum size of file-backed buffers.
+	 *
+	 * Zero disables file-backed buffers.  To be called at startup,
+	 * before any images are allocated from other threads.
+	 */
+	static void setMappingThreshold(size_t bytes);
+};
+
+} // namespace imageproc
+
+#endif
@@ -23,7 +23,12 @@
 #include "BitOps.h"
 #include <QImage>
 #include <QColor>
+#include <QThread>
+#include <QtConcurrentMap>
+#include <boost/foreach.hpp>
+#include <boost/scoped_array.hpp>
 #include <algorithm>
+#include <vector>
 #include <stdexcept>
 #include <assert.h>
 
@@ -32,6 +37,179 @@ class QImage;
 namespace imageproc
 {
 
+namespace
+{
+
+typedef InfluenceMap::Cell Cell;
+
+/**
+ * Strips shorter than this aren't worth growing in parallel.
+ */
+int const MIN_STRIP_HEIGHT = 64;
+
+/**
+ * \brief Tries to improve \p nbh from \p cell, located at (-dx, -dy) from it.
+ *
+ * \return true if \p nbh was updated and has to be queued.
+ */
+inline bool relax(Cell const* cell, Cell* nbh, int const dx, int const dy)
+{
+	uint32_t const new_dist_sq = cell->distSq
+		- 2 * (cell->vec.x * dx + cell->vec.y * dy) + dx * dx + dy * dy;
+	if (new_dist_sq < nbh->distSq) {
+		nbh->label = cell->label;
+		nbh->distSq = new_dist_sq;
+		nbh->vec.x = cell->vec.x - dx;
+		nbh->vec.y = cell->vec.y - dy;
+		return true;
+	}
+	return false;
+}
+
+int const NBH_DX[8] = { -1, 0, 1, 1, 1, 0, -1, -1 };
+int const NBH_DY[8] = { -1, -1, -1, 0, 1, 1, 1, 0 };
+
+/**
+ * \brief A horizontal band of padded rows, grown independently of other strips.
+ *
+ * A strip only ever writes its own cells.  Cells whose neighbours lie
+ * in an adjacent strip are collected in \p crossings and relaxed into
+ * that strip between rounds, when no strip is being grown.
+ */
+struct Strip
+{
+	Cell* begin;
+	Cell* end;
+	FastQueue<Cell*> queue;
+	std::vector<Cell*> crossings;
+	
+	Strip() : begin(0), end(0) {}
+};
+
+class StripGrower
+{
+public:
+	StripGrower(int stride) : m_stride(stride) {}
+	
+	void operator()(Strip& strip) const;
+private:
+	int m_stride;
+};
+
+void
+StripGrower::operator()(Strip& strip) const
+{
+	int const stride = m_stride;
+	Cell const* const inner_begin = strip.begin + stride;
+	Cell const* const inner_end = strip.end - stride;
+	
+	while (!strip.queue.empty()) {
+		Cell* const cell = strip.queue.front();
+		strip.queue.pop();
+		
+		assert(cell->distSq != ~uint32_t(0));
+		assert(cell->label != 0);
+		
+		if (cell >= inner_begin && cell < inner_end) {
+			for (int i = 0; i < 8; ++i) {
+				Cell* nbh = cell + NBH_DY[i] * stride + NBH_DX[i];
+				if (relax(cell, nbh, NBH_DX[i], NBH_DY[i])) {
+					strip.queue.push(nbh);
+				}
+			}
+		} else {
+			bool crosses = false;
+			for (int i = 0; i < 8; ++i) {
+				Cell* nbh = cell + NBH_DY[i] * stride + NBH_DX[i];
+				if (nbh < strip.begin || nbh >= strip.end) {
+					crosses = true;
+				} else if (relax(cell, nbh, NBH_DX[i], NBH_DY[i])) {
+					strip.queue.push(nbh);
+				}
+			}
+			if (crosses) {
+				strip.crossings.push_back(cell);
+			}
+		}
+	}
+}
+
+/**
+ * \brief Extends the labels of \p seeds over the cells with distSq of ~0.
+ *
+ * The map is split into horizontal strips, which are grown in parallel
+ * the same way a single queue would grow the whole map.  Between rounds,
+ * cells at strip boundaries are relaxed into the adjacent strips, which
+ * seeds the next round.  Growth stops when no cell can improve any of
+ * its neighbours, which is also where the single-queue growth stops.
+ * The two may only differ in which of the equally distant labels wins.
+ */
+void growLabels(Cell* padded_data, int const stride,
+	int const padded_height, FastQueue<Cell*>& seeds)
+{
+	int const max_strips = std::max(1, QThread::idealThreadCount());
+	int const num_strips = std::max(
+		1, std::min(max_strips, padded_height / MIN_STRIP_HEIGHT)
+	);
+	int const strip_height = padded_height / num_strips;
+	
+	boost::scoped_array<Strip> strips(new Strip[num_strips]);
+	for (int i = 0; i < num_strips; ++i) {
+		int const end_row = i == num_strips - 1
+			? padded_height : (i + 1) * strip_height;
+		strips[i].begin = padded_data + i * strip_height * stride;
+		strips[i].end = padded_data + end_row * stride;
+	}
+	
+	while (!seeds.empty()) {
+		Cell* cell = seeds.front();
+		seeds.pop();
+		int const row = (cell - padded_data) / stride;
+		strips[std::min(row / strip_height, num_strips - 1)].queue.push(cell);
+	}
+	
+	StripGrower const grower(stride);
+	if (num_strips == 1) {
+		grower(strips[0]);
+		assert(strips[0].crossings.empty());
+		return;
+	}
+	
+	for (;;) {
+		QtConcurrent::blockingMap(strips.get(), strips.get() + num_strips, grower);
+		
+		bool progress = false;
+		for (int i = 0; i < num_strips; ++i) {
+			Strip& strip = strips[i];
+			BOOST_FOREACH(Cell* cell, strip.crossings) {
+				for (int n = 0; n < 8; ++n) {
+					Cell* nbh = cell + NBH_DY[n] * stride + NBH_DX[n];
+					if (nbh < strip.begin) {
+						assert(i > 0);
+						if (relax(cell, nbh, NBH_DX[n], NBH_DY[n])) {
+							strips[i - 1].queue.push(nbh);
+							progress = true;
+						}
+					} else if (nbh >= strip.end) {
+						assert(i < num_strips - 1);
+						if (relax(cell, nbh, NBH_DX[n], NBH_DY[n])) {
+							strips[i + 1].queue.push(nbh);
+							progress = true;
+						}
+					}
+				}
+			}
+			strip.crossings.clear();
+		}
+		
+		if (!progress) {
+			break;
+		}
+	}
+}
+
+} // anonymous namespace
+
 InfluenceMap::InfluenceMap()
 :	m_pData(0),
 	m_size(),
@@ -157,109 +335,7 @@ InfluenceMap::init(
 		}
 	}
 	
-	while (!queue.empty()) {
-		cell = queue.front();
-		queue.pop();
-		
-		assert((cell - &m_data[0]) / width > 0);
-		assert((cell - &m_data[0]) / width < height - 1);
-		assert((cell - &m_data[0]) % width > 0);
-		assert((cell - &m_data[0]) % width < width - 1);
-		assert(cell->distSq != ~uint32_t(0));
-		assert(cell->label != 0);
-		assert(cell->label <= m_maxLabel);
-		
-		int32_t const dx2 = cell->vec.x << 1;
-		int32_t const dy2 = cell->vec.y << 1;
-		
-		// North-western neighbor.
-		Cell* nbh = cell - width - 1;
-		uint32_t new_dist_sq = cell->distSq + dx2 + dy2 + 2;
-		if (new_dist_sq < nbh->distSq) {
-			nbh->label = cell->label;
-			nbh->distSq = new_dist_sq;
-			nbh->vec.x = cell->vec.x + 1;
-			nbh->vec.y = cell->vec.y + 1;
-			queue.push(nbh);
-		}
-		
-		// Northern neighbor.
-		++nbh;
-		new_dist_sq = cell->distSq + dy2 + 1;
-		if (new_dist_sq < nbh->distSq) {
-			nbh->label = cell->label;
-			nbh->distSq = new_dist_sq;
-			nbh->vec.x = cell->vec.x;
-			nbh->vec.y = cell->vec.y + 1;
-			queue.push(nbh);
-		}
-		
-		// North-eastern neighbor.
-		++nbh;
-		new_dist_sq = cell->distSq - dx2 + dy2 + 2;
-		if (new_dist_sq < nbh->distSq) {
-			nbh->label = cell->label;
-			nbh->distSq = new_dist_sq;
-			nbh->vec.x = cell->vec.x - 1;
-			nbh->vec.y = cell->vec.y + 1;
-			queue.push(nbh);
-		}
-		
-		// Eastern neighbor.
-		nbh += width;
-		new_dist_sq = cell->distSq - dx2 + 1;
-		if (new_dist_sq < nbh->distSq) {
-			nbh->label = cell->label;
-			nbh->distSq = new_dist_sq;
-			nbh->vec.x = cell->vec.x - 1;
-			nbh->vec.y = cell->vec.y;
-			queue.push(nbh);
-		}
-		
-		// South-eastern neighbor.
-		nbh += width;
-		new_dist_sq = cell->distSq - dx2 - dy2 + 2;
-		if (new_dist_sq < nbh->distSq) {
-			nbh->label = cell->label;
-			nbh->distSq = new_dist_sq;
-			nbh->vec.x = cell->vec.x - 1;
-			nbh->vec.y = cell->vec.y - 1;
-			queue.push(nbh);
-		}
-		
-		// Southern neighbor.
-		--nbh;
-		new_dist_sq = cell->distSq - dy2 + 1;
-		if (new_dist_sq < nbh->distSq) {
-			nbh->label = cell->label;
-			nbh->distSq = new_dist_sq;
-			nbh->vec.x = cell->vec.x;
-			nbh->vec.y = cell->vec.y - 1;
-			queue.push(nbh);
-		}
-		
-		// South-western neighbor.
-		--nbh;
-		new_dist_sq = cell->distSq + dx2 - dy2 + 2;
-		if (new_dist_sq < nbh->distSq) {
-			nbh->label = cell->label;
-			nbh->distSq = new_dist_sq;
-			nbh->vec.x = cell->vec.x + 1;
-			nbh->vec.y = cell->vec.y - 1;
-			queue.push(nbh);
-		}
-		
-		// Western neighbor.
-		nbh -= width;
-		new_dist_sq = cell->distSq + dx2 + 1;
-		if (new_dist_sq < nbh->distSq) {
-			nbh->label = cell->label;
-			nbh->distSq = new_dist_sq;
-			nbh->vec.x = cell->vec.x + 1;
-			nbh->vec.y = cell->vec.y;
-			queue.push(nbh);
-		}
-	}
+	growLabels(&m_data[0], width, height, queue);
 }
 
 QImage
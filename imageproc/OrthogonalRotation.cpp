@@ -20,6 +20,7 @@
 #include "BinaryImage.h"
 #include "BWColor.h"
 #include "RasterOp.h"
+#include "BitOps.h"
 #include <QRect>
 #include <algorithm>
 #include <stdexcept>
@@ -28,9 +29,38 @@
 namespace imageproc
 {
 
-static inline uint32_t mask(int x)
+/**
+ * Returns 32 pixels of a line starting at \p x, with the leftmost one
+ * in the most significant bit.  Pixels outside of [0, wpl * 32) come out
+ * as zeroes, so \p x may be negative.
+ */
+static inline uint32_t loadWord(uint32_t const* line, int const wpl, int const x)
 {
-	return (uint32_t(1) << 31) >> (x % 32);
+	int const idx = x >= 0 ? x >> 5 : -((31 - x) >> 5); // floor(x / 32)
+	int const shift = x - idx * 32;
+	uint32_t const left = (idx >= 0 && idx < wpl) ? line[idx] : 0;
+	if (shift == 0) {
+		return left;
+	}
+	uint32_t const right = (idx + 1 >= 0 && idx + 1 < wpl) ? line[idx + 1] : 0;
+	return (left << shift) | (right >> (32 - shift));
+}
+
+/**
+ * Transposes a 32x32 bit matrix, where tile[i] is row i and the most
+ * significant bit is column 0.  Done by swapping progressively smaller
+ * off-diagonal blocks, 5 passes of whole-word operations in total.
+ */
+static void transpose32(uint32_t* tile)
+{
+	uint32_t m = 0x0000FFFF;
+	for (int j = 16; j != 0; j >>= 1, m ^= m << j) {
+		for (int k = 0; k < 32; k = (k + j + 1) & ~j) {
+			uint32_t const t = (tile[k] ^ (tile[k + j] >> j)) & m;
+			tile[k] ^= t;
+			tile[k + j] ^= t << j;
+		}
+	}
 }
 
 static BinaryImage rotate0(BinaryImage const& src, QRect const& src_rect)
@@ -50,11 +80,10 @@ static BinaryImage rotate90(BinaryImage const& src, QRect const& src_rect)
 	int const dst_w = src_rect.height();
 	int const dst_h = src_rect.width();
 	BinaryImage dst(dst_w, dst_h);
-	dst.fill(WHITE);
 	int const src_wpl = src.wordsPerLine();
 	int const dst_wpl = dst.wordsPerLine();
 	uint32_t const* const src_data = src.data() + src_rect.bottom() * src_wpl;
-	uint32_t* dst_line = dst.data();
+	uint32_t* const dst_data = dst.data();
 	
 	/*
 	 *   dst
@@ -64,19 +93,30 @@ static BinaryImage rotate90(BinaryImage const& src, QRect const& src_rect)
 	 * |
 	 */
 	
-	for (int dst_y = 0; dst_y < dst_h; ++dst_y) {
+	// Source lines are loaded bottom to top into 32x32 tiles,
+	// which become destination words once transposed.
+	uint32_t tile[32];
+	for (int dst_y = 0; dst_y < dst_h; dst_y += 32) {
 		int const src_x = src_rect.left() + dst_y;
-		uint32_t const* src_pword = src_data + src_x / 32;
-		uint32_t const src_mask = mask(src_x);
-		
-		for (int dst_x = 0; dst_x < dst_w; ++dst_x) {
-			if (*src_pword & src_mask) {
-				dst_line[dst_x / 32] |= mask(dst_x);
+		int const num_rows = std::min(32, dst_h - dst_y);
+		for (int dst_x = 0; dst_x < dst_w; dst_x += 32) {
+			int const num_cols = std::min(32, dst_w - dst_x);
+			uint32_t const* src_line = src_data - dst_x * src_wpl;
+			int i = 0;
+			for (; i < num_cols; ++i, src_line -= src_wpl) {
+				tile[i] = loadWord(src_line, src_wpl, src_x);
+			}
+			for (; i < 32; ++i) {
+				tile[i] = 0;
+			}
+			
+			transpose32(tile);
+			
+			uint32_t* dst_word = dst_data + dst_y * dst_wpl + (dst_x >> 5);
+			for (i = 0; i < num_rows; ++i, dst_word += dst_wpl) {
+				*dst_word = tile[i];
 			}
-			src_pword -= src_wpl;
 		}
-		
-		dst_line += dst_wpl;
 	}
 	
 	return dst;
@@ -87,11 +127,12 @@ static BinaryImage rotate180(BinaryImage const& src, QRect const& src_rect)
 	int const dst_w = src_rect.width();
 	int const dst_h = src_rect.height();
 	BinaryImage dst(dst_w, dst_h);
-	dst.fill(WHITE);
 	int const src_wpl = src.wordsPerLine();
 	int const dst_wpl = dst.wordsPerLine();
 	uint32_t const* src_line = src.data() + src_rect.bottom() * src_wpl;
 	uint32_t* dst_line = dst.data();
+	int const last_word_idx = (dst_w - 1) >> 5;
+	uint32_t const last_word_mask = ~uint32_t(0) << (31 - ((dst_w - 1) & 31));
 	
 	/*
 	 *  dst
@@ -101,12 +142,13 @@ static BinaryImage rotate180(BinaryImage const& src, QRect const& src_rect)
 	 */
 	
 	for (int dst_y = 0; dst_y < dst_h; ++dst_y) {
-		int src_x = src_rect.right();
-		for (int dst_x = 0; dst_x < dst_w; --src_x, ++dst_x) {
-			if (src_line[src_x / 32] & mask(src_x)) {
-				dst_line[dst_x / 32] |= mask(dst_x);
-			}
+		// Destination word i comes from the 32 source pixels ending
+		// at src_rect.right() - i * 32, in reverse order.
+		int src_x = src_rect.right() - 31;
+		for (int i = 0; i <= last_word_idx; ++i, src_x -= 32) {
+			dst_line[i] = reverseBits(loadWord(src_line, src_wpl, src_x));
 		}
+		dst_line[last_word_idx] &= last_word_mask;
 		
 		src_line -= src_wpl;
 		dst_line += dst_wpl;
@@ -120,11 +162,10 @@ static BinaryImage rotate270(BinaryImage const& src, QRect const& src_rect)
 	int const dst_w = src_rect.height();
 	int const dst_h = src_rect.width();
 	BinaryImage dst(dst_w, dst_h);
-	dst.fill(WHITE);
 	int const src_wpl = src.wordsPerLine();
 	int const dst_wpl = dst.wordsPerLine();
 	uint32_t const* const src_data = src.data() + src_rect.top() * src_wpl;
-	uint32_t* dst_line = dst.data();
+	uint32_t* const dst_data = dst.data();
 	
 	/*
 	 *  dst
@@ -134,19 +175,31 @@ static BinaryImage rotate270(BinaryImage const& src, QRect const& src_rect)
 	 *       v
 	 */
 	
-	for (int dst_y = 0; dst_y < dst_h; ++dst_y) {
-		int const src_x = src_rect.right() - dst_y;
-		uint32_t const* src_pword = src_data + src_x / 32;
-		uint32_t const src_mask = mask(src_x);
-		
-		for (int dst_x = 0; dst_x < dst_w; ++dst_x) {
-			if (*src_pword & src_mask) {
-				dst_line[dst_x / 32] |= mask(dst_x);
+	// Source lines are loaded top to bottom into 32x32 tiles.
+	// Once transposed, tile rows correspond to destination
+	// lines in reverse order.
+	uint32_t tile[32];
+	for (int dst_y = 0; dst_y < dst_h; dst_y += 32) {
+		int const src_x = src_rect.right() - dst_y - 31;
+		int const num_rows = std::min(32, dst_h - dst_y);
+		for (int dst_x = 0; dst_x < dst_w; dst_x += 32) {
+			int const num_cols = std::min(32, dst_w - dst_x);
+			uint32_t const* src_line = src_data + dst_x * src_wpl;
+			int i = 0;
+			for (; i < num_cols; ++i, src_line += src_wpl) {
+				tile[i] = loadWord(src_line, src_wpl, src_x);
+			}
+			for (; i < 32; ++i) {
+				tile[i] = 0;
+			}
+			
+			transpose32(tile);
+			
+			uint32_t* dst_word = dst_data + dst_y * dst_wpl + (dst_x >> 5);
+			for (i = 0; i < num_rows; ++i, dst_word += dst_wpl) {
+				*dst_word = tile[31 - i];
 			}
-			src_pword += src_wpl;
 		}
-		
-		dst_line += dst_wpl;
 	}
 	
 	return dst;
@@ -0,0 +1,366 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "PictureDetection.h"
+#include "BinaryImage.h"
+#include "BinaryThreshold.h"
+#include "Grayscale.h"
+#include "GrayRasterOp.h"
+#include "Morphology.h"
+#include "RasterOp.h"
+#include "Scale.h"
+#include "SeedFill.h"
+#include "TaskStatus.h"
+#include <QImage>
+#include <QPoint>
+#include <QRect>
+#include <QSize>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <stdint.h>
+
+namespace imageproc
+{
+
+namespace
+{
+
+struct CombineInverted
+{
+	static uint8_t transform(uint8_t src, uint8_t dst) {
+		unsigned const dilated = dst;
+		unsigned const eroded = src;
+		unsigned const res = 255 - (255 - dilated) * eroded / 255;
+		return static_cast<uint8_t>(res);
+	}
+};
+
+void checkCancelled(TaskStatus const* status)
+{
+	if (status) {
+		status->throwIfCancelled();
+	}
+}
+
+/**
+ * Computes the inverted morphological gradient of \p stretched
+ * within \p area, which is in \p stretched coordinates.
+ */
+GrayImage invertedGradient(GrayImage const& stretched, QRect const& area)
+{
+	GrayImage const eroded(erodeGray(stretched, QSize(3, 3), area, 0x00));
+	GrayImage dilated(dilateGray(stretched, QSize(3, 3), area, 0xff));
+	grayRasterOp<CombineInverted>(dilated, eroded);
+	return dilated;
+}
+
+bool isBlack(uint32_t const* line, int x)
+{
+	return (line[x >> 5] >> (31 - (x & 31))) & 1;
+}
+
+} // anonymous namespace
+
+GrayImage detectPictures(
+	GrayImage const& input_300dpi, int const marker_size,
+	TaskStatus const* const status, PictureDetectionStages* const stages)
+{
+	// We stretch the range of gray levels to cover the whole
+	// range of [0, 255].  We do it because we want text
+	// and background to be equally far from the center
+	// of the whole range.  Otherwise text printed with a big
+	// font will be considered a picture.
+	GrayImage stretched(stretchGrayRange(input_300dpi, 0.01, 0.01));
+	
+	checkCancelled(status);
+	
+	GrayImage const gradient(invertedGradient(stretched, stretched.rect()));
+	if (stages) {
+		stages->stretched = stretched;
+	}
+	stretched = GrayImage(); // Save memory.
+	
+	checkCancelled(status);
+	
+	GrayImage reconstructed(
+		erodeGray(gradient, QSize(marker_size, marker_size), 0x00)
+	);
+	if (stages) {
+		stages->gradient = gradient;
+		stages->marker = reconstructed;
+	}
+	
+	checkCancelled(status);
+	
+	seedFillGrayInPlace(reconstructed, gradient, CONN8, status);
+	if (stages) {
+		stages->reconstructed = reconstructed;
+	}
+	
+	checkCancelled(status);
+	
+	grayRasterOp<GRopInvert<GRopSrc> >(reconstructed, reconstructed);
+	
+	GrayImage holes_filled(createFramedImage(reconstructed.size()));
+	seedFillGrayInPlace(holes_filled, reconstructed, CONN8, status);
+	
+	return holes_filled;
+}
+
+GrayImage detectPicturesCoarseToFine(
+	GrayImage const& input_300dpi, TaskStatus const* const status,
+	GrayImage* const coarse_areas)
+{
+	int const coarse_factor = 3; // 300 dpi -> 100 dpi
+	int const marker_size = 35;
+	int const marker_radius = marker_size / 2;
+	
+	// How far from the coarse picture boundary refinement may change
+	// things, in coarse pixels.  The coarse boundary may be off by up to
+	// the radius of the marker erosion, plus the sampling error.
+	int const band_radius = (marker_radius + coarse_factor - 1) / coarse_factor + 1;
+	
+	// The band is refined in tiles, so that its parts far from each other
+	// don't make us process everything in between.
+	int const tile_size = 256;
+	
+	QSize const coarse_size(
+		input_300dpi.width() / coarse_factor,
+		input_300dpi.height() / coarse_factor
+	);
+	if (coarse_size.width() < marker_size || coarse_size.height() < marker_size) {
+		// Too small to benefit from a coarse pass.
+		GrayImage const areas(detectPictures(input_300dpi, marker_size, status));
+		if (coarse_areas) {
+			*coarse_areas = areas;
+		}
+		return areas;
+	}
+	
+	// The whole-image steps run once, at the coarse resolution.
+	// So does building the band where refinement takes place.
+	uint8_t gray_mapping[256];
+	GrayImage areas;
+	GrayImage reconstructed;
+	BinaryImage band;
+	{
+		GrayImage const coarse_input(scaleToGray(input_300dpi, coarse_size));
+		grayRangeStretchMapping(coarse_input, 0.01, 0.01, gray_mapping);
+		
+		checkCancelled(status);
+		
+		PictureDetectionStages stages;
+		GrayImage const coarse_result(
+			detectPictures(
+				coarse_input, marker_size / coarse_factor, status, &stages
+			)
+		);
+		
+		checkCancelled(status);
+		
+		BinaryThreshold const threshold(
+			BinaryThreshold::mokjiThreshold(coarse_result, 5, 26)
+		);
+		BinaryImage const mask(coarse_result, threshold);
+		QSize const brick(2 * band_radius + 1, 2 * band_radius + 1);
+		band = dilateBrick(mask, brick);
+		rasterOp<RopXor<RopSrc, RopDst> >(band, erodeBrick(mask, brick));
+		
+		areas = scaleToGray(coarse_result, input_300dpi.size());
+		reconstructed = scaleToGray(stages.reconstructed, input_300dpi.size());
+	}
+	if (coarse_areas) {
+		*coarse_areas = areas;
+	}
+	
+	QRect const coarse_band_rect(band.contentBoundingBox());
+	if (coarse_band_rect.isEmpty()) {
+		return areas;
+	}
+	
+	checkCancelled(status);
+	
+	// Maps full resolution coordinates to coarse ones.
+	QRect const image_rect(input_300dpi.rect());
+	std::vector<int> coarse_x(image_rect.width());
+	for (int x = 0; x < image_rect.width(); ++x) {
+		coarse_x[x] = std::min(x / coarse_factor, coarse_size.width() - 1);
+	}
+	std::vector<int> coarse_y(image_rect.height());
+	for (int y = 0; y < image_rect.height(); ++y) {
+		coarse_y[y] = std::min(y / coarse_factor, coarse_size.height() - 1);
+	}
+	
+	QRect band_rect;
+	band_rect.setLeft(coarse_band_rect.left() * coarse_factor);
+	band_rect.setTop(coarse_band_rect.top() * coarse_factor);
+	band_rect.setRight(
+		coarse_band_rect.right() == coarse_size.width() - 1
+		? image_rect.right()
+		: coarse_band_rect.right() * coarse_factor + coarse_factor - 1
+	);
+	band_rect.setBottom(
+		coarse_band_rect.bottom() == coarse_size.height() - 1
+		? image_rect.bottom()
+		: coarse_band_rect.bottom() * coarse_factor + coarse_factor - 1
+	);
+	
+	// Within the band, the reconstruction is redone at full resolution.
+	// Outside of it, seed and mask are both set to the coarse result,
+	// which makes the seed fill leave those pixels alone.
+	GrayImage seed(reconstructed.toQImage().copy(band_rect));
+	GrayImage mask(seed);
+	reconstructed = GrayImage(); // Save memory.
+	
+	int const band_wpl = band.wordsPerLine();
+	uint32_t const* const band_data = band.data();
+	int const seed_stride = seed.stride();
+	int const mask_stride = mask.stride();
+	
+	for (int y = band_rect.top(); y <= band_rect.bottom(); y += tile_size) {
+		for (int x = band_rect.left(); x <= band_rect.right(); x += tile_size) {
+			QRect const tile(
+				QRect(x, y, tile_size, tile_size).intersected(band_rect)
+			);
+			QRect const coarse_tile(
+				QPoint(coarse_x[tile.left()], coarse_y[tile.top()]),
+				QPoint(coarse_x[tile.right()], coarse_y[tile.bottom()])
+			);
+			if (band.countBlackPixels(coarse_tile) == 0) {
+				continue;
+			}
+			
+			checkCancelled(status);
+			
+			// Enough for both the marker erosion and the gradient
+			// to be exact within the tile.
+			QRect const gradient_area(
+				tile.adjusted(
+					-marker_radius, -marker_radius,
+					marker_radius, marker_radius
+				).intersected(image_rect)
+			);
+			QRect const window(
+				gradient_area.adjusted(-1, -1, 1, 1).intersected(image_rect)
+			);
+			
+			GrayImage stretched(input_300dpi.toQImage().copy(window));
+			uint8_t* line = stretched.data();
+			int const stride = stretched.stride();
+			for (int i = 0; i < window.height(); ++i, line += stride) {
+				for (int j = 0; j < window.width(); ++j) {
+					line[j] = gray_mapping[line[j]];
+				}
+			}
+			
+			GrayImage const gradient(
+				invertedGradient(
+					stretched, gradient_area.translated(-window.topLeft())
+				)
+			);
+			GrayImage const marker(
+				erodeGray(
+					gradient, QSize(marker_size, marker_size),
+					tile.translated(-gradient_area.topLeft()), 0x00
+				)
+			);
+			
+			int const gradient_stride = gradient.stride();
+			uint8_t const* gradient_line = gradient.data()
+				+ (tile.top() - gradient_area.top()) * gradient_stride
+				+ (tile.left() - gradient_area.left());
+			int const marker_stride = marker.stride();
+			uint8_t const* marker_line = marker.data();
+			uint8_t* seed_line = seed.data()
+				+ (tile.top() - band_rect.top()) * seed_stride
+				+ (tile.left() - band_rect.left());
+			uint8_t* mask_line = mask.data()
+				+ (tile.top() - band_rect.top()) * mask_stride
+				+ (tile.left() - band_rect.left());
+			
+			for (int y = tile.top(); y <= tile.bottom(); ++y) {
+				uint32_t const* band_line = band_data + coarse_y[y] * band_wpl;
+				for (int j = 0; j < tile.width(); ++j) {
+					if (isBlack(band_line, coarse_x[tile.left() + j])) {
+						seed_line[j] = marker_line[j];
+						mask_line[j] = gradient_line[j];
+					}
+				}
+				gradient_line += gradient_stride;
+				marker_line += marker_stride;
+				seed_line += seed_stride;
+				mask_line += mask_stride;
+			}
+		}
+	}
+	
+	checkCancelled(status);
+	
+	seedFillGrayInPlace(seed, mask, CONN8, status);
+	grayRasterOp<GRopInvert<GRopSrc> >(seed, seed);
+	
+	checkCancelled(status);
+	
+	// The same goes for filling holes.  Within the band, the seed is white,
+	// except where it touches the image frame, as in detectPictures().
+	GrayImage holes_filled(areas.toQImage().copy(band_rect));
+	mask = holes_filled;
+	{
+		int const holes_stride = holes_filled.stride();
+		uint8_t* holes_line = holes_filled.data();
+		uint8_t* mask_line = mask.data();
+		uint8_t const* inverted_line = seed.data();
+		
+		for (int y = band_rect.top(); y <= band_rect.bottom(); ++y) {
+			uint32_t const* band_line = band_data + coarse_y[y] * band_wpl;
+			for (int x = band_rect.left(); x <= band_rect.right(); ++x) {
+				if (!isBlack(band_line, coarse_x[x])) {
+					continue;
+				}
+				int const i = x - band_rect.left();
+				bool const on_frame = x == 0 || y == 0
+					|| x == image_rect.right() || y == image_rect.bottom();
+				holes_line[i] = on_frame ? 0x00 : 0xff;
+				mask_line[i] = inverted_line[i];
+			}
+			holes_line += holes_stride;
+			mask_line += mask_stride;
+			inverted_line += seed_stride;
+		}
+	}
+	seed = GrayImage(); // Save memory.
+	
+	seedFillGrayInPlace(holes_filled, mask, CONN8, status);
+	
+	int const holes_stride = holes_filled.stride();
+	int const areas_stride = areas.stride();
+	uint8_t const* src_line = holes_filled.data();
+	uint8_t* dst_line = areas.data()
+		+ band_rect.top() * areas_stride + band_rect.left();
+	for (int i = 0; i < band_rect.height(); ++i) {
+		memcpy(dst_line, src_line, band_rect.width());
+		src_line += holes_stride;
+		dst_line += areas_stride;
+	}
+	
+	return areas;
+}
+
+} // namespace imageproc
@@ -0,0 +1,87 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGEPROC_PICTURE_DETECTION_H_
+#define IMAGEPROC_PICTURE_DETECTION_H_
+
+#include "GrayImage.h"
+
+class TaskStatus;
+
+namespace imageproc
+{
+
+/**
+ * \brief Intermediate images produced by detectPictures().
+ *
+ * All of them have the size of the input image.
+ */
+struct PictureDetectionStages
+{
+	/** The input with its gray level range stretched. */
+	GrayImage stretched;
+
+	/** The inverted morphological gradient of \a stretched. */
+	GrayImage gradient;
+
+	/** The reconstruction marker, that is the eroded \a gradient. */
+	GrayImage marker;
+
+	/** \a gradient reconstructed from \a marker, before inversion. */
+	GrayImage reconstructed;
+};
+
+/**
+ * \brief Finds areas of an image that are likely to be pictures.
+ *
+ * \param input_300dpi A grayscale image at around 300 dpi.
+ * \param marker_size The size of the erosion window producing the
+ *        reconstruction marker.  35 is the right value for 300 dpi.
+ * \param status If provided, it's polled between the stages.
+ * \param stages If provided, receives the intermediate images.
+ * \return An image where picture areas are light and everything
+ *         else is dark.
+ */
+GrayImage detectPictures(
+	GrayImage const& input_300dpi, int marker_size = 35,
+	TaskStatus const* status = 0, PictureDetectionStages* stages = 0);
+
+/**
+ * \brief A faster approximation of detectPictures() for 300 dpi images.
+ *
+ * The whole image is processed at 100 dpi, which is where all the global
+ * steps (the gray level histogram, the reconstruction, the hole filling)
+ * take place.  The upscaled result is then refined at full resolution
+ * within a narrow band around picture boundaries.  Outside of that band
+ * the coarse result is kept as is and serves as a fixed boundary condition
+ * for the refinement, so no seams appear.
+ *
+ * \param input_300dpi A grayscale image at around 300 dpi.
+ * \param status If provided, it's polled between the stages.
+ * \param coarse_areas If provided, receives the upscaled coarse result,
+ *        before refinement.
+ * \return The same kind of image detectPictures() returns.
+ */
+GrayImage detectPicturesCoarseToFine(
+	GrayImage const& input_300dpi, TaskStatus const* status = 0,
+	GrayImage* coarse_areas = 0);
+
+} // namespace imageproc
+
+#endif
@@ -19,7 +19,10 @@
 #include "PolygonRasterizer.h"
 #include "PolygonUtils.h"
 #include "BinaryImage.h"
+#include "SpanBuffer.h"
 #include <QRect>
+#include <QSize>
+#include <QPoint>
 #include <QRectF>
 #include <QPolygonF>
 #include <QPainterPath>
@@ -28,12 +31,11 @@
 #include <QtGlobal>
 #include <boost/foreach.hpp>
 #include <vector>
+#include <utility>
 #include <iterator>
 #include <algorithm>
 #include <stdexcept>
 #include <math.h>
-#include <string.h>
-#include <stdint.h>
 #include <assert.h>
 
 namespace imageproc
@@ -45,8 +47,6 @@ namespace imageproc
 class PolygonRasterizer::Edge
 {
 public:
-	Edge(QPointF const& top, QPointF const& bottom, int vert_direction);
-	
 	Edge(QPointF const& from, QPointF const& to);
 	
 	QPointF const& top() const { return m_top; }
@@ -124,33 +124,29 @@ public:
 class PolygonRasterizer::Rasterizer
 {
 public:
-	Rasterizer(QRect const& image_rect, QPolygonF const& poly,
-		Qt::FillRule const fill_rule, bool invert);
-	
-	void fillBinary(BinaryImage& image, BWColor color) const;
-	
-	void fillGrayscale(QImage& image, uint8_t color) const;
+	Rasterizer(QSize const& image_size, QPolygonF const& poly,
+		Qt::FillRule const fill_rule);
+	
+	/**
+	 * Samples each row at its center, producing fully covered spans.
+	 */
+	void rasterize(SpanBuffer& spans) const;
+	
+	/**
+	 * Samples each row at several sub-scanlines, producing spans
+	 * with partial coverage along the edges.
+	 */
+	void rasterizeAntialiased(SpanBuffer& spans) const;
 private:
-	void prepareEdges();
-	
-	static void oddEvenLineBinary(
-		EdgeComponent const* edges, int num_edges,
-		uint32_t* line, uint32_t pattern);
-	
-	static void oddEvenLineGrayscale(
-		EdgeComponent const* edges, int num_edges,
-		uint8_t* line, uint8_t color);
+	typedef std::pair<double, double> Interval;
 	
-	static void windingLineBinary(
-		EdgeComponent const* edges, int num_edges,
-		uint32_t* line, uint32_t pattern, bool invert);
+	enum { SUBROWS = 4 };
 	
-	static void windingLineGrayscale(
-		EdgeComponent const* edges, int num_edges,
-		uint8_t* line, uint8_t pattern, bool invert);
+	void prepareEdges();
 	
-	static void fillBinarySegment(
-		int x_from, int x_to, uint32_t* line, uint32_t pattern);
+	void intervalsForLine(double y,
+		std::vector<EdgeComponent>& edges_for_line,
+		std::vector<Interval>& intervals) const;
 	
 	std::vector<Edge> m_edges; // m_edgeComponents references m_edges.
 	std::vector<EdgeComponent> m_edgeComponents;
@@ -158,12 +154,29 @@ private:
 	QPolygonF m_fillPoly;
 	QRectF m_boundingBox;
 	Qt::FillRule m_fillRule;
-	bool m_invert;
 };
 
 
 /*============================= PolygonRasterizer ===========================*/
 
+SpanBuffer
+PolygonRasterizer::rasterize(
+	QSize const& image_size, QPolygonF const& poly, Qt::FillRule const fill_rule)
+{
+	SpanBuffer spans(image_size);
+	Rasterizer(image_size, poly, fill_rule).rasterize(spans);
+	return spans;
+}
+
+SpanBuffer
+PolygonRasterizer::rasterizeAntialiased(
+	QSize const& image_size, QPolygonF const& poly, Qt::FillRule const fill_rule)
+{
+	SpanBuffer spans(image_size);
+	Rasterizer(image_size, poly, fill_rule).rasterizeAntialiased(spans);
+	return spans;
+}
+
 void
 PolygonRasterizer::fill(
 	BinaryImage& image, BWColor const color,
@@ -173,8 +186,7 @@ PolygonRasterizer::fill(
 		throw std::invalid_argument("PolygonRasterizer: target image is null");
 	}
 	
-	Rasterizer rasterizer(image.rect(), poly, fill_rule, false);
-	rasterizer.fillBinary(image, color);
+	rasterize(image.size(), poly, fill_rule).fill(image, color);
 }
 
 void
@@ -186,8 +198,7 @@ PolygonRasterizer::fillExcept(
 		throw std::invalid_argument("PolygonRasterizer: target image is null");
 	}
 	
-	Rasterizer rasterizer(image.rect(), poly, fill_rule, true);
-	rasterizer.fillBinary(image, color);
+	rasterize(image.size(), poly, fill_rule).fillExcept(image, color);
 }
 
 void
@@ -202,8 +213,7 @@ PolygonRasterizer::grayFill(
 		throw std::invalid_argument("PolygonRasterizer: target image is not grayscale");
 	}
 	
-	Rasterizer rasterizer(image.rect(), poly, fill_rule, false);
-	rasterizer.fillGrayscale(image, color);
+	rasterize(image.size(), poly, fill_rule).grayFill(image, color);
 }
 
 void
@@ -218,23 +228,12 @@ PolygonRasterizer::grayFillExcept(
 		throw std::invalid_argument("PolygonRasterizer: target image is not grayscale");
 	}
 	
-	Rasterizer rasterizer(image.rect(), poly, fill_rule, true);
-	rasterizer.fillGrayscale(image, color);
+	rasterize(image.size(), poly, fill_rule).grayFillExcept(image, color);
 }
 
 
 /*======================= PolygonRasterizer::Edge ==========================*/
 
-PolygonRasterizer::Edge::Edge(
-	QPointF const& top, QPointF const& bottom, int const vert_direction)
-:	m_top(top),
-	m_bottom(bottom),
-	m_deltaX(bottom.x() - top.x()),
-	m_reDeltaY(1.0 / (bottom.y() - top.y())),
-	m_vertDirection(vert_direction)
-{
-}
-
 PolygonRasterizer::Edge::Edge(QPointF const& from, QPointF const& to)
 {
 	if (from.y() < to.y()) {
@@ -261,15 +260,14 @@ PolygonRasterizer::Edge::xForY(double y) const
 /*=================== PolygonRasterizer::Rasterizer ====================*/
 
 PolygonRasterizer::Rasterizer::Rasterizer(
-	QRect const& image_rect, QPolygonF const& poly,
-	Qt::FillRule const fill_rule, bool const invert)
-:	m_imageRect(image_rect),
-	m_fillRule(fill_rule),
-	m_invert(invert)
+	QSize const& image_size, QPolygonF const& poly,
+	Qt::FillRule const fill_rule)
+:	m_imageRect(QPoint(0, 0), image_size),
+	m_fillRule(fill_rule)
 {
 	QPainterPath path1;
 	path1.setFillRule(fill_rule);
-	path1.addRect(image_rect);
+	path1.addRect(m_imageRect);
 	
 	QPainterPath path2;
 	path2.setFillRule(fill_rule);
@@ -277,12 +275,7 @@ PolygonRasterizer::Rasterizer::Rasterizer(
 	path2.closeSubpath();
 	
 	m_fillPoly = path1.intersected(path2).toFillPolygon();
-	
-	if (invert) {
-		m_boundingBox = path1.subtracted(path2).boundingRect();
-	} else {
-		m_boundingBox = m_fillPoly.boundingRect();
-	}
+	m_boundingBox = m_fillPoly.boundingRect();
 	
 	prepareEdges();
 }
@@ -296,7 +289,7 @@ PolygonRasterizer::Rasterizer::prepareEdges()
 	}
 	
 	// Collect the edges, excluding horizontal and null ones.
-	m_edges.reserve(num_verts + 2);
+	m_edges.reserve(num_verts);
 	for (int i = 0; i < num_verts - 1; ++i) {
 		QPointF const from(m_fillPoly[i]);
 		QPointF const to(m_fillPoly[i + 1]);
@@ -307,26 +300,13 @@ PolygonRasterizer::Rasterizer::prepareEdges()
 	
 	assert(m_fillPoly.isClosed());
 	
-	if (m_invert) {
-		// Add left and right edges with neutral direction (0),
-		// to avoid confusing a winding fill.
-		QRectF const rect(m_imageRect);
-		m_edges.push_back(Edge(rect.topLeft(), rect.bottomLeft(), 0));
-		m_edges.push_back(Edge(rect.topRight(), rect.bottomRight(), 0));
-	}
-	
 	// Create an ordered list of y coordinates of polygon vertexes.
 	std::vector<double> y_values;
-	y_values.reserve(num_verts + 2);
+	y_values.reserve(num_verts);
 	BOOST_FOREACH(QPointF const& pt, m_fillPoly) {
 		y_values.push_back(pt.y());
 	}
 	
-	if (m_invert) {
-		y_values.push_back(0.0);
-		y_values.push_back(m_imageRect.height());
-	}
-	
 	// Sort and remove duplicates.
 	std::sort(y_values.begin(), y_values.end());
 	y_values.erase(std::unique(y_values.begin(), y_values.end()), y_values.end());
@@ -355,221 +335,147 @@ PolygonRasterizer::Rasterizer::prepareEdges()
 }
 
 void
-PolygonRasterizer::Rasterizer::fillBinary(
-	BinaryImage& image, BWColor const color) const
+PolygonRasterizer::Rasterizer::rasterize(SpanBuffer& spans) const
 {
 	std::vector<EdgeComponent> edges_for_line;
-	typedef std::vector<EdgeComponent>::const_iterator EdgeIter;
-	
-	uint32_t* line = image.data();
-	int const wpl = image.wordsPerLine();
-	uint32_t const pattern = (color == WHITE) ? 0 : ~uint32_t(0);
+	std::vector<Interval> intervals;
 	
 	int i = qRound(m_boundingBox.top());
-	line += i * wpl;
 	int const limit = qRound(m_boundingBox.bottom());
-	for (; i < limit; ++i, line += wpl, edges_for_line.clear()) {
-		double const y = i + 0.5;
-		
-		// Get edges intersecting this horizontal line.
-		std::pair<EdgeIter, EdgeIter> const range(
-			std::equal_range(
-				m_edgeComponents.begin(), m_edgeComponents.end(),
-				y, EdgeOrderY()
-			)
-		);
-		
-		if (range.first == range.second) {
-			continue;
-		}
-		
-		std::copy(
-			range.first, range.second,
-			std::back_inserter(edges_for_line)
-		);
-		
-		// Calculate the intersection point of each edge with
-		// the current horizontal line.
-		BOOST_FOREACH(EdgeComponent& ecomp, edges_for_line) {
-			ecomp.setX(ecomp.edge().xForY(y));
-		}
-		
-		// Sort edge components by the x value of the intersection point.
-		std::sort(
-			edges_for_line.begin(), edges_for_line.end(),
-			EdgeOrderX()
-		);
-		
-		if (m_fillRule == Qt::OddEvenFill) {
-			oddEvenLineBinary(
-				&edges_for_line.front(), edges_for_line.size(),
-				line, pattern
-			);
-		} else {
-			windingLineBinary(
-				&edges_for_line.front(), edges_for_line.size(),
-				line, pattern, m_invert
+	for (; i < limit; ++i) {
+		intervalsForLine(i + 0.5, edges_for_line, intervals);
+		BOOST_FOREACH(Interval const& interval, intervals) {
+			spans.append(
+				i, SpanBuffer::Span(qRound(interval.first), qRound(interval.second))
 			);
 		}
 	}
 }
 
 void
-PolygonRasterizer::Rasterizer::fillGrayscale(
-	QImage& image, uint8_t const color) const
+PolygonRasterizer::Rasterizer::rasterizeAntialiased(SpanBuffer& spans) const
 {
-	std::vector<EdgeComponent> edges_for_line;
-	typedef std::vector<EdgeComponent>::const_iterator EdgeIter;
-	
-	uint8_t* line = image.bits();
-	int const bpl = image.bytesPerLine();
+	if (m_boundingBox.isEmpty()) {
+		return;
+	}
 	
-	int i = qRound(m_boundingBox.top());
-	line += i * bpl;
-	int const limit = qRound(m_boundingBox.bottom());
-	for (; i < limit; ++i, line += bpl, edges_for_line.clear()) {
-		double const y = i + 0.5;
-		
-		// Get edges intersecting this horizontal line.
-		std::pair<EdgeIter, EdgeIter> const range(
-			std::equal_range(
-				m_edgeComponents.begin(), m_edgeComponents.end(),
-				y, EdgeOrderY()
-			)
-		);
-		
-		if (range.first == range.second) {
-			continue;
-		}
-		
-		std::copy(
-			range.first, range.second,
-			std::back_inserter(edges_for_line)
-		);
+	std::vector<EdgeComponent> edges_for_line;
+	std::vector<Interval> intervals;
+	
+	int const x0 = (int)floor(m_boundingBox.left());
+	int const x1 = (int)ceil(m_boundingBox.right());
+	
+	// Coverage is accumulated in units of 1/255 of a pixel per sub-scanline.
+	// Fully covered runs go to a difference array, edge pixels go
+	// directly to a separate one.
+	std::vector<int> full(x1 - x0 + 1, 0);
+	std::vector<int> partial(x1 - x0 + 1, 0);
+	
+	int const top = (int)floor(m_boundingBox.top());
+	int const bottom = (int)ceil(m_boundingBox.bottom());
+	for (int i = top; i < bottom; ++i) {
+		int touched_from = x1;
+		int touched_to = x0 - 1;
 		
-		// Calculate the intersection point of each edge with
-		// the current horizontal line.
-		BOOST_FOREACH(EdgeComponent& ecomp, edges_for_line) {
-			ecomp.setX(ecomp.edge().xForY(y));
+		for (int s = 0; s < SUBROWS; ++s) {
+			double const y = i + (s + 0.5) / SUBROWS;
+			intervalsForLine(y, edges_for_line, intervals);
+			
+			BOOST_FOREACH(Interval const& interval, intervals) {
+				double const from = std::max<double>(interval.first, x0);
+				double const to = std::min<double>(interval.second, x1);
+				if (from >= to) {
+					continue;
+				}
+				
+				int const first = (int)floor(from);
+				int const last = (int)floor(to);
+				touched_from = std::min(touched_from, first);
+				touched_to = std::max(touched_to, last);
+				
+				if (first == last) {
+					partial[first - x0] += qRound((to - from) * 255.0);
+					continue;
+				}
+				
+				partial[first - x0] += qRound((first + 1 - from) * 255.0);
+				full[first + 1 - x0] += 255;
+				full[last - x0] -= 255;
+				partial[last - x0] += qRound((to - last) * 255.0);
+			}
 		}
 		
-		// Sort edge components by the x value of the intersection point.
-		std::sort(
-			edges_for_line.begin(), edges_for_line.end(),
-			EdgeOrderX()
-		);
-		
-		if (m_fillRule == Qt::OddEvenFill) {
-			oddEvenLineGrayscale(
-				&edges_for_line.front(), edges_for_line.size(),
-				line, color
-			);
-		} else {
-			windingLineGrayscale(
-				&edges_for_line.front(), edges_for_line.size(),
-				line, color, m_invert
-			);
+		int run = 0;
+		for (int x = touched_from; x <= touched_to; ++x) {
+			int const idx = x - x0;
+			run += full[idx];
+			int const sum = run + partial[idx];
+			full[idx] = 0;
+			partial[idx] = 0;
+			
+			int const coverage = std::min((sum + SUBROWS / 2) / SUBROWS, 255);
+			spans.append(i, SpanBuffer::Span(x, x + 1, (uint8_t)coverage));
 		}
 	}
 }
 
 void
-PolygonRasterizer::Rasterizer::oddEvenLineBinary(
-	EdgeComponent const* const edges, int const num_edges,
-	uint32_t* const line, uint32_t const pattern)
+PolygonRasterizer::Rasterizer::intervalsForLine(
+	double const y, std::vector<EdgeComponent>& edges_for_line,
+	std::vector<Interval>& intervals) const
 {
-	for (int i = 0; i < num_edges - 1; i += 2) {
-		double const x_from = edges[i].x();
-		double const x_to = edges[i + 1].x();
-		fillBinarySegment(
-			qRound(x_from), qRound(x_to), line, pattern
-		);
-	}
-}
-
-void
-PolygonRasterizer::Rasterizer::oddEvenLineGrayscale(
-	EdgeComponent const* const edges, int const num_edges,
-	uint8_t* const line, uint8_t const color)
-{
-	for (int i = 0; i < num_edges - 1; i += 2) {
-		int const from = qRound(edges[i].x());
-		int const to = qRound(edges[i + 1].x());
-		memset(line + from, color, to - from);
-	}
-}
-
-void
-PolygonRasterizer::Rasterizer::windingLineBinary(
-	EdgeComponent const* const edges, int const num_edges,
-	uint32_t* const line, uint32_t const pattern, bool invert)
-{
-	int dir_sum = 0;
-	for (int i = 0; i < num_edges - 1; ++i) {
-		dir_sum += edges[i].edge().vertDirection();
-		if ((dir_sum == 0) == invert) {
-			double const x_from = edges[i].x();
-			double const x_to = edges[i + 1].x();
-			fillBinarySegment(
-				qRound(x_from), qRound(x_to), line, pattern
-			);
-		}
-	}
-}
-
-void
-PolygonRasterizer::Rasterizer::windingLineGrayscale(
-	EdgeComponent const* const edges, int const num_edges,
-	uint8_t* const line, uint8_t const color, bool invert)
-{
-	int dir_sum = 0;
-	for (int i = 0; i < num_edges - 1; ++i) {
-		dir_sum += edges[i].edge().vertDirection();
-		if ((dir_sum == 0) == invert) {
-			int const from = qRound(edges[i].x());
-			int const to = qRound(edges[i + 1].x());
-			memset(line + from, color, to - from);
-		}
-	}
-}
-
-void
-PolygonRasterizer::Rasterizer::fillBinarySegment(
-	int const x_from, int const x_to,
-	uint32_t* const line, uint32_t const pattern)
-{
-	if (x_from == x_to) {
-		return;
-	}
+	typedef std::vector<EdgeComponent>::const_iterator EdgeIter;
 	
-	uint32_t const full_mask = ~uint32_t(0);
-	uint32_t const first_word_mask = full_mask >> (x_from & 31);
-	uint32_t const last_word_mask = full_mask << (31 - ((x_to - 1) & 31));
-	int const first_word_idx = x_from >> 5;
-	int const last_word_idx = (x_to - 1) >> 5; // x_to is exclusive
+	edges_for_line.clear();
+	intervals.clear();
 	
-	if (first_word_idx == last_word_idx) {
-		uint32_t const mask = first_word_mask & last_word_mask;
-		uint32_t& word = line[first_word_idx];
-		word = (word & ~mask) | (pattern & mask);
+	// Get edges intersecting this horizontal line.
+	std::pair<EdgeIter, EdgeIter> const range(
+		std::equal_range(
+			m_edgeComponents.begin(), m_edgeComponents.end(),
+			y, EdgeOrderY()
+		)
+	);
+	
+	if (range.first == range.second) {
 		return;
 	}
 	
-	int i = first_word_idx;
-	
-	// First word.
-	uint32_t& first_word = line[i];
-	first_word = (first_word & ~first_word_mask) | (pattern & first_word_mask);
+	std::copy(
+		range.first, range.second,
+		std::back_inserter(edges_for_line)
+	);
 	
-	// Middle words.
-	for (++i; i < last_word_idx; ++i) {
-		line[i] = pattern;
+	// Calculate the intersection point of each edge with
+	// the current horizontal line.
+	BOOST_FOREACH(EdgeComponent& ecomp, edges_for_line) {
+		ecomp.setX(ecomp.edge().xForY(y));
 	}
 	
-	// Last word.
-	uint32_t& last_word = line[i];
-	last_word = (last_word & ~last_word_mask) | (pattern & last_word_mask);
+	// Sort edge components by the x value of the intersection point.
+	std::sort(
+		edges_for_line.begin(), edges_for_line.end(),
+		EdgeOrderX()
+	);
+	
+	int const num_edges = edges_for_line.size();
+	if (m_fillRule == Qt::OddEvenFill) {
+		for (int i = 0; i < num_edges - 1; i += 2) {
+			intervals.push_back(
+				Interval(edges_for_line[i].x(), edges_for_line[i + 1].x())
+			);
+		}
+	} else {
+		int dir_sum = 0;
+		for (int i = 0; i < num_edges - 1; ++i) {
+			dir_sum += edges_for_line[i].edge().vertDirection();
+			if (dir_sum != 0) {
+				intervals.push_back(
+					Interval(edges_for_line[i].x(), edges_for_line[i + 1].x())
+				);
+			}
+		}
+	}
 }
 
 } // namespace imageproc
-
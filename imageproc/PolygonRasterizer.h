@@ -20,11 +20,13 @@
 #define IMAGEPROC_POLYGONRASTERIZER_H_
 
 #include "BWColor.h"
+#include "SpanBuffer.h"
 #include <Qt>
 
 class QPolygonF;
 class QRectF;
 class QImage;
+class QSize;
 
 namespace imageproc
 {
@@ -34,6 +36,22 @@ class BinaryImage;
 class PolygonRasterizer
 {
 public:
+	/**
+	 * \brief Converts a polygon into spans, clipped to an image of the given size.
+	 *
+	 * A pixel is included if its center is inside the polygon.
+	 * The resulting spans may be applied to several images, which is cheaper
+	 * than rasterizing the same polygon for each of them.
+	 */
+	static SpanBuffer rasterize(
+		QSize const& image_size, QPolygonF const& poly, Qt::FillRule fill_rule);
+	
+	/**
+	 * \brief Same as rasterize(), but also computes partial coverage of edge pixels.
+	 */
+	static SpanBuffer rasterizeAntialiased(
+		QSize const& image_size, QPolygonF const& poly, Qt::FillRule fill_rule);
+	
 	static void fill(
 		BinaryImage& image, BWColor color,
 		QPolygonF const& poly, Qt::FillRule fill_rule);
@@ -22,6 +22,7 @@
 #include "ColorMixer.h"
 #include "GrayImage.h"
 #include "VecNT.h"
+#include "TaskStatus.h"
 #include <QtGlobal>
 #include <QColor>
 #include <QImage>
@@ -49,7 +50,8 @@ void dewarpGeneric(
 	int const src_stride, PixelType* const dst_data,
 	QSize const dst_size, int const dst_stride,
 	CylindricalSurfaceDewarper const& distortion_model,
-	QRect const& model_domain, PixelType const bg_color)
+	QRect const& model_domain, PixelType const bg_color,
+	TaskStatus const* const status)
 {
 	int const src_width = src_size.width();
 	int const src_height = src_size.height();
@@ -64,7 +66,10 @@ void dewarpGeneric(
 	float const model_domain_top = model_domain.top();
 	float const model_y_scale = 1.0 / (model_domain.bottom() - model_domain.top());
 
+	TaskStatusPoller poller(status);
 	for (int dst_x = 0; dst_x < dst_width; ++dst_x) {
+		poller.poll();
+
 		double const model_x = (dst_x - model_domain_left) * model_x_scale;
 		CylindricalSurfaceDewarper::Generatrix const generatrix(
 			distortion_model.mapGeneratrix(model_x, state)
@@ -96,7 +101,8 @@ void dewarpGeneric(
 	int const src_stride, PixelType* const dst_data,
 	QSize const dst_size, int const dst_stride,
 	CylindricalSurfaceDewarper const& distortion_model,
-	QRect const& model_domain, PixelType const bg_color)
+	QRect const& model_domain, PixelType const bg_color,
+	TaskStatus const* const status)
 {
 	int const src_width = src_size.width();
 	int const src_height = src_size.height();
@@ -111,7 +117,10 @@ void dewarpGeneric(
 	float const model_domain_top = model_domain.top() - 0.5f;
 	float const model_y_scale = 1.0 / (model_domain.bottom() - model_domain.top());
 
+	TaskStatusPoller poller(status);
 	for (int dst_x = 0; dst_x < dst_width; ++dst_x) {
+		poller.poll();
+
 		double const model_x = (dst_x - model_domain_left) * model_x_scale;
 		CylindricalSurfaceDewarper::Generatrix const generatrix(
 			distortion_model.mapGeneratrix(model_x, state)
@@ -414,7 +423,8 @@ void dewarpGeneric(
 	int const src_stride, PixelType* const dst_data,
 	QSize const dst_size, int const dst_stride,
 	CylindricalSurfaceDewarper const& distortion_model,
-	QRect const& model_domain, PixelType const bg_color)
+	QRect const& model_domain, PixelType const bg_color,
+	TaskStatus const* const status)
 {
 	int const src_width = src_size.width();
 	int const src_height = src_size.height();
@@ -432,7 +442,10 @@ void dewarpGeneric(
 	std::vector<Vec2f> prev_grid_column(dst_height + 1);
 	std::vector<Vec2f> next_grid_column(dst_height + 1);
 
+	TaskStatusPoller poller(status);
 	for (int dst_x = 0; dst_x <= dst_width; ++dst_x) {
+		poller.poll();
+
 		double const model_x = (dst_x - model_domain_left) * model_x_scale;
 		CylindricalSurfaceDewarper::Generatrix const generatrix(
 			distortion_model.mapGeneratrix(model_x, state)
@@ -469,7 +482,8 @@ typedef unsigned MixingWeight;
 QImage dewarpGrayscale(
 	QImage const& src, QSize const& dst_size,
 	CylindricalSurfaceDewarper const& distortion_model,
-	QRect const& model_domain, QColor const& bg_color)
+	QRect const& model_domain, QColor const& bg_color,
+	TaskStatus const* const status)
 {
 	GrayImage dst(dst_size);
 	uint8_t const bg_sample = qGray(bg_color.rgb());
@@ -477,7 +491,7 @@ QImage dewarpGrayscale(
 	dewarpGeneric<GrayColorMixer<MixingWeight>, uint8_t>(
 		src.bits(), src.size(), src.bytesPerLine(),
 		dst.data(), dst_size, dst.stride(),
-		distortion_model, model_domain, bg_sample
+		distortion_model, model_domain, bg_sample, status
 	);
 	return dst.toQImage();
 }
@@ -485,14 +499,15 @@ QImage dewarpGrayscale(
 QImage dewarpRgb(
 	QImage const& src, QSize const& dst_size,
 	CylindricalSurfaceDewarper const& distortion_model,
-	QRect const& model_domain, QColor const& bg_color)
+	QRect const& model_domain, QColor const& bg_color,
+	TaskStatus const* const status)
 {
 	QImage dst(dst_size, QImage::Format_RGB32);
 	dst.fill(bg_color.rgb());
 	dewarpGeneric<RgbColorMixer<MixingWeight>, uint32_t>(
 		(uint32_t const*)src.bits(), src.size(), src.bytesPerLine()/4,
 		(uint32_t*)dst.bits(), dst_size, dst.bytesPerLine()/4,
-		distortion_model, model_domain, bg_color.rgb()
+		distortion_model, model_domain, bg_color.rgb(), status
 	);
 	return dst;
 }
@@ -500,14 +515,15 @@ QImage dewarpRgb(
 QImage dewarpArgb(
 	QImage const& src, QSize const& dst_size,
 	CylindricalSurfaceDewarper const& distortion_model,
-	QRect const& model_domain, QColor const& bg_color)
+	QRect const& model_domain, QColor const& bg_color,
+	TaskStatus const* const status)
 {
 	QImage dst(dst_size, QImage::Format_ARGB32);
 	dst.fill(bg_color.rgba());
 	dewarpGeneric<ArgbColorMixer<MixingWeight>, uint32_t>(
 		(uint32_t const*)src.bits(), src.size(), src.bytesPerLine()/4,
 		(uint32_t*)dst.bits(), dst_size, dst.bytesPerLine()/4,
-		distortion_model, model_domain, bg_color.rgba()
+		distortion_model, model_domain, bg_color.rgba(), status
 	);
 	return dst;
 }
@@ -518,23 +534,24 @@ QImage
 RasterDewarper::dewarp(
 	QImage const& src, QSize const& dst_size,
 	CylindricalSurfaceDewarper const& distortion_model,
-	QRect const& model_domain, QColor const& bg_color)
+	QRect const& model_domain, QColor const& bg_color,
+	TaskStatus const* const status)
 {
 	switch (src.format()) {
 		case QImage::Format_Invalid:
 			return QImage();
 		case QImage::Format_RGB32:
-			return dewarpRgb(src, dst_size, distortion_model, model_domain, bg_color);
+			return dewarpRgb(src, dst_size, distortion_model, model_domain, bg_color, status);
 		case QImage::Format_ARGB32:
-			return dewarpArgb(src, dst_size, distortion_model, model_domain, bg_color);
+			return dewarpArgb(src, dst_size, distortion_model, model_domain, bg_color, status);
 		case QImage::Format_Indexed8:
 			if (src.isGrayscale()) {
-				return dewarpGrayscale(src, dst_size, distortion_model, model_domain, bg_color);
+				return dewarpGrayscale(src, dst_size, distortion_model, model_domain, bg_color, status);
 			} else if (src.allGray()) {
 				// Only shades of gray but non-standard palette.
 				return dewarpGrayscale(
 					GrayImage(src).toQImage(), dst_size, distortion_model,
-					model_domain, bg_color
+					model_domain, bg_color, status
 				);
 			}
 			break;
@@ -543,7 +560,7 @@ RasterDewarper::dewarp(
 			if (src.allGray()) {
 				return dewarpGrayscale(
 					GrayImage(src).toQImage(),
-					dst_size, distortion_model, model_domain, bg_color
+					dst_size, distortion_model, model_domain, bg_color, status
 				);
 			}
 			break;
@@ -554,12 +571,12 @@ RasterDewarper::dewarp(
 	if (src.hasAlphaChannel()) {
 		return dewarpArgb(
 			src.convertToFormat(QImage::Format_ARGB32),
-			dst_size, distortion_model, model_domain, bg_color
+			dst_size, distortion_model, model_domain, bg_color, status
 		);
 	} else {
 		return dewarpRgb(
 			src.convertToFormat(QImage::Format_RGB32),
-			dst_size, distortion_model, model_domain, bg_color
+			dst_size, distortion_model, model_domain, bg_color, status
 		);
 	}
 }
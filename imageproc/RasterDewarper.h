@@ -24,6 +24,7 @@ class QImage;
 class QSize;
 class QRect;
 class QColor;
+class TaskStatus;
 
 namespace imageproc
 {
@@ -31,10 +32,15 @@ namespace imageproc
 class RasterDewarper
 {
 public:
+	/**
+	 * If \p status is provided, it's polled every few columns, and
+	 * dewarping stops with an exception if it gets cancelled.
+	 */
 	static QImage dewarp(
 		QImage const& src, QSize const& dst_size,
 		CylindricalSurfaceDewarper const& distortion_model,
-		QRect const& model_domain, QColor const& background_color
+		QRect const& model_domain, QColor const& background_color,
+		TaskStatus const* status = 0
 	);
 };
 
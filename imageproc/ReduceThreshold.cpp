@@ -17,9 +17,13 @@
 */
 
 #include "ReduceThreshold.h"
+#include "CpuFeatures.h"
 #include <stdexcept>
 #include <stdint.h>
 #include <assert.h>
+#ifdef IMAGEPROC_HAVE_AVX2
+#include <immintrin.h>
+#endif
 
 namespace imageproc
 {
@@ -28,37 +32,36 @@ namespace
 {
 
 /**
- * This lookup table is filled like this:
- * \code
- * for (unsigned i = 0; i < 256; i += 2) {
- *	unsigned out =
- *		((i & (1 << 1)) >> 1) |  // bit 1 becomes bit 0
- *		((i & (1 << 3)) >> 2) |  // bit 3 becomes bit 1
- *		((i & (1 << 5)) >> 3) |  // bit 5 becomes bit 2
- *		((i & (1 << 7)) >> 4);   // bit 7 becomes bit 3
- *	compressBitsLut[i >> 1] = static_cast<uint8_t>(out);
- * }
- * \endcode
- * We take every other byte because bit 0 doesn't matter here.
+ * Throw away every other bit starting with bit 0 and
+ * pack the remaining 16 bits into the lower half of a word.
  */
-static uint8_t const compressBitsLut[128] = {
-	0x0, 0x1, 0x0, 0x1, 0x2, 0x3, 0x2, 0x3,
-	0x0, 0x1, 0x0, 0x1, 0x2, 0x3, 0x2, 0x3,
-	0x4, 0x5, 0x4, 0x5, 0x6, 0x7, 0x6, 0x7,
-	0x4, 0x5, 0x4, 0x5, 0x6, 0x7, 0x6, 0x7,
-	0x0, 0x1, 0x0, 0x1, 0x2, 0x3, 0x2, 0x3,
-	0x0, 0x1, 0x0, 0x1, 0x2, 0x3, 0x2, 0x3,
-	0x4, 0x5, 0x4, 0x5, 0x6, 0x7, 0x6, 0x7,
-	0x4, 0x5, 0x4, 0x5, 0x6, 0x7, 0x6, 0x7,
-	0x8, 0x9, 0x8, 0x9, 0xa, 0xb, 0xa, 0xb,
-	0x8, 0x9, 0x8, 0x9, 0xa, 0xb, 0xa, 0xb,
-	0xc, 0xd, 0xc, 0xd, 0xe, 0xf, 0xe, 0xf,
-	0xc, 0xd, 0xc, 0xd, 0xe, 0xf, 0xe, 0xf,
-	0x8, 0x9, 0x8, 0x9, 0xa, 0xb, 0xa, 0xb,
-	0x8, 0x9, 0x8, 0x9, 0xa, 0xb, 0xa, 0xb,
-	0xc, 0xd, 0xc, 0xd, 0xe, 0xf, 0xe, 0xf,
-	0xc, 0xd, 0xc, 0xd, 0xe, 0xf, 0xe, 0xf
-};
+inline uint32_t compressBits(uint32_t bits)
+{
+	bits = (bits >> 1) & 0x55555555;
+	bits = (bits | (bits >> 1)) & 0x33333333;
+	bits = (bits | (bits >> 2)) & 0x0F0F0F0F;
+	bits = (bits | (bits >> 4)) & 0x00FF00FF;
+	bits = (bits | (bits >> 8)) & 0x0000FFFF;
+	return bits;
+}
+
+inline uint64_t doubleWord(uint32_t const word)
+{
+	return (uint64_t(word) << 32) | word;
+}
+
+/**
+ * Same as compressBits(), but for 64 bits at once.
+ */
+inline uint32_t compressBits64(uint64_t bits)
+{
+	bits = (bits >> 1) & doubleWord(0x55555555);
+	bits = (bits | (bits >> 1)) & doubleWord(0x33333333);
+	bits = (bits | (bits >> 2)) & doubleWord(0x0F0F0F0F);
+	bits = (bits | (bits >> 4)) & doubleWord(0x00FF00FF);
+	bits = (bits | (bits >> 8)) & doubleWord(0x0000FFFF);
+	return static_cast<uint32_t>(bits | (bits >> 16));
+}
 
 /**
  * Throw away every other bit starting with bit 0 and
@@ -66,12 +69,7 @@ static uint8_t const compressBitsLut[128] = {
  */
 inline uint32_t compressBitsUpperHalf(uint32_t const bits)
 {
-	uint32_t r;
-	r = compressBitsLut[(bits >> 25) /*& 0x7F*/] << 28;
-	r |= compressBitsLut[(bits >> 17) & 0x7F] << 24;
-	r |= compressBitsLut[(bits >> 9) & 0x7F] << 20;
-	r |= compressBitsLut[(bits >> 1) & 0x7F] << 16;
-	return r;
+	return compressBits(bits) << 16;
 }
 
 /**
@@ -80,46 +78,186 @@ inline uint32_t compressBitsUpperHalf(uint32_t const bits)
  */
 inline uint32_t compressBitsLowerHalf(uint32_t const bits)
 {
-	uint32_t r;
-	r = compressBitsLut[(bits >> 25) /*& 0x7F*/] << 12;
-	r |= compressBitsLut[(bits >> 17) & 0x7F] << 8;
-	r |= compressBitsLut[(bits >> 9) & 0x7F] << 4;
-	r |= compressBitsLut[(bits >> 1) & 0x7F];
-	return r;
+	return compressBits(bits);
 }
 
-inline uint32_t threshold1(uint32_t const top, uint32_t const bottom)
+/**
+ * Combines two horizontally adjacent pairs of bits from the top and
+ * bottom lines into the odd bits of the result.  The even bits are
+ * garbage.  Pairs never straddle 32-bit words, so this works on
+ * any number of whole words packed into an integer.
+ */
+template<typename T>
+inline T thresholdBits(T const top, T const bottom, int const threshold)
 {
-	uint32_t word = top | bottom;
-	word |= word << 1;
-	return word;
+	T const any = top | bottom;
+	T const both = top & bottom;
+	switch (threshold) {
+		case 1:
+			return any | (any << 1);
+		case 2:
+			return (both | (both << 1)) | (any & (any << 1));
+		case 3:
+			return (any & (any << 1)) & (both | (both << 1));
+		default:
+			return both & (both << 1);
+	}
 }
 
-inline uint32_t threshold2(uint32_t const top, uint32_t const bottom)
+/**
+ * Reduces \p num_src_words words of a pair of lines into
+ * (num_src_words + 1) / 2 words of the destination line.
+ */
+void reduceLineGeneric(
+	uint32_t const* top, uint32_t const* bottom,
+	uint32_t* dst, int const num_src_words, int const threshold)
 {
-	uint32_t word1 = top & bottom;
-	word1 |= word1 << 1;
-	uint32_t word2 = top | bottom;
-	word2 &= word2 << 1;
-	return word1 | word2;
+	int j = 0;
+	for (; j + 2 <= num_src_words; j += 2) {
+		uint64_t const t = (uint64_t(top[j]) << 32) | top[j + 1];
+		uint64_t const b = (uint64_t(bottom[j]) << 32) | bottom[j + 1];
+		dst[j >> 1] = compressBits64(thresholdBits(t, b, threshold));
+	}
+	if (j < num_src_words) {
+		uint32_t const word = thresholdBits(top[j], bottom[j], threshold);
+		dst[j >> 1] = compressBitsUpperHalf(word);
+	}
 }
 
-inline uint32_t threshold3(uint32_t const top, uint32_t const bottom)
+#ifdef IMAGEPROC_HAVE_AVX2
+
+IMAGEPROC_TARGET_AVX2
+inline __m256i shiftLeft1Avx2(__m256i const v)
 {
-	uint32_t word1 = top | bottom;
-	word1 &= word1 << 1;
-	uint32_t word2 = top & bottom;
-	word2 |= word2 << 1;
-	return word1 & word2;
+	return _mm256_slli_epi32(v, 1);
 }
 
-inline uint32_t threshold4(uint32_t const top, uint32_t const bottom)
+IMAGEPROC_TARGET_AVX2
+inline __m256i thresholdBitsAvx2(__m256i const top, __m256i const bottom, int const threshold)
 {
-	uint32_t word = top & bottom;
-	word &= word << 1;
-	return word;
+	__m256i const any = _mm256_or_si256(top, bottom);
+	__m256i const both = _mm256_and_si256(top, bottom);
+	switch (threshold) {
+		case 1:
+			return _mm256_or_si256(any, shiftLeft1Avx2(any));
+		case 2:
+			return _mm256_or_si256(
+				_mm256_or_si256(both, shiftLeft1Avx2(both)),
+				_mm256_and_si256(any, shiftLeft1Avx2(any))
+			);
+		case 3:
+			return _mm256_and_si256(
+				_mm256_and_si256(any, shiftLeft1Avx2(any)),
+				_mm256_or_si256(both, shiftLeft1Avx2(both))
+			);
+		default:
+			return _mm256_and_si256(both, shiftLeft1Avx2(both));
+	}
+}
+
+IMAGEPROC_TARGET_AVX2
+inline __m256i compressStepAvx2(__m256i const bits, int const shift, uint32_t const mask)
+{
+	return _mm256_and_si256(
+		_mm256_or_si256(bits, _mm256_srli_epi32(bits, shift)),
+		_mm256_set1_epi32(mask)
+	);
+}
+
+/**
+ * Processes 256 bits of both lines per step, which is 128 bits of output.
+ */
+IMAGEPROC_TARGET_AVX2
+void reduceLineAvx2(
+	uint32_t const* top, uint32_t const* bottom,
+	uint32_t* dst, int const num_src_words, int const threshold)
+{
+	// After combining pairs of 32-bit lanes, the results
+	// are in the even lanes.
+	__m256i const even_lanes = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	
+	int j = 0;
+	for (; j + 8 <= num_src_words; j += 8) {
+		__m256i const t = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(top + j));
+		__m256i const b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(bottom + j));
+		__m256i bits = thresholdBitsAvx2(t, b, threshold);
+		
+		// Same as compressBits(), for each of the 32-bit lanes.
+		bits = _mm256_and_si256(_mm256_srli_epi32(bits, 1), _mm256_set1_epi32(0x55555555));
+		bits = compressStepAvx2(bits, 1, 0x33333333);
+		bits = compressStepAvx2(bits, 2, 0x0F0F0F0F);
+		bits = compressStepAvx2(bits, 4, 0x00FF00FF);
+		bits = compressStepAvx2(bits, 8, 0x0000FFFF);
+		
+		// A 64-bit lane now holds the compressed left word in its lower
+		// half and the compressed right word in its upper half.
+		// Make its lower half (left << 16) | right.
+		bits = _mm256_or_si256(_mm256_slli_epi64(bits, 16), _mm256_srli_epi64(bits, 32));
+		bits = _mm256_permutevar8x32_epi32(bits, even_lanes);
+		_mm_storeu_si128(
+			reinterpret_cast<__m128i*>(dst + (j >> 1)), _mm256_castsi256_si128(bits)
+		);
+	}
+	
+	reduceLineGeneric(top + j, bottom + j, dst + (j >> 1), num_src_words - j, threshold);
+}
+
+#endif // IMAGEPROC_HAVE_AVX2
+
+/**
+ * Reduces a pair of lines into a line \p dst_width pixels wide.
+ */
+void reduceLine(
+	uint32_t const* top, uint32_t const* bottom,
+	uint32_t* dst, int const dst_width, int const threshold)
+{
+	int const num_src_words = (dst_width * 2 + 31) / 32;
+#ifdef IMAGEPROC_HAVE_AVX2
+	if (CpuFeatures::hasAvx2()) {
+		reduceLineAvx2(top, bottom, dst, num_src_words, threshold);
+		return;
+	}
+#endif
+	reduceLineGeneric(top, bottom, dst, num_src_words, threshold);
 }
 
+/**
+ * \brief A level of a single-pass reduction cascade.
+ *
+ * Accumulates up to two lines and reduces them as soon
+ * as both are available.
+ */
+class CascadeLevel
+{
+public:
+	CascadeLevel(int width, int threshold)
+	:	m_lines(width, 2), m_threshold(threshold), m_numLines(0) {}
+	
+	uint32_t* nextLine() {
+		return m_lines.data() + m_numLines * m_lines.wordsPerLine();
+	}
+	
+	/**
+	 * \brief Marks the line returned by nextLine() as filled.
+	 *
+	 * \return true if the pair of lines is complete and should
+	 *         be reduced with reduceInto().
+	 */
+	bool commitLine() {
+		return ++m_numLines == 2;
+	}
+	
+	void reduceInto(uint32_t* dst, int const dst_width) {
+		uint32_t const* top = m_lines.data();
+		reduceLine(top, top + m_lines.wordsPerLine(), dst, dst_width, m_threshold);
+		m_numLines = 0;
+	}
+private:
+	BinaryImage m_lines;
+	int m_threshold;
+	int m_numLines;
+};
+
 } // anonymous namespace
 
 
@@ -156,70 +294,97 @@ ReduceThreshold::reduce(int const threshold)
 	
 	int const dst_wpl = dst.wordsPerLine();
 	int const src_wpl = src.wordsPerLine();
-	int const steps_per_line = (dst_w * 2 + 31) / 32;
-	assert(steps_per_line <= src_wpl);
-	assert(steps_per_line / 2 <= dst_wpl);
+	assert((dst_w * 2 + 31) / 32 <= src_wpl);
 	
 	uint32_t const* src_line = src.data();
 	uint32_t* dst_line = dst.data();
 	
-	uint32_t word;
+	for (int i = dst_h; i > 0; --i) {
+		reduceLine(src_line, src_line + src_wpl, dst_line, dst_w, threshold);
+		src_line += src_wpl * 2;
+		dst_line += dst_wpl;
+	}
 	
-	if (threshold == 1) {
-		for (int i = dst_h; i > 0; --i) {
-			for (int j = 0; j < steps_per_line; j += 2) {
-				word = threshold1(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] = compressBitsUpperHalf(word);
-			}
-			for (int j = 1; j < steps_per_line; j += 2) {
-				word = threshold1(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] |= compressBitsLowerHalf(word);
-			}
-			src_line += src_wpl * 2;
-			dst_line += dst_wpl;
-		}
-	} else if (threshold == 2) {
-		for (int i = dst_h; i > 0; --i) {
-			for (int j = 0; j < steps_per_line; j += 2) {
-				word = threshold2(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] = compressBitsUpperHalf(word);
-			}
-			for (int j = 1; j < steps_per_line; j += 2) {
-				word = threshold2(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] |= compressBitsLowerHalf(word);
-			}
-			src_line += src_wpl * 2;
-			dst_line += dst_wpl;
+	m_image = dst;
+	return *this;
+}
+
+ReduceThreshold&
+ReduceThreshold::reduce(std::vector<int> const& thresholds)
+{
+	int const num_levels = thresholds.size();
+	for (int i = 0; i < num_levels; ++i) {
+		if (thresholds[i] < 1 || thresholds[i] > 4) {
+			throw std::invalid_argument("ReduceThreshold: invalid threshold");
 		}
-	} else if (threshold == 3) {
-		for (int i = dst_h; i > 0; --i) {
-			for (int j = 0; j < steps_per_line; j += 2) {
-				word = threshold3(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] = compressBitsUpperHalf(word);
-			}
-			for (int j = 1; j < steps_per_line; j += 2) {
-				word = threshold3(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] |= compressBitsLowerHalf(word);
+	}
+	
+	if (m_image.isNull()) {
+		return *this;
+	}
+	
+	// Levels that would reduce to a line are handled by reduce(int),
+	// after the ones that can be done in a single pass.
+	int num_fused = 0;
+	int dst_w = m_image.width();
+	int dst_h = m_image.height();
+	while (num_fused < num_levels && dst_w >= 2 && dst_h >= 2) {
+		dst_w /= 2;
+		dst_h /= 2;
+		++num_fused;
+	}
+	
+	if (num_fused >= 2) {
+		BinaryImage const& src = m_image;
+		BinaryImage dst(dst_w, dst_h);
+		
+		// levels[i] collects the lines produced by thresholds[i].
+		// The final level goes directly to dst.
+		std::vector<CascadeLevel> levels;
+		levels.reserve(num_fused - 1);
+		std::vector<int> widths(num_fused);
+		int width = src.width();
+		for (int i = 0; i < num_fused; ++i) {
+			width /= 2;
+			widths[i] = width;
+			if (i + 1 < num_fused) {
+				levels.push_back(CascadeLevel(width, thresholds[i + 1]));
 			}
-			src_line += src_wpl * 2;
-			dst_line += dst_wpl;
 		}
-	} else if (threshold == 4) {
-		for (int i = dst_h; i > 0; --i) {
-			for (int j = 0; j < steps_per_line; j += 2) {
-				word = threshold4(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] = compressBitsUpperHalf(word);
+		
+		int const src_wpl = src.wordsPerLine();
+		int const dst_wpl = dst.wordsPerLine();
+		uint32_t const* src_line = src.data();
+		uint32_t* dst_line = dst.data();
+		
+		for (int i = src.height() / 2; i > 0; --i, src_line += src_wpl * 2) {
+			reduceLine(
+				src_line, src_line + src_wpl,
+				levels[0].nextLine(), widths[0], thresholds[0]
+			);
+			
+			// Propagate through the levels for as long as pairs complete.
+			int level = 0;
+			while (levels[level].commitLine()) {
+				if (level + 2 == num_fused) {
+					levels[level].reduceInto(dst_line, widths[level + 1]);
+					dst_line += dst_wpl;
+					break;
+				}
+				levels[level].reduceInto(levels[level + 1].nextLine(), widths[level + 1]);
+				++level;
 			}
-			for (int j = 1; j < steps_per_line; j += 2) {
-				word = threshold4(src_line[j], src_line[j + src_wpl]);
-				dst_line[j / 2] |= compressBitsLowerHalf(word);
-			}
-			src_line += src_wpl * 2;
-			dst_line += dst_wpl;
 		}
+		
+		m_image = dst;
+	} else if (num_fused == 1) {
+		reduce(thresholds[0]);
+	}
+	
+	for (int i = num_fused; i < num_levels; ++i) {
+		reduce(thresholds[i]);
 	}
 	
-	m_image = dst;
 	return *this;
 }
 
@@ -20,6 +20,7 @@
 #define IMAGEPROC_REDUCETHRESHOLD_H_
 
 #include "BinaryImage.h"
+#include <vector>
 
 namespace imageproc
 {
@@ -48,6 +49,7 @@ namespace imageproc
  * \code
  * BinaryImage out = ReduceThreshold(input)(4)(4)(3);
  * \endcode
+ * A cascade may also be done in a single pass, see reduce(std::vector<int> const&).
  */
 class ReduceThreshold
 {
@@ -72,6 +74,17 @@ public:
 	 */
 	ReduceThreshold& reduce(int threshold);
 	
+	/**
+	 * \brief Performs a cascade of reductions and returns *this.
+	 *
+	 * The result is the same as calling reduce() for each of the
+	 * thresholds in turn, except the image is processed in strips,
+	 * with every level of the cascade produced as soon as its source
+	 * rows are available.  That way the source image is read only once
+	 * and the intermediate levels never leave the cache.
+	 */
+	ReduceThreshold& reduce(std::vector<int> const& thresholds);
+	
 	/**
 	 * \brief Operator () performs a reduction and returns *this.
 	 */
@@ -25,6 +25,7 @@
 #include "Morphology.h"
 #include "SeedFill.h"
 #include "RasterOp.h"
+#include "TaskStatus.h"
 #include <algorithm>
 #include <string.h>
 #include <math.h>
@@ -46,7 +47,7 @@ SEDM::SEDM()
 
 SEDM::SEDM(
 	BinaryImage const& image, DistType const dist_type,
-	Borders const borders)
+	Borders const borders, TaskStatus const* const status)
 :	m_pData(0),
 	m_size(image.size()),
 	m_stride(0)
@@ -107,11 +108,11 @@ SEDM::SEDM(
 		img_line += img_stride;
 	}
 	
-	processColumns();
-	processRows();
+	processColumns(status);
+	processRows(status);
 }
 
-SEDM::SEDM(ConnectivityMap& cmap)
+SEDM::SEDM(ConnectivityMap& cmap, TaskStatus const* const status)
 :	m_pData(0),
 	m_size(cmap.size()),
 	m_stride(0)
@@ -139,8 +140,8 @@ SEDM::SEDM(ConnectivityMap& cmap)
 		p_label += 2;
 	}
 	
-	processColumns(cmap);
-	processRows(cmap);
+	processColumns(cmap, status);
+	processRows(cmap, status);
 }
 
 SEDM::SEDM(SEDM const& other)
@@ -232,13 +233,16 @@ SEDM::distSq(
 }
 
 void
-SEDM::processColumns()
+SEDM::processColumns(TaskStatus const* const status)
 {
 	int const width = m_size.width() + 2;
 	int const height = m_size.height() + 2;
 	
+	TaskStatusPoller poller(status);
 	uint32_t* p_sqd = &m_data[0];
 	for (int x = 0; x < width; ++x, ++p_sqd) {
+		poller.poll();
+		
 		// (d + 1)^2 = d^2 + 2d + 1
 		uint32_t b = 1; // 2d + 1 in the above formula.
 		for (int todo = height - 1; todo > 0; --todo) {
@@ -267,14 +271,17 @@ SEDM::processColumns()
 }
 
 void
-SEDM::processColumns(ConnectivityMap& cmap)
+SEDM::processColumns(ConnectivityMap& cmap, TaskStatus const* const status)
 {
 	int const width = m_size.width() + 2;
 	int const height = m_size.height() + 2;
 	
+	TaskStatusPoller poller(status);
 	uint32_t* p_sqd = &m_data[0];
 	uint32_t* p_label = cmap.paddedData();
 	for (int x = 0; x < width; ++x, ++p_sqd, ++p_label) {
+		poller.poll();
+		
 		// (d + 1)^2 = d^2 + 2d + 1
 		uint32_t b = 1; // 2d + 1 in the above formula.
 		for (int todo = height - 1; todo > 0; --todo) {
@@ -307,7 +314,7 @@ SEDM::processColumns(ConnectivityMap& cmap)
 }
 
 void
-SEDM::processRows()
+SEDM::processRows(TaskStatus const* const status)
 {
 	int const width = m_size.width() + 2;
 	int const height = m_size.height() + 2;
@@ -316,8 +323,11 @@ SEDM::processRows()
 	std::vector<int> t(width, 0);
 	std::vector<uint32_t> row_copy(width, 0);
 	
+	TaskStatusPoller poller(status);
 	uint32_t* line = &m_data[0];
 	for (int y = 0; y < height; ++y, line += width) {
+		poller.poll();
+		
 		int q = 0;
 		s[0] = 0;
 		t[0] = 0;
@@ -358,7 +368,7 @@ SEDM::processRows()
 }
 
 void
-SEDM::processRows(ConnectivityMap& cmap)
+SEDM::processRows(ConnectivityMap& cmap, TaskStatus const* const status)
 {
 	int const width = m_size.width() + 2;
 	int const height = m_size.height() + 2;
@@ -368,9 +378,12 @@ SEDM::processRows(ConnectivityMap& cmap)
 	std::vector<uint32_t> row_copy(width, 0);
 	std::vector<uint32_t> cmap_row_copy(width, 0);
 	
+	TaskStatusPoller poller(status);
 	uint32_t* line = &m_data[0];
 	uint32_t* cmap_line = cmap.paddedData();
 	for (int y = 0; y < height; ++y, line += width, cmap_line += width) {
+		poller.poll();
+		
 		int q = 0;
 		s[0] = 0;
 		t[0] = 0;
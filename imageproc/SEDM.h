@@ -24,6 +24,8 @@
 #include <QSize>
 #include <stdint.h>
 
+class TaskStatus;
+
 namespace imageproc
 {
 
@@ -106,10 +108,13 @@ public:
 	 * \param borders Determines whether to compute
 	 *        distance to particular borders.  The borders
 	 *        are assumed to lie one pixel off the image area.
+	 * \param status If provided, it's polled every few lines,
+	 *        and construction stops with an exception if it
+	 *        gets cancelled.
 	 */
 	explicit SEDM(
 		BinaryImage const& image, DistType dist_type = DIST_TO_WHITE,
-		Borders borders = DIST_TO_ALL_BORDERS);
+		Borders borders = DIST_TO_ALL_BORDERS, TaskStatus const* status = 0);
 	
 	/**
 	 * \brief Build a distance map from a connectivity map.
@@ -122,7 +127,7 @@ public:
 	 *       with the nearest non-zero label.  This applies to
 	 *       the padding areas of the connectivity map as well.
 	 */
-	explicit SEDM(ConnectivityMap& cmap);
+	explicit SEDM(ConnectivityMap& cmap, TaskStatus const* status = 0);
 	
 	SEDM(SEDM const& other);
 	
@@ -174,13 +179,13 @@ public:
 private:
 	static uint32_t distSq(int x1, int x2, uint32_t dy_sq);
 	
-	void processColumns();
+	void processColumns(TaskStatus const* status);
 	
-	void processColumns(ConnectivityMap& cmap);
+	void processColumns(ConnectivityMap& cmap, TaskStatus const* status);
 	
-	void processRows();
+	void processRows(TaskStatus const* status);
 	
-	void processRows(ConnectivityMap& cmap);
+	void processRows(ConnectivityMap& cmap, TaskStatus const* status);
 	
 	BinaryImage findPeakCandidatesNonPadded() const;
 	
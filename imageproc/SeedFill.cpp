@@ -19,6 +19,7 @@
 #include "SeedFill.h"
 #include "SeedFillGeneric.h"
 #include "GrayImage.h"
+#include "TaskStatus.h"
 #include <QSize>
 #include <QImage>
 #include <QDebug>
@@ -498,7 +499,7 @@ uint8_t seedFillGray8SlowIteration(GrayImage& seed, GrayImage const& mask)
 
 BinaryImage seedFill(
 	BinaryImage const& seed, BinaryImage const& mask,
-	Connectivity const connectivity)
+	Connectivity const connectivity, TaskStatus const* const status)
 {
 	if (seed.size() != mask.size()) {
 		throw std::invalid_argument("seedFill: seed and mask have different sizes");
@@ -508,6 +509,10 @@ BinaryImage seedFill(
 	BinaryImage img(seed);
 	
 	do {
+		if (status) {
+			status->throwIfCancelled();
+		}
+
 		prev = img;
 		if (connectivity == CONN4) {
 			seedFill4Iteration(img, mask);
@@ -520,15 +525,17 @@ BinaryImage seedFill(
 }
 
 GrayImage seedFillGray(
-	GrayImage const& seed, GrayImage const& mask, Connectivity const connectivity)
+	GrayImage const& seed, GrayImage const& mask, Connectivity const connectivity,
+	TaskStatus const* const status)
 {
 	GrayImage result(seed);
-	seedFillGrayInPlace(result, mask, connectivity);
+	seedFillGrayInPlace(result, mask, connectivity, status);
 	return result;
 }
 
 void seedFillGrayInPlace(
-	GrayImage& seed, GrayImage const& mask, Connectivity const connectivity)
+	GrayImage& seed, GrayImage const& mask, Connectivity const connectivity,
+	TaskStatus const* const status)
 {
 	if (seed.size() != mask.size()) {
 		throw std::invalid_argument("seedFillGrayInPlace: seed and mask have different sizes");
@@ -541,7 +548,7 @@ void seedFillGrayInPlace(
 	seedFillGenericInPlace(
 		&darkest, &lightest, connectivity,
 		seed.data(), seed.stride(), seed.size(),
-		mask.data(), mask.stride()
+		mask.data(), mask.stride(), status
 	);
 }
 
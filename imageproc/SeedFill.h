@@ -23,6 +23,7 @@
 #include "Connectivity.h"
 
 class QImage;
+class TaskStatus;
 
 namespace imageproc
 {
@@ -41,10 +42,13 @@ class GrayImage;
  * \par
  * The underlying code implements Luc Vincent's iterative seed-fill
  * algorithm: http://www.vincent-net.com/luc/papers/93ieeeip_recons.pdf
+ * \par
+ * If \p status is provided, it's polled between iterations, and the
+ * fill stops with an exception if it gets cancelled.
  */
 BinaryImage seedFill(
 	BinaryImage const& seed, BinaryImage const& mask,
-	Connectivity connectivity);
+	Connectivity connectivity, TaskStatus const* status = 0);
 
 /**
  * \brief Spread darker colors from seed as long as mask allows it.
@@ -58,15 +62,20 @@ BinaryImage seedFill(
  * \par
  * The underlying code implements Luc Vincent's hybrid seed-fill algorithm:
  * http://www.vincent-net.com/luc/papers/93ieeeip_recons.pdf
+ * \par
+ * If \p status is provided, it's polled every few lines, and the
+ * fill stops with an exception if it gets cancelled.
  */
 GrayImage seedFillGray(
-	GrayImage const& seed, GrayImage const& mask, Connectivity connectivity);
+	GrayImage const& seed, GrayImage const& mask, Connectivity connectivity,
+	TaskStatus const* status = 0);
 
 /**
  * \brief A faster, in-place version of seedFillGray().
  */
 void seedFillGrayInPlace(
-	GrayImage& seed, GrayImage const& mask, Connectivity connectivity);
+	GrayImage& seed, GrayImage const& mask, Connectivity connectivity,
+	TaskStatus const* status = 0);
 
 /**
  * \brief A slower but more simple implementation of seedFillGray().
@@ -21,6 +21,7 @@
 
 #include "Connectivity.h"
 #include "FastQueue.h"
+#include "TaskStatus.h"
 #include <QSize>
 #include <vector>
 #include <assert.h>
@@ -114,9 +115,15 @@ void spread4(
 	FastQueue<Position<T> >& queue,
 	HTransition const* h_transitions,
 	VTransition const* v_transitions,
-	int const seed_stride, int const mask_stride)
+	int const seed_stride, int const mask_stride,
+	TaskStatus const* const status)
 {
+	// Queue items are cheap, so poll less often than once per line.
+	TaskStatusPoller poller(status, 4096);
+
 	while (!queue.empty()) {
+		poller.poll();
+
 		Position<T> const pos(queue.front());
 		queue.pop();
 
@@ -162,9 +169,15 @@ void spread8(
 	FastQueue<Position<T> >& queue,
 	HTransition const* h_transitions,
 	VTransition const* v_transitions,
-	int const seed_stride, int const mask_stride)
+	int const seed_stride, int const mask_stride,
+	TaskStatus const* const status)
 {
+	// Queue items are cheap, so poll less often than once per line.
+	TaskStatusPoller poller(status, 4096);
+
 	while (!queue.empty()) {
+		poller.poll();
+
 		Position<T> const pos(queue.front());
 		queue.pop();
 
@@ -241,7 +254,8 @@ template<typename T, typename SpreadOp, typename MaskOp>
 void seedFill4(
 	SpreadOp spread_op, MaskOp mask_op,
 	T* const seed, int const seed_stride, QSize const size,
-	T const* const mask, int const mask_stride)
+	T const* const mask, int const mask_stride,
+	TaskStatus const* const status)
 {
 	int const w = size.width();
 	int const h = size.height();
@@ -249,9 +263,12 @@ void seedFill4(
 	T* seed_line = seed;
 	T const* mask_line = mask;
 	T* prev_line = seed_line;
+	TaskStatusPoller poller(status);
 
 	// Top to bottom.
 	for (int y = 0; y < h; ++y) {
+		poller.poll();
+
 		int x = 0;
 
 		// First item in line.
@@ -280,6 +297,8 @@ void seedFill4(
 
 	// Bottom to top.
 	for (int y = h - 1; y >= 0; --y) {
+		poller.poll();
+
 		VTransition const vt(v_transitions[y]);
 
 		// Right to left.
@@ -327,7 +346,7 @@ void seedFill4(
 
 	spread4(
 		spread_op, mask_op, queue, &h_transitions[0],
-		&v_transitions[0], seed_stride, mask_stride
+		&v_transitions[0], seed_stride, mask_stride, status
 	);
 }
 
@@ -335,7 +354,8 @@ template<typename T, typename SpreadOp, typename MaskOp>
 void seedFill8(
 	SpreadOp spread_op, MaskOp mask_op,
 	T* const seed, int const seed_stride, QSize const size,
-	T const* const mask, int const mask_stride)
+	T const* const mask, int const mask_stride,
+	TaskStatus const* const status)
 {
 	int const w = size.width();
 	int const h = size.height();
@@ -367,9 +387,12 @@ void seedFill8(
 	}
 
 	T* prev_line = seed_line;
+	TaskStatusPoller poller(status);
 
 	// Top to bottom.
 	for (int y = 1; y < h; ++y) {
+		poller.poll();
+
 		seed_line += seed_stride;
 		mask_line += mask_stride;
 
@@ -418,6 +441,8 @@ void seedFill8(
 
 	// Bottom to top.
 	for (int y = h - 1; y >= 0; --y) {
+		poller.poll();
+
 		VTransition const vt(v_transitions[y]);
 
 		for (int x = w - 1; x >= 0; --x) {
@@ -486,7 +511,7 @@ void seedFill8(
 
 	spread8(
 		spread_op, mask_op, queue, &h_transitions[0],
-		&v_transitions[0], seed_stride, mask_stride
+		&v_transitions[0], seed_stride, mask_stride, status
 	);
 }
 
@@ -517,6 +542,9 @@ void seedFill8(
  * \param size Dimensions of the seed and the mask buffers.
  * \param mask Pointer to the mask data.
  * \param mask_stride The size of a row in the mask buffer, in terms of the number of T objects.
+ * \param status If provided, it's polled as the fill progresses, and the fill
+ *        stops with an exception if it gets cancelled.  \p seed is then left
+ *        partially filled.
  *
  * This code is an implementation of the hybrid grayscale restoration algorithm described in:
  * Morphological Grayscale Reconstruction in Image Analysis:
@@ -527,7 +555,7 @@ template<typename T, typename SpreadOp, typename MaskOp>
 void seedFillGenericInPlace(
 	SpreadOp spread_op, MaskOp mask_op, Connectivity conn,
 	T* seed, int seed_stride, QSize size,
-	T const* mask, int mask_stride)
+	T const* mask, int mask_stride, TaskStatus const* status = 0)
 {
 	if (size.isEmpty()) {
 		return;
@@ -535,12 +563,12 @@ void seedFillGenericInPlace(
 
 	if (conn == CONN4) {
 		detail::seed_fill_generic::seedFill4(
-			spread_op, mask_op, seed, seed_stride, size, mask, mask_stride
+			spread_op, mask_op, seed, seed_stride, size, mask, mask_stride, status
 		);
 	} else {
 		assert(conn == CONN8);
 		detail::seed_fill_generic::seedFill8(
-			spread_op, mask_op, seed, seed_stride, size, mask, mask_stride
+			spread_op, mask_op, seed, seed_stride, size, mask, mask_stride, status
 		);
 	}
 }
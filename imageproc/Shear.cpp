@@ -17,18 +17,159 @@
 */
 
 #include "Shear.h"
-#include "RasterOp.h"
 #include "BinaryImage.h"
+#include "CpuFeatures.h"
 #include <QRect>
-#include <QPoint>
+#include <vector>
+#include <algorithm>
 #include <stdexcept>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <assert.h>
+#ifdef IMAGEPROC_HAVE_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace imageproc
 {
 
+namespace
+{
+
+/**
+ * \brief A range of columns sharing the same vertical shift.
+ */
+struct ColumnBlock
+{
+	int x1; // inclusive
+	int x2; // exclusive
+	int shift;
+	
+	ColumnBlock(int x1, int x2, int shift) : x1(x1), x2(x2), shift(shift) {}
+};
+
+/**
+ * \brief Whole words of a line that come from the same source line.
+ */
+struct WordRun
+{
+	int begin;
+	int end;
+	int shift;
+	
+	WordRun(int begin, int end, int shift) : begin(begin), end(end), shift(shift) {}
+};
+
+/**
+ * \brief A part of a word that comes from a particular source line.
+ */
+struct PartialWord
+{
+	int idx;
+	uint32_t mask;
+	int shift;
+	bool firstInWord;
+	
+	PartialWord(int idx, uint32_t mask, int shift, bool first)
+	: idx(idx), mask(mask), shift(shift), firstInWord(first) {}
+};
+
+/**
+ * Returns a word of \p line, or zero if \p idx is outside of [0, wpl).
+ */
+inline uint32_t wordOrZero(uint32_t const* line, int const wpl, int const idx)
+{
+	return (idx >= 0 && idx < wpl) ? line[idx] : 0;
+}
+
+/**
+ * \brief Copies a line shifted horizontally by \p shift pixels.
+ *
+ * Positive shifts are to the right.  Pixels that don't come from
+ * the source line are left in an undefined state.
+ */
+void shiftLine(
+	uint32_t const* src, uint32_t* dst, int const wpl, int const shift)
+{
+	// dst[i] is made of the lower bits of src[i - q - 1]
+	// and the upper bits of src[i - q].
+	int const q = shift >= 0 ? shift >> 5 : -((31 - shift) >> 5); // floor(shift / 32)
+	int const r = shift - q * 32;
+	
+	if (r == 0) {
+		for (int i = 0; i < wpl; ++i) {
+			dst[i] = wordOrZero(src, wpl, i - q);
+		}
+		return;
+	}
+	
+	// The range of i where both source words are within the line.
+	int const safe_begin = std::max(0, q + 1);
+	int const safe_end = std::min(wpl, wpl + q);
+	
+	int i = 0;
+	for (; i < safe_begin && i < wpl; ++i) {
+		dst[i] = (wordOrZero(src, wpl, i - q) >> r)
+			| (wordOrZero(src, wpl, i - q - 1) << (32 - r));
+	}
+	
+#ifdef IMAGEPROC_HAVE_SSE2
+	__m128i const right_shift = _mm_cvtsi32_si128(r);
+	__m128i const left_shift = _mm_cvtsi32_si128(32 - r);
+	for (; i + 4 <= safe_end; i += 4) {
+		__m128i const upper = _mm_loadu_si128((__m128i const*)(src + i - q));
+		__m128i const lower = _mm_loadu_si128((__m128i const*)(src + i - q - 1));
+		_mm_storeu_si128(
+			(__m128i*)(dst + i),
+			_mm_or_si128(_mm_srl_epi32(upper, right_shift), _mm_sll_epi32(lower, left_shift))
+		);
+	}
+#endif
+	for (; i < safe_end; ++i) {
+		dst[i] = (src[i - q] >> r) | (src[i - q - 1] << (32 - r));
+	}
+	
+	for (; i < wpl; ++i) {
+		dst[i] = (wordOrZero(src, wpl, i - q) >> r)
+			| (wordOrZero(src, wpl, i - q - 1) << (32 - r));
+	}
+}
+
+/**
+ * \brief Returns the bits of a word that represent columns [x1, x2).
+ */
+inline uint32_t columnMask(int const word_idx, int const x1, int const x2)
+{
+	int const begin = std::max(x1 - word_idx * 32, 0);
+	int const end = std::min(x2 - word_idx * 32, 32);
+	uint32_t mask = ~uint32_t(0) >> begin;
+	if (end < 32) {
+		mask &= ~(~uint32_t(0) >> end);
+	}
+	return mask;
+}
+
+/**
+ * \brief Takes over the buffer of \p dst, unless it's shared with \p src.
+ *
+ * Lines are written as a whole, so in-place operation
+ * needs a separate destination.
+ */
+BinaryImage takeDestination(BinaryImage const& src, BinaryImage& dst)
+{
+	BinaryImage out;
+	if (src.data() == static_cast<BinaryImage const&>(dst).data()) {
+		out = BinaryImage(src.width(), src.height());
+	} else {
+		out.swap(dst);
+	}
+	return out;
+}
+
+} // anonymous namespace
+
 void hShearFromTo(BinaryImage const& src, BinaryImage& dst, double const shear,
 	double const y_origin, BWColor const background_color)
 {
@@ -53,6 +194,12 @@ void hShearFromTo(BinaryImage const& src, BinaryImage& dst, double const shear,
 		return;
 	}
 	
+	BinaryImage out(takeDestination(src, dst));
+	
+	int const wpl = src.wordsPerLine();
+	uint32_t const* const src_data = src.data();
+	uint32_t* const out_data = out.data();
+	
 	int shift2 = shift1;
 	int y1 = 0;
 	int y2 = 0;
@@ -65,26 +212,18 @@ void hShearFromTo(BinaryImage const& src, BinaryImage& dst, double const shear,
 			if (abs(shift1) >= width) {
 				// The shifted block would be completely off the image.
 				QRect const fr(0, y1, width, block_height);
-				dst.fill(fr, background_color);
-			} else if (shift1 < 0) {
-				// Shift to the left.
-				QRect const dr(0, y1, width + shift1, block_height);
-				QPoint const sp(-shift1, y1);
-				rasterOp<RopSrc>(dst, dr, src, sp);
-				QRect const fr(width + shift1, y1, -shift1, block_height);
-				dst.fill(fr, background_color);
-			} else if (shift1 > 0) {
-				// Shift to the right.
-				QRect const dr(shift1, y1, width - shift1, block_height);
-				QPoint const sp(0, y1);
-				rasterOp<RopSrc>(dst, dr, src, sp);
-				QRect const fr(0, y1, shift1, block_height);
-				dst.fill(fr, background_color);
+				out.fill(fr, background_color);
 			} else {
-				// No shift, just copy.
-				QRect const dr(0, y1, width, block_height);
-				QPoint const sp(0, y1);
-				rasterOp<RopSrc>(dst, dr, src, sp);
+				for (int y = y1; y < y2; ++y) {
+					shiftLine(src_data + y * wpl, out_data + y * wpl, wpl, shift1);
+				}
+				if (shift1 < 0) {
+					QRect const fr(width + shift1, y1, -shift1, block_height);
+					out.fill(fr, background_color);
+				} else if (shift1 > 0) {
+					QRect const fr(0, y1, shift1, block_height);
+					out.fill(fr, background_color);
+				}
 			}
 			
 			if (y2 == height) {
@@ -95,6 +234,8 @@ void hShearFromTo(BinaryImage const& src, BinaryImage& dst, double const shear,
 			shift1 = shift2;
 		}
 	}
+	
+	dst.swap(out);
 }
 
 void vShearFromTo(BinaryImage const& src, BinaryImage& dst, double const shear,
@@ -121,6 +262,7 @@ void vShearFromTo(BinaryImage const& src, BinaryImage& dst, double const shear,
 		return;
 	}
 	
+	std::vector<ColumnBlock> blocks;
 	int shift2 = shift1;
 	int x1 = 0;
 	int x2 = 0;
@@ -129,31 +271,7 @@ void vShearFromTo(BinaryImage const& src, BinaryImage& dst, double const shear,
 		shift += shear;
 		shift2 = (int)floor(shift);
 		if (shift1 != shift2 || x2 == width) {
-			int const block_width = x2 - x1;
-			if (abs(shift1) >= height) {
-				// The shifted block would be completely off the image.
-				QRect const fr(x1, 0, block_width, height);
-				dst.fill(fr, background_color);
-			} else if (shift1 < 0) {
-				// Shift upwards.
-				QRect const dr(x1, 0, block_width, height + shift1);
-				QPoint const sp(x1, -shift1);
-				rasterOp<RopSrc>(dst, dr, src, sp);
-				QRect const fr(x1, height + shift1, block_width, -shift1);
-				dst.fill(fr, background_color);
-			} else if (shift1 > 0) {
-				// Shift downwards.
-				QRect const dr(x1, shift1, block_width, height - shift1);
-				QPoint const sp(x1, 0);
-				rasterOp<RopSrc>(dst, dr, src, sp);
-				QRect const fr(x1, 0, block_width, shift1);
-				dst.fill(fr, background_color);
-			} else {
-				// No shift, just copy.
-				QRect const dr(x1, 0, block_width, height);
-				QPoint const sp(x1, 0);
-				rasterOp<RopSrc>(dst, dr, src, sp);
-			}
+			blocks.push_back(ColumnBlock(x1, x2, shift1));
 			
 			if (x2 == width) {
 				break;
@@ -163,6 +281,64 @@ void vShearFromTo(BinaryImage const& src, BinaryImage& dst, double const shear,
 			shift1 = shift2;
 		}
 	}
+	
+	// Every destination line is assembled from whole words of source
+	// lines, plus masked parts of words at block boundaries.
+	// Padding bits are covered by no block and end up as zeroes.
+	std::vector<WordRun> runs;
+	std::vector<PartialWord> partials;
+	int const wpl = src.wordsPerLine();
+	for (int i = 0; i < wpl; ++i) {
+		int const word_x1 = i * 32;
+		int const word_x2 = word_x1 + 32;
+		bool first = true;
+		for (unsigned b = 0; b < blocks.size(); ++b) {
+			ColumnBlock const& block = blocks[b];
+			if (block.x2 <= word_x1 || block.x1 >= word_x2) {
+				continue;
+			}
+			if (block.x1 <= word_x1 && block.x2 >= word_x2) {
+				if (!runs.empty() && runs.back().end == i && runs.back().shift == block.shift) {
+					++runs.back().end;
+				} else {
+					runs.push_back(WordRun(i, i + 1, block.shift));
+				}
+				break;
+			}
+			uint32_t const mask = columnMask(i, block.x1, block.x2);
+			partials.push_back(PartialWord(i, mask, block.shift, first));
+			first = false;
+		}
+	}
+	
+	BinaryImage out(takeDestination(src, dst));
+	
+	uint32_t const bg_word = background_color == BLACK ? ~uint32_t(0) : 0;
+	std::vector<uint32_t> bg_line(wpl, bg_word);
+	uint32_t const* const src_data = src.data();
+	uint32_t* out_line = out.data();
+	for (int y = 0; y < height; ++y, out_line += wpl) {
+		for (unsigned r = 0; r < runs.size(); ++r) {
+			WordRun const& run = runs[r];
+			int const src_y = y - run.shift;
+			uint32_t const* src_line = (src_y >= 0 && src_y < height)
+				? src_data + src_y * wpl : &bg_line[0];
+			memcpy(out_line + run.begin, src_line + run.begin, (run.end - run.begin) * 4);
+		}
+		for (unsigned p = 0; p < partials.size(); ++p) {
+			PartialWord const& part = partials[p];
+			int const src_y = y - part.shift;
+			uint32_t const word = (src_y >= 0 && src_y < height)
+				? src_data[src_y * wpl + part.idx] : bg_word;
+			if (part.firstInWord) {
+				out_line[part.idx] = word & part.mask;
+			} else {
+				out_line[part.idx] |= word & part.mask;
+			}
+		}
+	}
+	
+	dst.swap(out);
 }
 
 BinaryImage hShear(
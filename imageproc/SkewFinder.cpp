@@ -20,10 +20,12 @@
 #include "BinaryImage.h"
 #include "BWColor.h"
 #include "BitOps.h"
-#include "Shear.h"
 #include "ReduceThreshold.h"
 #include "Constants.h"
+#include <QtConcurrentMap>
 #include <QDebug>
+#include <vector>
+#include <algorithm>
 #include <stdexcept>
 #include <stdint.h>
 #include <math.h>
@@ -43,6 +45,8 @@ int const SkewFinder::DEFAULT_FINE_REDUCTION = 1;
 
 double const SkewFinder::LOW_SCORE = 1000.0;
 
+double const SkewFinder::EARLY_EXIT_CONFIDENCE = 0.05;
+
 SkewFinder::SkewFinder()
 :	m_maxAngle(DEFAULT_MAX_ANGLE),
 	m_accuracy(DEFAULT_ACCURACY),
@@ -94,6 +98,171 @@ SkewFinder::setResolutionRatio(double const ratio)
 	m_resolutionRatio = ratio;
 }
 
+/**
+ * \brief Black runs of a binary image, grouped by line.
+ *
+ * Projecting runs rather than pixels lets us score a shear angle
+ * without materializing the sheared image.
+ */
+class SkewFinder::BlackRuns
+{
+public:
+	explicit BlackRuns(BinaryImage const& image);
+	
+	int width() const { return m_width; }
+	
+	int height() const { return m_height; }
+	
+	/**
+	 * \brief Projects black runs onto the vertical axis after a vertical
+	 *        shear and returns the projection profile score.
+	 *
+	 * The result is identical to calling vShearFromTo() with
+	 * x_origin = 0.5 * width() and then measuring the squared
+	 * differences of black pixel counts of adjacent lines.
+	 */
+	double shearedProjectionScore(double shear) const;
+private:
+	static int findNextPixel(
+		uint32_t const* line, int x, int width, uint32_t modifier);
+	
+	std::vector<int> m_lineOffsets; // Indexes into m_runs.
+	std::vector<int> m_runs; // Pairs of [x_begin, x_end).
+	int m_width;
+	int m_height;
+};
+
+SkewFinder::BlackRuns::BlackRuns(BinaryImage const& image)
+:	m_width(image.width()),
+	m_height(image.height())
+{
+	m_lineOffsets.reserve(m_height + 1);
+	
+	uint32_t const* line = image.data();
+	int const wpl = image.wordsPerLine();
+	for (int y = 0; y < m_height; ++y, line += wpl) {
+		m_lineOffsets.push_back(m_runs.size());
+		int x = 0;
+		for (;;) {
+			x = findNextPixel(line, x, m_width, 0);
+			if (x == m_width) {
+				break;
+			}
+			int const x_end = findNextPixel(line, x, m_width, ~uint32_t(0));
+			m_runs.push_back(x);
+			m_runs.push_back(x_end);
+			x = x_end;
+			if (x == m_width) {
+				break;
+			}
+		}
+	}
+	m_lineOffsets.push_back(m_runs.size());
+}
+
+/**
+ * Returns the position of the first pixel at or after \p x having
+ * the color of ~modifier when interpreted as a bit mask, or \p width
+ * if there are no such pixels.
+ */
+int
+SkewFinder::BlackRuns::findNextPixel(
+	uint32_t const* const line, int const x, int const width, uint32_t const modifier)
+{
+	int const last_word_idx = (width - 1) >> 5;
+	int idx = x >> 5;
+	uint32_t word = (line[idx] ^ modifier) & (~uint32_t(0) >> (x & 31));
+	while (!word) {
+		if (++idx > last_word_idx) {
+			return width;
+		}
+		word = line[idx] ^ modifier;
+	}
+	return std::min((idx << 5) + countMostSignificantZeroes(word), width);
+}
+
+double
+SkewFinder::BlackRuns::shearedProjectionScore(double const shear) const
+{
+	// Split columns into blocks of identical vertical shifts,
+	// exactly like vShearFromTo() does.
+	std::vector<int> column_blocks(m_width);
+	std::vector<int> block_begins;
+	std::vector<int> block_shifts;
+	
+	double const x_origin = 0.5 * m_width;
+	double shift = 0.5 + shear * (0.5 - x_origin);
+	double const shift_end = 0.5 + shear * (m_width - 0.5 - x_origin);
+	if (floor(shift) == floor(shift_end)) {
+		block_begins.push_back(0);
+		block_shifts.push_back(0);
+		std::fill(column_blocks.begin(), column_blocks.end(), 0);
+	} else {
+		for (int x = 0; x < m_width; ++x, shift += shear) {
+			int const x_shift = (int)floor(shift);
+			if (block_shifts.empty() || block_shifts.back() != x_shift) {
+				block_begins.push_back(x);
+				block_shifts.push_back(x_shift);
+			}
+			column_blocks[x] = block_shifts.size() - 1;
+		}
+	}
+	block_begins.push_back(m_width);
+	
+	std::vector<int> line_counts(m_height, 0);
+	for (int y = 0; y < m_height; ++y) {
+		int const runs_end = m_lineOffsets[y + 1];
+		for (int i = m_lineOffsets[y]; i < runs_end; i += 2) {
+			int const run_begin = m_runs[i];
+			int const run_end = m_runs[i + 1];
+			for (int block = column_blocks[run_begin];; ++block) {
+				int const dst_y = y + block_shifts[block];
+				if (dst_y >= 0 && dst_y < m_height) {
+					int const from = std::max(run_begin, block_begins[block]);
+					int const to = std::min(run_end, block_begins[block + 1]);
+					line_counts[dst_y] += to - from;
+				}
+				if (block_begins[block + 1] >= run_end) {
+					break;
+				}
+			}
+		}
+	}
+	
+	double score = 0.0;
+	for (int y = 1; y < m_height; ++y) {
+		double const diff = line_counts[y] - line_counts[y - 1];
+		score += diff * diff;
+	}
+	
+	return score;
+}
+
+
+struct SkewFinder::AngleScore
+{
+	double angle;
+	double score;
+	
+	AngleScore(double a) : angle(a), score(0.0) {}
+};
+
+
+class SkewFinder::AngleScorer
+{
+public:
+	AngleScorer(SkewFinder const& finder, BlackRuns const& runs)
+	: m_pFinder(&finder), m_pRuns(&runs) {}
+	
+	void operator()(AngleScore& item) const {
+		item.score = m_pFinder->process(*m_pRuns, item.angle);
+	}
+private:
+	SkewFinder const* m_pFinder;
+	BlackRuns const* m_pRuns;
+};
+
+
 Skew
 SkewFinder::findSkew(BinaryImage const& image) const
 {
@@ -101,36 +270,58 @@ SkewFinder::findSkew(BinaryImage const& image) const
 		throw std::invalid_argument("SkewFinder: null image was provided");
 	}
 	
+	std::vector<int> thresholds;
 	ReduceThreshold coarse_reduced(image);
 	int const min_reduction = std::min(m_coarseReduction, m_fineReduction);
 	for (int i = 0; i < min_reduction; ++i) {
-		coarse_reduced.reduce(i == 0 ? 1 : 2);
+		thresholds.push_back(i == 0 ? 1 : 2);
 	}
+	coarse_reduced.reduce(thresholds);
 	
 	ReduceThreshold fine_reduced(coarse_reduced.image());
 	
+	thresholds.clear();
 	for (int i = min_reduction; i < m_coarseReduction; ++i) {
-		coarse_reduced.reduce(i == 0 ? 1 : 2);
+		thresholds.push_back(i == 0 ? 1 : 2);
 	}
+	coarse_reduced.reduce(thresholds);
 	
-	BinaryImage skewed(coarse_reduced.image().size());
+	BlackRuns const coarse_runs(coarse_reduced.image());
 	double const coarse_step = 1.0; // degrees
 	
-	// Coarse linear search.
-	int num_coarse_scores = 0;
+	// Coarse linear search.  Angles are independent of each other,
+	// so they are evaluated in parallel.
+	std::vector<AngleScore> coarse_scores;
+	for (double angle = -m_maxAngle; angle <= m_maxAngle; angle += coarse_step) {
+		coarse_scores.push_back(AngleScore(angle));
+	}
+	QtConcurrent::blockingMap(coarse_scores, AngleScorer(*this, coarse_runs));
+	
+	int const num_coarse_scores = coarse_scores.size();
 	double sum_coarse_scores = 0.0;
 	double best_coarse_score = 0.0;
 	double best_coarse_angle = -m_maxAngle;
-	for (double angle = -m_maxAngle; angle <= m_maxAngle; angle += coarse_step) {
-		double const score = process(coarse_reduced, skewed, angle);
+	for (int i = 0; i < num_coarse_scores; ++i) {
+		double const score = coarse_scores[i].score;
 		sum_coarse_scores += score;
-		++num_coarse_scores;
 		if (score > best_coarse_score) {
-			best_coarse_angle = angle;
+			best_coarse_angle = coarse_scores[i].angle;
 			best_coarse_score = score;
 		}
 	}
 	
+	if (num_coarse_scores > 1) {
+		double const avg_coarse_score = sum_coarse_scores / num_coarse_scores;
+		if (best_coarse_score <= avg_coarse_score * (1.0 + EARLY_EXIT_CONFIDENCE)) {
+			// No distinct peak (or no content at all).
+			double confidence = 0.0;
+			if (avg_coarse_score > 0.0) {
+				confidence = best_coarse_score / avg_coarse_score - 1.0;
+			}
+			return Skew(-best_coarse_angle, confidence);
+		}
+	}
+	
 	if (m_accuracy >= coarse_step) {
 		double confidence = 0.0;
 		if (num_coarse_scores > 1) {
@@ -140,28 +331,28 @@ SkewFinder::findSkew(BinaryImage const& image) const
 		return Skew(-best_coarse_angle, confidence - 1.0);
 	}
 	
+	thresholds.clear();
 	for (int i = min_reduction; i < m_fineReduction; ++i) {
-		fine_reduced.reduce(i == 0 ? 1 : 2);
+		thresholds.push_back(i == 0 ? 1 : 2);
 	}
+	fine_reduced.reduce(thresholds);
 	
-	if (m_coarseReduction != m_fineReduction) {
-		skewed = BinaryImage(fine_reduced.image().size());
-	}
+	BlackRuns const fine_runs(fine_reduced.image());
 	
 	// Fine binary search.
 	double angle_plus = best_coarse_angle + 0.5 * coarse_step;
 	double angle_minus = best_coarse_angle - 0.5 * coarse_step;
-	double score_plus = process(fine_reduced, skewed, angle_plus);
-	double score_minus = process(fine_reduced, skewed, angle_minus);
+	double score_plus = process(fine_runs, angle_plus);
+	double score_minus = process(fine_runs, angle_minus);
 	double const fine_score1 = score_plus;
 	double const fine_score2 = score_minus;
 	while (angle_plus - angle_minus > m_accuracy) {
 		if (score_plus > score_minus) {
 			angle_minus = 0.5 * (angle_plus + angle_minus);
-			score_minus = process(fine_reduced, skewed, angle_minus);
+			score_minus = process(fine_runs, angle_minus);
 		} else if (score_plus < score_minus) {
 			angle_plus = 0.5 * (angle_plus + angle_minus);
-			score_plus = process(fine_reduced, skewed, angle_plus);
+			score_plus = process(fine_runs, angle_plus);
 		} else {
 			// This protects us from unreasonably low m_accuracy.
 			break;
@@ -197,42 +388,20 @@ SkewFinder::findSkew(BinaryImage const& image) const
 }
 
 double
-SkewFinder::process(BinaryImage const& src, BinaryImage& dst, double const angle) const
+SkewFinder::shearedProjectionScore(BinaryImage const& image, double const shear)
 {
-	double const tg = tan(angle * constants::DEG2RAD);
-	double const x_center = 0.5 * dst.width();
-	vShearFromTo(src, dst, tg / m_resolutionRatio, x_center, WHITE);
-	return calcScore(dst);
+	if (image.isNull()) {
+		throw std::invalid_argument("SkewFinder: null image was provided");
+	}
+	
+	return BlackRuns(image).shearedProjectionScore(shear);
 }
 
 double
-SkewFinder::calcScore(BinaryImage const& image)
+SkewFinder::process(BlackRuns const& runs, double const angle) const
 {
-	int const width = image.width();
-	int const height = image.height();
-	uint32_t const* line = image.data();
-	int const wpl = image.wordsPerLine();
-	int const last_word_idx = (width - 1) >> 5;
-	uint32_t const last_word_mask = ~uint32_t(0) << (31 - ((width - 1) & 31));
-	
-	double score = 0.0;
-	int last_line_black_pixels = 0;
-	for (int y = 0; y < height; ++y, line += wpl) {
-		int num_black_pixels = 0;
-		int i = 0;
-		for (; i != last_word_idx; ++i) {
-			num_black_pixels += countNonZeroBits(line[i]);
-		}
-		num_black_pixels += countNonZeroBits(line[i] & last_word_mask);
-		
-		if (y != 0) {
-			double const diff = num_black_pixels - last_line_black_pixels;
-			score += diff * diff;
-		}
-		last_line_black_pixels = num_black_pixels;
-	}
-	
-	return score;
+	double const tg = tan(angle * constants::DEG2RAD);
+	return runs.shearedProjectionScore(tg / m_resolutionRatio);
 }
 
 } // namespace imageproc
@@ -136,14 +136,34 @@ public:
 	 * \brief Process the image and determine its skew.
 	 * \note If the image contains text columns at (slightly) different
 	 * angles, one of those angles will be found, with a lower confidence.
+	 * \note Coarse search angles are evaluated in parallel, using the
+	 * global thread pool.
 	 */
 	Skew findSkew(BinaryImage const& image) const;
+	
+	/**
+	 * \brief Scores a vertical shear of the image by its projection profile.
+	 *
+	 * This is the score findSkew() maximizes.  The result is the sum of
+	 * squared differences of black pixel counts of adjacent lines of
+	 * the image, as sheared by vShearFromTo() around its horizontal center.
+	 */
+	static double shearedProjectionScore(BinaryImage const& image, double shear);
 private:
+	class BlackRuns;
+	class AngleScorer;
+	struct AngleScore;
+	
 	static double const LOW_SCORE;
 	
-	double process(BinaryImage const& src, BinaryImage& dst, double angle) const;
+	/**
+	 * If the best coarse score exceeds the average coarse score by
+	 * less than this fraction, the fine search is skipped, as there
+	 * is no distinct peak to refine.
+	 */
+	static double const EARLY_EXIT_CONFIDENCE;
 	
-	static double calcScore(BinaryImage const& image);
+	double process(BlackRuns const& runs, double angle) const;
 	
 	double m_maxAngle;
 	double m_accuracy;
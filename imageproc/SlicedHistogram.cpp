@@ -20,11 +20,43 @@
 #include "BinaryImage.h"
 #include "BitOps.h"
 #include <QRect>
+#include <vector>
+#include <algorithm>
 #include <stdexcept>
+#include <stdint.h>
 
 namespace imageproc
 {
 
+namespace
+{
+
+/**
+ * For every byte value, has a 64-bit word with the bits of that byte
+ * spread into 8-bit lanes.  The most significant bit of the byte goes
+ * to the least significant lane.
+ */
+struct ByteLanes
+{
+	uint64_t spread[256];
+	
+	ByteLanes() {
+		for (int byte = 0; byte < 256; ++byte) {
+			uint64_t lanes = 0;
+			for (int bit = 0; bit < 8; ++bit) {
+				if (byte & (0x80 >> bit)) {
+					lanes |= uint64_t(1) << (bit * 8);
+				}
+			}
+			spread[byte] = lanes;
+		}
+	}
+};
+
+ByteLanes const s_byteLanes;
+
+} // anonymous namespace
+
 SlicedHistogram::SlicedHistogram()
 {
 }
@@ -80,13 +112,11 @@ SlicedHistogram::processHorizontalLines(BinaryImage const& image, QRect const& a
 			m_data.push_back(count);
 		}
 	} else {
+		int const num_inner_words = last_word_idx - first_word_idx - 1;
 		for (int y = top; y <= bottom; ++y, line += wpl) {
-			int idx = first_word_idx;
-			int count = countNonZeroBits(line[idx] & first_word_mask);
-			for (++idx; idx != last_word_idx; ++idx) {
-				count += countNonZeroBits(line[idx]);
-			}
-			count += countNonZeroBits(line[idx] & last_word_mask);
+			int count = countNonZeroBits(line[first_word_idx] & first_word_mask);
+			count += countNonZeroBits(line + first_word_idx + 1, num_inner_words);
+			count += countNonZeroBits(line[last_word_idx] & last_word_mask);
 			m_data.push_back(count);
 		}
 	}
@@ -95,21 +125,64 @@ SlicedHistogram::processHorizontalLines(BinaryImage const& image, QRect const& a
 void
 SlicedHistogram::processVerticalLines(BinaryImage const& image, QRect const& area)
 {
-	m_data.reserve(area.width());
+	int const width = area.width();
+	m_data.resize(width, 0);
+	if (width <= 0 || area.height() <= 0) {
+		return;
+	}
 	
-	int const right = area.right();
+	// The image is scanned line by line, not column by column.  Counters
+	// for 8 adjacent columns are packed into 8-bit lanes of a 64-bit word,
+	// so a byte of a line is accounted for by a single addition.  Before
+	// lanes can overflow, they are flushed into m_data.
+	int const num_lanes_words = (width + 7) >> 3;
+	std::vector<uint64_t> lanes(num_lanes_words, 0);
+	
+	int const left = area.left();
 	int const height = area.height();
 	int const wpl = image.wordsPerLine();
-	uint32_t const* const top_line = image.data() + area.top() * wpl;
+	int const last_word_idx = (area.right() >> 5);
+	uint32_t const* line = image.data() + area.top() * wpl;
 	
-	for (int x = area.left(); x <= right; ++x) {
-		uint32_t const* pword = top_line + (x >> 5);
-		int const least_significant_zeroes = 31 - (x & 31);
-		int count = 0;
-		for (int i = 0; i < height; ++i, pword += wpl) {
-			count += (*pword >> least_significant_zeroes) & 1;
+	for (int y = 0; y < height;) {
+		int const chunk_end = std::min(height, y + 255);
+		for (; y < chunk_end; ++y, line += wpl) {
+			uint64_t* plane = &lanes[0];
+			for (int x = 0; x < width; x += 32, plane += 4) {
+				// 32 pixels starting at left + x, the leftmost one in the MSB.
+				int const idx = (left + x) >> 5;
+				int const shift = (left + x) & 31;
+				uint32_t word = line[idx] << shift;
+				if (shift != 0 && idx < last_word_idx) {
+					word |= line[idx + 1] >> (32 - shift);
+				}
+				if (width - x < 32) {
+					word &= ~(~uint32_t(0) >> (width - x));
+				}
+				if (!word) {
+					continue;
+				}
+				plane[0] += s_byteLanes.spread[word >> 24];
+				if (x + 8 < width) {
+					plane[1] += s_byteLanes.spread[(word >> 16) & 0xff];
+				}
+				if (x + 16 < width) {
+					plane[2] += s_byteLanes.spread[(word >> 8) & 0xff];
+				}
+				if (x + 24 < width) {
+					plane[3] += s_byteLanes.spread[word & 0xff];
+				}
+			}
+		}
+		
+		for (int i = 0; i < num_lanes_words; ++i) {
+			uint64_t packed = lanes[i];
+			lanes[i] = 0;
+			int const end = std::min(8, width - i * 8);
+			for (int lane = 0; lane < end; ++lane, packed >>= 8) {
+				m_data[i * 8 + lane] += int(packed & 0xff);
+			}
 		}
-		m_data.push_back(count);
 	}
 }
 
@@ -0,0 +1,514 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "SpanBuffer.h"
+#include "BinaryImage.h"
+#include <QImage>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <string.h>
+#include <assert.h>
+
+namespace imageproc
+{
+
+namespace
+{
+
+void fillBinarySegment(
+	int const x_from, int const x_to,
+	uint32_t* const line, uint32_t const pattern)
+{
+	if (x_from == x_to) {
+		return;
+	}
+	
+	uint32_t const full_mask = ~uint32_t(0);
+	uint32_t const first_word_mask = full_mask >> (x_from & 31);
+	uint32_t const last_word_mask = full_mask << (31 - ((x_to - 1) & 31));
+	int const first_word_idx = x_from >> 5;
+	int const last_word_idx = (x_to - 1) >> 5; // x_to is exclusive
+	
+	if (first_word_idx == last_word_idx) {
+		uint32_t const mask = first_word_mask & last_word_mask;
+		uint32_t& word = line[first_word_idx];
+		word = (word & ~mask) | (pattern & mask);
+		return;
+	}
+	
+	int i = first_word_idx;
+	
+	// First word.
+	uint32_t& first_word = line[i];
+	first_word = (first_word & ~first_word_mask) | (pattern & first_word_mask);
+	
+	// Middle words.
+	for (++i; i < last_word_idx; ++i) {
+		line[i] = pattern;
+	}
+	
+	// Last word.
+	uint32_t& last_word = line[i];
+	last_word = (last_word & ~last_word_mask) | (pattern & last_word_mask);
+}
+
+/**
+ * A pixel belongs to a binary shape if it's covered by at least a half.
+ */
+inline bool isSolid(SpanBuffer::Span const& span)
+{
+	return span.coverage >= 128;
+}
+
+inline unsigned blendChannel(unsigned dst, unsigned src, unsigned alpha)
+{
+	return (dst * (255 - alpha) + src * alpha + 127) / 255;
+}
+
+inline void blendGraySpan(
+	uint8_t* const line, SpanBuffer::Span const& span, uint8_t const gray)
+{
+	unsigned const alpha = span.coverage;
+	if (alpha == 255) {
+		memset(line + span.begin, gray, span.end - span.begin);
+		return;
+	}
+	for (int x = span.begin; x < span.end; ++x) {
+		line[x] = static_cast<uint8_t>(blendChannel(line[x], gray, alpha));
+	}
+}
+
+/**
+ * The fill color is treated as opaque.
+ */
+void blendRgbSpan(
+	QRgb* const line, SpanBuffer::Span const& span, QRgb const color,
+	QImage::Format const format)
+{
+	unsigned const alpha = span.coverage;
+	if (alpha == 255) {
+		std::fill(line + span.begin, line + span.end, color | 0xff000000);
+		return;
+	}
+	
+	bool const premultiplied = format == QImage::Format_ARGB32_Premultiplied;
+	bool const opaque = format == QImage::Format_RGB32;
+	
+	for (int x = span.begin; x < span.end; ++x) {
+		QRgb const dst = line[x];
+		unsigned const dst_alpha = opaque ? 255 : qAlpha(dst);
+		if (premultiplied || dst_alpha == 255) {
+			line[x] = qRgba(
+				blendChannel(qRed(dst), qRed(color), alpha),
+				blendChannel(qGreen(dst), qGreen(color), alpha),
+				blendChannel(qBlue(dst), qBlue(color), alpha),
+				blendChannel(dst_alpha, 255, alpha)
+			);
+		} else {
+			// Non-premultiplied translucent destination.
+			unsigned const dst_weight = dst_alpha * (255 - alpha) / 255;
+			unsigned const res_alpha = alpha + dst_weight;
+			line[x] = qRgba(
+				(qRed(color) * alpha + qRed(dst) * dst_weight) / res_alpha,
+				(qGreen(color) * alpha + qGreen(dst) * dst_weight) / res_alpha,
+				(qBlue(color) * alpha + qBlue(dst) * dst_weight) / res_alpha,
+				res_alpha
+			);
+		}
+	}
+}
+
+void fillMonoSpan(
+	uint8_t* const line, SpanBuffer::Span const& span,
+	int const color_idx, bool const lsb)
+{
+	for (int x = span.begin; x < span.end; ++x) {
+		uint8_t const mask = lsb ? (1 << (x & 7)) : (0x80 >> (x & 7));
+		if (color_idx) {
+			line[x >> 3] |= mask;
+		} else {
+			line[x >> 3] &= ~mask;
+		}
+	}
+}
+
+} // anonymous namespace
+
+
+class SpanBuffer::UniteOp
+{
+public:
+	uint8_t operator()(uint8_t lhs, uint8_t rhs) const {
+		return std::max(lhs, rhs);
+	}
+};
+
+
+class SpanBuffer::IntersectOp
+{
+public:
+	uint8_t operator()(uint8_t lhs, uint8_t rhs) const {
+		return std::min(lhs, rhs);
+	}
+};
+
+
+class SpanBuffer::SubtractOp
+{
+public:
+	uint8_t operator()(uint8_t lhs, uint8_t rhs) const {
+		return std::min<uint8_t>(lhs, 255 - rhs);
+	}
+};
+
+
+SpanBuffer::SpanBuffer()
+:	m_lastRow(-1)
+{
+}
+
+SpanBuffer::SpanBuffer(QSize const& size)
+:	m_rowOffsets(std::max(size.height(), 0), 0),
+	m_size(size),
+	m_lastRow(-1)
+{
+}
+
+QRect
+SpanBuffer::boundingRect() const
+{
+	int left = std::numeric_limits<int>::max();
+	int right = std::numeric_limits<int>::min();
+	int top = -1;
+	int bottom = -1;
+	
+	for (int y = 0; y <= m_lastRow; ++y) {
+		Span const* const begin = rowBegin(y);
+		Span const* const end = rowEnd(y);
+		if (begin == end) {
+			continue;
+		}
+		if (top == -1) {
+			top = y;
+		}
+		bottom = y;
+		left = std::min(left, begin->begin);
+		right = std::max(right, end[-1].end);
+	}
+	
+	if (top == -1) {
+		return QRect();
+	}
+	
+	return QRect(left, top, right - left, bottom - top + 1);
+}
+
+void
+SpanBuffer::append(int const y, Span const& span)
+{
+	if (y < 0 || y < m_lastRow || y >= m_size.height()) {
+		throw std::invalid_argument("SpanBuffer: row out of order or out of range");
+	}
+	
+	int const begin = std::max(span.begin, 0);
+	int const end = std::min(span.end, m_size.width());
+	if (begin >= end || span.coverage == 0) {
+		return;
+	}
+	
+	for (; m_lastRow < y; ++m_lastRow) {
+		m_rowOffsets[m_lastRow + 1] = m_spans.size();
+	}
+	
+	if ((int)m_spans.size() > m_rowOffsets[y]) {
+		Span& last = m_spans.back();
+		assert(begin >= last.end);
+		if (last.end == begin && last.coverage == span.coverage) {
+			last.end = end;
+			return;
+		}
+	}
+	
+	m_spans.push_back(Span(begin, end, span.coverage));
+}
+
+SpanBuffer
+SpanBuffer::inverted() const
+{
+	SpanBuffer res(m_size);
+	int const width = m_size.width();
+	int const height = m_size.height();
+	
+	for (int y = 0; y < height; ++y) {
+		int x = 0;
+		for (Span const* span = rowBegin(y); span != rowEnd(y); ++span) {
+			if (span->begin > x) {
+				res.append(y, Span(x, span->begin));
+			}
+			if (span->coverage != 255) {
+				res.append(y, Span(span->begin, span->end, 255 - span->coverage));
+			}
+			x = span->end;
+		}
+		if (x < width) {
+			res.append(y, Span(x, width));
+		}
+	}
+	
+	return res;
+}
+
+SpanBuffer
+SpanBuffer::unite(SpanBuffer const& lhs, SpanBuffer const& rhs)
+{
+	return combine(lhs, rhs, UniteOp());
+}
+
+SpanBuffer
+SpanBuffer::intersect(SpanBuffer const& lhs, SpanBuffer const& rhs)
+{
+	return combine(lhs, rhs, IntersectOp());
+}
+
+SpanBuffer
+SpanBuffer::subtract(SpanBuffer const& lhs, SpanBuffer const& rhs)
+{
+	return combine(lhs, rhs, SubtractOp());
+}
+
+template<typename Op>
+SpanBuffer
+SpanBuffer::combine(SpanBuffer const& lhs, SpanBuffer const& rhs, Op op)
+{
+	if (lhs.size() != rhs.size()) {
+		throw std::invalid_argument("SpanBuffer: can't combine buffers of different sizes");
+	}
+	
+	SpanBuffer res(lhs.size());
+	int const height = lhs.size().height();
+	int const none = std::numeric_limits<int>::max();
+	
+	for (int y = 0; y < height; ++y) {
+		Span const* l = lhs.rowBegin(y);
+		Span const* const l_end = lhs.rowEnd(y);
+		Span const* r = rhs.rowBegin(y);
+		Span const* const r_end = rhs.rowEnd(y);
+		
+		int x = 0;
+		while (l != l_end || r != r_end) {
+			// The coverage at x and the position where it may change.
+			uint8_t l_cov = 0;
+			int l_next = none;
+			if (l != l_end) {
+				if (x < l->begin) {
+					l_next = l->begin;
+				} else {
+					l_cov = l->coverage;
+					l_next = l->end;
+				}
+			}
+			
+			uint8_t r_cov = 0;
+			int r_next = none;
+			if (r != r_end) {
+				if (x < r->begin) {
+					r_next = r->begin;
+				} else {
+					r_cov = r->coverage;
+					r_next = r->end;
+				}
+			}
+			
+			int const next = std::min(l_next, r_next);
+			res.append(y, Span(x, next, op(l_cov, r_cov)));
+			x = next;
+			
+			if (l != l_end && x >= l->end) {
+				++l;
+			}
+			if (r != r_end && x >= r->end) {
+				++r;
+			}
+		}
+	}
+	
+	return res;
+}
+
+void
+SpanBuffer::fill(BinaryImage& image, BWColor const color) const
+{
+	if (image.size() != m_size) {
+		throw std::invalid_argument("SpanBuffer: image size mismatch");
+	}
+	
+	uint32_t* line = image.data();
+	int const wpl = image.wordsPerLine();
+	uint32_t const pattern = (color == WHITE) ? 0 : ~uint32_t(0);
+	
+	for (int y = 0; y <= m_lastRow; ++y, line += wpl) {
+		for (Span const* span = rowBegin(y); span != rowEnd(y); ++span) {
+			if (isSolid(*span)) {
+				fillBinarySegment(span->begin, span->end, line, pattern);
+			}
+		}
+	}
+}
+
+void
+SpanBuffer::fillExcept(BinaryImage& image, BWColor const color) const
+{
+	if (image.size() != m_size) {
+		throw std::invalid_argument("SpanBuffer: image size mismatch");
+	}
+	
+	uint32_t* line = image.data();
+	int const wpl = image.wordsPerLine();
+	uint32_t const pattern = (color == WHITE) ? 0 : ~uint32_t(0);
+	int const width = m_size.width();
+	int const height = m_size.height();
+	
+	for (int y = 0; y < height; ++y, line += wpl) {
+		int x = 0;
+		for (Span const* span = rowBegin(y); span != rowEnd(y); ++span) {
+			if (isSolid(*span)) {
+				fillBinarySegment(x, std::max(x, span->begin), line, pattern);
+				x = span->end;
+			}
+		}
+		fillBinarySegment(x, width, line, pattern);
+	}
+}
+
+void
+SpanBuffer::grayFill(QImage& image, uint8_t const color) const
+{
+	if (image.size() != m_size) {
+		throw std::invalid_argument("SpanBuffer: image size mismatch");
+	}
+	if (image.format() != QImage::Format_Indexed8 || !image.isGrayscale()) {
+		throw std::invalid_argument("SpanBuffer: target image is not grayscale");
+	}
+	
+	uint8_t* line = image.bits();
+	int const bpl = image.bytesPerLine();
+	
+	for (int y = 0; y <= m_lastRow; ++y, line += bpl) {
+		for (Span const* span = rowBegin(y); span != rowEnd(y); ++span) {
+			if (isSolid(*span)) {
+				memset(line + span->begin, color, span->end - span->begin);
+			}
+		}
+	}
+}
+
+bool
+SpanBuffer::canBlend(QImage const& image)
+{
+	switch (image.format()) {
+		case QImage::Format_Indexed8:
+			return image.isGrayscale();
+		case QImage::Format_RGB32:
+		case QImage::Format_ARGB32:
+		case QImage::Format_ARGB32_Premultiplied:
+			return true;
+		case QImage::Format_Mono:
+		case QImage::Format_MonoLSB:
+			return image.numColors() == 2;
+		default:
+			return false;
+	}
+}
+
+void
+SpanBuffer::blend(QImage& image, QRgb const color) const
+{
+	if (image.size() != m_size) {
+		throw std::invalid_argument("SpanBuffer: image size mismatch");
+	}
+	if (!canBlend(image)) {
+		throw std::invalid_argument("SpanBuffer: can't blend into this image format");
+	}
+	
+	QImage::Format const format = image.format();
+	uint8_t* line = image.bits();
+	int const bpl = image.bytesPerLine();
+	
+	if (format == QImage::Format_Indexed8) {
+		uint8_t const gray = qGray(color);
+		for (int y = 0; y <= m_lastRow; ++y, line += bpl) {
+			for (Span const* span = rowBegin(y); span != rowEnd(y); ++span) {
+				blendGraySpan(line, *span, gray);
+			}
+		}
+	} else if (format == QImage::Format_Mono || format == QImage::Format_MonoLSB) {
+		// The color table entry closest to the fill color.
+		int const gray = qGray(color);
+		int const idx = qAbs(qGray(image.color(1)) - gray)
+			< qAbs(qGray(image.color(0)) - gray);
+		bool const lsb = format == QImage::Format_MonoLSB;
+		for (int y = 0; y <= m_lastRow; ++y, line += bpl) {
+			for (Span const* span = rowBegin(y); span != rowEnd(y); ++span) {
+				if (isSolid(*span)) {
+					fillMonoSpan(line, *span, idx, lsb);
+				}
+			}
+		}
+	} else {
+		for (int y = 0; y <= m_lastRow; ++y, line += bpl) {
+			for (Span const* span = rowBegin(y); span != rowEnd(y); ++span) {
+				blendRgbSpan((QRgb*)line, *span, color, format);
+			}
+		}
+	}
+}
+
+void
+SpanBuffer::grayFillExcept(QImage& image, uint8_t const color) const
+{
+	if (image.size() != m_size) {
+		throw std::invalid_argument("SpanBuffer: image size mismatch");
+	}
+	if (image.format() != QImage::Format_Indexed8 || !image.isGrayscale()) {
+		throw std::invalid_argument("SpanBuffer: target image is not grayscale");
+	}
+	
+	uint8_t* line = image.bits();
+	int const bpl = image.bytesPerLine();
+	int const width = m_size.width();
+	int const height = m_size.height();
+	
+	for (int y = 0; y < height; ++y, line += bpl) {
+		int x = 0;
+		for (Span const* span = rowBegin(y); span != rowEnd(y); ++span) {
+			if (isSolid(*span)) {
+				if (span->begin > x) {
+					memset(line + x, color, span->begin - x);
+				}
+				x = span->end;
+			}
+		}
+		if (width > x) {
+			memset(line + x, color, width - x);
+		}
+	}
+}
+
+} // namespace imageproc
@@ -0,0 +1,173 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGEPROC_SPANBUFFER_H_
+#define IMAGEPROC_SPANBUFFER_H_
+
+#include "BWColor.h"
+#include <QSize>
+#include <QRect>
+#include <QColor>
+#include <vector>
+#include <stdint.h>
+
+class QImage;
+
+namespace imageproc
+{
+
+class BinaryImage;
+
+/**
+ * \brief A rasterized shape, stored as horizontal runs of pixels.
+ *
+ * Each row holds a sorted set of non-overlapping spans.  Every span
+ * carries an 8-bit coverage value, 255 meaning the pixels are fully inside
+ * the shape.  Spans produced without antialiasing are always fully covered.
+ * A span buffer may be applied to any number of images of the same size,
+ * and may be combined with other span buffers using boolean operations.
+ */
+class SpanBuffer
+{
+public:
+	struct Span
+	{
+		int begin; /**< The first pixel of the span. */
+		int end; /**< One past the last pixel of the span. */
+		uint8_t coverage;
+		
+		Span(int b, int e, uint8_t cov = 255) : begin(b), end(e), coverage(cov) {}
+	};
+	
+	/**
+	 * \brief Constructs a null span buffer.
+	 */
+	SpanBuffer();
+	
+	/**
+	 * \brief Constructs an empty span buffer for an image of the given size.
+	 */
+	explicit SpanBuffer(QSize const& size);
+	
+	bool isNull() const { return m_size.isEmpty(); }
+	
+	QSize const& size() const { return m_size; }
+	
+	/**
+	 * \brief Returns true if there are no spans in any of the rows.
+	 */
+	bool isEmpty() const { return m_spans.empty(); }
+	
+	/**
+	 * \brief Returns the bounding box of all spans.
+	 */
+	QRect boundingRect() const;
+	
+	Span const* rowBegin(int y) const { return spansData() + rowOffset(y); }
+	
+	Span const* rowEnd(int y) const { return spansData() + rowOffset(y + 1); }
+	
+	/**
+	 * \brief Appends a span to the buffer.
+	 *
+	 * Spans have to be appended in order: row by row, and left to right
+	 * within a row.  Spans may touch the previous one but must not overlap it.
+	 * Spans are clipped to the image width, and touching spans of the same
+	 * coverage are merged.  Empty and zero-coverage spans are ignored.
+	 */
+	void append(int y, Span const& span);
+	
+	/**
+	 * \brief Returns the complement of this span buffer.
+	 *
+	 * Gaps become fully covered spans, and partial coverage gets inverted.
+	 */
+	SpanBuffer inverted() const;
+	
+	static SpanBuffer unite(SpanBuffer const& lhs, SpanBuffer const& rhs);
+	
+	static SpanBuffer intersect(SpanBuffer const& lhs, SpanBuffer const& rhs);
+	
+	static SpanBuffer subtract(SpanBuffer const& lhs, SpanBuffer const& rhs);
+	
+	/**
+	 * \brief Fills pixels covered by at least a half with the given color.
+	 */
+	void fill(BinaryImage& image, BWColor color) const;
+	
+	/**
+	 * \brief Fills pixels covered by less than a half with the given color.
+	 *
+	 * Only the words between the spans are written to.
+	 */
+	void fillExcept(BinaryImage& image, BWColor color) const;
+	
+	/**
+	 * \brief Same as fill(), but for grayscale images.
+	 */
+	void grayFill(QImage& image, uint8_t color) const;
+	
+	/**
+	 * \brief Same as fillExcept(), but for grayscale images.
+	 */
+	void grayFillExcept(QImage& image, uint8_t color) const;
+	
+	/**
+	 * \brief Returns true if blend() supports the format of the image.
+	 */
+	static bool canBlend(QImage const& image);
+	
+	/**
+	 * \brief Blends an opaque color into the image, weighted by coverage.
+	 *
+	 * Supported formats are grayscale Indexed8, RGB32, ARGB32 and
+	 * ARGB32_Premultiplied.  Mono and MonoLSB images with two colors are
+	 * supported too: pixels covered by at least a half get the color table
+	 * entry closest to \p color.
+	 */
+	void blend(QImage& image, QRgb color) const;
+private:
+	class UniteOp;
+	class IntersectOp;
+	class SubtractOp;
+	
+	template<typename Op>
+	static SpanBuffer combine(SpanBuffer const& lhs, SpanBuffer const& rhs, Op op);
+	
+	Span const* spansData() const { return m_spans.empty() ? 0 : &m_spans[0]; }
+	
+	int rowOffset(int y) const {
+		return y <= m_lastRow ? m_rowOffsets[y] : (int)m_spans.size();
+	}
+	
+	std::vector<Span> m_spans;
+	
+	/**
+	 * m_rowOffsets[y] is the index of the first span of row y in m_spans.
+	 * Only the entries up to m_lastRow are valid, the following rows
+	 * being empty.
+	 */
+	std::vector<int> m_rowOffsets;
+	QSize m_size;
+	int m_lastRow;
+};
+
+} // namespace imageproc
+
+#endif
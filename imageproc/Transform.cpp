@@ -19,6 +19,7 @@
 #include "Scale.h"
 #include "Grayscale.h"
 #include "GrayImage.h"
+#include "TaskStatus.h"
 #include <QImage>
 #include <QRect>
 #include <QSizeF>
@@ -162,7 +163,8 @@ static void transformGeneric(
 	StorageUnit const* const src_data, int const src_stride, QSize const src_size,
 	StorageUnit* const dst_data, int const dst_stride, QTransform const& xform,
 	QRect const& dst_rect, StorageUnit const background_color,
-	bool const weak_background, QSizeF const& min_mapping_area)
+	bool const weak_background, QSizeF const& min_mapping_area,
+	TaskStatus const* const status)
 {
 	int const sw = src_size.width();
 	int const sh = src_size.height();
@@ -183,7 +185,11 @@ static void transformGeneric(
 	int const src32_unit_w = std::max<int>(1, qRound(src32_unit_size.width()));
 	int const src32_unit_h = std::max<int>(1, qRound(src32_unit_size.height()));
 	
+	TaskStatusPoller poller(status);
+
 	for (int dy = 0; dy < dh; ++dy, dst_line += dst_stride) {
+		poller.poll();
+
 		double const f_dy_center = dy + 0.5;
 		double const f_sx32_base = f_dy_center * inv_xform.m21() + inv_xform.dx();
 		double const f_sy32_base = f_dy_center * inv_xform.m22() + inv_xform.dy();
@@ -385,7 +391,8 @@ static void transformGeneric(
 QImage transform(
 	QImage const& src, QTransform const& xform,
 	QRect const& dst_rect, QColor const& background_color,
-	bool const weak_background, QSizeF const& min_mapping_area)
+	bool const weak_background, QSizeF const& min_mapping_area,
+	TaskStatus const* const status)
 {
 	if (src.isNull() || dst_rect.isEmpty()) {
 		return QImage();
@@ -408,7 +415,7 @@ QImage transform(
 			gray_src.data(), gray_src.stride(), src.size(),
 			gray_dst.data(), gray_dst.stride(), xform, dst_rect,
 			qGray(background_color.rgb()),
-			weak_background, min_mapping_area
+			weak_background, min_mapping_area, status
 		);
 		return gray_dst;
 	} else {
@@ -418,7 +425,7 @@ QImage transform(
 			transformGeneric<uint32_t, ARGB32>(
 				(uint32_t const*)src_argb32.bits(), src_argb32.bytesPerLine() / 4, src_argb32.size(),
 				(uint32_t*)dst.bits(), dst.bytesPerLine() / 4, xform, dst_rect,
-				background_color.rgba(), weak_background, min_mapping_area
+				background_color.rgba(), weak_background, min_mapping_area, status
 			);
 			return dst;
 		} else {
@@ -427,7 +434,7 @@ QImage transform(
 			transformGeneric<uint32_t, RGB32>(
 				(uint32_t const*)src_rgb32.bits(), src_rgb32.bytesPerLine() / 4, src_rgb32.size(),
 				(uint32_t*)dst.bits(), dst.bytesPerLine() / 4, xform, dst_rect,
-				background_color.rgb(), weak_background, min_mapping_area
+				background_color.rgb(), weak_background, min_mapping_area, status
 			);
 			return dst;
 		}
@@ -437,7 +444,8 @@ QImage transform(
 GrayImage transformToGray(
 	QImage const& src, QTransform const& xform,
 	QRect const& dst_rect, QColor const& background_color,
-	bool const weak_background, QSizeF const& min_mapping_area)
+	bool const weak_background, QSizeF const& min_mapping_area,
+	TaskStatus const* const status)
 {
 	if (src.isNull() || dst_rect.isEmpty()) {
 		return GrayImage();
@@ -458,7 +466,7 @@ GrayImage transformToGray(
 		gray_src.data(), gray_src.stride(), gray_src.size(),
 		dst.data(), dst.stride(), xform, dst_rect,
 		qGray(background_color.rgb()),
-		weak_background, min_mapping_area
+		weak_background, min_mapping_area, status
 	);
 	
 	return dst;
@@ -25,6 +25,7 @@ class QImage;
 class QRect;
 class QTransform;
 class QColor;
+class TaskStatus;
 
 namespace imageproc
 {
@@ -50,6 +51,8 @@ class GrayImage;
  * \param min_mapping_area Defines the minimum rectangle in the source image
  *        that maps to a destination pixel.  This can be used to control
  *        smoothing.
+ * \param status If provided, it's polled every few lines, and the
+ *        transformation stops with an exception if it gets cancelled.
  * \return The transformed image.  It's format may differ from the
  *         source image format, for example Format_Indexed8 may
  *         be transformed to Format_RGB32, if the source image
@@ -59,7 +62,8 @@ QImage transform(
 	QImage const& src, QTransform const& xform,
 	QRect const& dst_rect, QColor const& background_color,
 	bool weak_background = false,
-	QSizeF const& min_mapping_area = QSizeF(0.9, 0.9));
+	QSizeF const& min_mapping_area = QSizeF(0.9, 0.9),
+	TaskStatus const* status = 0);
 
 /**
  * \brief Apply an affine transformation to the image.
@@ -71,7 +75,8 @@ GrayImage transformToGray(
 	QImage const& src, QTransform const& xform,
 	QRect const& dst_rect, QColor const& background_color,
 	bool weak_background = false,
-	QSizeF const& min_mapping_area = QSizeF(0.9, 0.9));
+	QSizeF const& min_mapping_area = QSizeF(0.9, 0.9),
+	TaskStatus const* status = 0);
 
 } // namespace imageproc
 
@@ -18,8 +18,12 @@
 
 #include "BinaryImage.h"
 #include "BWColor.h"
+#include "ImageStorage.h"
 #include "Utils.h"
 #include <QImage>
+#include <QColor>
+#include <QRect>
+#include <QPoint>
 #include <boost/test/auto_unit_test.hpp>
 #include <stdlib.h>
 
@@ -31,6 +35,35 @@ namespace tests
 
 using namespace utils;
 
+/**
+ * The bit-by-bit thresholding, kept as a reference for the vectorized one.
+ */
+static BinaryImage referenceThreshold(
+	QImage const& image, QRect const& rect, int const threshold)
+{
+	BinaryImage dst(rect.size(), WHITE);
+	uint32_t* dst_line = dst.data();
+	for (int y = rect.top(); y <= rect.bottom(); ++y) {
+		for (int x = rect.left(); x <= rect.right(); ++x) {
+			QRgb const c = image.pixel(x, y);
+			bool black = false;
+			if (image.format() == QImage::Format_ARGB32_Premultiplied) {
+				QRgb const pm = reinterpret_cast<QRgb const*>(image.scanLine(y))[x];
+				int const sum = qRed(pm)*(255*11) + qGreen(pm)*(255*16) + qBlue(pm)*(255*5);
+				black = qAlpha(pm) == 0 || sum < qAlpha(pm) * threshold * 32;
+			} else {
+				black = qGray(c) < threshold;
+			}
+			if (black) {
+				int const dx = x - rect.left();
+				dst_line[dx >> 5] |= uint32_t(0x80000000) >> (dx & 31);
+			}
+		}
+		dst_line += dst.wordsPerLine();
+	}
+	return dst;
+}
+
 BOOST_AUTO_TEST_SUITE(BinaryImageTestSuite);
 
 BOOST_AUTO_TEST_CASE(test_null_image)
@@ -73,6 +106,39 @@ BOOST_AUTO_TEST_CASE(test_from_to_qimage)
 	//BOOST_CHECK(BinaryImage(qimg_rgb16, 0x80).toQImage() == qimg_mono);
 }
 
+BOOST_AUTO_TEST_CASE(test_thresholding_matches_reference)
+{
+	int const w = 131;
+	int const h = 9;
+	QImage argb32(w, h, QImage::Format_ARGB32);
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			argb32.setPixel(x, y, qRgba(rand() & 0xff, rand() & 0xff, rand() & 0xff, rand() & 0xff));
+		}
+	}
+	
+	QImage images[] = {
+		argb32,
+		argb32.convertToFormat(QImage::Format_RGB32),
+		argb32.convertToFormat(QImage::Format_ARGB32_Premultiplied),
+		argb32.convertToFormat(QImage::Format_Indexed8),
+		randomGrayImage(w, h)
+	};
+	int const thresholds[] = { 0, 1, 100, 128, 255, 256 };
+	QRect const rects[] = { argb32.rect(), QRect(3, 1, 97, 5) };
+	
+	for (unsigned i = 0; i < sizeof(images) / sizeof(images[0]); ++i) {
+		for (unsigned t = 0; t < sizeof(thresholds) / sizeof(thresholds[0]); ++t) {
+			for (unsigned r = 0; r < sizeof(rects) / sizeof(rects[0]); ++r) {
+				BOOST_CHECK(
+					BinaryImage(images[i], rects[r], BinaryThreshold(thresholds[t]))
+					== referenceThreshold(images[i], rects[r], thresholds[t])
+				);
+			}
+		}
+	}
+}
+
 BOOST_AUTO_TEST_CASE(test_full_fill)
 {
 	BinaryImage white(100, 100);
@@ -159,6 +225,66 @@ BOOST_AUTO_TEST_CASE(test_content_bounding_box4)
 	BOOST_CHECK(img.contentBoundingBox() == QRect(1, 1, 6, 6));
 }
 
+BOOST_AUTO_TEST_CASE(test_file_backed_storage)
+{
+	size_t const orig_threshold = ImageStorage::mappingThreshold();
+	ImageStorage::setMappingThreshold(1);
+	
+	int const w = 70;
+	int const h = 40;
+	QImage qimg(w, h, QImage::Format_Mono);
+	qimg.setNumColors(2);
+	qimg.setColor(0, 0xffffffff);
+	qimg.setColor(1, 0xff000000);
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			qimg.setPixel(x, y, rand() & 1);
+		}
+	}
+	
+	BinaryImage const img(qimg);
+	BinaryImage copy(img);
+	copy.fill(BLACK);
+	BOOST_CHECK(img.toQImage() == qimg);
+	BOOST_CHECK(copy.countBlackPixels() == w * h);
+	
+	ImageStorage::setMappingThreshold(orig_threshold);
+}
+
+BOOST_AUTO_TEST_CASE(test_paste_into_keeps_dpi)
+{
+	int const w = 70;
+	int const h = 40;
+	QImage const orig(randomMonoQImage(w, h));
+	
+	// Inverted color table, to make sure black goes to the darker entry.
+	QImage dst(orig.convertToFormat(QImage::Format_MonoLSB));
+	dst.setColor(0, 0xff000000);
+	dst.setColor(1, 0xffffffff);
+	dst.invertPixels();
+	dst.setDotsPerMeterX(11811);
+	dst.setDotsPerMeterY(23622);
+	
+	// Partially outside of dst.
+	QPoint const pos(50, 10);
+	BinaryImage const patch(randomBinaryImage(30, 20));
+	patch.pasteInto(dst, pos);
+	
+	BOOST_CHECK(dst.format() == QImage::Format_MonoLSB);
+	BOOST_CHECK(dst.dotsPerMeterX() == 11811);
+	BOOST_CHECK(dst.dotsPerMeterY() == 23622);
+	
+	QImage const patch_qimg(patch.toQImage());
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			QPoint const src_pt(QPoint(x, y) - pos);
+			QRgb const expected = patch_qimg.rect().contains(src_pt)
+				? patch_qimg.pixel(src_pt) : orig.pixel(x, y);
+			BOOST_REQUIRE(dst.pixel(x, y) == expected);
+		}
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
@@ -0,0 +1,223 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "GaussBlur.h"
+#include "GrayImage.h"
+#include "Grayscale.h"
+#include "Constants.h"
+#include <QImage>
+#include <QSize>
+#include <boost/test/auto_unit_test.hpp>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+namespace imageproc
+{
+
+namespace tests
+{
+
+BOOST_AUTO_TEST_SUITE(GaussBlurTestSuite);
+
+/**
+ * The straightforward double precision implementation gaussBlurGray()
+ * used to be, processing one column or line at a time.
+ */
+namespace reference
+{
+
+static void findIirConstants(
+	double* n_p, double *n_m, double *d_p,
+	double* d_m, double *bd_p, double *bd_m, double std_dev)
+{
+	double const div = sqrt(2.0 * constants::PI) * std_dev;
+	double const x0 = -1.783 / std_dev;
+	double const x1 = -1.723 / std_dev;
+	double const x2 = 0.6318 / std_dev;
+	double const x3 = 1.997  / std_dev;
+	double const x4 = 1.6803 / div;
+	double const x5 = 3.735 / div;
+	double const x6 = -0.6803 / div;
+	double const x7 = -0.2598 / div;
+	
+	n_p[0] = x4 + x6;
+	n_p[1] = (exp(x1)*(x7*sin(x3)-(x6+2*x4)*cos(x3)) +
+		exp(x0)*(x5*sin(x2) - (2*x6+x4)*cos (x2)));
+	n_p[2] = (2 * exp(x0+x1) *
+		((x4+x6)*cos(x3)*cos(x2) - x5*cos(x3)*sin(x2) -
+		x7*cos(x2)*sin(x3)) +
+		x6*exp(2*x0) + x4*exp(2*x1));
+	n_p[3] = (exp(x1+2*x0) * (x7*sin(x3) - x6*cos(x3)) +
+		exp(x0+2*x1) * (x5*sin(x2) - x4*cos(x2)));
+	n_p[4] = 0.0;
+	
+	d_p[0] = 0.0;
+	d_p[1] = -2 * exp(x1) * cos(x3) -  2 * exp(x0) * cos (x2);
+	d_p[2] = 4 * cos(x3) * cos(x2) * exp(x0 + x1) +  exp(2 * x1) + exp(2 * x0);
+	d_p[3] = -2 * cos(x2) * exp(x0 + 2*x1) -  2*cos(x3) * exp(x1 + 2*x0);
+	d_p[4] = exp(2*x0 + 2*x1);
+	
+	for (int i = 0; i <= 4; i++) {
+		d_m[i] = d_p[i];
+	}
+	
+	n_m[0] = 0.0;
+	for (int i = 1; i <= 4; i++) {
+		n_m[i] = n_p[i] - d_p[i] * n_p[0];
+	}
+	
+	double sum_n_p = 0.0;
+	double sum_n_m = 0.0;
+	double sum_d = 0.0;
+	for (int i = 0; i <= 4; i++) {
+		sum_n_p += n_p[i];
+		sum_n_m += n_m[i];
+		sum_d += d_p[i];
+	}
+	
+	double const a = sum_n_p / (1.0 + sum_d);
+	double const b = sum_n_m / (1.0 + sum_d);
+	for (int i = 0; i <= 4; i++) {
+		bd_p[i] = d_p[i] * a;
+		bd_m[i] = d_m[i] * b;
+	}
+}
+
+/**
+ * Filters \p count samples spaced by \p step, writing the result back.
+ */
+static void filterSequence(
+	uint8_t* data, int const step, int const count,
+	double const* n_p, double const* n_m, double const* d_p,
+	double const* d_m, double const* bd_p, double const* bd_m)
+{
+	std::vector<double> val_p(count, 0.0);
+	std::vector<double> val_m(count, 0.0);
+	std::vector<int> src(count);
+	for (int i = 0; i < count; ++i) {
+		src[i] = data[i * step];
+	}
+	
+	for (int k = 0; k < count; ++k) {
+		int const km = count - 1 - k;
+		int const terms = std::min(k, 4);
+		int i = 0;
+		for (; i <= terms; ++i) {
+			val_p[k] += n_p[i] * src[k - i] - d_p[i] * val_p[k - i];
+			val_m[km] += n_m[i] * src[km + i] - d_m[i] * val_m[km + i];
+		}
+		for (; i <= 4; ++i) {
+			val_p[k] += (n_p[i] - bd_p[i]) * src[0];
+			val_m[km] += (n_m[i] - bd_m[i]) * src[count - 1];
+		}
+	}
+	
+	for (int i = 0; i < count; ++i) {
+		int const sum = (int)floor(val_p[i] + val_m[i] + 0.5);
+		data[i * step] = (uint8_t)std::max(0, std::min(sum, 255));
+	}
+}
+
+static GrayImage gaussBlurGray(GrayImage const& src, double radius)
+{
+	if (radius < 1.0) {
+		radius = 1.0;
+	}
+	radius += 1.0;
+	double const std_dev = sqrt((radius * radius) / (-2.0 * log(1.0 / 255.0)));
+	
+	double n_p[5], n_m[5], d_p[5], d_m[5], bd_p[5], bd_m[5];
+	findIirConstants(n_p, n_m, d_p, d_m, bd_p, bd_m, std_dev);
+	
+	GrayImage dst(src);
+	uint8_t* const data = dst.data();
+	int const stride = dst.stride();
+	
+	for (int x = 0; x < dst.width(); ++x) {
+		filterSequence(data + x, stride, dst.height(), n_p, n_m, d_p, d_m, bd_p, bd_m);
+	}
+	for (int y = 0; y < dst.height(); ++y) {
+		filterSequence(data + y * stride, 1, dst.width(), n_p, n_m, d_p, d_m, bd_p, bd_m);
+	}
+	
+	return dst;
+}
+
+} // namespace reference
+
+static GrayImage createTestImage(QSize const& size)
+{
+	GrayImage image(size);
+	uint8_t* line = image.data();
+	for (int y = 0; y < size.height(); ++y, line += image.stride()) {
+		for (int x = 0; x < size.width(); ++x) {
+			// Sharp edges with some noise on top.
+			int const base = ((x / 7 + y / 5) & 1) ? 220 : 30;
+			line[x] = (uint8_t)(base + rand() % 31 - 15);
+		}
+	}
+	return image;
+}
+
+static int maxDifference(GrayImage const& img1, GrayImage const& img2)
+{
+	int max_diff = 0;
+	for (int y = 0; y < img1.height(); ++y) {
+		uint8_t const* line1 = img1.data() + y * img1.stride();
+		uint8_t const* line2 = img2.data() + y * img2.stride();
+		for (int x = 0; x < img1.width(); ++x) {
+			max_diff = std::max(max_diff, abs(line1[x] - line2[x]));
+		}
+	}
+	return max_diff;
+}
+
+BOOST_AUTO_TEST_CASE(test_matches_scalar_implementation)
+{
+	// Sizes that are and aren't multiples of the block size.
+	QSize const sizes[] = { QSize(64, 48), QSize(37, 53), QSize(1, 20), QSize(20, 1) };
+	double const radii[] = { 0.5, 2.0, 7.5, 30.0 };
+	
+	for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		GrayImage const input(createTestImage(sizes[i]));
+		for (unsigned j = 0; j < sizeof(radii) / sizeof(radii[0]); ++j) {
+			GrayImage const control(reference::gaussBlurGray(input, radii[j]));
+			GrayImage const blurred(gaussBlurGray(input, radii[j]));
+			BOOST_REQUIRE(blurred.size() == control.size());
+			BOOST_CHECK(maxDifference(blurred, control) <= 1);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_qimage_and_grayimage_overloads_agree)
+{
+	GrayImage const input(createTestImage(QSize(50, 40)));
+	QImage const via_qimage(gaussBlurGray(input.toQImage(), 3.0));
+	GrayImage const via_grayimage(gaussBlurGray(input, 3.0));
+	BOOST_CHECK(GrayImage(via_qimage) == via_grayimage);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+} // namespace tests
+
+} // namespace imageproc
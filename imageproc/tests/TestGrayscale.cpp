@@ -17,6 +17,8 @@
 */
 
 #include "Grayscale.h"
+#include "GrayImage.h"
+#include "ImageStorage.h"
 #include "Utils.h"
 #include <QImage>
 #include <boost/test/auto_unit_test.hpp>
@@ -30,6 +32,33 @@ namespace tests
 
 using namespace utils;
 
+/**
+ * The per-pixel conversion, kept as a reference for the vectorized one.
+ */
+static QImage referenceToGrayscale(QImage const& src)
+{
+	QImage dst(src.size(), QImage::Format_Indexed8);
+	dst.setColorTable(createGrayscalePalette());
+	for (int y = 0; y < src.height(); ++y) {
+		for (int x = 0; x < src.width(); ++x) {
+			dst.setPixel(x, y, qGray(src.pixel(x, y)));
+		}
+	}
+	return dst;
+}
+
+static QImage randomRgb32Image(int const width, int const height)
+{
+	QImage image(width, height, QImage::Format_RGB32);
+	for (int y = 0; y < height; ++y) {
+		QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+		for (int x = 0; x < width; ++x) {
+			line[x] = qRgb(rand() & 0xff, rand() & 0xff, rand() & 0xff);
+		}
+	}
+	return image;
+}
+
 BOOST_AUTO_TEST_SUITE(GrayscaleTestSuite);
 
 BOOST_AUTO_TEST_CASE(test_null_image)
@@ -79,6 +108,51 @@ BOOST_AUTO_TEST_CASE(test_argb32_to_grayscale)
 	BOOST_CHECK(toGrayscale(argb32) == gray);
 }
 
+BOOST_AUTO_TEST_CASE(test_color_to_grayscale_matches_reference)
+{
+	// Odd widths exercise the scalar tails of vectorized loops.
+	int const widths[] = { 1, 15, 33, 77, 130 };
+	for (unsigned i = 0; i < sizeof(widths) / sizeof(widths[0]); ++i) {
+		QImage const rgb32(randomRgb32Image(widths[i], 7));
+		QImage const rgb888(rgb32.convertToFormat(QImage::Format_RGB888));
+		QImage const indexed8(rgb32.convertToFormat(QImage::Format_Indexed8));
+		
+		BOOST_CHECK(toGrayscale(rgb32) == referenceToGrayscale(rgb32));
+		BOOST_CHECK(toGrayscale(rgb888) == referenceToGrayscale(rgb888));
+		BOOST_CHECK(toGrayscale(indexed8) == referenceToGrayscale(indexed8));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_file_backed_gray_image)
+{
+	size_t const orig_threshold = ImageStorage::mappingThreshold();
+	ImageStorage::setMappingThreshold(1);
+	
+	QImage const rgb32(randomRgb32Image(70, 40));
+	QImage const expected(referenceToGrayscale(rgb32));
+	QImage escaped;
+	{
+		GrayImage const img(rgb32);
+		BOOST_REQUIRE(img.toQImage() == expected);
+		
+		// Writing to a copy must not affect the original.
+		GrayImage copy(img);
+		copy.fill(0);
+		BOOST_CHECK(img.toQImage() == expected);
+		BOOST_CHECK(copy.data()[0] == 0);
+		
+		escaped = img.toQImage();
+	}
+	
+	// The pixels have to outlive the GrayImage while they are referenced.
+	GrayImage(QSize(10, 10));
+	BOOST_CHECK(escaped == expected);
+	escaped = QImage();
+	GrayImage(QSize(10, 10));
+	
+	ImageStorage::setMappingThreshold(orig_threshold);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
@@ -0,0 +1,246 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "HoughLineDetector.h"
+#include "GrayImage.h"
+#include "Constants.h"
+#include <QSize>
+#include <QRect>
+#include <QPoint>
+#include <boost/test/auto_unit_test.hpp>
+#include <boost/foreach.hpp>
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+namespace imageproc
+{
+
+namespace tests
+{
+
+namespace
+{
+
+class Random
+{
+public:
+	Random() : m_state(777) {}
+
+	int next(int range) {
+		m_state = m_state * 1103515245u + 12345u;
+		return static_cast<int>((m_state >> 16) % static_cast<uint32_t>(range));
+	}
+private:
+	uint32_t m_state;
+};
+
+namespace reference
+{
+
+/**
+ * Distance bins the way HoughLineDetector computed them before it went
+ * fixed-point: in double precision, for every angle.
+ */
+class ScalarBins
+{
+public:
+	ScalarBins(QSize const& input_dimensions, double distance_resolution,
+		double start_angle, double angle_delta, int num_angles)
+	: m_recipDistanceResolution(1.0 / distance_resolution)
+	{
+		int const max_x = input_dimensions.width() - 1;
+		int const max_y = input_dimensions.height() - 1;
+		QPoint const checkpoints[3] = {
+			QPoint(max_x, max_y), QPoint(max_x, 0), QPoint(0, max_y)
+		};
+		
+		double min_distance = 0.0;
+		for (int i = 0; i < num_angles; ++i) {
+			double const angle = (start_angle + angle_delta * i) * constants::DEG2RAD;
+			m_cos.push_back(cos(angle));
+			m_sin.push_back(sin(angle));
+			BOOST_FOREACH (QPoint const& p, checkpoints) {
+				double const distance = m_cos.back() * p.x() + m_sin.back() * p.y();
+				min_distance = std::min(min_distance, distance);
+			}
+		}
+		m_distanceBias = -min_distance;
+	}
+	
+	int bin(int x, int y, int angle_idx) const {
+		double const distance = m_cos[angle_idx] * x + m_sin[angle_idx] * y;
+		return (int)((distance + m_distanceBias) * m_recipDistanceResolution + 0.5);
+	}
+private:
+	std::vector<double> m_cos;
+	std::vector<double> m_sin;
+	double m_recipDistanceResolution;
+	double m_distanceBias;
+};
+
+} // namespace reference
+
+struct Params
+{
+	QSize size;
+	double distanceResolution;
+	double startAngle;
+	double angleDelta;
+	int numAngles;
+};
+
+/**
+ * Processes each point on its own and compares the bin it lands in for
+ * each angle with the scalar one.  Returns the number of (point, angle)
+ * pairs that landed in a different bin, or -1 if any of them landed
+ * more than one bin away.
+ */
+int countBinMismatches(Params const& params, int num_points)
+{
+	reference::ScalarBins const scalar(
+		params.size, params.distanceResolution,
+		params.startAngle, params.angleDelta, params.numAngles
+	);
+	Random rng;
+	int mismatches = 0;
+	
+	for (int i = 0; i < num_points; ++i) {
+		int const x = rng.next(params.size.width());
+		int const y = rng.next(params.size.height());
+		
+		HoughLineDetector detector(
+			params.size, params.distanceResolution,
+			params.startAngle, params.angleDelta, params.numAngles
+		);
+		detector.process(x, y, 3);
+		
+		std::vector<unsigned> const& hist = detector.histogram();
+		int const width = detector.histogramWidth();
+		for (int a = 0; a < params.numAngles; ++a) {
+			unsigned const* row = &hist[a * width];
+			unsigned const* const bin = std::find(row, row + width, 3u);
+			if (bin == row + width) {
+				return -1;
+			}
+			int const diff = abs(int(bin - row) - scalar.bin(x, y, a));
+			if (diff > 1) {
+				return -1;
+			} else if (diff == 1) {
+				++mismatches;
+			}
+		}
+	}
+	
+	return mismatches;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_SUITE(HoughLineDetectorTestSuite);
+
+BOOST_AUTO_TEST_CASE(test_fixed_point_bins_match_scalar_ones)
+{
+	// The parameters VertLineFinder uses.
+	Params const vert = { QSize(1200, 1600), 5.0, -7.0, 0.25, 57 };
+	int const vert_mismatches = countBinMismatches(vert, 200);
+	BOOST_CHECK(vert_mismatches >= 0);
+	BOOST_CHECK(vert_mismatches <= 200 * vert.numAngles / 100);
+	
+	// All directions, at a finer resolution.
+	Params const all = { QSize(900, 700), 1.0, 0.0, 3.0, 120 };
+	int const all_mismatches = countBinMismatches(all, 200);
+	BOOST_CHECK(all_mismatches >= 0);
+	BOOST_CHECK(all_mismatches <= 200 * all.numAngles / 100);
+}
+
+BOOST_AUTO_TEST_CASE(test_floating_point_fallback_matches_scalar_exactly)
+{
+	// Too fine a resolution leaves too few fractional bits.
+	Params const params = { QSize(60, 40), 0.01, -30.0, 2.0, 31 };
+	BOOST_CHECK_EQUAL(countBinMismatches(params, 50), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_batches_match_individual_points)
+{
+	QSize const size(800, 600);
+	Random rng;
+	
+	// Enough to be split into chunks.
+	std::vector<HoughLineDetector::WeightedPoint> points;
+	for (int i = 0; i < 50000; ++i) {
+		points.push_back(
+			HoughLineDetector::WeightedPoint(
+				rng.next(size.width()), rng.next(size.height()),
+				1 + rng.next(10)
+			)
+		);
+	}
+	
+	HoughLineDetector batched(size, 2.0, -10.0, 0.5, 41);
+	batched.process(points);
+	
+	HoughLineDetector individual(size, 2.0, -10.0, 0.5, 41);
+	BOOST_FOREACH (HoughLineDetector::WeightedPoint const& pt, points) {
+		individual.process(pt.x, pt.y, pt.weight);
+	}
+	
+	BOOST_CHECK(batched.histogram() == individual.histogram());
+}
+
+BOOST_AUTO_TEST_CASE(test_gray_image_matches_individual_points)
+{
+	GrayImage image(QSize(200, 150));
+	Random rng;
+	for (int y = 0; y < image.height(); ++y) {
+		uint8_t* const line = image.data() + y * image.stride();
+		for (int x = 0; x < image.width(); ++x) {
+			line[x] = static_cast<uint8_t>(rng.next(256));
+		}
+	}
+	
+	unsigned weight_table[256];
+	for (int i = 0; i < 256; ++i) {
+		weight_table[i] = i < 40 ? 40 - i : 0;
+	}
+	
+	QRect const area(20, 10, 150, 120);
+	HoughLineDetector from_image(image.size(), 3.0, -5.0, 0.5, 21);
+	from_image.process(image, weight_table, area);
+	
+	HoughLineDetector individual(image.size(), 3.0, -5.0, 0.5, 21);
+	for (int y = area.top(); y <= area.bottom(); ++y) {
+		uint8_t const* const line = image.data() + y * image.stride();
+		for (int x = area.left(); x <= area.right(); ++x) {
+			if (weight_table[line[x]] != 0) {
+				individual.process(x, y, weight_table[line[x]]);
+			}
+		}
+	}
+	
+	BOOST_CHECK(from_image.histogram() == individual.histogram());
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+} // namespace tests
+
+} // namespace imageproc
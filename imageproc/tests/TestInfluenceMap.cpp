@@ -0,0 +1,194 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "InfluenceMap.h"
+#include "ConnectivityMap.h"
+#include "Connectivity.h"
+#include "BinaryImage.h"
+#include "BWColor.h"
+#include <QSize>
+#include <QRect>
+#include <boost/test/auto_unit_test.hpp>
+#include <deque>
+#include <vector>
+#include <stdint.h>
+
+namespace imageproc
+{
+
+namespace tests
+{
+
+namespace
+{
+
+typedef InfluenceMap::Cell Cell;
+
+namespace reference
+{
+
+/**
+ * The single-queue growth InfluenceMap used before it was split
+ * into parallel strips.  Returns padded cells.
+ */
+std::vector<Cell> growSerially(ConnectivityMap const& cmap)
+{
+	static int const dxs[8] = { -1, 0, 1, 1, 1, 0, -1, -1 };
+	static int const dys[8] = { -1, -1, -1, 0, 1, 1, 1, 0 };
+	
+	int const width = cmap.size().width() + 2;
+	int const height = cmap.size().height() + 2;
+	std::vector<Cell> cells(width * height);
+	std::deque<int> queue;
+	
+	uint32_t const* label = cmap.paddedData();
+	for (int i = 0; i < width * height; ++i) {
+		cells[i].label = label[i];
+		cells[i].distSq = 0;
+		cells[i].vec.x = 0;
+		cells[i].vec.y = 0;
+		if (label[i] != 0) {
+			queue.push_back(i);
+		} else if (i >= width && i < width * (height - 1)
+				&& i % width != 0 && i % width != width - 1) {
+			cells[i].distSq = ~uint32_t(0);
+		}
+	}
+	
+	while (!queue.empty()) {
+		int const idx = queue.front();
+		queue.pop_front();
+		Cell const& cell = cells[idx];
+		for (int n = 0; n < 8; ++n) {
+			int const dx = dxs[n];
+			int const dy = dys[n];
+			Cell& nbh = cells[idx + dy * width + dx];
+			uint32_t const new_dist_sq = cell.distSq
+				- 2 * (cell.vec.x * dx + cell.vec.y * dy) + dx * dx + dy * dy;
+			if (new_dist_sq < nbh.distSq) {
+				nbh.label = cell.label;
+				nbh.distSq = new_dist_sq;
+				nbh.vec.x = cell.vec.x - dx;
+				nbh.vec.y = cell.vec.y - dy;
+				queue.push_back(idx + dy * width + dx);
+			}
+		}
+	}
+	
+	return cells;
+}
+
+} // namespace reference
+
+/**
+ * Checks that \p imap has the same distances as the serial growth,
+ * and that where their labels differ, both labels are equally close.
+ */
+bool matchesSerialGrowth(InfluenceMap const& imap, ConnectivityMap const& cmap)
+{
+	std::vector<Cell> const serial(reference::growSerially(cmap));
+	int const width = imap.size().width();
+	int const height = imap.size().height();
+	int const stride = imap.stride();
+	uint32_t const* const labels = cmap.data();
+	
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			Cell const& cell = imap.data()[y * stride + x];
+			Cell const& control = serial[(y + 1) * stride + x + 1];
+			if (cell.distSq != control.distSq) {
+				return false;
+			}
+			if (cell.label == control.label) {
+				continue;
+			}
+			
+			// A tie: the nearest pixel of our label must be
+			// as far as the nearest pixel of the serial one.
+			int const seed_x = x + cell.vec.x;
+			int const seed_y = y + cell.vec.y;
+			if (seed_x < 0 || seed_x >= width || seed_y < 0 || seed_y >= height) {
+				return false;
+			}
+			if (labels[seed_y * cmap.stride() + seed_x] != cell.label) {
+				return false;
+			}
+		}
+	}
+	
+	return true;
+}
+
+class Random
+{
+public:
+	Random() : m_state(54321) {}
+
+	int next(int range) {
+		m_state = m_state * 1103515245u + 12345u;
+		return static_cast<int>((m_state >> 16) % static_cast<uint32_t>(range));
+	}
+private:
+	uint32_t m_state;
+};
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_SUITE(InfluenceMapTestSuite);
+
+BOOST_AUTO_TEST_CASE(test_scattered_seeds_match_serial_growth)
+{
+	// Tall enough to be split into strips on any multi-core machine.
+	QSize const size(317, 901);
+	Random rng;
+	
+	for (int pass = 0; pass < 5; ++pass) {
+		BinaryImage image(size, WHITE);
+		for (int i = 0; i < 40; ++i) {
+			QRect const blob(
+				rng.next(size.width()), rng.next(size.height()),
+				1 + rng.next(6), 1 + rng.next(6)
+			);
+			image.fill(blob.intersected(image.rect()), BLACK);
+		}
+		
+		ConnectivityMap const cmap(image, CONN8);
+		InfluenceMap const imap(cmap);
+		BOOST_CHECK(matchesSerialGrowth(imap, cmap));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_single_seed_crosses_all_strips)
+{
+	BinaryImage image(QSize(64, 1000), WHITE);
+	image.fill(QRect(5, 3, 2, 2), BLACK);
+	
+	ConnectivityMap const cmap(image, CONN8);
+	InfluenceMap const imap(cmap);
+	BOOST_CHECK(matchesSerialGrowth(imap, cmap));
+	
+	Cell const& far_corner = imap.data()[999 * imap.stride() + 63];
+	BOOST_CHECK_EQUAL(far_corner.label, 1u);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+} // namespace tests
+
+} // namespace imageproc
@@ -21,6 +21,8 @@
 #include "Utils.h"
 #include <QImage>
 #include <QRect>
+#include <stdlib.h>
+#include <stdint.h>
 #include <boost/test/auto_unit_test.hpp>
 
 namespace imageproc
@@ -33,6 +35,49 @@ using namespace utils;
 
 BOOST_AUTO_TEST_SUITE(OrthogonalRotationTestSuite);
 
+namespace
+{
+
+bool isBlack(BinaryImage const& img, int const x, int const y)
+{
+	uint32_t const word = img.data()[y * img.wordsPerLine() + (x >> 5)];
+	return (word >> (31 - (x & 31))) & 1;
+}
+
+/**
+ * A pixel-by-pixel rotation to compare against.
+ */
+BinaryImage referenceRotation(BinaryImage const& src, QRect const& rect, int const degrees)
+{
+	bool const swap_dims = (degrees == 90 || degrees == 270);
+	int const dst_w = swap_dims ? rect.height() : rect.width();
+	int const dst_h = swap_dims ? rect.width() : rect.height();
+	BinaryImage dst(dst_w, dst_h, WHITE);
+	uint32_t* const dst_data = dst.data();
+	int const dst_wpl = dst.wordsPerLine();
+	for (int y = 0; y < dst_h; ++y) {
+		for (int x = 0; x < dst_w; ++x) {
+			int src_x, src_y;
+			if (degrees == 90) {
+				src_x = rect.left() + y;
+				src_y = rect.bottom() - x;
+			} else if (degrees == 180) {
+				src_x = rect.right() - x;
+				src_y = rect.bottom() - y;
+			} else {
+				src_x = rect.right() - y;
+				src_y = rect.top() + x;
+			}
+			if (isBlack(src, src_x, src_y)) {
+				dst_data[y * dst_wpl + (x >> 5)] |= uint32_t(1) << (31 - (x & 31));
+			}
+		}
+	}
+	return dst;
+}
+
+} // anonymous namespace
+
 BOOST_AUTO_TEST_CASE(test_null_image)
 {
 	BinaryImage const null_img;
@@ -175,6 +220,30 @@ BOOST_AUTO_TEST_CASE(test_sub_image)
 	BOOST_REQUIRE(orthogonalRotation(img, rect, -90) == out4_img);
 }
 
+BOOST_AUTO_TEST_CASE(test_matches_reference)
+{
+	// Sizes and offsets are chosen to produce both complete and
+	// incomplete 32x32 tiles, aligned and unaligned.
+	for (int i = 0; i < 200; ++i) {
+		int const width = 1 + rand() % 150;
+		int const height = 1 + rand() % 150;
+		BinaryImage const img(randomBinaryImage(width, height));
+		
+		int const left = rand() % width;
+		int const top = rand() % height;
+		QRect const rect(
+			left, top, 1 + rand() % (width - left), 1 + rand() % (height - top)
+		);
+		
+		for (int degrees = 90; degrees < 360; degrees += 90) {
+			BOOST_REQUIRE(
+				orthogonalRotation(img, rect, degrees)
+				== referenceRotation(img, rect, degrees)
+			);
+		}
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
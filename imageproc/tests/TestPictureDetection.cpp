@@ -0,0 +1,158 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "PictureDetection.h"
+#include "GrayImage.h"
+#include "BinaryThreshold.h"
+#include <QSize>
+#include <boost/test/auto_unit_test.hpp>
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace imageproc
+{
+
+namespace tests
+{
+
+namespace
+{
+
+class Random
+{
+public:
+	Random() : m_state(12345) {}
+
+	int next(int range) {
+		m_state = m_state * 1103515245u + 12345u;
+		return static_cast<int>((m_state >> 16) % static_cast<uint32_t>(range));
+	}
+private:
+	uint32_t m_state;
+};
+
+/**
+ * A 300 dpi letter-sized page with lines of glyph-like boxes,
+ * a noisy rectangular picture and a noisy elliptic one.
+ */
+GrayImage createTestPage()
+{
+	GrayImage page(QSize(1275, 1650));
+	page.fill(0xe0);
+	uint8_t* const data = page.data();
+	int const stride = page.stride();
+	Random rng;
+	
+	for (int y = 150; y < 1500; y += 45) {
+		for (int x = 120; x < 1150; x += 22) {
+			if (rng.next(7) == 0) {
+				continue; // A space between words.
+			}
+			int const width = 10 + rng.next(6);
+			for (int yy = 0; yy < 22; ++yy) {
+				for (int xx = 0; xx < width; ++xx) {
+					if (xx < 3 || xx >= width - 3 || yy < 3 || yy >= 19) {
+						data[(y + yy) * stride + x + xx] = 0x20;
+					}
+				}
+			}
+		}
+	}
+	
+	for (int y = 400; y < 900; ++y) {
+		for (int x = 300; x < 1000; ++x) {
+			data[y * stride + x] = static_cast<uint8_t>(
+				60 + (x * 3 + y * 2) % 140 + rng.next(30)
+			);
+		}
+	}
+	
+	for (int y = 1100; y < 1300; ++y) {
+		for (int x = 700; x < 1100; ++x) {
+			int const dx = x - 900;
+			int const dy = y - 1200;
+			if (dx * dx / 4 + dy * dy < 90 * 90) {
+				data[y * stride + x] = static_cast<uint8_t>(90 + rng.next(80));
+			}
+		}
+	}
+	
+	return page;
+}
+
+/**
+ * Counts pixels that end up on different sides of \p threshold.
+ */
+int countMismatches(GrayImage const& img1, GrayImage const& img2, int threshold)
+{
+	int const width = img1.width();
+	int const height = img1.height();
+	uint8_t const* line1 = img1.data();
+	uint8_t const* line2 = img2.data();
+	int count = 0;
+	
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			if ((line1[x] < threshold) != (line2[x] < threshold)) {
+				++count;
+			}
+		}
+		line1 += img1.stride();
+		line2 += img2.stride();
+	}
+	
+	return count;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_SUITE(PictureDetectionTestSuite);
+
+BOOST_AUTO_TEST_CASE(test_coarse_to_fine_matches_full_resolution)
+{
+	GrayImage const page(createTestPage());
+	GrayImage const full(detectPictures(page, 35));
+	GrayImage coarse;
+	GrayImage const refined(detectPicturesCoarseToFine(page, 0, &coarse));
+	BOOST_REQUIRE(full.size() == page.size());
+	BOOST_REQUIRE(refined.size() == page.size());
+	BOOST_REQUIRE(coarse.size() == page.size());
+	
+	// That's how OutputGenerator turns picture areas into a mask.
+	int const threshold = BinaryThreshold::mokjiThreshold(full, 5, 26);
+	int const num_pixels = page.width() * page.height();
+	int const refined_mismatches = countMismatches(full, refined, threshold);
+	int const coarse_mismatches = countMismatches(full, coarse, threshold);
+	
+	BOOST_CHECK(refined_mismatches < num_pixels / 200);
+	BOOST_CHECK(refined_mismatches < coarse_mismatches / 4);
+}
+
+BOOST_AUTO_TEST_CASE(test_small_images_are_processed_at_full_resolution)
+{
+	GrayImage const page(createTestPage());
+	GrayImage const small(page.toQImage().copy(280, 380, 90, 90));
+	BOOST_CHECK(detectPicturesCoarseToFine(small) == detectPictures(small, 35));
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+} // namespace tests
+
+} // namespace imageproc
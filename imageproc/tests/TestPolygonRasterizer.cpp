@@ -17,6 +17,7 @@
 */
 
 #include "PolygonRasterizer.h"
+#include "SpanBuffer.h"
 #include "BinaryImage.h"
 #include "BinaryThreshold.h"
 #include "RasterOp.h"
@@ -177,6 +178,123 @@ BOOST_AUTO_TEST_CASE(regression_test_1)
 	BOOST_CHECK(testFillExceptShape(QSize(938, 1299), shape, Qt::WindingFill));
 }
 
+BOOST_AUTO_TEST_CASE(test_span_operations)
+{
+	QSize const image_size(300, 200);
+	QPolygonF const star(createShape(image_size, 90));
+	QPolygonF const rect(QRectF(QPointF(20.3, 30.7), QSize(150, 120)));
+	
+	SpanBuffer const star_spans(
+		PolygonRasterizer::rasterize(image_size, star, Qt::WindingFill)
+	);
+	SpanBuffer const rect_spans(
+		PolygonRasterizer::rasterize(image_size, rect, Qt::WindingFill)
+	);
+	
+	BinaryImage star_img(image_size, WHITE);
+	PolygonRasterizer::fill(star_img, BLACK, star, Qt::WindingFill);
+	BinaryImage rect_img(image_size, WHITE);
+	PolygonRasterizer::fill(rect_img, BLACK, rect, Qt::WindingFill);
+	
+	BinaryImage united(image_size, WHITE);
+	SpanBuffer::unite(star_spans, rect_spans).fill(united, BLACK);
+	BinaryImage control(star_img);
+	rasterOp<RopOr<RopSrc, RopDst> >(control, rect_img);
+	BOOST_CHECK(united == control);
+	
+	BinaryImage intersected(image_size, WHITE);
+	SpanBuffer::intersect(star_spans, rect_spans).fill(intersected, BLACK);
+	control = star_img;
+	rasterOp<RopAnd<RopSrc, RopDst> >(control, rect_img);
+	BOOST_CHECK(intersected == control);
+	
+	BinaryImage subtracted(image_size, WHITE);
+	SpanBuffer::subtract(star_spans, rect_spans).fill(subtracted, BLACK);
+	control = star_img;
+	rasterOp<RopSubtract<RopDst, RopSrc> >(control, rect_img);
+	BOOST_CHECK(subtracted == control);
+	
+	BinaryImage inverted(image_size, WHITE);
+	star_spans.inverted().fill(inverted, BLACK);
+	BinaryImage except(image_size, WHITE);
+	star_spans.fillExcept(except, BLACK);
+	BOOST_CHECK(inverted == except);
+}
+
+BOOST_AUTO_TEST_CASE(test_antialiased_coverage)
+{
+	QSize const image_size(300, 300);
+	QPolygonF const shape(createShape(image_size, 120));
+	SpanBuffer const spans(
+		PolygonRasterizer::rasterizeAntialiased(image_size, shape, Qt::WindingFill)
+	);
+	
+	// Make a grayscale image where the coverage determines the darkness.
+	QImage coverage(image_size, QImage::Format_RGB32);
+	coverage.fill(0xffffffff);
+	for (int y = 0; y < image_size.height(); ++y) {
+		QRgb* line = reinterpret_cast<QRgb*>(coverage.scanLine(y));
+		for (SpanBuffer::Span const* span = spans.rowBegin(y);
+				span != spans.rowEnd(y); ++span) {
+			int const gray = 255 - span->coverage;
+			for (int x = span->begin; x < span->end; ++x) {
+				line[x] = qRgb(gray, gray, gray);
+			}
+		}
+	}
+	
+	BinaryImage b_image(image_size, WHITE);
+	PolygonRasterizer::fill(b_image, BLACK, shape, Qt::WindingFill);
+	BOOST_CHECK(fuzzyCompare(b_image, coverage));
+}
+
+static int coverageAt(SpanBuffer const& spans, int const x, int const y)
+{
+	for (SpanBuffer::Span const* span = spans.rowBegin(y);
+			span != spans.rowEnd(y); ++span) {
+		if (x >= span->begin && x < span->end) {
+			return span->coverage;
+		}
+	}
+	return 0;
+}
+
+BOOST_AUTO_TEST_CASE(test_exact_coverage)
+{
+	// Pixels 10 and 40 are half covered horizontally,
+	// and pixels 20 and 60 are half covered vertically.
+	QSize const image_size(60, 80);
+	QPolygonF const rect(QRectF(10.5, 20.5, 30.0, 40.0));
+	SpanBuffer const spans(
+		PolygonRasterizer::rasterizeAntialiased(image_size, rect, Qt::WindingFill)
+	);
+	
+	for (int y = 0; y < image_size.height(); ++y) {
+		int const v_edge = (y == 20 || y == 60) ? 1 : 0;
+		bool const v_inside = y >= 20 && y <= 60;
+		for (int x = 0; x < image_size.width(); ++x) {
+			int const h_edge = (x == 10 || x == 40) ? 1 : 0;
+			bool const h_inside = x >= 10 && x <= 40;
+			
+			int expected = 0;
+			if (v_inside && h_inside) {
+				// 255, 128 on edges, 64 in corners.
+				expected = 256 >> (v_edge + h_edge);
+				expected = qMin(expected, 255);
+			}
+			
+			int const coverage = coverageAt(spans, x, y);
+			if (qAbs(coverage - expected) > 1) {
+				BOOST_ERROR(
+					"Coverage of (" << x << ", " << y << ") is "
+					<< coverage << ", expected " << expected
+				);
+				return;
+			}
+		}
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
@@ -20,6 +20,8 @@
 #include "BinaryImage.h"
 #include "Utils.h"
 #include <QImage>
+#include <vector>
+#include <stdlib.h>
 #include <boost/test/auto_unit_test.hpp>
 
 namespace imageproc
@@ -118,6 +120,39 @@ BOOST_AUTO_TEST_CASE(test_lines)
 	BOOST_CHECK(makeBinaryImage(out4, 1, 4) == ReduceThreshold(img)(4));
 }
 
+BOOST_AUTO_TEST_CASE(test_cascade_matches_sequential)
+{
+	// Widths cover both the vectorized and the scalar parts of a line,
+	// and heights cover cascades ending in a line.
+	int const sizes[][2] = {
+		{ 700, 90 }, { 513, 37 }, { 257, 8 }, { 64, 3 }, { 5, 200 }, { 1000, 1 }
+	};
+	for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		QImage qimg(sizes[s][0], sizes[s][1], QImage::Format_Mono);
+		qimg.setNumColors(2);
+		qimg.setColor(0, 0xffffffff);
+		qimg.setColor(1, 0xff000000);
+		for (int y = 0; y < qimg.height(); ++y) {
+			for (int x = 0; x < qimg.width(); ++x) {
+				qimg.setPixel(x, y, (rand() % 3) ? 0 : 1);
+			}
+		}
+		BinaryImage const img(qimg);
+		
+		std::vector<int> thresholds;
+		for (int i = 0; i < 5; ++i) {
+			thresholds.push_back(1 + rand() % 4);
+		}
+		
+		ReduceThreshold sequential(img);
+		for (unsigned i = 0; i < thresholds.size(); ++i) {
+			sequential.reduce(thresholds[i]);
+		}
+		
+		BOOST_CHECK(ReduceThreshold(img).reduce(thresholds).image() == sequential.image());
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
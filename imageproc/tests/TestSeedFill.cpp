@@ -21,11 +21,13 @@
 #include "BinaryImage.h"
 #include "BWColor.h"
 #include "Grayscale.h"
+#include "TaskStatus.h"
 #include "Utils.h"
 #include <QImage>
 #include <QSize>
 #include <QPoint>
 #include <boost/test/auto_unit_test.hpp>
+#include <stdexcept>
 
 namespace imageproc
 {
@@ -35,6 +37,29 @@ namespace tests
 
 using namespace utils;
 
+namespace
+{
+
+class SimpleTaskStatus : public TaskStatus
+{
+public:
+	SimpleTaskStatus() : m_cancelled(false) {}
+
+	virtual void cancel() { m_cancelled = true; }
+
+	virtual bool isCancelled() const { return m_cancelled; }
+
+	virtual void throwIfCancelled() const {
+		if (m_cancelled) {
+			throw std::runtime_error("cancelled");
+		}
+	}
+private:
+	bool m_cancelled;
+};
+
+} // anonymous namespace
+
 BOOST_AUTO_TEST_SUITE(SeedFillTestSuite);
 
 BOOST_AUTO_TEST_CASE(test_regression_1)
@@ -206,6 +231,32 @@ BOOST_AUTO_TEST_CASE(test_gray_vs_binary)
 	}
 }
 
+BOOST_AUTO_TEST_CASE(test_cancellation)
+{
+	BinaryImage const bin_seed(randomBinaryImage(50, 50));
+	BinaryImage const bin_mask(randomBinaryImage(50, 50));
+	GrayImage const gray_seed(toGrayscale(bin_seed.toQImage()));
+	GrayImage const gray_mask(toGrayscale(bin_mask.toQImage()));
+
+	SimpleTaskStatus status;
+	BOOST_CHECK(
+		seedFill(bin_seed, bin_mask, CONN8, &status)
+		== seedFill(bin_seed, bin_mask, CONN8)
+	);
+	BOOST_CHECK(
+		seedFillGray(gray_seed, gray_mask, CONN8, &status)
+		== seedFillGray(gray_seed, gray_mask, CONN8)
+	);
+
+	status.cancel();
+	BOOST_CHECK_THROW(
+		seedFill(bin_seed, bin_mask, CONN8, &status), std::runtime_error
+	);
+	BOOST_CHECK_THROW(
+		seedFillGray(gray_seed, gray_mask, CONN4, &status), std::runtime_error
+	);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
@@ -21,6 +21,9 @@
 #include "BWColor.h"
 #include "Utils.h"
 #include <QImage>
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <boost/test/auto_unit_test.hpp>
 
 namespace imageproc
@@ -33,6 +36,64 @@ using namespace utils;
 
 BOOST_AUTO_TEST_SUITE(ShearTestSuite);
 
+namespace
+{
+
+bool isBlack(BinaryImage const& img, int const x, int const y)
+{
+	uint32_t const word = img.data()[y * img.wordsPerLine() + (x >> 5)];
+	return (word >> (31 - (x & 31))) & 1;
+}
+
+/**
+ * A pixel-by-pixel shear to compare against.  Shifts are accumulated
+ * the same way hShearFromTo() and vShearFromTo() do it.
+ */
+BinaryImage referenceShear(
+	BinaryImage const& src, bool const horizontal, double const shear,
+	double const origin, BWColor const background_color)
+{
+	int const width = src.width();
+	int const height = src.height();
+	BinaryImage dst(width, height, WHITE);
+	uint32_t* const dst_data = dst.data();
+	int const wpl = dst.wordsPerLine();
+	
+	double shift = 0.5 + shear * (0.5 - origin);
+	int const outer_end = horizontal ? height : width;
+	int const inner_end = horizontal ? width : height;
+	for (int outer = 0; outer < outer_end; ++outer, shift += shear) {
+		int const s = (int)floor(shift);
+		for (int inner = 0; inner < inner_end; ++inner) {
+			int const x = horizontal ? inner : outer;
+			int const y = horizontal ? outer : inner;
+			int const src_x = horizontal ? x - s : x;
+			int const src_y = horizontal ? y : y - s;
+			bool black = background_color == BLACK;
+			if (src_x >= 0 && src_x < width && src_y >= 0 && src_y < height) {
+				black = isBlack(src, src_x, src_y);
+			}
+			if (black) {
+				dst_data[y * wpl + (x >> 5)] |= uint32_t(1) << (31 - (x & 31));
+			}
+		}
+	}
+	return dst;
+}
+
+/**
+ * Returns true if the shear would produce the same non-zero shift for
+ * every line, a case the shear functions don't support.
+ */
+bool uniformShift(double const shear, double const origin, int const num_lines)
+{
+	double const first = floor(0.5 + shear * (0.5 - origin));
+	double const last = floor(0.5 + shear * (num_lines - 0.5 - origin));
+	return first == last && first != 0;
+}
+
+} // anonymous namespace
+
 BOOST_AUTO_TEST_CASE(test_small_image)
 {
 	static int const inp[] = {
@@ -90,6 +151,40 @@ BOOST_AUTO_TEST_CASE(test_small_image)
 	BOOST_REQUIRE(v_shear_inplace == v_out_img);
 }
 
+BOOST_AUTO_TEST_CASE(test_matches_reference)
+{
+	for (int i = 0; i < 200; ++i) {
+		// Wide images exercise the vectorized part of horizontal shifts.
+		int const width = 1 + rand() % (i & 1 ? 700 : 100);
+		int const height = 1 + rand() % 100;
+		BinaryImage const img(randomBinaryImage(width, height));
+		
+		// Mostly small shears, like in skew detection, but also
+		// large ones, with shifts exceeding the image size.
+		double const max_shear = (i % 3 == 0) ? 3.0 : 0.1;
+		double const shear = max_shear * ((rand() % 2001) - 1000) / 1000.0;
+		BWColor const bg = (rand() & 1) ? BLACK : WHITE;
+		
+		double const y_origin = height * (rand() % 1000) / 1000.0;
+		if (!uniformShift(shear, y_origin, height)) {
+			BinaryImage const expected(referenceShear(img, true, shear, y_origin, bg));
+			BOOST_REQUIRE(hShear(img, shear, y_origin, bg) == expected);
+			BinaryImage in_place(img);
+			hShearInPlace(in_place, shear, y_origin, bg);
+			BOOST_REQUIRE(in_place == expected);
+		}
+		
+		double const x_origin = width * (rand() % 1000) / 1000.0;
+		if (!uniformShift(shear, x_origin, width)) {
+			BinaryImage const expected(referenceShear(img, false, shear, x_origin, bg));
+			BOOST_REQUIRE(vShear(img, shear, x_origin, bg) == expected);
+			BinaryImage in_place(img);
+			vShearInPlace(in_place, shear, x_origin, bg);
+			BOOST_REQUIRE(in_place == expected);
+		}
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
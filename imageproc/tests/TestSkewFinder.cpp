@@ -18,6 +18,9 @@
 
 #include "SkewFinder.h"
 #include "BinaryImage.h"
+#include "Shear.h"
+#include "BitOps.h"
+#include "Constants.h"
 #include <QApplication>
 #include <QImage>
 #include <QPainter>
@@ -27,6 +30,7 @@
 #include <boost/test/auto_unit_test.hpp>
 #include <math.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 namespace imageproc
 {
@@ -92,6 +96,82 @@ BOOST_AUTO_TEST_CASE(test_negative_detection)
 	BOOST_CHECK(skew.confidence() < Skew::GOOD_CONFIDENCE);
 }
 
+BOOST_AUTO_TEST_CASE(test_blank_page)
+{
+	BinaryImage const image(1000, 800, WHITE);
+	
+	SkewFinder skew_finder;
+	Skew const skew(skew_finder.findSkew(image));
+	BOOST_CHECK(skew.confidence() < Skew::GOOD_CONFIDENCE);
+}
+
+static double projectionScoreOfShearedImage(BinaryImage const& image, double shear)
+{
+	BinaryImage const sheared(
+		vShear(image, shear, 0.5 * image.width(), WHITE)
+	);
+	
+	int const width = sheared.width();
+	int const height = sheared.height();
+	uint32_t const* line = sheared.data();
+	int const wpl = sheared.wordsPerLine();
+	int const last_word_idx = (width - 1) >> 5;
+	uint32_t const last_word_mask = ~uint32_t(0) << (31 - ((width - 1) & 31));
+	
+	double score = 0.0;
+	int last_line_black_pixels = 0;
+	for (int y = 0; y < height; ++y, line += wpl) {
+		int num_black_pixels = 0;
+		int i = 0;
+		for (; i != last_word_idx; ++i) {
+			num_black_pixels += countNonZeroBits(line[i]);
+		}
+		num_black_pixels += countNonZeroBits(line[i] & last_word_mask);
+		
+		if (y != 0) {
+			double const diff = num_black_pixels - last_line_black_pixels;
+			score += diff * diff;
+		}
+		last_line_black_pixels = num_black_pixels;
+	}
+	
+	return score;
+}
+
+BOOST_AUTO_TEST_CASE(test_projection_matches_sheared_image)
+{
+	// Lines of "words" rotated by 3 degrees.
+	QImage image(701, 500, QImage::Format_ARGB32_Premultiplied);
+	image.fill(0xffffffff);
+	{
+		QPainter painter(&image);
+		painter.setPen(Qt::NoPen);
+		painter.setBrush(QColor(0, 0, 0));
+		painter.translate(0.5 * image.width(), 0.5 * image.height());
+		painter.rotate(3.0);
+		painter.translate(-0.5 * image.width(), -0.5 * image.height());
+		for (int y = 40; y < 460; y += 20) {
+			for (int x = 30; x < 650; x += 47) {
+				painter.drawRect(x, y, 25 + (x + y) % 13, 8);
+			}
+		}
+	}
+	BinaryImage const bw_image(image);
+	
+	for (double angle = -7.0; angle <= 7.0; angle += 0.7) {
+		double const shear = tan(angle * constants::DEG2RAD);
+		BOOST_CHECK_EQUAL(
+			SkewFinder::shearedProjectionScore(bw_image, shear),
+			projectionScoreOfShearedImage(bw_image, shear)
+		);
+	}
+	
+	SkewFinder skew_finder;
+	Skew const skew(skew_finder.findSkew(bw_image));
+	BOOST_CHECK(fabs(skew.angle() - 3.0) < 0.15);
+	BOOST_CHECK(skew.confidence() >= Skew::GOOD_CONFIDENCE);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
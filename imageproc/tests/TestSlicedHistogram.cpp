@@ -20,8 +20,12 @@
 #include "BinaryImage.h"
 #include "Utils.h"
 #include <QImage>
+#include <QRect>
 #include <stdexcept>
 #include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
 #include <boost/test/auto_unit_test.hpp>
 
 namespace imageproc
@@ -112,6 +116,52 @@ BOOST_AUTO_TEST_CASE(test_small_image)
 	BOOST_CHECK(checkHistogram(ver_hist, ver_counts + 1, ver_counts + 9));
 }
 
+BOOST_AUTO_TEST_CASE(test_random_areas)
+{
+	// Heights over 255 make the column counters overflow
+	// their packed lanes if not flushed in time.
+	for (int i = 0; i < 50; ++i) {
+		int const width = 1 + rand() % 300;
+		int const height = 1 + rand() % 400;
+		BinaryImage const img(randomBinaryImage(width, height));
+		uint32_t const* const data = img.data();
+		int const wpl = img.wordsPerLine();
+		
+		int const left = rand() % width;
+		int const top = rand() % height;
+		QRect const area(
+			left, top, 1 + rand() % (width - left), 1 + rand() % (height - top)
+		);
+		SlicedHistogram const rows(img, area, SlicedHistogram::ROWS);
+		SlicedHistogram const cols(img, area, SlicedHistogram::COLS);
+		BOOST_REQUIRE(rows.size() == size_t(area.height()));
+		BOOST_REQUIRE(cols.size() == size_t(area.width()));
+		
+		std::vector<int> row_counts(area.height(), 0);
+		std::vector<int> col_counts(area.width(), 0);
+		for (int y = 0; y < area.height(); ++y) {
+			uint32_t const* line = data + (area.top() + y) * wpl;
+			for (int x = 0; x < area.width(); ++x) {
+				int const img_x = area.left() + x;
+				if ((line[img_x >> 5] >> (31 - (img_x & 31))) & 1) {
+					++row_counts[y];
+					++col_counts[x];
+				}
+			}
+		}
+		
+		int total = 0;
+		for (int y = 0; y < area.height(); ++y) {
+			BOOST_CHECK_EQUAL(rows[y], row_counts[y]);
+			total += row_counts[y];
+		}
+		for (int x = 0; x < area.width(); ++x) {
+			BOOST_CHECK_EQUAL(cols[x], col_counts[x]);
+		}
+		BOOST_CHECK_EQUAL(img.countBlackPixels(area), total);
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } // namespace tests
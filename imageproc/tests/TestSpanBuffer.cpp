@@ -0,0 +1,170 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SpanBuffer.h"
+#include "PolygonRasterizer.h"
+#include "Grayscale.h"
+#include "Utils.h"
+#include <QPolygonF>
+#include <QRectF>
+#include <QImage>
+#include <QPainter>
+#include <QColor>
+#include <Qt>
+#include <stdlib.h>
+#include <boost/test/auto_unit_test.hpp>
+
+namespace imageproc
+{
+
+namespace tests
+{
+
+using namespace utils;
+
+BOOST_AUTO_TEST_SUITE(SpanBufferTestSuite);
+
+/**
+ * Fills a polygon the way fill zones used to be applied: by painting it
+ * on an ARGB32 copy of the image and converting the result back.
+ */
+static QImage paintWithQPainter(
+	QImage const& img, QPolygonF const& poly, QColor const& color)
+{
+	QImage canvas(img.convertToFormat(QImage::Format_ARGB32_Premultiplied));
+	{
+		QPainter painter(&canvas);
+		painter.setRenderHint(QPainter::Antialiasing, true);
+		painter.setPen(Qt::NoPen);
+		painter.setBrush(color);
+		painter.drawPolygon(poly, Qt::WindingFill);
+	}
+	
+	if (img.format() == QImage::Format_Indexed8) {
+		return toGrayscale(canvas);
+	} else {
+		return canvas.convertToFormat(img.format());
+	}
+}
+
+static QImage blendSpans(
+	QImage const& img, QPolygonF const& poly, QColor const& color)
+{
+	QImage res(img);
+	PolygonRasterizer::rasterizeAntialiased(
+		img.size(), poly, Qt::WindingFill
+	).blend(res, color.rgb());
+	return res;
+}
+
+/**
+ * Returns the largest difference between any color channels
+ * of corresponding pixels.
+ */
+static int maxDifference(QImage const& img1, QImage const& img2)
+{
+	int max_diff = 0;
+	for (int y = 0; y < img1.height(); ++y) {
+		for (int x = 0; x < img1.width(); ++x) {
+			QRgb const p1 = img1.pixel(x, y);
+			QRgb const p2 = img2.pixel(x, y);
+			max_diff = qMax(max_diff, qAbs(qRed(p1) - qRed(p2)));
+			max_diff = qMax(max_diff, qAbs(qGreen(p1) - qGreen(p2)));
+			max_diff = qMax(max_diff, qAbs(qBlue(p1) - qBlue(p2)));
+			max_diff = qMax(max_diff, qAbs(qAlpha(p1) - qAlpha(p2)));
+		}
+	}
+	return max_diff;
+}
+
+static QImage randomRgbImage(int const width, int const height)
+{
+	QImage img(width, height, QImage::Format_RGB32);
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			img.setPixel(x, y, qRgb(rand() % 256, rand() % 256, rand() % 256));
+		}
+	}
+	return img;
+}
+
+// Edges half a pixel off the pixel grid, so edge pixels are partially covered.
+static QPolygonF const HALF_PIXEL_RECT(QRectF(3.5, 2.5, 20.0, 13.0));
+
+// Rounding differs a little between QPainter and us.
+static int const TOLERANCE = 4;
+
+BOOST_AUTO_TEST_CASE(test_can_blend)
+{
+	BOOST_CHECK(SpanBuffer::canBlend(randomGrayImage(4, 4)));
+	BOOST_CHECK(SpanBuffer::canBlend(randomRgbImage(4, 4)));
+	BOOST_CHECK(SpanBuffer::canBlend(randomMonoQImage(4, 4)));
+	BOOST_CHECK(!SpanBuffer::canBlend(QImage(4, 4, QImage::Format_RGB16)));
+}
+
+BOOST_AUTO_TEST_CASE(test_grayscale)
+{
+	QImage const img(randomGrayImage(30, 20));
+	QColor const color(200, 200, 200);
+	
+	QImage const res(blendSpans(img, HALF_PIXEL_RECT, color));
+	BOOST_REQUIRE(res.format() == QImage::Format_Indexed8);
+	BOOST_CHECK(maxDifference(res, paintWithQPainter(img, HALF_PIXEL_RECT, color)) <= TOLERANCE);
+}
+
+BOOST_AUTO_TEST_CASE(test_rgb32)
+{
+	QImage const img(randomRgbImage(30, 20));
+	QColor const color(200, 50, 100);
+	
+	QImage const res(blendSpans(img, HALF_PIXEL_RECT, color));
+	BOOST_REQUIRE(res.format() == QImage::Format_RGB32);
+	BOOST_CHECK(maxDifference(res, paintWithQPainter(img, HALF_PIXEL_RECT, color)) <= TOLERANCE);
+}
+
+BOOST_AUTO_TEST_CASE(test_argb32_premultiplied)
+{
+	QImage const img(
+		randomRgbImage(30, 20).convertToFormat(QImage::Format_ARGB32_Premultiplied)
+	);
+	QColor const color(20, 150, 250);
+	
+	QImage const res(blendSpans(img, HALF_PIXEL_RECT, color));
+	BOOST_CHECK(maxDifference(res, paintWithQPainter(img, HALF_PIXEL_RECT, color)) <= TOLERANCE);
+}
+
+BOOST_AUTO_TEST_CASE(test_mono)
+{
+	// Converting to Mono dithers partially covered pixels,
+	// so the edges are kept on the pixel grid.
+	QPolygonF const rect(QRectF(3.0, 2.0, 20.0, 13.0));
+	QImage const img(randomMonoQImage(30, 20));
+	
+	QImage const black(blendSpans(img, rect, Qt::black));
+	BOOST_REQUIRE(black.format() == QImage::Format_Mono);
+	BOOST_CHECK(maxDifference(black, paintWithQPainter(img, rect, Qt::black)) == 0);
+	
+	QImage const white(blendSpans(img, rect, Qt::white));
+	BOOST_CHECK(maxDifference(white, paintWithQPainter(img, rect, Qt::white)) == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+} // namespace tests
+
+} // namespace imageproc
@@ -22,6 +22,7 @@
 #include "PngMetadataLoader.h"
 #include "TiffMetadataLoader.h"
 #include "JpegMetadataLoader.h"
+#include "imageproc/ImageStorage.h"
 #include <QMetaType>
 #include <QtPlugin>
 #include <QLocale>
@@ -162,6 +163,16 @@ int main(int argc, char** argv)
 	app.setOrganizationDomain("scantailor.sourceforge.net");
 	QSettings settings;
 	
+	bool ok = false;
+	int const mapping_threshold_mb = settings.value(
+		"settings/mapped_image_threshold_mb"
+	).toInt(&ok);
+	if (ok && mapping_threshold_mb >= 0) {
+		imageproc::ImageStorage::setMappingThreshold(
+			size_t(mapping_threshold_mb) << 20
+		);
+	}
+	
 	PngMetadataLoader::registerMyself();
 	TiffMetadataLoader::registerMyself();
 	JpegMetadataLoader::registerMyself();
@@ -177,7 +188,10 @@ int main(int argc, char** argv)
 	// Note that we use app.arguments() rather than argv,
 	// because the former is Unicode-safe under Windows.
 	QStringList const args(app.arguments());
-	if (args.size() > 1) {
+	if (args.size() > 2 && args[1] == QLatin1String("--batch-node")) {
+		// Join distributed batch processing started by another instance.
+		main_wnd->openProjectAsBatchNode(args[2]);
+	} else if (args.size() > 1) {
 		main_wnd->openProject(args[1]);
 	}
 	
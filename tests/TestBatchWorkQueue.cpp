@@ -0,0 +1,176 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BatchWorkQueue.h"
+#include "ImageId.h"
+#include "PageId.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QString>
+#include <QByteArray>
+#include <QDateTime>
+#include <QMutex>
+#include <QWaitCondition>
+#include <boost/test/auto_unit_test.hpp>
+#include <vector>
+
+namespace Tests
+{
+
+namespace
+{
+
+/**
+ * \brief A directory standing in for the shared one nodes work in.
+ */
+class SharedDir
+{
+public:
+	SharedDir() : m_path(
+		QDir::temp().absoluteFilePath(
+			QString::fromAscii("batch_work_queue_test_%1_%2")
+			.arg(QCoreApplication::applicationPid())
+			.arg(QDateTime::currentDateTime().toTime_t())
+		)
+	) {
+		QDir().mkpath(m_path);
+	}
+	
+	~SharedDir() {
+		QDir().rmdir(m_path);
+	}
+	
+	QString projectFile() const {
+		return QDir(m_path).filePath(QString::fromAscii("project.ScanTailor"));
+	}
+private:
+	QString m_path;
+};
+
+void sleepMsec(unsigned long msec)
+{
+	QMutex mutex;
+	QWaitCondition cond;
+	mutex.lock();
+	cond.wait(&mutex, msec);
+	mutex.unlock();
+}
+
+std::vector<PageId> makePages(int count)
+{
+	std::vector<PageId> pages;
+	for (int i = 0; i < count; ++i) {
+		pages.push_back(
+			PageId(ImageId(QString::fromAscii("/images/%1.png").arg(i)))
+		);
+	}
+	return pages;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_SUITE(BatchWorkQueueTestSuite);
+
+BOOST_AUTO_TEST_CASE(test_lease_and_complete)
+{
+	SharedDir const dir;
+	std::vector<PageId> const pages(makePages(3));
+	BOOST_REQUIRE(BatchWorkQueue::create(dir.projectFile(), 5, pages));
+	
+	BatchWorkQueue node1(dir.projectFile());
+	BatchWorkQueue node2(dir.projectFile());
+	BOOST_REQUIRE(node1.isValid());
+	BOOST_CHECK(node1.filterIdx() == 5);
+	BOOST_CHECK(node1.pages() == pages);
+	
+	BOOST_CHECK(node1.lease() == 0);
+	BOOST_CHECK(node2.lease() == 1);
+	BOOST_CHECK(node1.lease() == 2);
+	BOOST_CHECK(node1.lease() == -1);
+	BOOST_CHECK(node2.lease() == -1);
+	
+	BOOST_CHECK(node1.complete(0, QByteArray("result 0")));
+	BOOST_CHECK(node2.complete(1, QByteArray("result 1")));
+	BOOST_CHECK(!node2.isFinished());
+	BOOST_CHECK(node1.complete(2, QByteArray("result 2")));
+	BOOST_CHECK(node2.isFinished());
+	
+	BOOST_CHECK(node2.result(0) == QByteArray("result 0"));
+	BOOST_CHECK(node1.result(1) == QByteArray("result 1"));
+	
+	// Completed pages are never leased again.
+	BOOST_CHECK(node2.lease() == -1);
+	
+	node1.remove();
+	BOOST_CHECK(!node2.exists());
+}
+
+BOOST_AUTO_TEST_CASE(test_released_page_is_leased_again)
+{
+	SharedDir const dir;
+	BOOST_REQUIRE(BatchWorkQueue::create(dir.projectFile(), 0, makePages(2)));
+	
+	BatchWorkQueue node1(dir.projectFile());
+	BatchWorkQueue node2(dir.projectFile());
+	
+	BOOST_CHECK(node1.lease() == 0);
+	BOOST_CHECK(node1.lease() == 1);
+	node1.release(0);
+	BOOST_CHECK(node2.lease() == 0);
+	
+	node1.remove();
+}
+
+BOOST_AUTO_TEST_CASE(test_takeover_of_expired_lease)
+{
+	SharedDir const dir;
+	BOOST_REQUIRE(BatchWorkQueue::create(dir.projectFile(), 0, makePages(2)));
+	
+	BatchWorkQueue node1(dir.projectFile());
+	BatchWorkQueue node2(dir.projectFile());
+	node2.setLeaseTimeout(0);
+	
+	BOOST_CHECK(node1.lease() == 0);
+	BOOST_CHECK(node1.lease() == 1);
+	
+	// The leases are observed for the first time.
+	BOOST_CHECK(node2.lease() == -1);
+	
+	// A live node keeps its leases.
+	node1.heartbeat();
+	sleepMsec(1100);
+	BOOST_CHECK(node2.lease() == -1);
+	
+	// The leases stayed unchanged for longer than the timeout.
+	sleepMsec(1100);
+	int const taken = node2.lease();
+	BOOST_CHECK(taken == 0);
+	
+	// The node that was judged dead still finishes its pages.
+	node1.heartbeat();
+	BOOST_CHECK(node1.complete(1, QByteArray("result 1")));
+	BOOST_CHECK(!node1.isFinished());
+	BOOST_CHECK(node2.complete(taken, QByteArray("result 0")));
+	BOOST_CHECK(node1.isFinished());
+	
+	node2.remove();
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+} // namespace Tests
@@ -0,0 +1,151 @@
+/*
+    Scan Tailor - Interactive post-processing tool for scanned pages.
+    Copyright (C)  Joseph Artsimovich <joseph.artsimovich@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SnapshotMap.h"
+#include <boost/test/auto_unit_test.hpp>
+#include <memory>
+
+namespace Tests
+{
+
+BOOST_AUTO_TEST_SUITE(SnapshotMapTestSuite);
+
+typedef SnapshotMap<int, int> Map;
+
+BOOST_AUTO_TEST_CASE(test_empty)
+{
+	Map map;
+	BOOST_CHECK(!map.get(1).get());
+	BOOST_CHECK(map.version(1) == 0);
+	BOOST_CHECK(!map.snapshot()->find(1));
+}
+
+BOOST_AUTO_TEST_CASE(test_set_and_get)
+{
+	Map map;
+	map.set(1, 10);
+	map.set(2, 20);
+	
+	std::auto_ptr<int> const value(map.get(1));
+	BOOST_REQUIRE(value.get());
+	BOOST_CHECK(*value == 10);
+	
+	Map::SnapshotPtr const snapshot(map.snapshot());
+	BOOST_REQUIRE(snapshot->find(2));
+	BOOST_CHECK(*snapshot->find(2) == 20);
+	BOOST_CHECK(!snapshot->find(3));
+}
+
+BOOST_AUTO_TEST_CASE(test_snapshot_is_immutable)
+{
+	Map map;
+	map.set(1, 10);
+	Map::SnapshotPtr const before(map.snapshot());
+	
+	map.set(1, 11);
+	map.erase(1);
+	map.set(2, 20);
+	
+	BOOST_REQUIRE(before->find(1));
+	BOOST_CHECK(*before->find(1) == 10);
+	BOOST_CHECK(!before->find(2));
+	
+	Map::SnapshotPtr const after(map.snapshot());
+	BOOST_CHECK(!after->find(1));
+	BOOST_REQUIRE(after->find(2));
+	BOOST_CHECK(*after->find(2) == 20);
+}
+
+BOOST_AUTO_TEST_CASE(test_versions)
+{
+	Map map;
+	map.set(1, 10);
+	quint64 const v1 = map.version(1);
+	BOOST_CHECK(v1 != 0);
+	
+	map.set(2, 20);
+	quint64 const v2 = map.version(2);
+	BOOST_CHECK(v2 > v1);
+	
+	// Other keys keep their versions.
+	BOOST_CHECK(map.version(1) == v1);
+	
+	// Setting the same value still counts as a change.
+	map.set(1, 10);
+	BOOST_CHECK(map.version(1) > v2);
+	
+	map.erase(1);
+	BOOST_CHECK(map.version(1) == 0);
+	
+	map.set(1, 10);
+	BOOST_CHECK(map.version(1) > v2);
+	
+	map.clear();
+	BOOST_CHECK(map.version(1) == 0);
+	BOOST_CHECK(map.version(2) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_unmodified_map_keeps_version)
+{
+	Map map;
+	map.set(1, 10);
+	quint64 const version = map.snapshot()->version();
+	
+	map.erase(2);
+	{
+		Map::Transaction transaction(map);
+		BOOST_CHECK(*transaction.find(1) == 10);
+	}
+	
+	BOOST_CHECK(map.snapshot()->version() == version);
+}
+
+BOOST_AUTO_TEST_CASE(test_transaction)
+{
+	Map map;
+	map.set(1, 10);
+	quint64 const version = map.snapshot()->version();
+	
+	{
+		Map::Transaction transaction(map);
+		transaction.set(1, *transaction.find(1) + 1);
+		transaction.set(2, 20);
+		transaction.erase(3);
+		
+		// The transaction sees its own changes.
+		BOOST_REQUIRE(transaction.find(1));
+		BOOST_CHECK(*transaction.find(1) == 11);
+		
+		// Others don't see them until it's over.
+		BOOST_CHECK(!map.snapshot()->find(2));
+		BOOST_CHECK(*map.snapshot()->find(1) == 10);
+	}
+	
+	Map::SnapshotPtr const snapshot(map.snapshot());
+	BOOST_CHECK(*snapshot->find(1) == 11);
+	BOOST_CHECK(*snapshot->find(2) == 20);
+	
+	// All changes of a transaction get the same version.
+	BOOST_CHECK(snapshot->version() == version + 1);
+	BOOST_CHECK(snapshot->version(1) == snapshot->version());
+	BOOST_CHECK(snapshot->version(2) == snapshot->version());
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+} // namespace Tests